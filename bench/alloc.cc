@@ -0,0 +1,126 @@
+//  alloc.cc
+
+#include "alloc.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+
+#include <malloc.h>
+
+static std::atomic<uint64_t> noallocs(0);
+static std::atomic<int64_t> live(0);
+static std::atomic<int64_t> peak(0);
+
+//  Account usable size of block rather than requested one since it is what
+//  process actually holds.
+static void Acquire(void *ptr) {
+    if (ptr) {
+        int64_t size = malloc_usable_size(ptr);
+        int64_t current = live.fetch_add(size, std::memory_order_relaxed)
+                        + size;
+        int64_t maximum = peak.load(std::memory_order_relaxed);
+
+        while (current > maximum &&
+               !peak.compare_exchange_weak(maximum, current,
+                                           std::memory_order_relaxed)) {
+        }
+    }
+}
+
+static void Release(void *ptr) {
+    if (ptr) {
+        live.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    }
+}
+
+#ifdef __GLIBC__
+
+//  Allocator of glibc is hooked by interposition of its public entry points
+//  which forward calls to the internal ones. Aligned allocations are hooked
+//  too since their blocks are released with free.
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) noexcept {
+    noallocs.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = __libc_malloc(size);
+    Acquire(ptr);
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size) noexcept {
+    noallocs.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = __libc_calloc(nmemb, size);
+    Acquire(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) noexcept {
+    noallocs.fetch_add(1, std::memory_order_relaxed);
+
+    //  Block could be moved or freed, so it is released in advance and its
+    //  old size is restored on failure.
+    Release(ptr);
+    void *result = __libc_realloc(ptr, size);
+    Acquire(result ? result : size ? ptr : NULL);
+    return result;
+}
+
+void *memalign(size_t alignment, size_t size) noexcept {
+    noallocs.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = __libc_memalign(alignment, size);
+    Acquire(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) noexcept {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) noexcept {
+    if (!alignment || (alignment & (alignment - 1)) ||
+        alignment % sizeof(void *)) {
+        return EINVAL;
+    }
+
+    void *ptr = memalign(alignment, size);
+
+    if (!ptr) {
+        return ENOMEM;
+    }
+
+    *memptr = ptr;
+    return 0;
+}
+
+void free(void *ptr) noexcept {
+    Release(ptr);
+    __libc_free(ptr);
+}
+
+}
+
+#endif
+
+uint64_t CountAllocations(void) {
+    return noallocs.load(std::memory_order_relaxed);
+}
+
+HeapUsage GetHeapUsage(void) {
+    HeapUsage usage;
+    usage.noallocs = noallocs.load(std::memory_order_relaxed);
+    usage.live = live.load(std::memory_order_relaxed);
+    usage.peak = peak.load(std::memory_order_relaxed);
+    return usage;
+}
+
+void ResetHeapPeak(void) {
+    peak.store(live.load(std::memory_order_relaxed),
+               std::memory_order_relaxed);
+}
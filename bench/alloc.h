@@ -0,0 +1,32 @@
+//  alloc.h
+
+#pragma once
+
+#include <cstdint>
+
+/**
+ *  Usage of heap which is tracked by hooked allocator.
+ */
+struct HeapUsage {
+    uint64_t noallocs;  ///< Number of malloc, calloc and realloc calls.
+    uint64_t live;      ///< Usable size of blocks which are not freed yet.
+    uint64_t peak;      ///< Maximum of live bytes since the last reset.
+};
+
+/**
+ *  Get number of heap allocations (malloc, calloc and realloc calls) made by
+ *  the process so far. It is always zero if allocator could not be hooked.
+ */
+uint64_t CountAllocations(void);
+
+/**
+ *  Get current usage of heap. All counters are zero if allocator could not
+ *  be hooked.
+ */
+HeapUsage GetHeapUsage(void);
+
+/**
+ *  Reset peak of heap usage to the number of live bytes so that peak of the
+ *  next operation could be measured.
+ */
+void ResetHeapPeak(void);
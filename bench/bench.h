@@ -0,0 +1,39 @@
+//  bench.h
+
+#pragma once
+
+extern "C" {
+#include <matfile/matfile.h>
+}
+
+#include "alloc.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ *  Report throughput and average number of heap allocations per iteration.
+ *  Counter of allocations should be taken right before benchmark loop.
+ */
+void ReportCounters(benchmark::State &state, uint64_t bytes, uint64_t allocs);
+
+/**
+ *  Create numerical array filled with reproducible moderately compressible
+ *  values.
+ */
+matfile_array_t *MakeArray(const char *name,
+                           matfile_array_type_t type,
+                           size_t numel,
+                           int complex);
+
+/**
+ *  Serialize mat-file with single array into memory. Mat-file is written in
+ *  native byte order or in the opposite one.
+ */
+std::vector<char> MakeMatfile(matfile_array_type_t type,
+                              size_t numel,
+                              int complex,
+                              matfile_compression_t compression,
+                              matfile_endianness_t endianness = MFEND_SAME);
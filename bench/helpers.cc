@@ -0,0 +1,161 @@
+//  helpers.cc
+
+#include "bench.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <zlib.h>
+
+void ReportCounters(benchmark::State &state, uint64_t bytes, uint64_t allocs) {
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.counters["allocs/op"] = benchmark::Counter(
+        CountAllocations() - allocs, benchmark::Counter::kAvgIterations);
+}
+
+matfile_array_t *MakeArray(const char *name,
+                           matfile_array_type_t type,
+                           size_t numel,
+                           int complex) {
+    int32_t dims[] = {static_cast<int32_t>(numel), 1};
+    matfile_array_t *array = matfile_array_create(name, type, 2, dims, complex);
+    matfile_data_type_t storage = matfile_get_storage_type(type);
+    uint32_t state = 0x9e3779b9u;
+
+    //  Slowly varying values with noise in low bits compress at ratio which
+    //  is typical for measurements.
+    std::vector<double> values(numel);
+
+    for (size_t i = 0; i != numel; ++i) {
+        state = state * 1664525u + 1013904223u;
+        values[i] = static_cast<double>((i / 64) % 100 + (state >> 29));
+    }
+
+    for (int part = 0; part != 1 + !!complex; ++part) {
+        matfile_numerical_part_t *dst = part ? &array->pi : &array->pr;
+        size_t size = matfile_get_type_size(storage);
+
+        for (size_t i = 0; i != numel; ++i) {
+            double value = values[i] + part;
+            char *ptr = static_cast<char *>(dst->data) + i * size;
+
+            switch (storage) {
+            case MFDT_DOUBLE: *reinterpret_cast<double *>(ptr) = value; break;
+            case MFDT_SINGLE: *reinterpret_cast<float *>(ptr) = value; break;
+            case MFDT_INT32: *reinterpret_cast<int32_t *>(ptr) = value; break;
+            case MFDT_UINT8: *reinterpret_cast<uint8_t *>(ptr) = value; break;
+            default: break;
+            }
+        }
+    }
+
+    return array;
+}
+
+/**
+ *  Switch byte order of uncompressed data elements in place. Every data
+ *  element except miMATRIX has payload of single numerical type while payload
+ *  of miMATRIX is sequence of such data elements.
+ */
+static void SwapDataElements(char *data, size_t length) {
+    for (size_t offset = 0; offset < length;) {
+        uint32_t tag[2];
+        memcpy(tag, data + offset, sizeof(tag));
+
+        bool small = tag[0] >> 16;
+        uint32_t type = small ? tag[0] & 0xffff : tag[0];
+        uint32_t size = small ? tag[0] >> 16 : tag[1];
+        char *payload = data + offset + (small ? 4 : 8);
+        size_t width = matfile_get_type_size(static_cast<matfile_data_type_t>(
+            type));
+
+        if (type == MFDT_MATRIX) {
+            SwapDataElements(payload, size);
+        }
+
+        for (size_t i = 0; width > 1 && i + width <= size; i += width) {
+            std::reverse(payload + i, payload + i + width);
+        }
+
+        for (int i = 0; i != 2 - small; ++i) {
+            char *word = data + offset + 4 * i;
+            std::reverse(word, word + 4);
+        }
+
+        offset += small ? 8 : 8 + size + (8 - size % 8) % 8;
+    }
+}
+
+/**
+ *  Make byte-swapped copy of mat-file written without compression. Arrays are
+ *  compressed afterwards if compression is requested.
+ */
+static std::vector<char> SwapMatfile(const std::vector<char> &bytes,
+                                     matfile_compression_t compression) {
+    size_t header_size = sizeof(matfile_header_t);
+    std::vector<char> swapped(bytes);
+    matfile_header_t *header = reinterpret_cast<matfile_header_t *>(
+        swapped.data());
+    header->version = header->version << 8 | header->version >> 8;
+    header->endianness = header->endianness << 8 | header->endianness >> 8;
+    SwapDataElements(swapped.data() + header_size, bytes.size() - header_size);
+
+    if (compression == MFCOMP_NONE) {
+        return swapped;
+    }
+
+    std::vector<char> compressed(swapped.begin(),
+                                 swapped.begin() + header_size);
+
+    for (size_t offset = header_size; offset < swapped.size();) {
+        uint32_t size;
+        memcpy(&size, swapped.data() + offset + 4, sizeof(size));
+        std::reverse(reinterpret_cast<char *>(&size),
+                     reinterpret_cast<char *>(&size) + sizeof(size));
+
+        uLongf length = compressBound(8 + size);
+        std::vector<char> stream(8 + length);
+        compress2(reinterpret_cast<Bytef *>(stream.data() + 8), &length,
+                  reinterpret_cast<const Bytef *>(swapped.data() + offset),
+                  8 + size, Z_DEFAULT_COMPRESSION);
+
+        uint32_t tag[2] = {MFDT_COMPRESSED, static_cast<uint32_t>(length)};
+        std::reverse(reinterpret_cast<char *>(tag),
+                     reinterpret_cast<char *>(tag) + 4);
+        std::reverse(reinterpret_cast<char *>(tag) + 4,
+                     reinterpret_cast<char *>(tag) + 8);
+        memcpy(stream.data(), tag, sizeof(tag));
+        compressed.insert(compressed.end(), stream.begin(),
+                          stream.begin() + 8 + length);
+        offset += 8 + size + (8 - size % 8) % 8;
+    }
+
+    return compressed;
+}
+
+std::vector<char> MakeMatfile(matfile_array_type_t type,
+                              size_t numel,
+                              int complex,
+                              matfile_compression_t compression,
+                              matfile_endianness_t endianness) {
+    matfile_t *mat = matfile_create();
+    matfile_add_array(mat, MakeArray("array", type, numel, complex));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = endianness == MFEND_SWITCH ? MFCOMP_NONE : compression;
+    opts.narrow = 0;
+
+    tape_t *tape = tape_create(0);
+    std::vector<char> bytes;
+
+    if (!matfile_write_memory(mat, tape, &opts)) {
+        const char *data = static_cast<const char *>(tape_deref(tape));
+        bytes.assign(data, data + tape_length(tape));
+    }
+
+    tape_destroy(tape);
+    matfile_destroy(mat);
+    return endianness == MFEND_SWITCH ? SwapMatfile(bytes, compression)
+                                      : bytes;
+}
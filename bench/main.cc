@@ -0,0 +1,5 @@
+//  main.cc
+
+#include <benchmark/benchmark.h>
+
+BENCHMARK_MAIN();
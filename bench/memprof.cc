@@ -0,0 +1,316 @@
+//  memprof.cc
+//
+//  Harness which measures peak heap, number of heap allocations and peak RSS
+//  of reading every mat-file of corpus in every load mode. Heap is tracked
+//  with hooked allocator and RSS is taken from getrusage. Every measurement
+//  runs in forked process so that neither heap nor RSS of previous loads
+//  affects it.
+
+extern "C" {
+#include <matfile/matfile.h>
+}
+
+#include "alloc.h"
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ *  Measurement of single load of mat-file.
+ */
+struct sample_t {
+    int ok;                 ///< Mat-file is loaded successfully.
+    uint64_t file_size;     ///< Size of mat-file in bytes.
+    uint64_t decoded;       ///< Bytes of decoded numerical parts.
+    uint64_t peak;          ///< Peak heap in excess of heap before load.
+    uint64_t noallocs;      ///< Number of heap allocations of load.
+    uint64_t rss;           ///< Peak RSS in excess of RSS before load (KiB).
+};
+
+/**
+ *  Load mode is a way to get mat-file into memory.
+ */
+struct load_mode_t {
+    const char *name;
+    matfile_t *(*load)(const char *filename);
+};
+
+static matfile_t *LoadFile(const char *filename) {
+    return matfile_read(filename);
+}
+
+static matfile_t *LoadSerial(const char *filename) {
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    ctx.nothreads = 1;
+    return matfile_read_ctx(filename, &ctx);
+}
+
+//  File content is held by caller during parsing, so it is counted too.
+static matfile_t *LoadMemory(const char *filename) {
+    FILE *fin = std::fopen(filename, "rb");
+
+    if (!fin) {
+        return NULL;
+    }
+
+    std::vector<char> bytes;
+    char chunk[65536];
+    size_t length;
+
+    while ((length = std::fread(chunk, 1, sizeof(chunk), fin)) != 0) {
+        bytes.insert(bytes.end(), chunk, chunk + length);
+    }
+
+    std::fclose(fin);
+    return matfile_read_memory(bytes.data(), bytes.size(), NULL);
+}
+
+static const load_mode_t modes[] = {
+    {"file", LoadFile},
+    {"serial", LoadSerial},
+    {"memory", LoadMemory},
+};
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options] <mat-file>..." << std::endl
+        << std::endl
+        << "  --modes LIST      comma-separated load modes"
+            << " (file,serial,memory)" << std::endl
+        << "  --max-ratio R     fail if peak heap exceeds R times decoded size"
+            << std::endl
+        << "  --json            print measurements as JSON" << std::endl;
+}
+
+static uint64_t GetMaxRSS(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static uint64_t GetDecodedSize(const matfile_t *mat) {
+    uint64_t decoded = 0;
+
+    for (size_t i = 0; i != mat->noelements; ++i) {
+        const matfile_data_element_t *element = &mat->elements[i];
+
+        if (!matfile_is_large(element) || element->large.type != MFDT_MATRIX ||
+            !element->large.array) {
+            continue;
+        }
+
+        const matfile_array_t *array = element->large.array;
+        matfile_array_type_t type = static_cast<matfile_array_type_t>(
+            array->flags & MF_CLASS_MASK);
+
+        if (!array->pr.data) {
+            continue;
+        }
+
+        uint64_t size = matfile_array_numel(array)
+                      * matfile_get_type_size(matfile_get_storage_type(type));
+        decoded += array->pi.data ? 2 * size : size;
+    }
+
+    return decoded;
+}
+
+//  Load mat-file in child process and pass measurement through pipe.
+static sample_t Measure(const char *filename, const load_mode_t &mode) {
+    sample_t sample = {};
+    int fds[2];
+
+    if (pipe(fds)) {
+        return sample;
+    }
+
+    std::fflush(NULL);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        struct stat st;
+        sample.file_size = stat(filename, &st) ? 0 : st.st_size;
+
+        ResetHeapPeak();
+        HeapUsage before = GetHeapUsage();
+        uint64_t rss = GetMaxRSS();
+        matfile_t *mat = mode.load(filename);
+        HeapUsage after = GetHeapUsage();
+
+        if (mat) {
+            sample.ok = 1;
+            sample.decoded = GetDecodedSize(mat);
+            sample.peak = after.peak - before.live;
+            sample.noallocs = after.noallocs - before.noallocs;
+            sample.rss = GetMaxRSS() - rss;
+            matfile_destroy(mat);
+        }
+
+        ssize_t written = write(fds[1], &sample, sizeof(sample));
+        _exit(written != sizeof(sample));
+    }
+
+    close(fds[1]);
+
+    if (pid > 0 && read(fds[0], &sample, sizeof(sample)) != sizeof(sample)) {
+        sample.ok = 0;
+    }
+
+    close(fds[0]);
+
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+
+    return sample;
+}
+
+static bool ParseModes(const char *arg,
+                       std::vector<const load_mode_t *> &list) {
+    std::string names(arg);
+    list.clear();
+
+    for (size_t pos = 0; pos <= names.size();) {
+        size_t end = names.find(',', pos);
+        std::string name = names.substr(pos, end == std::string::npos
+                                             ? std::string::npos
+                                             : end - pos);
+        bool found = false;
+
+        for (const auto &mode : modes) {
+            if (name == mode.name) {
+                list.push_back(&mode);
+                found = true;
+            }
+        }
+
+        if (!found) {
+            std::cerr << "error: unknown mode `" << name << "`." << std::endl;
+            return false;
+        }
+
+        if (end == std::string::npos) {
+            break;
+        }
+
+        pos = end + 1;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        {"modes", required_argument, NULL, 'm'},
+        {"max-ratio", required_argument, NULL, 'r'},
+        {"json", no_argument, NULL, 'j'},
+        {NULL, 0, NULL, 0},
+    };
+
+    std::vector<const load_mode_t *> list;
+    double max_ratio = 0.0;
+    bool json = false;
+    int opt;
+
+    for (const auto &mode : modes) {
+        list.push_back(&mode);
+    }
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            if (!ParseModes(optarg, list)) {
+                return 1;
+            }
+
+            break;
+        case 'r':
+            max_ratio = std::strtod(optarg, NULL);
+            break;
+        case 'j':
+            json = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (json) {
+        std::printf("[");
+    }
+    else {
+        std::printf("%-32s %-8s %12s %12s %12s %10s %10s %7s\n", "mat-file",
+                    "mode", "file", "decoded", "peak heap", "allocs",
+                    "RSS KiB", "ratio");
+    }
+
+    size_t nofailures = 0;
+
+    for (int i = optind; i != argc; ++i) {
+        for (size_t j = 0; j != list.size(); ++j) {
+            sample_t sample = Measure(argv[i], *list[j]);
+            double ratio = sample.decoded
+                         ? static_cast<double>(sample.peak) / sample.decoded
+                         : 0.0;
+            const char *status = "ok";
+
+            if (!sample.ok) {
+                status = "FAILED";
+            }
+            else if (max_ratio > 0 && ratio > max_ratio) {
+                status = "EXCEEDED";
+            }
+
+            nofailures += status[0] != 'o';
+
+            if (json) {
+                std::printf("%s\n{\"file\":\"%s\",\"mode\":\"%s\","
+                            "\"status\":\"%s\",\"file_size\":%llu,"
+                            "\"decoded\":%llu,\"peak_heap\":%llu,"
+                            "\"allocs\":%llu,\"max_rss_kb\":%llu,"
+                            "\"ratio\":%.4f}",
+                            i == optind && !j ? "" : ",", argv[i],
+                            list[j]->name, status,
+                            (unsigned long long)sample.file_size,
+                            (unsigned long long)sample.decoded,
+                            (unsigned long long)sample.peak,
+                            (unsigned long long)sample.noallocs,
+                            (unsigned long long)sample.rss, ratio);
+            }
+            else {
+                std::printf("%-32s %-8s %12llu %12llu %12llu %10llu %10llu "
+                            "%7.3f  %s\n", argv[i], list[j]->name,
+                            (unsigned long long)sample.file_size,
+                            (unsigned long long)sample.decoded,
+                            (unsigned long long)sample.peak,
+                            (unsigned long long)sample.noallocs,
+                            (unsigned long long)sample.rss, ratio, status);
+            }
+        }
+    }
+
+    if (json) {
+        std::printf("\n]\n");
+    }
+
+    return nofailures != 0;
+}
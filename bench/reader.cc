@@ -0,0 +1,260 @@
+//  reader.cc
+
+#include "bench.h"
+
+extern "C" {
+#include "../src/internal.h"
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+//  Array sizes, classes, complexity, compression policies and byte orders
+//  which every benchmark of reader is parameterized with.
+static void ReaderArguments(benchmark::internal::Benchmark *bench) {
+    bench->ArgNames({"numel", "class", "complex", "compression",
+                     "endianness"});
+    bench->ArgsProduct({
+        {1 << 10, 1 << 16, 1 << 20},
+        {MFMX_DOUBLE_CLASS, MFMX_SINGLE_CLASS, MFMX_INT32_CLASS,
+         MFMX_UINT8_CLASS},
+        {0, 1},
+        {MFCOMP_NONE, MFCOMP_RATIO},
+        {MFEND_SAME, MFEND_SWITCH},
+    });
+}
+
+//  Inflate is measured on compressed arrays only.
+static void InflateArguments(benchmark::internal::Benchmark *bench) {
+    bench->ArgNames({"numel", "class", "complex", "compression"});
+    bench->ArgsProduct({
+        {1 << 10, 1 << 16, 1 << 20},
+        {MFMX_DOUBLE_CLASS, MFMX_SINGLE_CLASS, MFMX_INT32_CLASS,
+         MFMX_UINT8_CLASS},
+        {0, 1},
+        {MFCOMP_RATIO},
+    });
+}
+
+//  Numerical parts are parsed without compression.
+static void PartArguments(benchmark::internal::Benchmark *bench) {
+    bench->ArgNames({"numel", "class", "narrow"});
+    bench->ArgsProduct({
+        {1 << 10, 1 << 16, 1 << 20},
+        {MFMX_DOUBLE_CLASS, MFMX_SINGLE_CLASS, MFMX_INT32_CLASS,
+         MFMX_UINT8_CLASS},
+        {0, 1},
+    });
+}
+
+static std::vector<char> MakeMatfile(const benchmark::State &state,
+                                     matfile_endianness_t endianness) {
+    return MakeMatfile(static_cast<matfile_array_type_t>(state.range(1)),
+                       state.range(0),
+                       state.range(2),
+                       static_cast<matfile_compression_t>(state.range(3)),
+                       endianness);
+}
+
+static matfile_endianness_t Endianness(const benchmark::State &state) {
+    return static_cast<matfile_endianness_t>(state.range(4));
+}
+
+static void BM_ParseDataElements(benchmark::State &state) {
+    std::vector<char> bytes = MakeMatfile(state, Endianness(state));
+    const char *data = bytes.data() + sizeof(matfile_header_t);
+    size_t length = bytes.size() - sizeof(matfile_header_t);
+    uint64_t allocs = CountAllocations();
+
+    for (auto _ : state) {
+        matfile_t *mat = static_cast<matfile_t *>(calloc(1, sizeof(*mat)));
+        mat->elements = matfile_parse(data, length, Endianness(state),
+                                      &mat->noelements);
+
+        if (!mat->elements) {
+            state.SkipWithError("could not parse data elements");
+        }
+
+        matfile_destroy(mat);
+    }
+
+    ReportCounters(state, length, allocs);
+}
+
+static void BM_DecompressDataElement(benchmark::State &state) {
+    std::vector<char> bytes = MakeMatfile(state, MFEND_SAME);
+    const uint32_t *tag = reinterpret_cast<const uint32_t *>(
+        bytes.data() + sizeof(matfile_header_t));
+
+    if (tag[0] != MFDT_COMPRESSED) {
+        state.SkipWithError("array is not compressed");
+        return;
+    }
+
+    uint64_t allocs = CountAllocations();
+    uint64_t size = 0;
+
+    for (auto _ : state) {
+        matfile_data_element_t element;
+        memset(&element, 0, sizeof(element));
+        element.large.type = tag[0];
+        element.large.size = tag[1];
+        element.large.data = const_cast<uint32_t *>(tag + 2);
+
+        if (decompress_data_element(&element, NULL)) {
+            state.SkipWithError("could not decompress data element");
+            break;
+        }
+
+        size = element.large.size;
+        free(element.large.data);
+    }
+
+    //  Throughput is measured in inflated bytes.
+    ReportCounters(state, size, allocs);
+}
+
+static void BM_ParseNumericalPart(benchmark::State &state) {
+    matfile_array_type_t type = static_cast<matfile_array_type_t>(
+        state.range(1));
+    matfile_array_t *array = MakeArray("array", type, state.range(0), 0);
+    matfile_data_type_t storage = matfile_get_storage_type(type);
+    size_t size = matfile_array_numel(array) * matfile_get_type_size(storage);
+    tape_t *tape = tape_create(size + 16);
+
+    //  Narrowed part is stored as miUINT8 and widened back on parse.
+    if (state.range(2)) {
+        std::vector<uint8_t> narrow(matfile_array_numel(array));
+        mf_convert_numbers(narrow.data(), MFDT_UINT8, array->pr.data, storage,
+                           narrow.size(), 0);
+        mf_serialize_data_element(tape, MFDT_UINT8, narrow.data(),
+                                  narrow.size());
+    }
+    else {
+        mf_serialize_data_element(tape, storage, array->pr.data, size);
+    }
+
+    uint64_t allocs = CountAllocations();
+    parse_state_t parsing = {};
+
+    for (auto _ : state) {
+        matfile_numerical_part_t part;
+        size_t length = tape_length(tape);
+
+        if (!parse_numerical_part(array, &part, tape_deref(tape), &length,
+                                  &parsing)) {
+            state.SkipWithError("could not parse numerical part");
+            break;
+        }
+
+        free(part.data);
+    }
+
+    ReportCounters(state, tape_length(tape), allocs);
+    tape_destroy(tape);
+    matfile_array_destroy(array);
+}
+
+static void BM_ReadMemory(benchmark::State &state) {
+    std::vector<char> bytes = MakeMatfile(state, Endianness(state));
+    uint64_t allocs = CountAllocations();
+
+    for (auto _ : state) {
+        matfile_t *mat = matfile_read_memory(bytes.data(), bytes.size(), NULL);
+
+        if (!mat) {
+            state.SkipWithError("could not read mat-file");
+            break;
+        }
+
+        matfile_destroy(mat);
+    }
+
+    ReportCounters(state, bytes.size(), allocs);
+}
+
+static void BM_ReadFile(benchmark::State &state) {
+    std::vector<char> bytes = MakeMatfile(state, Endianness(state));
+    std::string filename = "matfile-bench-" + std::to_string(getpid()) + ".mat";
+    FILE *fout = fopen(filename.c_str(), "wb");
+
+    if (!fout || fwrite(bytes.data(), 1, bytes.size(), fout) != bytes.size()) {
+        state.SkipWithError("could not write mat-file");
+    }
+
+    if (fout) {
+        fclose(fout);
+    }
+
+    uint64_t allocs = CountAllocations();
+
+    for (auto _ : state) {
+        matfile_t *mat = matfile_read(filename.c_str());
+
+        if (!mat) {
+            state.SkipWithError("could not read mat-file");
+            break;
+        }
+
+        matfile_destroy(mat);
+    }
+
+    ReportCounters(state, bytes.size(), allocs);
+    remove(filename.c_str());
+}
+
+//  Read mat-file of corpus generated with matfile-gen.
+static void ReadCorpus(benchmark::State &state, const std::string &filename) {
+    FILE *fin = fopen(filename.c_str(), "rb");
+
+    if (!fin) {
+        state.SkipWithError("could not open corpus");
+        return;
+    }
+
+    fseek(fin, 0, SEEK_END);
+    uint64_t size = ftell(fin);
+    fclose(fin);
+
+    uint64_t allocs = CountAllocations();
+
+    for (auto _ : state) {
+        matfile_t *mat = matfile_read(filename.c_str());
+
+        if (!mat) {
+            state.SkipWithError("could not read corpus");
+            break;
+        }
+
+        matfile_destroy(mat);
+    }
+
+    ReportCounters(state, size, allocs);
+}
+
+//  Corpus benchmark is registered only if path to corpus is given.
+static int RegisterCorpus(void) {
+    const char *filename = getenv("MATFILE_BENCH_CORPUS");
+
+    if (filename) {
+        std::string path(filename);
+        benchmark::RegisterBenchmark("BM_ReadCorpus",
+                                     [path](benchmark::State &state) {
+                                         ReadCorpus(state, path);
+                                     });
+    }
+
+    return 0;
+}
+
+static int corpus_registered = RegisterCorpus();
+
+BENCHMARK(BM_ParseDataElements)->Apply(ReaderArguments);
+BENCHMARK(BM_DecompressDataElement)->Apply(InflateArguments);
+BENCHMARK(BM_ParseNumericalPart)->Apply(PartArguments);
+BENCHMARK(BM_ReadMemory)->Apply(ReaderArguments);
+BENCHMARK(BM_ReadFile)->Apply(ReaderArguments);
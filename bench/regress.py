@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Benchmark regression gate.
+
+Run gated benchmarks of matfile-bench on corpora generated with matfile-gen
+and compare median throughput and peak RSS against checked-in baseline.
+Every benchmark runs in its own process so that its peak RSS is measured in
+isolation. Exit status is not zero if any benchmark regresses beyond
+tolerance of baseline.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import subprocess
+import sys
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--bench', required=True,
+                        help='path to matfile-bench')
+    parser.add_argument('--gen', required=True,
+                        help='path to matfile-gen')
+    parser.add_argument('--baseline', required=True,
+                        help='path to JSON baseline')
+    parser.add_argument('--workdir', default='.',
+                        help='directory for corpora and reports')
+    parser.add_argument('--repetitions', type=int,
+                        help='override number of repetitions of baseline')
+    parser.add_argument('--update', action='store_true',
+                        help='write measurements into baseline')
+    return parser.parse_args()
+
+
+def escape_name(name):
+    """Escape name of benchmark for std::regex which rejects escapes of
+    characters which are not special."""
+    return re.sub(r'([.^$|()\[\]{}*+?\\])', r'\\\1', name)
+
+
+def generate_corpus(gen, workdir, spec):
+    """Generate corpus once per specification and return its path."""
+    digest = hashlib.sha1(' '.join(spec).encode()).hexdigest()[:12]
+    path = os.path.join(workdir, 'corpus-%s.mat' % digest)
+
+    if not os.path.exists(path):
+        subprocess.check_call([gen] + spec + [path])
+
+    return path
+
+
+def run_benchmark(bench, name, repetitions, corpus, report):
+    """Run single benchmark and return median throughput and peak RSS."""
+    env = dict(os.environ)
+
+    if corpus:
+        env['MATFILE_BENCH_CORPUS'] = corpus
+
+    argv = [bench,
+            '--benchmark_filter=^%s$' % escape_name(name),
+            '--benchmark_repetitions=%d' % repetitions,
+            '--benchmark_report_aggregates_only=true',
+            '--benchmark_format=json',
+            '--benchmark_out=%s' % report,
+            '--benchmark_out_format=json']
+
+    with open(os.devnull, 'w') as devnull:
+        proc = subprocess.Popen(argv, env=env, stdout=devnull)
+        _, status, usage = os.wait4(proc.pid, 0)
+
+    if status:
+        raise RuntimeError('benchmark `%s` failed with status %d' %
+                           (name, status))
+
+    try:
+        with open(report) as fin:
+            runs = json.load(fin)['benchmarks']
+    except (IOError, ValueError):
+        raise RuntimeError('there is no report of benchmark `%s`' % name)
+
+    for run in runs:
+        if run.get('aggregate_name') == 'median':
+            if run.get('error_occurred'):
+                raise RuntimeError('benchmark `%s` failed: %s' %
+                                   (name, run.get('error_message')))
+            return run['bytes_per_second'], usage.ru_maxrss
+
+    raise RuntimeError('there is no median of benchmark `%s`' % name)
+
+
+def format_change(baseline, current):
+    if not baseline:
+        return 'n/a'
+    return '%+.1f%%' % (100.0 * (current - baseline) / baseline)
+
+
+def main():
+    args = parse_args()
+
+    with open(args.baseline) as fin:
+        baseline = json.load(fin)
+
+    os.makedirs(args.workdir, exist_ok=True)
+
+    repetitions = args.repetitions or baseline['repetitions']
+    throughput_tolerance = baseline['throughput_tolerance']
+    rss_tolerance = baseline['rss_tolerance']
+    nofailures = 0
+
+    header = ('%-56s %12s %12s %8s %10s %10s %8s  %s' %
+              ('benchmark', 'base MiB/s', 'cur MiB/s', 'change',
+               'base RSS', 'cur RSS', 'change', 'status'))
+    print(header)
+    print('-' * len(header))
+
+    for gate in baseline['benchmarks']:
+        name = gate['name']
+        corpus = None
+
+        if 'corpus' in gate:
+            corpus = generate_corpus(args.gen, args.workdir, gate['corpus'])
+
+        report = os.path.join(args.workdir, 'report-%s.json' %
+                              re.sub(r'[^\w]+', '_', gate['label']))
+        throughput, rss = run_benchmark(args.bench, name, repetitions,
+                                        corpus, report)
+
+        base_throughput = gate.get('bytes_per_second', 0)
+        base_rss = gate.get('max_rss_kb', 0)
+        status = 'ok'
+
+        #  Gates of noisy microbenchmarks could override tolerances.
+        lower = 1 - gate.get('throughput_tolerance', throughput_tolerance)
+        upper = 1 + gate.get('rss_tolerance', rss_tolerance)
+
+        if base_throughput and throughput < base_throughput * lower:
+            status = 'SLOWER'
+        elif base_rss and rss > base_rss * upper:
+            status = 'LARGER'
+
+        if args.update:
+            gate['bytes_per_second'] = round(throughput)
+            gate['max_rss_kb'] = rss
+            status = 'updated'
+        elif status != 'ok':
+            nofailures += 1
+
+        print('%-56s %12.1f %12.1f %8s %10d %10d %8s  %s' %
+              (gate['label'], base_throughput / 2**20, throughput / 2**20,
+               format_change(base_throughput, throughput), base_rss, rss,
+               format_change(base_rss, rss), status))
+
+    if args.update:
+        with open(args.baseline, 'w') as fout:
+            json.dump(baseline, fout, indent=4)
+            fout.write('\n')
+
+    if nofailures:
+        print('%d benchmark(s) regressed' % nofailures)
+        return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
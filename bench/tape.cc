@@ -0,0 +1,58 @@
+//  tape.cc
+
+#include "bench.h"
+
+extern "C" {
+#include "../src/internal.h"
+}
+
+static void BM_TapePush(benchmark::State &state) {
+    size_t chunk = state.range(0), total = state.range(1);
+    uint64_t allocs = CountAllocations();
+
+    for (auto _ : state) {
+        tape_t *tape = tape_create(16);
+
+        for (size_t length = 0; length < total; length += chunk) {
+            benchmark::DoNotOptimize(tape_push(tape, chunk));
+        }
+
+        tape_destroy(tape);
+    }
+
+    ReportCounters(state, total, allocs);
+}
+
+template <typename T, T (*swap)(T, int)>
+static void BM_Swap(benchmark::State &state) {
+    std::vector<T> words(state.range(0));
+
+    for (size_t i = 0; i != words.size(); ++i) {
+        words[i] = static_cast<T>(i * 0x0102030405060708ull);
+    }
+
+    int switched = state.range(1) == MFEND_SWITCH;
+    uint64_t allocs = CountAllocations();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i != words.size(); ++i) {
+            words[i] = swap(words[i], switched);
+        }
+
+        benchmark::ClobberMemory();
+    }
+
+    ReportCounters(state, words.size() * sizeof(T), allocs);
+}
+
+static void SwapArguments(benchmark::internal::Benchmark *bench) {
+    bench->ArgNames({"numel", "endianness"});
+    bench->ArgsProduct({{1 << 10, 1 << 20}, {MFEND_SAME, MFEND_SWITCH}});
+}
+
+BENCHMARK(BM_TapePush)
+    ->ArgNames({"chunk", "total"})
+    ->ArgsProduct({{8, 64, 4096}, {1 << 16, 1 << 24}});
+BENCHMARK_TEMPLATE(BM_Swap, uint16_t, swap2)->Apply(SwapArguments);
+BENCHMARK_TEMPLATE(BM_Swap, uint32_t, swap4)->Apply(SwapArguments);
+BENCHMARK_TEMPLATE(BM_Swap, uint64_t, swap8)->Apply(SwapArguments);
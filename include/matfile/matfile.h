@@ -17,12 +17,22 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <matfile/tape.h>
 
 #define MATFILE_VERSION     "0.1.0"
 
 #define MF_ALIGNMENT        8u  ///<Alignment of data in mat-file.
 #define MATFILE_ALIGNMENT   MF_ALIGNMENT
 
+#define MF_CLASS_MASK       0x00ffu ///<Mask of array class in array flags.
+#define MF_FLAG_LOGICAL     0x0200u ///<Array is logical.
+#define MF_FLAG_GLOBAL      0x0400u ///<Array is global variable.
+#define MF_FLAG_COMPLEX     0x0800u ///<Array has imaginary part.
+
+#define MF_INDEX_SUFFIX     ".idx"  ///<Suffix of sidecar index file.
+
+#define MF_LATENCY_BUCKETS  720u    ///<Number of buckets of latency histogram.
+
 /**
  *  Identify differences between endianess on encoder and on decoder sides.
  */
@@ -77,6 +87,103 @@ typedef enum _matfile_data_type_t {
     MFDT_COUNT,         ///<Number of data element types
 } matfile_data_type_t;
 
+/**
+ *  Compression policy which is applied to every array on writing. Writer
+ *  estimates compressibility of array on small sample of its payload before
+ *  compression and stores array uncompressed if deflate does not pay.
+ */
+typedef enum _matfile_compression_t {
+    MFCOMP_NONE = 0,    ///<Do not compress data elements at all.
+    MFCOMP_SPEED,       ///<Compress fast and skip incompressible data.
+    MFCOMP_RATIO,       ///<Compress as good as possible.
+    MFCOMP_THRESHOLD,   ///<Compress if estimated ratio is at least min_ratio.
+    MFCOMP_COUNT,       ///<Number of compression policies.
+} matfile_compression_t;
+
+/**
+ *  Phase of reading which time is accounted in statistics. Phases do not
+ *  overlap, e.g. inflate time is not included in parse time.
+ */
+typedef enum _matfile_phase_t {
+    MFPHASE_OPEN = 0,   ///<Open file, get its size and read sidecar index.
+    MFPHASE_READ,       ///<Read bytes of file into memory.
+    MFPHASE_INFLATE,    ///<Inflate compressed data elements.
+    MFPHASE_PARSE,      ///<Decode data elements and array headers.
+    MFPHASE_CONVERT,    ///<Copy or convert numerical parts.
+    MFPHASE_COUNT,      ///<Number of phases.
+} matfile_phase_t;
+
+/**
+ *  Outcome of reading which tells apart interrupted reading from failed one.
+ */
+typedef enum _matfile_status_t {
+    MFSTATUS_OK = 0,        ///<Mat-file is read.
+    MFSTATUS_ERROR,         ///<Mat-file could not be read.
+    MFSTATUS_CANCELLED,     ///<Reading is cancelled with token.
+    MFSTATUS_EXPIRED,       ///<Deadline of reading has passed.
+    MFSTATUS_COUNT,         ///<Number of statuses.
+} matfile_status_t;
+
+/**
+ *  Way to load mat-file which peak memory is estimated.
+ *
+ *  \see matfile_estimate
+ */
+typedef enum _matfile_load_mode_t {
+    MFLOAD_FILE = 0,    ///<Read file into memory and parse it.
+    MFLOAD_MEMORY,      ///<Parse bytes which are held by caller.
+    MFLOAD_COUNT,       ///<Number of load modes.
+} matfile_load_mode_t;
+
+/**
+ *  Format of file which array is extracted to.
+ *
+ *  \see matfile_extract
+ */
+typedef enum _matfile_extract_format_t {
+    MFEXTRACT_NPY = 0,  ///<NumPy .npy file.
+    MFEXTRACT_RAW,      ///<Values in native byte order without header.
+    MFEXTRACT_COUNT,    ///<Number of formats.
+} matfile_extract_format_t;
+
+/**
+ *  Order of data elements in repacked mat-file. Sorting is stable, so data
+ *  elements with equal keys keep order of source mat-file.
+ *
+ *  \see matfile_repack
+ */
+typedef enum _matfile_repack_order_t {
+    MFORDER_KEEP = 0,   ///<Order of source mat-file.
+    MFORDER_SIZE,       ///<Ascending size of inflated data element.
+    MFORDER_NAME,       ///<Ascending name of array.
+    MFORDER_LIST,       ///<Listed arrays first, the rest in source order.
+    MFORDER_COUNT,      ///<Number of orders.
+} matfile_repack_order_t;
+
+/**
+ *  Operation on single variable which latency is recorded in histograms.
+ *  Unlike phases, operations are nested, e.g. lookup includes inflate and
+ *  conversion of the same variable.
+ */
+typedef enum _matfile_operation_t {
+    MFOP_LOOKUP = 0,    ///<Locate, inflate, decode and convert variable.
+    MFOP_INFLATE,       ///<Inflate compressed data element of variable.
+    MFOP_CONVERT,       ///<Copy or convert numerical part of variable.
+    MFOP_COUNT,         ///<Number of operations.
+} matfile_operation_t;
+
+/**
+ *  Size class of variable which latency histograms are tagged with. Size is
+ *  the number of bytes which operation produces.
+ */
+typedef enum _matfile_size_class_t {
+    MFSIZE_SMALL = 0,   ///<Less than 64 KiB.
+    MFSIZE_MEDIUM,      ///<Less than 16 MiB.
+    MFSIZE_LARGE,       ///<16 MiB or more.
+    MFSIZE_COUNT,       ///<Number of size classes.
+    MFSIZE_ANY = MFSIZE_COUNT,  ///<All size classes merged in snapshot.
+} matfile_size_class_t;
+
 //  Forward type definitions.
 
 typedef const char * matfile_varname_t;
@@ -88,6 +195,28 @@ typedef struct _matfile_data_element_large_t matfile_data_element_large_t;
 
 typedef union _matfile_data_element_t matfile_data_element_t;
 
+/**
+ *  Recorder of time spans of reading and writing which could be dumped in
+ *  Chrome trace event format.
+ *
+ *  \see matfile_trace_create
+ */
+typedef struct _matfile_trace_t matfile_trace_t;
+
+/**
+ *  Token which cancels readings it is attached to from any thread.
+ *
+ *  \see matfile_cancel_create
+ */
+typedef struct _matfile_cancel_t matfile_cancel_t;
+
+/**
+ *  Set of log-bucketed histograms of latency of operations on variables.
+ *
+ *  \see matfile_latency_create
+ */
+typedef struct _matfile_latency_t matfile_latency_t;
+
 #pragma pack(push, 1)
 
 /**
@@ -272,6 +401,413 @@ typedef struct _matfile_t {
     size_t                  noelements;
 } matfile_t;
 
+/**
+ *  Options which control serialization of mat-file.
+ *
+ *  \see matfile_write_options_init
+ */
+typedef struct _matfile_write_options_t {
+    /**
+     *  Compression policy of data elements.
+     */
+    matfile_compression_t compression;
+
+    /**
+     *  Level of zlib compression in range from 1 to 9. Negative value means
+     *  that level is choosen according to compression policy.
+     */
+    int level;
+
+    /**
+     *  Minimal estimated compression ratio (uncompressed size over compressed
+     *  size) which makes compression worth it.
+     */
+    double min_ratio;
+
+    /**
+     *  Number of payload bytes which are used to estimate compressibility.
+     */
+    size_t sample_size;
+
+    /**
+     *  Store numerical parts with the smallest data type which represents all
+     *  values exactly (e.g. integer-valued double array as miUINT8) like
+     *  MATLAB does. Array class in array flags is kept as is.
+     */
+    int narrow;
+
+    /**
+     *  Write sidecar index which contains location and content hash of every
+     *  array in mat-file.
+     */
+    int index;
+
+    /**
+     *  Rewrite only arrays which content hash differs from the one in sidecar
+     *  index of existing mat-file. Other data elements are copied as is
+     *  without encoding. This mode implies sidecar index.
+     */
+    int incremental;
+
+    /**
+     *  Split compressed stream of array into independently decodable blocks
+     *  of this many uncompressed bytes with full flush of deflate. Stream is
+     *  still standard zlib stream and its blocks are recorded in sidecar
+     *  index, so readers could inflate them in parallel. Zero disables
+     *  splitting.
+     */
+    size_t block_size;
+
+    /**
+     *  Trace which records spans of serialization, compression and writing
+     *  of every array or null.
+     */
+    matfile_trace_t *trace;
+} matfile_write_options_t;
+
+/**
+ *  Boundary of independently decodable block of compressed array.
+ */
+typedef struct _matfile_index_block_t {
+    uint64_t compressed;    ///<Offset of raw deflate block in zlib stream.
+    uint64_t uncompressed;  ///<Offset of block in inflated data element.
+} matfile_index_block_t;
+
+/**
+ *  Callback which receives serialized mat-file chunk by chunk.
+ *
+ *  \param[in] opaque User data.
+ *  \param[in] data   Chunk of serialized mat-file.
+ *  \param[in] size   Size of chunk in bytes.
+ *  \return Returns 0 on success. Not zero aborts serialization.
+ *
+ *  \see matfile_write_callback
+ */
+typedef int (*matfile_write_callback_t)(void *opaque,
+                                        const void *data,
+                                        size_t size);
+
+/**
+ *  Statistics of reading. Counters are accumulated over all reads with the
+ *  same statistics so they should be reset explicitly.
+ *
+ *  \see matfile_stats_reset
+ */
+typedef struct _matfile_stats_t {
+    uint64_t bytes_read;                ///<Bytes read from file.
+    uint64_t bytes_inflated;            ///<Bytes produced by inflate.
+    uint64_t noallocs;                  ///<Number of heap allocations.
+    uint64_t alloc_bytes;               ///<Total size of heap allocations.
+    uint64_t copy_bytes;                ///<Bytes copied between buffers.
+    uint64_t phase_ns[MFPHASE_COUNT];   ///<Monotonic time of every phase.
+} matfile_stats_t;
+
+/**
+ *  Copy of latency histogram of single operation. Buckets are logarithmic
+ *  with 16 linear sub-buckets per power of two, so relative error of any
+ *  quantile is at most 1/16.
+ *
+ *  \see matfile_latency_snapshot
+ *  \see matfile_latency_bucket_bound
+ */
+typedef struct _matfile_latency_snapshot_t {
+    uint64_t count;                         ///<Number of operations.
+    uint64_t min_ns;                        ///<The fastest operation.
+    uint64_t max_ns;                        ///<The slowest operation.
+    uint64_t total_ns;                      ///<Sum of latencies.
+    uint64_t buckets[MF_LATENCY_BUCKETS];   ///<Counts of operations.
+} matfile_latency_snapshot_t;
+
+/**
+ *  Callback which receives histograms one by one on export.
+ *
+ *  \param[in] opaque   User data.
+ *  \param[in] op       Operation.
+ *  \param[in] size     Size class of variables.
+ *  \param[in] snapshot Histogram of operation.
+ *  \return Returns 0 to continue. Not zero stops export.
+ *
+ *  \see matfile_latency_export
+ */
+typedef int (*matfile_latency_callback_t)(
+    void *opaque,
+    matfile_operation_t op,
+    matfile_size_class_t size,
+    const matfile_latency_snapshot_t *snapshot);
+
+/**
+ *  Context of reading which controls how mat-file is deserialized.
+ *
+ *  \see matfile_context_init
+ */
+typedef struct _matfile_context_t {
+    /**
+     *  Number of threads which inflate blocks of compressed arrays listed in
+     *  sidecar index. Zero means the number of online processors.
+     */
+    size_t nothreads;
+
+    /**
+     *  Statistics which are updated on reading or null. Nothing is measured
+     *  if statistics are not requested.
+     */
+    matfile_stats_t *stats;
+
+    /**
+     *  Trace which records spans of reading, inflate, parsing and conversion
+     *  of every data element or null.
+     */
+    matfile_trace_t *trace;
+
+    /**
+     *  Histograms which record latency of lookup, inflate and conversion of
+     *  every variable or null.
+     */
+    matfile_latency_t *latency;
+
+    /**
+     *  Token which cancels reading or null. Cancellation is checked between
+     *  data elements and between chunks of inflate.
+     */
+    matfile_cancel_t *cancel;
+
+    /**
+     *  Monotonic time in nanoseconds after which reading is abandoned or zero
+     *  if there is no deadline. It is checked as often as cancellation.
+     *
+     *  \see matfile_deadline
+     */
+    uint64_t deadline;
+
+    /**
+     *  Status of reading which is set on return or null. Interrupted reading
+     *  releases everything it has allocated.
+     */
+    matfile_status_t *status;
+} matfile_context_t;
+
+/**
+ *  Location and content hash of single array in mat-file.
+ */
+typedef struct _matfile_index_entry_t {
+    char     *name;     ///<Name of array.
+    uint64_t  offset;   ///<Offset of data element from the beginning of file.
+    uint64_t  size;     ///<Size of data element including tag and padding.
+    uint64_t  hash;     ///<Content hash of array.
+
+    /**
+     *  Boundaries of blocks of compressed array or null. There are noblocks
+     *  + 1 boundaries and the last one marks the end of deflate data.
+     */
+    matfile_index_block_t *blocks;
+
+    /**
+     *  Number of independently decodable blocks.
+     */
+    size_t noblocks;
+} matfile_index_entry_t;
+
+/**
+ *  Footprint of single array which is known before loading.
+ */
+typedef struct _matfile_estimate_entry_t {
+    char                *name;      ///<Name of array.
+    matfile_array_type_t type;      ///<Class of array.
+    int                  complex;   ///<Array has imaginary part.
+    int32_t             *dims;      ///<Shape of array.
+    size_t               nodims;    ///<Number of dimensions.
+    uint64_t             numel;     ///<Number of elements.
+    uint64_t             stored;    ///<Size of data element in file.
+    uint64_t             inflated;  ///<Inflated size or zero if uncompressed.
+    uint64_t             decoded;   ///<Bytes of numerical parts after load.
+} matfile_estimate_entry_t;
+
+/**
+ *  Memory footprint of loading of mat-file.
+ *
+ *  \see matfile_estimate
+ */
+typedef struct _matfile_estimate_t {
+    uint64_t                  file_size;            ///<Size of mat-file.
+    uint64_t                  decoded;              ///<Sum of entries.
+    uint64_t                  peak[MFLOAD_COUNT];   ///<Peak heap of reader.
+    matfile_estimate_entry_t *entries;              ///<Selected arrays.
+    size_t                    noentries;            ///<Number of entries.
+} matfile_estimate_t;
+
+/**
+ *  Options which control extraction of array.
+ *
+ *  \see matfile_extract_options_init
+ */
+typedef struct _matfile_extract_options_t {
+    /**
+     *  Format of output file.
+     */
+    matfile_extract_format_t format;
+
+    /**
+     *  Write values in row-major (C) order instead of column-major order of
+     *  mat-file. Values are scattered over mapped output file.
+     */
+    int row_major;
+
+    /**
+     *  Size of every buffer which payload goes through. Memory usage of
+     *  extraction is a small multiple of it.
+     */
+    size_t buffer_size;
+} matfile_extract_options_t;
+
+/**
+ *  Options which control repacking of mat-file.
+ *
+ *  \see matfile_repack_options_init
+ */
+typedef struct _matfile_repack_options_t {
+    /**
+     *  Compression policy, level, block size, sidecar index and trace of
+     *  output. Arrays are recompressed as is, so narrowing and incremental
+     *  save do not apply.
+     */
+    matfile_write_options_t write;
+
+    /**
+     *  Number of threads which inflate and deflate data elements or zero for
+     *  all processors.
+     */
+    size_t nothreads;
+
+    /**
+     *  Order of data elements in output mat-file.
+     */
+    matfile_repack_order_t order;
+
+    /**
+     *  Names of arrays which go first if order is MFORDER_LIST.
+     */
+    const char *const *names;
+
+    /**
+     *  Number of names.
+     */
+    size_t nonames;
+} matfile_repack_options_t;
+
+/**
+ *  Summary statistics of real or imaginary part of array. NaN values are
+ *  counted but they are excluded from the rest of statistics.
+ */
+typedef struct _matfile_summary_part_t {
+    uint64_t count;     ///<Number of values which are not NaN.
+    uint64_t nonans;    ///<Number of NaN values.
+    uint64_t nozeros;   ///<Number of zero values.
+    double   min;       ///<Minimal value or NaN if there are no values.
+    double   max;       ///<Maximal value or NaN if there are no values.
+    double   mean;      ///<Mean value or NaN if there are no values.
+    double   std;       ///<Population standard deviation.
+} matfile_summary_part_t;
+
+/**
+ *  Summary statistics of single array.
+ */
+typedef struct _matfile_summary_entry_t {
+    char                   *name;       ///<Name of array.
+    matfile_array_type_t    type;       ///<Class of array.
+    int                     complex;    ///<Array has imaginary part.
+    uint64_t                numel;      ///<Number of elements.
+    matfile_summary_part_t  parts[2];   ///<Real and imaginary parts.
+} matfile_summary_entry_t;
+
+/**
+ *  Summary statistics of numerical arrays of mat-file.
+ *
+ *  \see matfile_summarize
+ */
+typedef struct _matfile_summary_t {
+    matfile_summary_entry_t *entries;   ///<Numerical arrays in file order.
+    size_t                   noentries; ///<Number of entries.
+} matfile_summary_t;
+
+/**
+ *  Index of arrays in mat-file. It is stored in sidecar file next to mat-file
+ *  and it is valid only if size of mat-file is the same.
+ *
+ *  \see MF_INDEX_SUFFIX
+ */
+typedef struct _matfile_index_t {
+    uint64_t               file_size;   ///<Size of indexed mat-file.
+    matfile_index_entry_t *entries;     ///<Index entries in file order.
+    size_t                 noentries;   ///<Number of index entries.
+} matfile_index_t;
+
+/**
+ *  Array which grows by columns at the end of mat-file.
+ *
+ *  \see matfile_growable_open
+ */
+typedef struct _matfile_growable_t matfile_growable_t;
+
+/**
+ *  Memory-mapped mat-file which exposes numerical parts of uncompressed
+ *  arrays without copying.
+ *
+ *  \see matfile_view_open
+ */
+typedef struct _matfile_view_t matfile_view_t;
+
+#define MF_VIEW_READ    0x0 ///<Map mat-file for reading only.
+#define MF_VIEW_WRITE   0x1 ///<Map mat-file for updates in place.
+
+/**
+ *  \brief Create empty mat-file data structure.
+ *
+ *  \return Pointer to mat-file object without data elements or null if there
+ *  is not enough memory.
+ */
+matfile_t *matfile_create(void);
+
+/**
+ *  \brief Create numerical array which payload is zero-initialized.
+ *
+ *  \param[in] name    Symbolic name of variable.
+ *  \param[in] type    Array class. Only numerical classes are supported.
+ *  \param[in] nodims  Number of dimensions.
+ *  \param[in] dims    Shape of array.
+ *  \param[in] complex Allocate imaginary part if not zero.
+ *  \return Pointer to array or null on failure.
+ */
+matfile_array_t *matfile_array_create(const char *name,
+                                      matfile_array_type_t type,
+                                      size_t nodims,
+                                      const int32_t *dims,
+                                      int complex);
+
+/**
+ *  \brief Destroy array and free all its buffers.
+ *
+ *  \param[in] array Pointer to array.
+ */
+void matfile_array_destroy(matfile_array_t *array);
+
+/**
+ *  \brief Get total number of elements in array.
+ *
+ *  \param[in] array Pointer to array.
+ *  \return Product of array dimensions.
+ */
+size_t matfile_array_numel(const matfile_array_t *array);
+
+/**
+ *  \brief Add array to mat-file as miMATRIX data element. Mat-file takes
+ *  ownership of array.
+ *
+ *  \param[in,out] mat   Pointer to mat-file object.
+ *  \param[in]     array Pointer to array.
+ *  \return Return zero if array is added successfully.
+ */
+int matfile_add_array(matfile_t *mat, matfile_array_t *array);
+
 /**
  *  \brief Destroy mat-file data structure and free all accuired resources.
  *
@@ -297,6 +833,30 @@ matfile_array_t *matfile_get_array(const matfile_t *mat, const char *name);
  */
 const char *matfile_get_type_string(matfile_data_type_t type);
 
+/**
+ *  \brief Get size of numerical data type in bytes.
+ *
+ *  \param type Data type code.
+ *  \return Size of element in bytes or zero if data type is not numerical.
+ */
+size_t matfile_get_type_size(matfile_data_type_t type);
+
+/**
+ *  \brief Get data type which naturally stores elements of array class.
+ *
+ *  \param type Array class.
+ *  \return Data type code or zero if array class is not numerical.
+ */
+matfile_data_type_t matfile_get_storage_type(matfile_array_type_t type);
+
+/**
+ *  \brief Get textual description of array class.
+ *
+ *  \param type Array class.
+ *  \return C-string that describes array class.
+ */
+const char *matfile_get_class_string(matfile_array_type_t type);
+
 /**
  *  This function parses raw bytes into array of data element i.e. there is not
  *  header block that contains description and version info.
@@ -326,6 +886,225 @@ matfile_data_element_t *matfile_parse(const void *data,
  */
 matfile_t *matfile_read(const char *filename);
 
+/**
+ *  \brief Fill reading context with default values.
+ *
+ *  \param[out] ctx Context to initialize.
+ */
+void matfile_context_init(matfile_context_t *ctx);
+
+/**
+ *  \brief Deserialize mat-file within reading context. Compressed arrays
+ *  which blocks are listed in consistent sidecar index are inflated in
+ *  parallel.
+ *
+ *  \param filename Name of mat-file to read.
+ *  \param ctx      Reading context or null for defaults.
+ *  \return If it reads and parses file successfully then it returns pointer to
+ *  data, otherwise it returns null.
+ */
+matfile_t *matfile_read_ctx(const char *filename, const matfile_context_t *ctx);
+
+/**
+ *  \brief Deserialize mat-file from memory. In contrast to matfile_parse the
+ *  buffer starts with header of mat-file.
+ *
+ *  \param data Serialized mat-file.
+ *  \param size Size of serialized mat-file in bytes.
+ *  \param ctx  Reading context or null for defaults.
+ *  \return If it parses buffer successfully then it returns pointer to data,
+ *  otherwise it returns null.
+ */
+matfile_t *matfile_read_memory(const void *data,
+                               size_t size,
+                               const matfile_context_t *ctx);
+
+/**
+ *  \brief Create cancellation token which is not cancelled yet.
+ *
+ *  \return Token on success, otherwise null.
+ */
+matfile_cancel_t *matfile_cancel_create(void);
+
+/**
+ *  \brief Destroy cancellation token. It should not be attached to any
+ *  ongoing reading.
+ *
+ *  \param[in] cancel Token or null.
+ */
+void matfile_cancel_destroy(matfile_cancel_t *cancel);
+
+/**
+ *  \brief Request cancellation of all readings token is attached to. It
+ *  could be called from any thread and from signal handler.
+ *
+ *  \param[in] cancel Token.
+ */
+void matfile_cancel(matfile_cancel_t *cancel);
+
+/**
+ *  \brief Clear cancellation request so that token could be reused.
+ *
+ *  \param[in] cancel Token.
+ */
+void matfile_cancel_reset(matfile_cancel_t *cancel);
+
+/**
+ *  \brief Check whether cancellation is requested.
+ *
+ *  \param[in] cancel Token.
+ *  \return Return not zero if token is cancelled, otherwise zero.
+ */
+int matfile_is_cancelled(const matfile_cancel_t *cancel);
+
+/**
+ *  \brief Get deadline which is the given time from now.
+ *
+ *  \param[in] timeout Time budget in nanoseconds.
+ *  \return Monotonic time of deadline in nanoseconds.
+ */
+uint64_t matfile_deadline(uint64_t timeout);
+
+/**
+ *  \brief Get textual name of status of reading.
+ *
+ *  \param status Status of reading.
+ *  \return C-string that names status.
+ */
+const char *matfile_get_status_string(matfile_status_t status);
+
+/**
+ *  \brief Reset all counters and timings of statistics to zero.
+ *
+ *  \param[out] stats Statistics of reading.
+ */
+void matfile_stats_reset(matfile_stats_t *stats);
+
+/**
+ *  \brief Get textual name of reading phase.
+ *
+ *  \param phase Phase of reading.
+ *  \return C-string that names phase.
+ */
+const char *matfile_get_phase_string(matfile_phase_t phase);
+
+/**
+ *  \brief Create empty trace. Trace could be shared by many reads and writes
+ *  which run concurrently.
+ *
+ *  \return Trace on success, otherwise null.
+ */
+matfile_trace_t *matfile_trace_create(void);
+
+/**
+ *  \brief Destroy trace and all recorded spans.
+ *
+ *  \param[in] trace Trace or null.
+ */
+void matfile_trace_destroy(matfile_trace_t *trace);
+
+/**
+ *  \brief Get number of recorded spans.
+ *
+ *  \param[in] trace Trace.
+ *  \return Number of spans.
+ */
+size_t matfile_trace_length(matfile_trace_t *trace);
+
+/**
+ *  \brief Write recorded spans as JSON in Chrome trace event format which
+ *  could be opened in Perfetto or chrome://tracing.
+ *
+ *  \param[in] trace    Trace.
+ *  \param[in] filename Name of output file.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int matfile_trace_dump(matfile_trace_t *trace, const char *filename);
+
+/**
+ *  \brief Create empty latency histograms. Histograms could be shared by
+ *  many reads which run concurrently.
+ *
+ *  \return Histograms on success, otherwise null.
+ */
+matfile_latency_t *matfile_latency_create(void);
+
+/**
+ *  \brief Destroy latency histograms.
+ *
+ *  \param[in] latency Histograms or null.
+ */
+void matfile_latency_destroy(matfile_latency_t *latency);
+
+/**
+ *  \brief Reset all histograms to zero, e.g. at the beginning of reporting
+ *  interval.
+ *
+ *  \param[in] latency Histograms.
+ */
+void matfile_latency_reset(matfile_latency_t *latency);
+
+/**
+ *  \brief Copy histogram of operation on variables of size class.
+ *
+ *  \param[in]  latency  Histograms.
+ *  \param[in]  op       Operation.
+ *  \param[in]  size     Size class or MFSIZE_ANY to merge all classes.
+ *  \param[out] snapshot Copy of histogram.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int matfile_latency_snapshot(matfile_latency_t *latency,
+                             matfile_operation_t op,
+                             matfile_size_class_t size,
+                             matfile_latency_snapshot_t *snapshot);
+
+/**
+ *  \brief Pass snapshot of every non-empty histogram to callback.
+ *
+ *  \param[in] latency  Histograms.
+ *  \param[in] callback Callback.
+ *  \param[in] opaque   User data of callback.
+ *  \return Return zero on success, otherwise value returned by callback.
+ */
+int matfile_latency_export(matfile_latency_t *latency,
+                           matfile_latency_callback_t callback,
+                           void *opaque);
+
+/**
+ *  \brief Estimate quantile of latency from snapshot. Quantile q is the
+ *  value of nearest rank ceil(q * count) among observed latencies.
+ *
+ *  \param[in] snapshot Histogram.
+ *  \param[in] q        Quantile in range [0, 1], e.g. 0.999.
+ *  \return Latency in nanoseconds or zero if histogram is empty.
+ */
+uint64_t matfile_latency_quantile(const matfile_latency_snapshot_t *snapshot,
+                                  double q);
+
+/**
+ *  \brief Get exclusive upper bound of latency bucket.
+ *
+ *  \param[in] no Index of bucket.
+ *  \return Bound in nanoseconds.
+ */
+uint64_t matfile_latency_bucket_bound(size_t no);
+
+/**
+ *  \brief Get textual name of operation.
+ *
+ *  \param op Operation.
+ *  \return C-string that names operation.
+ */
+const char *matfile_get_operation_string(matfile_operation_t op);
+
+/**
+ *  \brief Get textual name of size class.
+ *
+ *  \param size Size class.
+ *  \return C-string that names size class.
+ */
+const char *matfile_get_size_class_string(matfile_size_class_t size);
+
 /**
  *  Checks the current data element is large.
  *
@@ -356,9 +1135,419 @@ int matfile_is_small(const matfile_data_element_t *element);
  *
  *  \param[in] filename Name of target mat-file.
  *  \param[in] mat Data structure that represent a content of mat-file.
+ *  \param[in] opts Serialization options or null for defaults.
  *  \return Returns 0 if it writes mat-file successully.
  */
-int matfile_write(const char *filename, const matfile_t *mat);
+int matfile_write(const char *filename,
+                  const matfile_t *mat,
+                  const matfile_write_options_t *opts);
+
+/**
+ *  \brief Append array to the end of existing mat-file without rewriting of
+ *  data elements which are already stored. If there is no such file then new
+ *  mat-file is created. Cost of the operation depends on size of the array
+ *  only.
+ *
+ *  \note Mat-file should be written in native byte order and should not
+ *  contain subsystem-specific data.
+ *
+ *  \param[in] filename Name of target mat-file.
+ *  \param[in] array    Array to append.
+ *  \param[in] opts     Serialization options or null for defaults.
+ *  \return Returns 0 if array is appended successfully. On failure mat-file
+ *  is truncated to its original size.
+ */
+int matfile_append(const char *filename,
+                   const matfile_array_t *array,
+                   const matfile_write_options_t *opts);
+
+/**
+ *  \brief Serialize mat-file and pass it to callback. Chunks are passed as
+ *  soon as they are produced, so the whole mat-file is never kept in memory.
+ *  Sidecar index and incremental save are not supported by the sink.
+ *
+ *  \param[in] mat      Mat-file to serialize.
+ *  \param[in] callback Callback which receives chunks in order.
+ *  \param[in] opaque   User data passed to callback.
+ *  \param[in] opts     Serialization options or null for defaults.
+ *  \return Returns 0 if mat-file is serialized successfully.
+ */
+int matfile_write_callback(const matfile_t *mat,
+                           matfile_write_callback_t callback,
+                           void *opaque,
+                           const matfile_write_options_t *opts);
+
+/**
+ *  \brief Serialize mat-file into memory. Serialized mat-file is appended to
+ *  tape, so it could be taken with tape_purge or reused for the next call.
+ *
+ *  \param[in] mat  Mat-file to serialize.
+ *  \param[in] tape Tape which serialized mat-file is appended to.
+ *  \param[in] opts Serialization options or null for defaults.
+ *  \return Returns 0 if mat-file is serialized successfully. Tape is left
+ *  intact on failure.
+ */
+int matfile_write_memory(const matfile_t *mat,
+                         tape_t *tape,
+                         const matfile_write_options_t *opts);
+
+/**
+ *  \brief Calculate content hash of array. It depends on name, flags, shape
+ *  and values of array but not on storage type and compression.
+ *
+ *  \param[in] array Pointer to array.
+ *  \return 64-bit hash value.
+ */
+uint64_t matfile_array_hash(const matfile_array_t *array);
+
+/**
+ *  \brief Create empty index.
+ *
+ *  \return Pointer to index or null on failure.
+ */
+matfile_index_t *matfile_index_create(void);
+
+/**
+ *  \brief Destroy index and free all its entries.
+ *
+ *  \param[in] index Pointer to index.
+ */
+void matfile_index_destroy(matfile_index_t *index);
+
+/**
+ *  \brief Find index entry by name of array.
+ *
+ *  \param[in] index Pointer to index.
+ *  \param[in] name  Name of array.
+ *  \return Pointer to the last entry with the name or null.
+ */
+const matfile_index_entry_t *matfile_index_find(const matfile_index_t *index,
+                                                const char *name);
+
+/**
+ *  \brief Read sidecar index of mat-file.
+ *
+ *  \param[in] filename Name of mat-file (not the sidecar itself).
+ *  \return Pointer to index if sidecar exists and it is consistent with
+ *  mat-file, i.e. size, modification time and inode of mat-file are the same
+ *  as they were on write of sidecar, otherwise null.
+ */
+matfile_index_t *matfile_index_read(const char *filename);
+
+/**
+ *  \brief Build index of mat-file from tags of its data elements. Only
+ *  headers of arrays are read (and inflated) so the cost does not depend on
+ *  size of payload. Content hashes are zero and data elements which are not
+ *  arrays have empty names.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \return Pointer to index on success, otherwise null.
+ */
+matfile_index_t *matfile_index_scan(const char *filename);
+
+/**
+ *  \brief Write sidecar index of mat-file. Sidecar records identity of
+ *  mat-file so it should be written after mat-file is complete.
+ *
+ *  \param[in] filename Name of mat-file (not the sidecar itself).
+ *  \param[in] index    Index to write.
+ *  \return Returns 0 if sidecar is written successfully.
+ */
+int matfile_index_write(const char *filename, const matfile_index_t *index);
+
+/**
+ *  \brief Write new mat-file which consists of named arrays of source
+ *  mat-file in the given order. Data elements are copied as is without
+ *  decoding unless array is renamed.
+ *
+ *  \param[in] src     Name of source mat-file.
+ *  \param[in] dst     Name of target mat-file.
+ *  \param[in] names   Names of arrays to copy.
+ *  \param[in] renames New names of arrays or null. Null entry keeps name.
+ *  \param[in] nonames Number of names.
+ *  \return Returns 0 if mat-file is written successfully.
+ */
+int matfile_subset(const char *src,
+                   const char *dst,
+                   const char *const *names,
+                   const char *const *renames,
+                   size_t nonames);
+
+/**
+ *  \brief Write new mat-file which consists of all data elements of source
+ *  mat-file except named arrays.
+ *
+ *  \param[in] src     Name of source mat-file.
+ *  \param[in] dst     Name of target mat-file.
+ *  \param[in] names   Names of arrays to drop.
+ *  \param[in] nonames Number of names.
+ *  \return Returns 0 if mat-file is written successfully.
+ */
+int matfile_drop(const char *src,
+                 const char *dst,
+                 const char *const *names,
+                 size_t nonames);
+
+/**
+ *  \brief Write new mat-file which consists of data elements of all source
+ *  mat-files in the given order.
+ *
+ *  \param[in] dst    Name of target mat-file.
+ *  \param[in] srcs   Names of source mat-files.
+ *  \param[in] nosrcs Number of source mat-files.
+ *  \return Returns 0 if mat-file is written successfully.
+ */
+int matfile_merge(const char *dst, const char *const *srcs, size_t nosrcs);
+
+/**
+ *  \brief Estimate memory footprint of loading of mat-file without reading
+ *  payloads. Tags are scanned and compressed data elements are inflated only
+ *  until array name, so decoded size of every array is exact. Peak heap is
+ *  derived from allocation pattern of reader for the whole mat-file since
+ *  reader always loads all arrays; allocator overhead is not included.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \param[in] names    Names of arrays to report or null for all arrays.
+ *  \param[in] nonames  Number of names.
+ *  \return Pointer to estimate on success, otherwise null.
+ */
+matfile_estimate_t *matfile_estimate(const char *filename,
+                                     const char *const *names,
+                                     size_t nonames);
+
+/**
+ *  \brief Release estimate of memory footprint.
+ *
+ *  \param[in] estimate Estimate or null.
+ */
+void matfile_estimate_destroy(matfile_estimate_t *estimate);
+
+/**
+ *  \brief Get textual name of load mode.
+ *
+ *  \param mode Load mode.
+ *  \return C-string that names load mode.
+ */
+const char *matfile_get_load_mode_string(matfile_load_mode_t mode);
+
+/**
+ *  \brief Fill extract options with default values. By default array is
+ *  written to .npy file in column-major order through 1 MiB buffers.
+ *
+ *  \param[out] opts Options to initialize.
+ */
+void matfile_extract_options_init(matfile_extract_options_t *opts);
+
+/**
+ *  \brief Extract single numerical array into file without loading it.
+ *  Payload is read, inflated, converted to data type of array class and
+ *  written chunk by chunk, so memory usage does not depend on size of array.
+ *  Complex values are interleaved. Header of .npy file has Fortran order
+ *  unless row-major order is requested, so no transpose is needed by
+ *  default.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \param[in] name     Name of array.
+ *  \param[in] output   Name of output file.
+ *  \param[in] opts     Extract options or null for defaults.
+ *  \return Returns 0 if array is extracted successfully.
+ */
+int matfile_extract(const char *filename,
+                    const char *name,
+                    const char *output,
+                    const matfile_extract_options_t *opts);
+
+/**
+ *  \brief Compute min, max, mean, standard deviation, NaN count and zero
+ *  count of every numerical array in one streaming pass. Payloads go through
+ *  fixed-size buffers and arrays are processed in parallel, so whole arrays
+ *  are never materialized. Values are accumulated as doubles, so integers
+ *  beyond 2^53 are rounded. Arrays which are not numerical are skipped.
+ *
+ *  \param[in] filename  Name of mat-file.
+ *  \param[in] nothreads Number of threads or zero for all processors.
+ *  \return Pointer to summary on success, otherwise null.
+ */
+matfile_summary_t *matfile_summarize(const char *filename, size_t nothreads);
+
+/**
+ *  \brief Release summary statistics.
+ *
+ *  \param[in] summary Summary or null.
+ */
+void matfile_summary_destroy(matfile_summary_t *summary);
+
+/**
+ *  \brief Fill repack options with default values. By default data elements
+ *  keep their order, they are compressed with the default write policy on
+ *  all processors and sidecar index is written.
+ *
+ *  \param[out] opts Options to initialize.
+ */
+void matfile_repack_options_init(matfile_repack_options_t *opts);
+
+/**
+ *  \brief Write mat-file with data elements of source mat-file recompressed
+ *  and reordered. Every array is inflated and its miMATRIX data element is
+ *  deflated again according to compression policy, so payload is kept bit
+ *  for bit and arrays of any class are supported. Data elements are
+ *  processed in parallel and written in order as soon as they are ready.
+ *  Content hashes in sidecar index of output are zero like in scanned index,
+ *  so the first incremental save rewrites every array.
+ *
+ *  \param[in] src  Name of source mat-file.
+ *  \param[in] dst  Name of target mat-file.
+ *  \param[in] opts Repack options or null for defaults.
+ *  \return Returns 0 if mat-file is repacked successfully.
+ */
+int matfile_repack(const char *src,
+                   const char *dst,
+                   const matfile_repack_options_t *opts);
+
+/**
+ *  \brief Get textual name of extract format.
+ *
+ *  \param format Extract format.
+ *  \return C-string that names extract format.
+ */
+const char *matfile_get_extract_format_string(matfile_extract_format_t format);
+
+/**
+ *  \brief Get textual name of repack order.
+ *
+ *  \param order Repack order.
+ *  \return C-string that names repack order.
+ */
+const char *matfile_get_repack_order_string(matfile_repack_order_t order);
+
+/**
+ *  \brief Append array to mat-file uncompressed and in data type of its class
+ *  so that it could grow by columns in place later.
+ *
+ *  \param[in] filename Name of mat-file. It is created if it does not exist.
+ *  \param[in] array    Real two-dimensional numerical array.
+ *  \return Pointer to growable array on success, otherwise null.
+ */
+matfile_growable_t *matfile_growable_create(const char *filename,
+                                            const matfile_array_t *array);
+
+/**
+ *  \brief Open array which is the last data element of mat-file in order to
+ *  grow it by columns. The array should be real, two-dimensional,
+ *  uncompressed and stored in data type of its class.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \param[in] name     Name of array.
+ *  \return Pointer to growable array on success, otherwise null.
+ */
+matfile_growable_t *matfile_growable_open(const char *filename,
+                                          const char *name);
+
+/**
+ *  \brief Append columns to growable array. The cost of the call is
+ *  proportional to the size of new columns. Mat-file is valid as soon as the
+ *  routine returns.
+ *
+ *  \param[in] growable Growable array.
+ *  \param[in] columns  Column-major buffer of numbers of array class type.
+ *  \param[in] nocols   Number of columns.
+ *  \return Returns 0 if columns are appended successfully.
+ */
+int matfile_growable_append(matfile_growable_t *growable,
+                            const void *columns,
+                            size_t nocols);
+
+/**
+ *  \brief Flush appended columns and patched header to storage device.
+ *
+ *  \param[in] growable Growable array.
+ *  \return Returns 0 if data are flushed successfully.
+ */
+int matfile_growable_flush(matfile_growable_t *growable);
+
+/**
+ *  \brief Close growable array and release its resources.
+ *
+ *  \param[in] growable Growable array.
+ *  \return Returns 0 if file is closed successfully.
+ */
+int matfile_growable_close(matfile_growable_t *growable);
+
+/**
+ *  \brief Map mat-file into memory. Mapping is shared so updates of arrays
+ *  through writable view go directly to the file and the whole file is never
+ *  rewritten. Mat-file should be in native byte order.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \param[in] flags    Either MF_VIEW_READ or MF_VIEW_WRITE.
+ *  \return Pointer to view on success, otherwise null.
+ */
+matfile_view_t *matfile_view_open(const char *filename, int flags);
+
+/**
+ *  \brief Map mat-file into memory for updates in place. It is shortcut for
+ *  matfile_view_open with MF_VIEW_WRITE flag.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \return Pointer to view on success, otherwise null.
+ */
+matfile_view_t *matfile_open_rw(const char *filename);
+
+/**
+ *  \brief Create mat-file of uncompressed arrays and map it for filling. The
+ *  exact layout of mat-file is computed from flags, dims and names of arrays
+ *  and space is preallocated at once. Headers are written in advance, so
+ *  producers fill numerical parts of arrays from matfile_view_get_array
+ *  directly. Different arrays could be filled from different threads.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \param[in] arrays   Numerical arrays which define layout. Their
+ *  numerical parts are not used.
+ *  \param[in] noarrays Number of arrays.
+ *  \return Pointer to writable view on success, otherwise null.
+ */
+matfile_view_t *matfile_view_create(const char *filename,
+                                    const matfile_array_t *const *arrays,
+                                    size_t noarrays);
+
+/**
+ *  \brief Get array which numerical parts point to mapped memory. Only
+ *  uncompressed numerical arrays which are stored in data type of its class
+ *  and are aligned could be viewed. Other arrays are rejected. Arrays of
+ *  view made by matfile_view_create could be got from many threads.
+ *
+ *  \param[in] view View of mat-file.
+ *  \param[in] name Name of array.
+ *  \return Pointer to array owned by view or null. It should not be
+ *  destroyed with matfile_array_destroy.
+ */
+matfile_array_t *matfile_view_get_array(matfile_view_t *view,
+                                        const char *name);
+
+/**
+ *  \brief Flush updates of writable view to mat-file with msync.
+ *
+ *  \param[in] view View of mat-file.
+ *  \return Returns 0 if view is flushed successfully.
+ */
+int matfile_view_flush(matfile_view_t *view);
+
+/**
+ *  \brief Flush updates, unmap mat-file and release arrays of view.
+ *
+ *  \param[in] view View of mat-file.
+ *  \return Returns 0 if view is flushed and closed successfully.
+ */
+int matfile_view_close(matfile_view_t *view);
+
+/**
+ *  \brief Fill write options with default values. By default arrays are
+ *  narrowed and compressed with default zlib level if it reduces size at least
+ *  by 10%.
+ *
+ *  \param[out] opts Options to initialize.
+ */
+void matfile_write_options_init(matfile_write_options_t *opts);
 
 /**
  *  Destroy list of variable names.
@@ -57,6 +57,14 @@ void *tape_deref(tape_t *tape);
  */
 void tape_destroy(tape_t *tape);
 
+/**
+ *  Get number of bytes which are pushed on tape.
+ *
+ *  \param[in] tape Pointer into tape object.
+ *  \return Current length of tape in bytes.
+ */
+size_t tape_length(const tape_t *tape);
+
 /**
  *  Pop some bytes from tape and roll back pointer to the end of tape.
  *
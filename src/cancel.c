@@ -0,0 +1,79 @@
+/**
+ *  \file cancel.c
+ *  \brief The file contains cancellation tokens and deadlines which let
+ *  latency-sensitive callers abandon reading midway.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+typedef struct _matfile_cancel_t {
+    atomic_int cancelled;   ///<Cancellation is requested.
+} matfile_cancel_t;
+
+static const char *status_strings[] = {
+    "ok",
+    "error",
+    "cancelled",
+    "expired",
+};
+
+matfile_cancel_t *matfile_cancel_create(void) {
+    matfile_cancel_t *cancel = malloc(sizeof(matfile_cancel_t));
+
+    if (!cancel) {
+        fprintf(stderr, "could not allocate memory for cancellation token\n");
+        return NULL;
+    }
+
+    atomic_init(&cancel->cancelled, 0);
+    return cancel;
+}
+
+void matfile_cancel_destroy(matfile_cancel_t *cancel) {
+    free(cancel);
+}
+
+void matfile_cancel(matfile_cancel_t *cancel) {
+    atomic_store_explicit(&cancel->cancelled, 1, memory_order_relaxed);
+}
+
+void matfile_cancel_reset(matfile_cancel_t *cancel) {
+    atomic_store_explicit(&cancel->cancelled, 0, memory_order_relaxed);
+}
+
+int matfile_is_cancelled(const matfile_cancel_t *cancel) {
+    return atomic_load_explicit(&((matfile_cancel_t *)cancel)->cancelled,
+                                memory_order_relaxed);
+}
+
+uint64_t matfile_deadline(uint64_t timeout) {
+    return mf_monotonic_ns() + timeout;
+}
+
+const char *matfile_get_status_string(matfile_status_t status) {
+    return status < MFSTATUS_COUNT ? status_strings[status] : "unknown";
+}
+
+matfile_status_t mf_check_context(const matfile_context_t *ctx) {
+    if (!ctx) {
+        return MFSTATUS_OK;
+    }
+
+    if (ctx->cancel && matfile_is_cancelled(ctx->cancel)) {
+        return MFSTATUS_CANCELLED;
+    }
+
+    //  Clock is read only if there is deadline.
+    if (ctx->deadline && matfile_deadline(0) >= ctx->deadline) {
+        return MFSTATUS_EXPIRED;
+    }
+
+    return MFSTATUS_OK;
+}
@@ -0,0 +1,292 @@
+/**
+ *  \file estimate.c
+ *  \brief The file contains estimation of memory footprint of loading of
+ *  mat-file from tags and array headers only. It is used for admission
+ *  control before committing to load.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include "internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *load_mode_strings[] = {
+    "file",
+    "memory",
+};
+
+/**
+ *  Get capacity of tape which starts with initial capacity and grows by
+ *  doubling until length fits.
+ *
+ *  \param[in] initial Initial capacity.
+ *  \param[in] length  Length of content.
+ *  \return Final capacity.
+ */
+uint64_t tape_capacity(uint64_t initial, uint64_t length);
+
+/**
+ *  Find position of name in list.
+ *
+ *  \param[in] names   Names of arrays or null.
+ *  \param[in] nonames Number of names.
+ *  \param[in] name    Name to find.
+ *  \return Position of name or nonames if there is no such name.
+ */
+size_t find_name(const char *const *names, size_t nonames, const char *name);
+
+uint64_t tape_capacity(uint64_t initial, uint64_t length) {
+    uint64_t capacity = initial ? initial : 1;
+
+    while (capacity < length) {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+size_t find_name(const char *const *names, size_t nonames, const char *name) {
+    for (size_t i = 0; i != nonames; ++i) {
+        if (!strcmp(names[i], name)) {
+            return i;
+        }
+    }
+
+    return nonames;
+}
+
+matfile_estimate_t *matfile_estimate(const char *filename,
+                                     const char *const *names,
+                                     size_t nonames) {
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "there is not such file `%s`\n", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    matfile_header_t header;
+
+    if (fstat(fd, &st) ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        fprintf(stderr, "could not read header of `%s`\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    if (header.endianness != (('M' << 8) | 'I')) {
+        fprintf(stderr, "mat-file has foreign byte order or wrong header\n");
+        close(fd);
+        return NULL;
+    }
+
+    matfile_estimate_t *estimate = calloc(1, sizeof(matfile_estimate_t));
+    tape_t *entries = tape_create(8 * sizeof(matfile_estimate_entry_t));
+    char *found = calloc(nonames ? nonames : 1, 1);
+
+    if (!estimate || !entries || !found) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        free(found);
+        tape_destroy(entries);
+        free(estimate);
+        close(fd);
+        return NULL;
+    }
+
+    estimate->file_size = st.st_size;
+
+    //  Blocks of compressed arrays are inflated into exact buffer if they
+    //  are listed in sidecar index.
+    matfile_index_t *index = matfile_index_read(filename);
+
+    //  Heap of parsing grows by arrays which stay and temporary buffers of
+    //  inflate which are released after array is decoded.
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint64_t offset = sizeof(matfile_header_t);
+    uint64_t live = sizeof(matfile_t), peak = live;
+    size_t noelements = 0;
+    int retcode = 0;
+
+    while (offset + tag_size <= estimate->file_size && !retcode) {
+        uint32_t tag[2];
+
+        if (pread(fd, tag, sizeof(tag), offset) != sizeof(tag)) {
+            fprintf(stderr, "could not read tag of data element\n");
+            retcode = 1;
+            break;
+        }
+
+        uint32_t type, size;
+        size_t length;
+        mf_decode_tag(tag, &type, &size, &length);
+        ++noelements;
+
+        if (type == MFDT_COMPRESSED) {
+            length = tag_size + size;
+        }
+
+        if (offset + length > estimate->file_size) {
+            fprintf(stderr, "data element exceeds mat-file `%s`\n", filename);
+            retcode = 1;
+            break;
+        }
+
+        if (length == tag_size) {
+            offset += length;
+            continue;
+        }
+
+        if (type != MFDT_MATRIX && type != MFDT_COMPRESSED) {
+            live += length - tag_size;
+            peak = live > peak ? live : peak;
+            offset += length;
+            continue;
+        }
+
+        matfile_array_t array;
+        uint64_t payload;
+
+        if (mf_scan_array_header(fd, offset, type, size, &array, &payload)) {
+            fprintf(stderr, "could not scan array at offset %llu\n",
+                    (unsigned long long)offset);
+            retcode = 1;
+            break;
+        }
+
+        matfile_array_type_t array_type = array.flags & MF_CLASS_MASK;
+        int complex = !!(array.flags & MF_FLAG_COMPLEX);
+        uint64_t numel = matfile_array_numel(&array);
+        uint64_t decoded = 0;
+
+        if (array_type >= MFMX_DOUBLE_CLASS && array_type < MFMX_COUNT) {
+            matfile_data_type_t storage = matfile_get_storage_type(array_type);
+            decoded = numel * matfile_get_type_size(storage) * (1 + complex);
+        }
+
+        uint64_t meta = sizeof(matfile_array_t) + array.nodims * 4
+                      + array.length + 1;
+
+        if (type == MFDT_COMPRESSED) {
+            const matfile_index_entry_t *entry = NULL;
+
+            for (size_t i = 0; index && i != index->noentries; ++i) {
+                if (index->entries[i].offset == offset) {
+                    entry = &index->entries[i];
+                }
+            }
+
+            //  Serial inflate doubles its buffer from compressed size until
+            //  whole payload fits and then shrinks it.
+            uint64_t buffer = entry && entry->noblocks > 1
+                            ? payload
+                            : tape_capacity(size | 0x80, payload);
+            peak = live + buffer > peak ? live + buffer : peak;
+            peak = live + payload + meta + decoded > peak
+                 ? live + payload + meta + decoded
+                 : peak;
+        }
+        else {
+            peak = live + meta + decoded > peak ? live + meta + decoded : peak;
+        }
+
+        live += meta + decoded;
+
+        size_t no = find_name(names, nonames, array.name);
+
+        if (!names || no != nonames) {
+            matfile_estimate_entry_t *dst =
+                tape_push(entries, sizeof(matfile_estimate_entry_t));
+
+            if (!dst) {
+                fprintf(stderr, "could not reallocate memory for tape\n");
+                retcode = 1;
+            }
+            else {
+                dst->name = array.name;
+                dst->type = array_type;
+                dst->complex = complex;
+                dst->dims = array.dims;
+                dst->nodims = array.nodims;
+                dst->numel = numel;
+                dst->stored = length;
+                dst->inflated = type == MFDT_COMPRESSED ? tag_size + payload
+                                                        : 0;
+                dst->decoded = decoded;
+                estimate->decoded += decoded;
+                array.dims = NULL;
+                array.name = NULL;
+            }
+
+            if (names) {
+                found[no] = 1;
+            }
+        }
+
+        SAFE_RELEASE(array.dims)
+        SAFE_RELEASE(array.name)
+        offset += length;
+    }
+
+    //  Descriptors of data elements are accumulated on tape during parsing.
+    size_t element_size = sizeof(matfile_data_element_t);
+    peak += tape_capacity(16 * element_size, noelements * element_size);
+    estimate->peak[MFLOAD_MEMORY] = peak;
+    estimate->peak[MFLOAD_FILE] = peak + (estimate->file_size
+                                          ? estimate->file_size : 1);
+
+    for (size_t i = 0; i != nonames && !retcode; ++i) {
+        if (!found[i]) {
+            fprintf(stderr, "there is no array `%s` in `%s`\n", names[i],
+                    filename);
+            retcode = 1;
+        }
+    }
+
+    matfile_index_destroy(index);
+    free(found);
+    close(fd);
+
+    if (tape_length(entries)) {
+        estimate->noentries = tape_length(entries)
+                            / sizeof(matfile_estimate_entry_t);
+        estimate->entries = tape_purge(entries);
+        retcode |= !estimate->entries;
+    }
+    else {
+        tape_destroy(entries);
+    }
+
+    if (retcode) {
+        matfile_estimate_destroy(estimate);
+        return NULL;
+    }
+
+    return estimate;
+}
+
+void matfile_estimate_destroy(matfile_estimate_t *estimate) {
+    if (!estimate) {
+        return;
+    }
+
+    for (size_t i = 0; estimate->entries && i != estimate->noentries; ++i) {
+        free(estimate->entries[i].dims);
+        free(estimate->entries[i].name);
+    }
+
+    free(estimate->entries);
+    free(estimate);
+}
+
+const char *matfile_get_load_mode_string(matfile_load_mode_t mode) {
+    return mode < MFLOAD_COUNT ? load_mode_strings[mode] : "unknown";
+}
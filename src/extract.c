@@ -0,0 +1,655 @@
+/**
+ *  \file extract.c
+ *  \brief The file contains streaming extraction of single numerical array
+ *  into .npy or raw binary file. Payload goes through fixed-size buffers, so
+ *  memory usage does not depend on size of array.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MF_NPY_ALIGNMENT    64u         ///<Alignment of .npy payload.
+
+static const char *extract_format_strings[] = {
+    "npy",
+    "raw",
+};
+
+/**
+ *  Destination of extracted values. Values are either appended to file in
+ *  order of mat-file (column-major) or scattered over mapped file in
+ *  row-major order.
+ */
+typedef struct _extract_output_t {
+    FILE           *fout;       ///<Output file.
+    unsigned char  *mapping;    ///<Mapped output file in row-major mode.
+    size_t          length;     ///<Length of mapping.
+    size_t          header;     ///<Length of .npy header.
+} extract_output_t;
+
+/**
+ *  Format header of .npy file of version 1.0. Header is padded with spaces
+ *  so that payload is aligned.
+ *
+ *  \param[in]  array     Array which flags and dims describe payload.
+ *  \param[in]  row_major Payload is in row-major order.
+ *  \param[out] header    Buffer for header.
+ *  \param[in]  capacity  Capacity of buffer.
+ *  \return Length of header or zero if array could not be represented.
+ */
+size_t format_npy_header(const matfile_array_t *array,
+                         int row_major,
+                         char *header,
+                         size_t capacity);
+
+int mf_stream_open(extract_stream_t *stream,
+                   int fd,
+                   uint64_t offset,
+                   size_t capacity) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint32_t tag[2];
+
+    memset(stream, 0, sizeof(extract_stream_t));
+
+    if (pread(fd, tag, tag_size, offset) != tag_size) {
+        fprintf(stderr, "could not read tag of data element\n");
+        return 1;
+    }
+
+    if (tag[0] != MFDT_MATRIX && tag[0] != MFDT_COMPRESSED) {
+        fprintf(stderr, "data element is not array\n");
+        return 1;
+    }
+
+    stream->fd = fd;
+    stream->offset = offset + tag_size;
+    stream->remaining = tag[1];
+    stream->compressed = tag[0] == MFDT_COMPRESSED;
+    stream->capacity = capacity;
+    stream->buffer = malloc(capacity);
+    stream->input = stream->compressed ? malloc(capacity) : NULL;
+
+    if (!stream->buffer || (stream->compressed && !stream->input)) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        mf_stream_close(stream);
+        return 1;
+    }
+
+    if (stream->compressed && inflateInit(&stream->zs) != Z_OK) {
+        fprintf(stderr, "could not initialize inflate\n");
+        stream->compressed = 0;
+        mf_stream_close(stream);
+        return 1;
+    }
+
+    //  Compressed stream starts with tag of miMATRIX data element.
+    if (stream->compressed && (mf_stream_read(stream, tag, tag_size) ||
+                               tag[0] != MFDT_MATRIX)) {
+        fprintf(stderr, "compressed data element is not array\n");
+        mf_stream_close(stream);
+        return 1;
+    }
+
+    return 0;
+}
+
+void mf_stream_close(extract_stream_t *stream) {
+    if (stream->compressed) {
+        inflateEnd(&stream->zs);
+    }
+
+    free(stream->input);
+    free(stream->buffer);
+    memset(stream, 0, sizeof(extract_stream_t));
+}
+
+int mf_stream_fill(extract_stream_t *stream) {
+    size_t length = stream->end - stream->begin;
+    memmove(stream->buffer, stream->buffer + stream->begin, length);
+    stream->begin = 0;
+    stream->end = length;
+
+    if (!stream->compressed) {
+        size_t chunk = stream->capacity - stream->end;
+        chunk = chunk < stream->remaining ? chunk : stream->remaining;
+
+        if (pread(stream->fd, stream->buffer + stream->end, chunk,
+                  stream->offset) != chunk) {
+            fprintf(stderr, "could not read data element\n");
+            return 1;
+        }
+
+        stream->offset += chunk;
+        stream->remaining -= chunk;
+        stream->end += chunk;
+        return 0;
+    }
+
+    stream->zs.next_out = stream->buffer + stream->end;
+    stream->zs.avail_out = stream->capacity - stream->end;
+
+    while (stream->zs.avail_out) {
+        if (!stream->zs.avail_in) {
+            if (!stream->remaining) {
+                break;
+            }
+
+            size_t chunk = stream->capacity < stream->remaining
+                         ? stream->capacity
+                         : stream->remaining;
+
+            if (pread(stream->fd, stream->input, chunk, stream->offset)
+                    != chunk) {
+                fprintf(stderr, "could not read data element\n");
+                return 1;
+            }
+
+            stream->offset += chunk;
+            stream->remaining -= chunk;
+            stream->zs.next_in = stream->input;
+            stream->zs.avail_in = chunk;
+        }
+
+        int code = inflate(&stream->zs, Z_NO_FLUSH);
+
+        if (code == Z_STREAM_END) {
+            stream->remaining = 0;
+            stream->zs.avail_in = 0;
+            break;
+        }
+        else if (code != Z_OK) {
+            fprintf(stderr, "inflate failed with error code %d\n", code);
+            return 1;
+        }
+    }
+
+    stream->end = stream->capacity - stream->zs.avail_out;
+    return 0;
+}
+
+int mf_stream_read(extract_stream_t *stream, void *dst, uint64_t size) {
+    unsigned char *out = dst;
+
+    while (size) {
+        if (stream->begin == stream->end &&
+            (mf_stream_fill(stream) || stream->begin == stream->end)) {
+            fprintf(stderr, "data element is truncated\n");
+            return 1;
+        }
+
+        size_t chunk = stream->end - stream->begin;
+        chunk = chunk < size ? chunk : size;
+
+        if (out) {
+            memcpy(out, stream->buffer + stream->begin, chunk);
+            out += chunk;
+        }
+
+        stream->begin += chunk;
+        size -= chunk;
+    }
+
+    return 0;
+}
+
+int mf_stream_read_header(extract_stream_t *stream,
+                          matfile_array_t *array,
+                          size_t *header_size) {
+    if (mf_stream_fill(stream)) {
+        return 1;
+    }
+
+    const unsigned char *begin = stream->buffer + stream->begin;
+    const unsigned char *rest =
+        mf_parse_array_header(array, begin, stream->end - stream->begin,
+                              NULL, NULL);
+
+    if (!rest) {
+        return 1;
+    }
+
+    stream->begin += rest - begin;
+
+    if (header_size) {
+        *header_size = rest - begin;
+    }
+
+    return 0;
+}
+
+int mf_part_open(extract_part_t *part,
+                 extract_stream_t *stream,
+                 uint64_t numel) {
+    uint32_t tag[2], type, size;
+    size_t length;
+
+    if (mf_stream_read(stream, tag, sizeof(tag))) {
+        return 1;
+    }
+
+    const void *payload = mf_decode_tag(tag, &type, &size, &length);
+
+    if (!matfile_get_type_size(type) || type > MFDT_UINT64) {
+        fprintf(stderr, "data element as not numerical type\n");
+        return 1;
+    }
+
+    if (size != matfile_get_type_size(type) * numel) {
+        fprintf(stderr, "mismatch of data element sizes\n");
+        return 1;
+    }
+
+    part->stream = stream;
+    part->type = type;
+    part->nopacked = 0;
+    part->padding = 0;
+
+    if (payload == tag + 1) {
+        memcpy(part->packed, payload, sizeof(part->packed));
+        part->nopacked = size;
+    }
+    else {
+        part->padding = length - sizeof(tag) - size;
+    }
+
+    return 0;
+}
+
+int mf_part_read(extract_part_t *part,
+                 void *dst,
+                 matfile_data_type_t type,
+                 void *scratch,
+                 size_t n) {
+    size_t size = n * matfile_get_type_size(part->type);
+    void *src = part->type == type ? dst : scratch;
+
+    if (part->nopacked) {
+        size_t offset = sizeof(part->packed) - part->nopacked;
+
+        if (size > part->nopacked) {
+            return 1;
+        }
+
+        memcpy(src, (const char *)part->packed + offset, size);
+        part->nopacked -= size;
+    }
+    else if (mf_stream_read(part->stream, src, size)) {
+        return 1;
+    }
+
+    if (src != dst && mf_convert_numbers(dst, type, src, part->type, n, 0)) {
+        fprintf(stderr, "could not restore data type of numerical part\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int mf_part_skip(extract_part_t *part, uint64_t n) {
+    if (part->nopacked) {
+        part->nopacked = 0;
+        return 0;
+    }
+
+    uint64_t size = n * matfile_get_type_size(part->type);
+    return mf_stream_read(part->stream, NULL, size + part->padding);
+}
+
+size_t format_npy_header(const matfile_array_t *array,
+                         int row_major,
+                         char *header,
+                         size_t capacity) {
+    matfile_array_type_t type = array->flags & MF_CLASS_MASK;
+    int complex = !!(array->flags & MF_FLAG_COMPLEX);
+    size_t size = matfile_get_type_size(matfile_get_storage_type(type));
+    const uint16_t probe = 1;
+    char order = size == 1 ? '|' : *(const char *)&probe ? '<' : '>';
+    char kind;
+
+    switch (type) {
+    case MFMX_DOUBLE_CLASS:
+    case MFMX_SINGLE_CLASS:
+        kind = complex ? 'c' : 'f';
+        size *= 1 + complex;
+        break;
+    case MFMX_INT8_CLASS:
+    case MFMX_INT16_CLASS:
+    case MFMX_INT32_CLASS:
+    case MFMX_INT64_CLASS:
+        kind = 'i';
+        break;
+    default:
+        kind = array->flags & MF_FLAG_LOGICAL ? 'b' : 'u';
+        break;
+    }
+
+    if (complex && kind != 'c') {
+        fprintf(stderr, "there is no .npy data type for complex integers\n");
+        return 0;
+    }
+
+    //  Magic string and version are followed by length of header dictionary.
+    const size_t prefix = 10;
+    int length = snprintf(header + prefix, capacity - prefix,
+                          "{'descr': '%c%c%zu', 'fortran_order': %s, "
+                          "'shape': (", order, kind, size,
+                          row_major ? "False" : "True");
+
+    //  Formatting stops as soon as output is truncated, so the remaining
+    //  capacity never wraps around.
+    for (size_t i = 0; i != array->nodims && length >= 0 &&
+                       (size_t)length < capacity - prefix; ++i) {
+        length += snprintf(header + prefix + length, capacity - prefix - length,
+                           "%s%d", i ? ", " : "", array->dims[i]);
+    }
+
+    //  Tuple of single dimension needs trailing comma.
+    if (length >= 0 && (size_t)length < capacity - prefix) {
+        length += snprintf(header + prefix + length, capacity - prefix - length,
+                           "%s), }", array->nodims == 1 ? "," : "");
+    }
+
+    if (length < 0 || (size_t)length >= capacity - prefix) {
+        fprintf(stderr, "too long .npy header\n");
+        return 0;
+    }
+
+    size_t total = (prefix + length + 1 + MF_NPY_ALIGNMENT - 1)
+                 / MF_NPY_ALIGNMENT * MF_NPY_ALIGNMENT;
+
+    if (total > capacity || total - prefix > UINT16_MAX) {
+        fprintf(stderr, "too long .npy header\n");
+        return 0;
+    }
+
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (total - prefix) & 0xff;
+    header[9] = (total - prefix) >> 8;
+    memset(header + prefix + length, ' ', total - prefix - length - 1);
+    header[total - 1] = '\n';
+    return total;
+}
+
+void matfile_extract_options_init(matfile_extract_options_t *opts) {
+    opts->format = MFEXTRACT_NPY;
+    opts->row_major = 0;
+    opts->buffer_size = MF_STREAM_BUFFER;
+}
+
+int matfile_extract(const char *filename,
+                    const char *name,
+                    const char *output,
+                    const matfile_extract_options_t *opts) {
+    matfile_extract_options_t defaults;
+
+    if (!opts) {
+        matfile_extract_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    matfile_header_t header;
+
+    if (fd < 0) {
+        fprintf(stderr, "there is not such file `%s`\n", filename);
+        return 1;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        mf_validate_header(&header)) {
+        fprintf(stderr, "could not extract arrays of `%s`\n", filename);
+        close(fd);
+        return 1;
+    }
+
+    //  Prefer sidecar index to scan of data elements.
+    matfile_index_t *index = matfile_index_read(filename);
+
+    if (!index && !(index = matfile_index_scan(filename))) {
+        close(fd);
+        return 1;
+    }
+
+    const matfile_index_entry_t *entry = matfile_index_find(index, name);
+
+    if (!entry) {
+        fprintf(stderr, "there is no array `%s` in `%s`\n", name, filename);
+        matfile_index_destroy(index);
+        close(fd);
+        return 1;
+    }
+
+    //  Interleaved complex values are assembled from two streams where the
+    //  second one is ahead by real part. Row-major order needs no second
+    //  stream since values are scattered anyway.
+    size_t capacity = opts->buffer_size > MF_HEADER_PROBE
+                    ? opts->buffer_size
+                    : MF_HEADER_PROBE;
+    extract_stream_t streams[2];
+    extract_part_t parts[2];
+    matfile_array_t array;
+    uint64_t offset = entry->offset;
+    size_t header_size = 0;
+
+    memset(streams, 0, sizeof(streams));
+    memset(&array, 0, sizeof(array));
+    matfile_index_destroy(index);
+
+    if (mf_stream_open(&streams[0], fd, offset, capacity)) {
+        close(fd);
+        return 1;
+    }
+
+    int retcode = mf_stream_read_header(&streams[0], &array, &header_size);
+
+    matfile_array_type_t type = array.flags & MF_CLASS_MASK;
+    matfile_data_type_t storage = matfile_get_storage_type(type);
+    int complex = !!(array.flags & MF_FLAG_COMPLEX);
+    uint64_t numel = retcode ? 0 : matfile_array_numel(&array);
+    int interleave = complex && !opts->row_major;
+
+    if (!retcode && !(type >= MFMX_DOUBLE_CLASS && type < MFMX_COUNT)) {
+        fprintf(stderr, "array `%s` is not numerical\n", name);
+        retcode = 1;
+    }
+
+    //  Product of dims should not wrap around before payload is validated
+    //  against it.
+    uint64_t limit = UINT64_MAX / (2 * sizeof(uint64_t));
+    uint64_t product = 1;
+
+    for (size_t i = 0; i != array.nodims && !retcode; ++i) {
+        if (array.dims[i] < 0 ||
+            (array.dims[i] && product > limit / array.dims[i])) {
+            fprintf(stderr, "shape of array `%s` is too large\n", name);
+            retcode = 1;
+        }
+
+        product *= array.dims[i] > 0 ? array.dims[i] : 0;
+    }
+
+    retcode = retcode || mf_part_open(&parts[0], &streams[0], numel);
+
+    if (!retcode && interleave) {
+        //  Second stream skips array header and real part.
+        retcode = mf_stream_open(&streams[1], fd, offset, capacity)
+               || mf_stream_read(&streams[1], NULL, header_size)
+               || mf_part_open(&parts[1], &streams[1], numel)
+               || mf_part_skip(&parts[1], numel)
+               || mf_part_open(&parts[1], &streams[1], numel);
+    }
+
+    //  Header of .npy file describes shape and order of payload.
+    char npy[MF_HEADER_PROBE];
+    extract_output_t out = {NULL, NULL, 0, 0};
+
+    if (!retcode && opts->format == MFEXTRACT_NPY) {
+        out.header = format_npy_header(&array, opts->row_major, npy,
+                                       sizeof(npy));
+        retcode = !out.header;
+    }
+
+    if (!retcode && !(out.fout = fopen(output, "w+b"))) {
+        fprintf(stderr, "could not open file `%s` for writing\n", output);
+        retcode = 1;
+    }
+
+    if (!retcode && fwrite(npy, 1, out.header, out.fout) != out.header) {
+        fprintf(stderr, "could not write .npy header\n");
+        retcode = 1;
+    }
+
+    size_t elem_size = matfile_get_type_size(storage);
+    size_t slot_size = elem_size * (1 + complex);
+
+    //  Row-major values are scattered over mapped output file, so the page
+    //  cache rather than heap holds them until writeback.
+    if (!retcode && opts->row_major && numel) {
+        out.length = out.header + numel * slot_size;
+
+        if (fflush(out.fout) || ftruncate(fileno(out.fout), out.length)) {
+            fprintf(stderr, "could not allocate file `%s`\n", output);
+            retcode = 1;
+        }
+        else {
+            out.mapping = mmap(NULL, out.length, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fileno(out.fout), 0);
+
+            if (out.mapping == MAP_FAILED) {
+                fprintf(stderr, "could not map file `%s`\n", output);
+                out.mapping = NULL;
+                retcode = 1;
+            }
+        }
+    }
+
+    //  Buffers hold chunk of values of class data type, the same number of
+    //  stored values and interleaved output.
+    size_t chunk = capacity / (slot_size > 8 ? slot_size : 8);
+    unsigned char *values = malloc(2 * chunk * elem_size);
+    unsigned char *scratch = malloc(chunk * 8);
+    unsigned char *slots = interleave ? malloc(chunk * slot_size) : NULL;
+
+    if (!retcode && (!values || !scratch || (interleave && !slots))) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        retcode = 1;
+    }
+
+    if (!retcode && !opts->row_major) {
+        for (uint64_t i = 0; i < numel && !retcode; i += chunk) {
+            size_t n = numel - i < chunk ? numel - i : chunk;
+            const unsigned char *src = values;
+
+            retcode = mf_part_read(&parts[0], values, storage, scratch, n);
+
+            if (!retcode && interleave) {
+                unsigned char *imag = values + chunk * elem_size;
+                retcode = mf_part_read(&parts[1], imag, storage, scratch, n);
+
+                for (size_t j = 0; j != n && !retcode; ++j) {
+                    memcpy(slots + j * slot_size, values + j * elem_size,
+                           elem_size);
+                    memcpy(slots + j * slot_size + elem_size,
+                           imag + j * elem_size, elem_size);
+                }
+
+                src = slots;
+            }
+
+            if (!retcode && fwrite(src, slot_size, n, out.fout) != n) {
+                fprintf(stderr, "could not write to file `%s`\n", output);
+                retcode = 1;
+            }
+        }
+    }
+    else if (!retcode) {
+        //  Column-major position is tracked with per-dimension counters and
+        //  translated into row-major offset incrementally.
+        uint64_t *strides = calloc(2 * array.nodims, sizeof(uint64_t));
+        uint64_t *counters = strides + array.nodims;
+
+        if (!strides) {
+            fprintf(stderr, "could not allocate enough memory\n");
+            retcode = 1;
+        }
+
+        for (size_t i = array.nodims; i-- && !retcode;) {
+            strides[i] = i + 1 == array.nodims
+                       ? 1
+                       : strides[i + 1] * array.dims[i + 1];
+        }
+
+        for (int part = 0; part <= complex && !retcode; ++part) {
+            uint64_t position = 0;
+
+            //  Only padding of real part is left before imaginary part.
+            if (part) {
+                retcode = mf_part_skip(&parts[0], 0)
+                       || mf_part_open(&parts[0], &streams[0], numel);
+                memset(counters, 0, array.nodims * sizeof(uint64_t));
+            }
+
+            for (uint64_t i = 0; i < numel && !retcode; i += chunk) {
+                size_t n = numel - i < chunk ? numel - i : chunk;
+                retcode = mf_part_read(&parts[0], values, storage, scratch, n);
+
+                for (size_t j = 0; j != n && !retcode; ++j) {
+                    unsigned char *dst = out.mapping + out.header
+                                       + position * slot_size
+                                       + part * elem_size;
+                    memcpy(dst, values + j * elem_size, elem_size);
+
+                    position += strides[0];
+
+                    for (size_t k = 0; k + 1 < array.nodims &&
+                         ++counters[k] == (uint64_t)array.dims[k]; ++k) {
+                        counters[k] = 0;
+                        position += strides[k + 1]
+                                  - strides[k] * array.dims[k];
+                    }
+                }
+            }
+        }
+
+        free(strides);
+    }
+
+    free(slots);
+    free(scratch);
+    free(values);
+
+    if (out.mapping && munmap(out.mapping, out.length)) {
+        fprintf(stderr, "could not unmap file `%s`\n", output);
+        retcode = 1;
+    }
+
+    if (out.fout && fclose(out.fout)) {
+        fprintf(stderr, "could not close file `%s`\n", output);
+        retcode = 1;
+    }
+
+    if (retcode && out.fout) {
+        remove(output);
+    }
+
+    mf_stream_close(&streams[1]);
+    mf_stream_close(&streams[0]);
+    free(array.dims);
+    free(array.name);
+    close(fd);
+    return retcode;
+}
+
+const char *matfile_get_extract_format_string(matfile_extract_format_t format) {
+    return format < MFEXTRACT_COUNT ? extract_format_strings[format]
+                                    : "unknown";
+}
@@ -0,0 +1,535 @@
+/**
+ *  \file gen.cc
+ *  \brief Utility to generate synthetic mat-files deterministically from
+ *  specification. The same specification and seed always produce the same
+ *  bytes so corpora for benchmarks and regression tests could be generated
+ *  locally instead of being shipped.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+extern "C" {
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include <zlib.h>
+}
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ *  Specification of mat-file to generate.
+ */
+struct spec_t {
+    uint64_t seed = 0;                  ///< Seed of generator.
+    size_t novars = 8;                  ///< Number of top-level variables.
+    size_t min_numel = 1024;            ///< Minimal number of elements.
+    size_t max_numel = 1024;            ///< Maximal number of elements.
+    std::vector<matfile_array_type_t> classes = {MFMX_DOUBLE_CLASS};
+    double sparsity = 0.0;              ///< Fraction of zero elements.
+    double complex_fraction = 0.0;      ///< Fraction of complex arrays.
+    bool compress = false;              ///< Compress top-level variables.
+    bool narrow = false;                ///< Store with narrowest data type.
+    bool big_endian = false;            ///< Use big-endian byte order.
+    size_t depth = 0;                   ///< Nesting of struct and cell.
+    size_t fanout = 2;                  ///< Children of struct or cell.
+};
+
+/**
+ *  SplitMix64 generator. Unlike standard distributions it yields the same
+ *  sequence with every standard library.
+ */
+struct random_t {
+    uint64_t state;
+
+    explicit random_t(uint64_t seed) : state(seed) {
+    }
+
+    uint64_t next(void) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    //  Uniform number in range [0, 1).
+    double uniform(void) {
+        return (next() >> 11) * (1.0 / (1ull << 53));
+    }
+};
+
+static const struct {
+    const char *name;
+    matfile_array_type_t type;
+} class_names[] = {
+    {"double", MFMX_DOUBLE_CLASS},
+    {"single", MFMX_SINGLE_CLASS},
+    {"int8", MFMX_INT8_CLASS},
+    {"uint8", MFMX_UINT8_CLASS},
+    {"int16", MFMX_INT16_CLASS},
+    {"uint16", MFMX_UINT16_CLASS},
+    {"int32", MFMX_INT32_CLASS},
+    {"uint32", MFMX_UINT32_CLASS},
+    {"int64", MFMX_INT64_CLASS},
+    {"uint64", MFMX_UINT64_CLASS},
+};
+
+static const option options[] = {
+    {"seed", required_argument, NULL, 's'},
+    {"vars", required_argument, NULL, 'v'},
+    {"numel", required_argument, NULL, 'n'},
+    {"classes", required_argument, NULL, 'c'},
+    {"sparsity", required_argument, NULL, 'z'},
+    {"complex", required_argument, NULL, 'i'},
+    {"compress", no_argument, NULL, 'C'},
+    {"narrow", no_argument, NULL, 'N'},
+    {"big-endian", no_argument, NULL, 'B'},
+    {"depth", required_argument, NULL, 'd'},
+    {"fanout", required_argument, NULL, 'f'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0},
+};
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [options] <output>" << std::endl
+        << std::endl
+        << "  --seed N          seed of generator (0)" << std::endl
+        << "  --vars N          number of top-level variables (8)" << std::endl
+        << "  --numel MIN[:MAX] number of elements of numerical array"
+            << " (1024)" << std::endl
+        << "  --classes LIST    comma-separated classes of arrays (double)"
+            << std::endl
+        << "  --sparsity F      fraction of zero elements (0)" << std::endl
+        << "  --complex F       fraction of complex arrays (0)" << std::endl
+        << "  --compress        compress top-level variables" << std::endl
+        << "  --narrow          store integral values with narrowest type"
+            << std::endl
+        << "  --big-endian      write big-endian mat-file" << std::endl
+        << "  --depth N         nesting of struct and cell arrays (0)"
+            << std::endl
+        << "  --fanout N        number of children of struct or cell (2)"
+            << std::endl;
+}
+
+static bool parse_classes(const char *arg, spec_t &spec) {
+    std::string list(arg);
+    spec.classes.clear();
+
+    for (size_t pos = 0; pos <= list.size();) {
+        size_t end = list.find(',', pos);
+        std::string name = list.substr(pos, end == std::string::npos
+                                            ? std::string::npos
+                                            : end - pos);
+        bool found = false;
+
+        for (const auto &entry : class_names) {
+            if (name == entry.name) {
+                spec.classes.push_back(entry.type);
+                found = true;
+            }
+        }
+
+        if (!found) {
+            std::cerr << "error: unknown class `" << name << "`." << std::endl;
+            return false;
+        }
+
+        if (end == std::string::npos) {
+            break;
+        }
+
+        pos = end + 1;
+    }
+
+    return true;
+}
+
+static bool parse_spec(int argc, char *argv[], spec_t &spec) {
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        char *end = NULL;
+
+        switch (opt) {
+        case 's':
+            spec.seed = std::strtoull(optarg, &end, 0);
+            break;
+        case 'v':
+            spec.novars = std::strtoull(optarg, &end, 0);
+            break;
+        case 'n':
+            spec.min_numel = spec.max_numel = std::strtoull(optarg, &end, 0);
+
+            if (*end == ':') {
+                spec.max_numel = std::strtoull(end + 1, &end, 0);
+            }
+
+            break;
+        case 'c':
+            if (!parse_classes(optarg, spec)) {
+                return false;
+            }
+
+            break;
+        case 'z':
+            spec.sparsity = std::strtod(optarg, &end);
+            break;
+        case 'i':
+            spec.complex_fraction = std::strtod(optarg, &end);
+            break;
+        case 'C':
+            spec.compress = true;
+            break;
+        case 'N':
+            spec.narrow = true;
+            break;
+        case 'B':
+            spec.big_endian = true;
+            break;
+        case 'd':
+            spec.depth = std::strtoull(optarg, &end, 0);
+            break;
+        case 'f':
+            spec.fanout = std::strtoull(optarg, &end, 0);
+            break;
+        default:
+            return false;
+        }
+
+        if (end && *end) {
+            std::cerr << "error: wrong value `" << optarg << "`." << std::endl;
+            return false;
+        }
+    }
+
+    if (!spec.min_numel || spec.min_numel > spec.max_numel ||
+        spec.max_numel > INT32_MAX) {
+        std::cerr << "error: wrong range of number of elements." << std::endl;
+        return false;
+    }
+
+    if (!spec.fanout) {
+        std::cerr << "error: fanout should be positive." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ *  Append data element in large format to buffer.
+ */
+static void push_element(std::vector<char> &buffer,
+                         uint32_t type,
+                         const void *data,
+                         size_t size) {
+    uint32_t tag[2] = {type, static_cast<uint32_t>(size)};
+    size_t padding = (MF_ALIGNMENT - size % MF_ALIGNMENT) % MF_ALIGNMENT;
+    const char *bytes = static_cast<const char *>(data);
+
+    buffer.insert(buffer.end(), reinterpret_cast<char *>(tag),
+                  reinterpret_cast<char *>(tag + 2));
+    buffer.insert(buffer.end(), bytes, bytes + size);
+    buffer.insert(buffer.end(), padding, 0);
+}
+
+/**
+ *  Serialize numerical array into miMATRIX data element with the library so
+ *  that its layout is exactly the one of writer.
+ */
+static bool make_leaf(const spec_t &spec,
+                      random_t &random,
+                      const char *name,
+                      std::vector<char> &buffer) {
+    matfile_array_type_t type = spec.classes[random.next()
+                                             % spec.classes.size()];
+    double log_min = std::log(static_cast<double>(spec.min_numel));
+    double log_max = std::log(static_cast<double>(spec.max_numel));
+    size_t numel = std::llround(
+        std::exp(log_min + (log_max - log_min) * random.uniform()));
+    int complex = random.uniform() < spec.complex_fraction;
+
+    numel = std::max(spec.min_numel, std::min(spec.max_numel, numel));
+
+    //  Arrays are matrices with bounded number of rows.
+    int32_t rows = numel < 1000 ? numel : 1000;
+    int32_t dims[] = {rows, static_cast<int32_t>((numel + rows - 1) / rows)};
+    matfile_array_t *array = matfile_array_create(name, type, 2, dims,
+                                                  complex);
+
+    if (!array) {
+        return false;
+    }
+
+    matfile_data_type_t storage = matfile_get_storage_type(type);
+    size_t type_size = matfile_get_type_size(storage);
+    bool integral = spec.narrow || (storage != MFDT_DOUBLE &&
+                                    storage != MFDT_SINGLE);
+    numel = matfile_array_numel(array);
+
+    //  Values vary slowly with noise in low bits and fit every class.
+    for (int part = 0; part <= complex; ++part) {
+        char *data = static_cast<char *>(part ? array->pi.data
+                                              : array->pr.data);
+
+        for (size_t i = 0; i != numel; ++i) {
+            double value = (i / 64) % 100 + random.next() % 8;
+
+            if (!integral) {
+                value += random.uniform();
+            }
+
+            if (random.uniform() < spec.sparsity) {
+                value = 0;
+            }
+
+            char *ptr = data + i * type_size;
+
+            switch (storage) {
+            case MFDT_DOUBLE: *(double *)ptr = value; break;
+            case MFDT_SINGLE: *(float *)ptr = value; break;
+            case MFDT_INT8: *(int8_t *)ptr = value; break;
+            case MFDT_UINT8: *(uint8_t *)ptr = value; break;
+            case MFDT_INT16: *(int16_t *)ptr = value; break;
+            case MFDT_UINT16: *(uint16_t *)ptr = value; break;
+            case MFDT_INT32: *(int32_t *)ptr = value; break;
+            case MFDT_UINT32: *(uint32_t *)ptr = value; break;
+            case MFDT_INT64: *(int64_t *)ptr = value; break;
+            case MFDT_UINT64: *(uint64_t *)ptr = value; break;
+            default: break;
+            }
+        }
+    }
+
+    matfile_t *mat = matfile_create();
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+    opts.narrow = spec.narrow;
+
+    tape_t *tape = tape_create(numel * type_size * (1 + complex) + 256);
+    bool ok = mat && tape && !matfile_add_array(mat, array);
+
+    if (!ok) {
+        matfile_array_destroy(array);
+    }
+
+    ok = ok && !matfile_write_memory(mat, tape, &opts);
+
+    if (ok) {
+        const char *data = static_cast<const char *>(tape_deref(tape));
+        buffer.insert(buffer.end(), data + sizeof(matfile_header_t),
+                      data + tape_length(tape));
+    }
+
+    tape_destroy(tape);
+    matfile_destroy(mat);
+    return ok;
+}
+
+/**
+ *  Serialize struct or cell array which children are nested deeper. Levels
+ *  alternate between 1xN cells and 1x1 structs so that numerical arrays are
+ *  always fields of struct.
+ */
+static bool make_node(const spec_t &spec,
+                      random_t &random,
+                      const char *name,
+                      size_t depth,
+                      std::vector<char> &buffer) {
+    if (!depth) {
+        return make_leaf(spec, random, name, buffer);
+    }
+
+    bool is_struct = depth % 2 == 1;
+    uint32_t flags[2] = {is_struct ? MFMX_STRUCT_CLASS : MFMX_CELL_CLASS, 0};
+    int32_t dims[2] = {1, is_struct ? 1 : static_cast<int32_t>(spec.fanout)};
+    std::vector<char> payload;
+
+    push_element(payload, MFDT_UINT32, flags, sizeof(flags));
+    push_element(payload, MFDT_INT32, dims, sizeof(dims));
+    push_element(payload, MFDT_INT8, name, std::strlen(name));
+
+    if (is_struct) {
+        //  Field names are null-terminated and padded to the same length.
+        const int32_t length = 32;
+        std::vector<char> names(spec.fanout * length, 0);
+
+        for (size_t i = 0; i != spec.fanout; ++i) {
+            std::snprintf(&names[i * length], length, "f%zu", i);
+        }
+
+        push_element(payload, MFDT_INT32, &length, sizeof(length));
+        push_element(payload, MFDT_INT8, names.data(), names.size());
+    }
+
+    //  Children of struct and cell do not have names.
+    for (size_t i = 0; i != spec.fanout; ++i) {
+        if (!make_node(spec, random, "", depth - 1, payload)) {
+            return false;
+        }
+    }
+
+    push_element(buffer, MFDT_MATRIX, payload.data(), payload.size());
+    return true;
+}
+
+static uint32_t swap32(uint32_t value) {
+    return __builtin_bswap32(value);
+}
+
+/**
+ *  Reverse byte order of data elements in buffer recursively. Numbers are
+ *  swapped according to size of their data type.
+ */
+static void swap_elements(char *data, size_t size) {
+    const size_t tag_size = sizeof(matfile_data_element_small_t);
+
+    for (size_t offset = 0; offset + tag_size <= size;) {
+        uint32_t *tag = reinterpret_cast<uint32_t *>(data + offset);
+        bool small = tag[0] >> 16;
+        uint32_t type = small ? tag[0] & 0xffff : tag[0];
+        uint32_t length = small ? tag[0] >> 16 : tag[1];
+        char *payload = data + offset + (small ? 4 : tag_size);
+        size_t type_size = type < MFDT_MATRIX
+                         ? matfile_get_type_size((matfile_data_type_t)type)
+                         : 0;
+
+        if (type == MFDT_MATRIX) {
+            swap_elements(payload, length);
+        }
+        else if (type == MFDT_UTF16) {
+            type_size = 2;
+        }
+        else if (type == MFDT_UTF32) {
+            type_size = 4;
+        }
+
+        for (size_t i = 0; type_size > 1 && i + type_size <= length;
+             i += type_size) {
+            std::reverse(payload + i, payload + i + type_size);
+        }
+
+        tag[0] = swap32(tag[0]);
+
+        if (!small) {
+            tag[1] = swap32(tag[1]);
+        }
+
+        offset += small ? tag_size : tag_size + length
+                + (MF_ALIGNMENT - length % MF_ALIGNMENT) % MF_ALIGNMENT;
+    }
+}
+
+/**
+ *  Write header of mat-file. Header does not contain creation time so output
+ *  depends on specification only.
+ */
+static bool write_header(FILE *fout, const spec_t &spec) {
+    matfile_header_t header;
+    std::memset(&header, ' ', sizeof(header.description));
+    header.subsys_data_offset = 0;
+
+    const char description[] = "MATLAB 5.0 MAT-file, Platform: GLNXA64, "
+                               "Created by: matfile-gen";
+    std::memcpy(header.description, description, sizeof(description) - 1);
+
+    header.version = 0x0100;
+    header.endianness = ('M' << 8) | 'I';
+
+    if (spec.big_endian) {
+        header.version = __builtin_bswap16(header.version);
+        header.endianness = __builtin_bswap16(header.endianness);
+    }
+
+    return std::fwrite(&header, sizeof(header), 1, fout) == 1;
+}
+
+/**
+ *  Deflate data element into miCOMPRESSED one.
+ */
+static bool compress_element(const spec_t &spec, std::vector<char> &buffer) {
+    uLongf size = compressBound(buffer.size());
+    std::vector<char> compressed(sizeof(matfile_data_element_small_t) + size);
+
+    if (compress2(reinterpret_cast<Bytef *>(&compressed[8]), &size,
+                  reinterpret_cast<const Bytef *>(buffer.data()),
+                  buffer.size(), 6) != Z_OK) {
+        return false;
+    }
+
+    uint32_t *tag = reinterpret_cast<uint32_t *>(compressed.data());
+    tag[0] = MFDT_COMPRESSED;
+    tag[1] = size;
+
+    if (spec.big_endian) {
+        tag[0] = swap32(tag[0]);
+        tag[1] = swap32(tag[1]);
+    }
+
+    //  Compressed data element is not padded.
+    compressed.resize(sizeof(matfile_data_element_small_t) + size);
+    buffer.swap(compressed);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    spec_t spec;
+
+    if (!parse_spec(argc, argv, spec) || optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *fout = std::fopen(argv[optind], "wb");
+
+    if (!fout) {
+        std::cerr << "error: could not open `" << argv[optind] << "`."
+                  << std::endl;
+        return 1;
+    }
+
+    bool ok = write_header(fout, spec);
+    std::vector<char> buffer;
+
+    //  Every variable has its own generator so variables do not depend on
+    //  each other and corpora of different size share prefix.
+    for (size_t i = 0; i != spec.novars && ok; ++i) {
+        random_t random(spec.seed * 0x100000001b3ull + i);
+        char name[32];
+        std::snprintf(name, sizeof(name), "var%04zu", i);
+
+        buffer.clear();
+        ok = make_node(spec, random, name, spec.depth, buffer);
+
+        if (ok && spec.big_endian) {
+            swap_elements(buffer.data(), buffer.size());
+        }
+
+        if (ok && spec.compress) {
+            ok = compress_element(spec, buffer);
+        }
+
+        ok = ok && std::fwrite(buffer.data(), 1, buffer.size(), fout)
+                        == buffer.size();
+    }
+
+    if (std::fclose(fout) || !ok) {
+        std::cerr << "error: could not generate `" << argv[optind] << "`."
+                  << std::endl;
+        std::remove(argv[optind]);
+        return 1;
+    }
+
+    return 0;
+}
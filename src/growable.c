@@ -0,0 +1,306 @@
+/**
+ *  \file growable.c
+ *  \brief The file contains routines which grow the last array of mat-file
+ *  by columns in place.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct _matfile_growable_t {
+    int         fd;             ///<File descriptor of mat-file.
+    uint64_t    offset;         ///<Offset of miMATRIX tag.
+    uint64_t    part_offset;    ///<Offset of tag of real part.
+    uint32_t    part_size;      ///<Size of real part in bytes.
+    int32_t     rows;           ///<Number of rows.
+    int32_t     cols;           ///<Number of columns.
+    size_t      column_size;    ///<Size of column in bytes.
+} matfile_growable_t;
+
+/**
+ *  Write zero padding after real part and patch sizes and dims of array so
+ *  that array covers bytes which are already written.
+ *
+ *  \param[in] growable Growable array.
+ *  \param[in] size     New size of real part in bytes.
+ *  \param[in] cols     New number of columns.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int patch_growable(matfile_growable_t *growable, uint32_t size, int32_t cols);
+
+int mf_locate_real_part(int fd,
+                        uint64_t offset,
+                        uint64_t size,
+                        matfile_array_t *array,
+                        uint64_t *part_offset) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    unsigned char header[MF_HEADER_PROBE];
+    size_t length = size - tag_size < sizeof(header)
+                  ? size - tag_size
+                  : sizeof(header);
+    uint32_t tag[2];
+
+    if (pread(fd, tag, tag_size, offset) != tag_size) {
+        fprintf(stderr, "could not read tag of data element\n");
+        return 1;
+    }
+
+    if (tag[0] != MFDT_MATRIX) {
+        fprintf(stderr, "array is compressed or it is not array at all\n");
+        return 1;
+    }
+
+    if (pread(fd, header, length, offset + tag_size) != length) {
+        fprintf(stderr, "could not read array header\n");
+        return 1;
+    }
+
+    const unsigned char *rest = mf_parse_array_header(array, header, length,
+                                                      NULL, NULL);
+
+    if (!rest) {
+        return 1;
+    }
+
+    matfile_array_type_t type = array->flags & MF_CLASS_MASK;
+    matfile_data_type_t storage_type = matfile_get_storage_type(type);
+    uint32_t part_type, part_size;
+    size_t part_length;
+
+    if (type < MFMX_DOUBLE_CLASS || type >= MFMX_COUNT) {
+        fprintf(stderr, "array `%s` is not numerical\n", array->name);
+        goto fail;
+    }
+
+    if (rest + tag_size > header + length) {
+        fprintf(stderr, "too short subelement for matrix: real part\n");
+        goto fail;
+    }
+
+    const void *part = mf_decode_tag(rest, &part_type, &part_size,
+                                     &part_length);
+
+    //  Small data element format could not grow in place as well as numbers
+    //  which are narrowed to shorter data type on write.
+    if ((const unsigned char *)part != rest + tag_size ||
+        part_type != storage_type) {
+        fprintf(stderr, "real part of array `%s` is not stored as %s\n",
+            array->name, matfile_get_type_string(storage_type));
+        goto fail;
+    }
+
+    if (part_size != matfile_array_numel(array)
+                   * matfile_get_type_size(storage_type)) {
+        fprintf(stderr, "wrong size of real part of array `%s`\n",
+            array->name);
+        goto fail;
+    }
+
+    *part_offset = offset + tag_size + (rest - header);
+    return 0;
+
+fail:
+    free(array->dims);
+    free(array->name);
+    return 1;
+}
+
+int patch_growable(matfile_growable_t *growable, uint32_t size, int32_t cols) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint64_t data_offset = growable->part_offset + tag_size;
+    size_t padding = (MF_ALIGNMENT - size % MF_ALIGNMENT) % MF_ALIGNMENT;
+    uint64_t zeros = 0;
+    uint32_t matrix_size = data_offset + size + padding
+                         - growable->offset - tag_size;
+
+    //  Header fields are patched after columns are written so array never
+    //  references bytes which are not written yet. Dims are placed right
+    //  after array flags subelement.
+    if (pwrite(growable->fd, &zeros, padding, data_offset + size) != padding ||
+        pwrite(growable->fd, &size, sizeof(size),
+               growable->part_offset + 4) != sizeof(size) ||
+        pwrite(growable->fd, &cols, sizeof(cols),
+               growable->offset + 3 * tag_size + 8 + 4) != sizeof(cols) ||
+        pwrite(growable->fd, &matrix_size, sizeof(matrix_size),
+               growable->offset + 4) != sizeof(matrix_size)) {
+        fprintf(stderr, "could not patch array header\n");
+        return 1;
+    }
+
+    growable->part_size = size;
+    growable->cols = cols;
+    return 0;
+}
+
+matfile_growable_t *matfile_growable_create(const char *filename,
+                                            const matfile_array_t *array) {
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+    opts.narrow = 0;
+
+    if (matfile_append(filename, array, &opts)) {
+        return NULL;
+    }
+
+    return matfile_growable_open(filename, array->name);
+}
+
+matfile_growable_t *matfile_growable_open(const char *filename,
+                                          const char *name) {
+    matfile_index_t *index = matfile_index_scan(filename);
+
+    if (!index) {
+        return NULL;
+    }
+
+    const matfile_index_entry_t *entry = index->noentries
+                                       ? &index->entries[index->noentries - 1]
+                                       : NULL;
+
+    if (!entry || strcmp(entry->name, name)) {
+        fprintf(stderr, "array `%s` is not the last one in `%s`\n",
+            name, filename);
+        matfile_index_destroy(index);
+        return NULL;
+    }
+
+    matfile_growable_t *growable = calloc(1, sizeof(matfile_growable_t));
+
+    if (!growable) {
+        fprintf(stderr, "could not allocate memory for growable array\n");
+        matfile_index_destroy(index);
+        return NULL;
+    }
+
+    growable->offset = entry->offset;
+
+    if ((growable->fd = open(filename, O_RDWR)) < 0) {
+        fprintf(stderr, "could not open file `%s` for writing\n", filename);
+        matfile_index_destroy(index);
+        free(growable);
+        return NULL;
+    }
+
+    matfile_array_t array;
+    int retcode = mf_locate_real_part(growable->fd, entry->offset, entry->size,
+                                      &array, &growable->part_offset);
+
+    if (retcode) {
+        matfile_index_destroy(index);
+        matfile_growable_close(growable);
+        return NULL;
+    }
+
+    matfile_array_type_t type = array.flags & MF_CLASS_MASK;
+    size_t type_size = matfile_get_type_size(matfile_get_storage_type(type));
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint64_t part_size = matfile_array_numel(&array) * type_size;
+    uint64_t padding = (MF_ALIGNMENT - part_size % MF_ALIGNMENT)
+                     % MF_ALIGNMENT;
+
+    if (array.nodims != 2 || array.flags & MF_FLAG_COMPLEX ||
+        growable->part_offset + tag_size + part_size + padding
+            != entry->offset + entry->size) {
+        fprintf(stderr, "array `%s` is not real matrix\n", name);
+        retcode = 1;
+    }
+    else {
+        growable->rows = array.dims[0];
+        growable->cols = array.dims[1];
+        growable->column_size = growable->rows * type_size;
+        growable->part_size = growable->cols * growable->column_size;
+    }
+
+    free(array.dims);
+    free(array.name);
+    matfile_index_destroy(index);
+
+    if (retcode) {
+        matfile_growable_close(growable);
+        return NULL;
+    }
+
+    //  Sidecar index goes stale as soon as array grows.
+    char *sidecar = mf_index_filename(filename);
+
+    if (sidecar) {
+        remove(sidecar);
+        free(sidecar);
+    }
+
+    return growable;
+}
+
+int matfile_growable_append(matfile_growable_t *growable,
+                            const void *columns,
+                            size_t nocols) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint64_t size = nocols * growable->column_size;
+    uint64_t part_size = growable->part_size + size;
+    uint64_t matrix_size = growable->part_offset + tag_size + part_size
+                         + MF_ALIGNMENT - growable->offset;
+
+    if (matrix_size > UINT32_MAX || growable->cols + nocols > INT32_MAX) {
+        fprintf(stderr, "array could not grow beyond format limits\n");
+        return 1;
+    }
+
+    //  Columns are contiguous in column-major order so new ones are written
+    //  over padding of real part.
+    uint64_t offset = growable->part_offset + tag_size + growable->part_size;
+    const char *data = columns;
+
+    while (size) {
+        ssize_t written = pwrite(growable->fd, data, size, offset);
+
+        if (written < 0) {
+            fprintf(stderr, "could not write columns\n");
+            return 1;
+        }
+
+        data += written;
+        offset += written;
+        size -= written;
+    }
+
+    return patch_growable(growable, part_size, growable->cols + nocols);
+}
+
+int matfile_growable_flush(matfile_growable_t *growable) {
+    if (fdatasync(growable->fd)) {
+        fprintf(stderr, "could not flush growable array\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int matfile_growable_close(matfile_growable_t *growable) {
+    int retcode = 0;
+
+    if (!growable) {
+        return 0;
+    }
+
+    if (growable->fd >= 0 && close(growable->fd)) {
+        fprintf(stderr, "could not close growable array\n");
+        retcode = 1;
+    }
+
+    free(growable);
+    return retcode;
+}
@@ -0,0 +1,590 @@
+/**
+ *  \file index.c
+ *  \brief The file contains content hashing of arrays and sidecar index
+ *  routines.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define PRIME64_1   0x9e3779b185ebca87ull
+#define PRIME64_2   0xc2b2ae3d27d4eb4full
+#define PRIME64_3   0x165667b19e3779f9ull
+#define PRIME64_4   0x85ebca77c2b2ae63ull
+#define PRIME64_5   0x27d4eb2f165667c5ull
+
+#define MF_INFLATE_PROBE    65536u  ///<Maximal compressed size of header.
+
+static const char index_magic[8] = {'M', 'F', 'I', 'D', 'X', '0', '0', '1'};
+
+/**
+ *  Get modification time of file in nanoseconds.
+ *
+ *  \param[in] st Status of file.
+ *  \return Modification time.
+ */
+static inline uint64_t mtime_ns(const struct stat *st) {
+    return (uint64_t)st->st_mtim.tv_sec * 1000000000u + st->st_mtim.tv_nsec;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t value) {
+    acc ^= xxh64_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t mf_hash_bytes(const void *data, size_t size, uint64_t seed) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + size;
+    uint64_t h64;
+
+    if (size >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+
+        do {
+            v1 = xxh64_round(v1, read64(p +  0));
+            v2 = xxh64_round(v2, read64(p +  8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h64 = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h64 = xxh64_merge(h64, v1);
+        h64 = xxh64_merge(h64, v2);
+        h64 = xxh64_merge(h64, v3);
+        h64 = xxh64_merge(h64, v4);
+    }
+    else {
+        h64 = seed + PRIME64_5;
+    }
+
+    h64 += size;
+
+    for (; p + 8 <= end; p += 8) {
+        h64 ^= xxh64_round(0, read64(p));
+        h64 = rotl64(h64, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (p + 4 <= end) {
+        h64 ^= (uint64_t)read32(p) * PRIME64_1;
+        h64 = rotl64(h64, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+
+    for (; p < end; ++p) {
+        h64 ^= (*p) * PRIME64_5;
+        h64 = rotl64(h64, 11) * PRIME64_1;
+    }
+
+    h64 ^= h64 >> 33;
+    h64 *= PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= PRIME64_3;
+    h64 ^= h64 >> 32;
+
+    return h64;
+}
+
+int mf_index_append(matfile_index_t *index,
+                    const char *name,
+                    uint64_t offset,
+                    uint64_t size,
+                    uint64_t hash) {
+    size_t length = (index->noentries + 1) * sizeof(matfile_index_entry_t);
+    matfile_index_entry_t *entries = realloc(index->entries, length);
+
+    if (!entries) {
+        fprintf(stderr, "could not reallocate memory for index\n");
+        return 1;
+    }
+
+    index->entries = entries;
+
+    matfile_index_entry_t *entry = &entries[index->noentries];
+    entry->name = malloc(strlen(name) + 1);
+
+    if (!entry->name) {
+        fprintf(stderr, "could not allocate memory for index entry\n");
+        return 1;
+    }
+
+    strcpy(entry->name, name);
+    entry->offset = offset;
+    entry->size = size;
+    entry->hash = hash;
+    entry->blocks = NULL;
+    entry->noblocks = 0;
+
+    index->noentries += 1;
+    return 0;
+}
+
+int mf_index_set_blocks(matfile_index_entry_t *entry,
+                        const matfile_index_block_t *blocks,
+                        size_t noblocks) {
+    size_t size = (noblocks + 1) * sizeof(matfile_index_block_t);
+    matfile_index_block_t *copy = malloc(size);
+
+    if (!copy) {
+        fprintf(stderr, "could not allocate memory for index blocks\n");
+        return 1;
+    }
+
+    memcpy(copy, blocks, size);
+    free(entry->blocks);
+    entry->blocks = copy;
+    entry->noblocks = noblocks;
+    return 0;
+}
+
+char *mf_index_filename(const char *filename) {
+    size_t length = strlen(filename);
+    char *sidecar = malloc(length + sizeof(MF_INDEX_SUFFIX));
+
+    if (!sidecar) {
+        fprintf(stderr, "could not allocate memory for filename\n");
+        return NULL;
+    }
+
+    memcpy(sidecar, filename, length);
+    memcpy(sidecar + length, MF_INDEX_SUFFIX, sizeof(MF_INDEX_SUFFIX));
+    return sidecar;
+}
+
+int mf_scan_array_header(int fd,
+                         uint64_t offset,
+                         uint32_t type,
+                         uint32_t size,
+                         matfile_array_t *array,
+                         uint64_t *payload) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    unsigned char header[MF_HEADER_PROBE];
+    size_t length = 0;
+
+    if (payload) {
+        *payload = size;
+    }
+
+    if (type == MFDT_MATRIX) {
+        length = size < sizeof(header) ? size : sizeof(header);
+
+        if (pread(fd, header, length, offset + tag_size) != length) {
+            fprintf(stderr, "could not read array header\n");
+            return 1;
+        }
+    }
+    else if (type == MFDT_COMPRESSED) {
+        //  Inflate only the beginning of compressed stream which contains tag
+        //  of miMATRIX and array header.
+        size_t probe = size < MF_INFLATE_PROBE ? size : MF_INFLATE_PROBE;
+        unsigned char *compressed = malloc(probe);
+
+        if (!compressed) {
+            fprintf(stderr, "could not allocate enough memory\n");
+            return 1;
+        }
+
+        if (pread(fd, compressed, probe, offset + tag_size) != probe) {
+            fprintf(stderr, "could not read compressed array header\n");
+            free(compressed);
+            return 1;
+        }
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        stream.next_in = compressed;
+        stream.avail_in = probe;
+        stream.next_out = header;
+        stream.avail_out = sizeof(header);
+
+        int code = inflateInit(&stream);
+
+        if (code == Z_OK) {
+            code = inflate(&stream, Z_SYNC_FLUSH);
+        }
+
+        length = sizeof(header) - stream.avail_out;
+        inflateEnd(&stream);
+        free(compressed);
+
+        if (code < Z_OK && code != Z_BUF_ERROR) {
+            fprintf(stderr, "inflate failed with error code %d\n", code);
+            return 1;
+        }
+
+        const uint32_t *subtag = (const uint32_t *)header;
+
+        if (length < tag_size || subtag[0] != MFDT_MATRIX) {
+            return 1;
+        }
+
+        if (payload) {
+            *payload = subtag[1];
+        }
+
+        memmove(header, header + tag_size, length - tag_size);
+        length -= tag_size;
+    }
+    else {
+        return 1;
+    }
+
+    if (!mf_parse_array_header(array, header, length, NULL, NULL)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+uint64_t matfile_array_hash(const matfile_array_t *array) {
+    matfile_array_type_t type = array->flags & MF_CLASS_MASK;
+    size_t size = matfile_array_numel(array)
+                * matfile_get_type_size(matfile_get_storage_type(type));
+    uint64_t flags = (array->flags & 0xffffffffu) & ~MF_FLAG_COMPLEX;
+    uint64_t hash = 0;
+
+    hash = mf_hash_bytes(array->name, strlen(array->name), hash);
+    hash = mf_hash_bytes(&flags, sizeof(flags), hash);
+    hash = mf_hash_bytes(array->dims, array->nodims * sizeof(int32_t), hash);
+    hash = mf_hash_bytes(array->pr.data, size, hash);
+
+    if (array->pi.data) {
+        hash = mf_hash_bytes(array->pi.data, size, hash);
+    }
+
+    return hash;
+}
+
+matfile_index_t *matfile_index_create(void) {
+    matfile_index_t *index = calloc(1, sizeof(matfile_index_t));
+
+    if (!index) {
+        fprintf(stderr, "could not allocate memory for index\n");
+        return NULL;
+    }
+
+    return index;
+}
+
+void matfile_index_destroy(matfile_index_t *index) {
+    if (!index) {
+        return;
+    }
+
+    for (size_t i = 0; i != index->noentries; ++i) {
+        SAFE_RELEASE(index->entries[i].name)
+        SAFE_RELEASE(index->entries[i].blocks)
+    }
+
+    SAFE_RELEASE(index->entries)
+    SAFE_RELEASE(index)
+}
+
+const matfile_index_entry_t *matfile_index_find(const matfile_index_t *index,
+                                                const char *name) {
+    //  The last entry wins since arrays are loaded in file order.
+    for (size_t i = index->noentries; i != 0; --i) {
+        if (!strcmp(index->entries[i - 1].name, name)) {
+            return &index->entries[i - 1];
+        }
+    }
+
+    return NULL;
+}
+
+matfile_index_t *matfile_index_read(const char *filename) {
+    struct stat st;
+
+    if (stat(filename, &st)) {
+        return NULL;
+    }
+
+    char *sidecar = mf_index_filename(filename);
+
+    if (!sidecar) {
+        return NULL;
+    }
+
+    FILE *fin = fopen(sidecar, "rb");
+    free(sidecar);
+
+    if (!fin) {
+        return NULL;
+    }
+
+    //  Header of sidecar consists of magic, size of mat-file, number of
+    //  entries, modification time and inode of mat-file.
+    char magic[8];
+    uint64_t header[4];
+
+    if (fread(magic, 1, sizeof(magic), fin) != sizeof(magic) ||
+        memcmp(magic, index_magic, sizeof(magic)) ||
+        fread(header, 1, sizeof(header), fin) != sizeof(header)) {
+        fprintf(stderr, "sidecar index of `%s` is corrupted\n", filename);
+        fclose(fin);
+        return NULL;
+    }
+
+    //  Sidecar is stale if mat-file was changed or replaced without it.
+    if (header[0] != (uint64_t)st.st_size || header[2] != mtime_ns(&st) ||
+        header[3] != (uint64_t)st.st_ino) {
+        fclose(fin);
+        return NULL;
+    }
+
+    matfile_index_t *index = matfile_index_create();
+
+    if (!index) {
+        fclose(fin);
+        return NULL;
+    }
+
+    index->file_size = header[0];
+
+    for (uint64_t i = 0; i != header[1]; ++i) {
+        //  Every entry is offset, size, hash, length of name and number of
+        //  blocks which are followed by name padded to 64-bit boundary and
+        //  block boundaries.
+        uint64_t fields[5];
+        char name[256];
+
+        if (fread(fields, 1, sizeof(fields), fin) != sizeof(fields) ||
+            fields[3] >= sizeof(name)) {
+            fprintf(stderr, "sidecar index of `%s` is corrupted\n", filename);
+            matfile_index_destroy(index);
+            fclose(fin);
+            return NULL;
+        }
+
+        size_t length = fields[3];
+        size_t padding = (MF_ALIGNMENT - length % MF_ALIGNMENT) % MF_ALIGNMENT;
+
+        if (fread(name, 1, length + padding, fin) != length + padding) {
+            fprintf(stderr, "sidecar index of `%s` is corrupted\n", filename);
+            matfile_index_destroy(index);
+            fclose(fin);
+            return NULL;
+        }
+
+        name[length] = '\0';
+
+        if (mf_index_append(index, name, fields[0], fields[1], fields[2])) {
+            matfile_index_destroy(index);
+            fclose(fin);
+            return NULL;
+        }
+
+        if (!fields[4]) {
+            continue;
+        }
+
+        matfile_index_entry_t *entry = &index->entries[index->noentries - 1];
+        entry->noblocks = fields[4];
+        entry->blocks = calloc(fields[4] + 1, sizeof(matfile_index_block_t));
+
+        if (!entry->blocks ||
+            fread(entry->blocks, sizeof(matfile_index_block_t), fields[4] + 1,
+                  fin) != fields[4] + 1) {
+            fprintf(stderr, "sidecar index of `%s` is corrupted\n", filename);
+            matfile_index_destroy(index);
+            fclose(fin);
+            return NULL;
+        }
+    }
+
+    fclose(fin);
+    return index;
+}
+
+int matfile_index_write(const char *filename, const matfile_index_t *index) {
+    //  Sidecar identifies the mat-file as it is now, so the mat-file should
+    //  not be modified afterwards.
+    struct stat st;
+
+    if (stat(filename, &st)) {
+        fprintf(stderr, "there is not such file `%s`\n", filename);
+        return 1;
+    }
+
+    char *sidecar = mf_index_filename(filename);
+
+    if (!sidecar) {
+        return 1;
+    }
+
+    FILE *fout = fopen(sidecar, "wb");
+
+    if (!fout) {
+        fprintf(stderr, "could not open file `%s` for writing\n", sidecar);
+        free(sidecar);
+        return 1;
+    }
+
+    uint64_t header[4] = {index->file_size, index->noentries, mtime_ns(&st),
+                          st.st_ino};
+    int retcode = 0;
+
+    retcode |= fwrite(index_magic, 1, sizeof(index_magic), fout)
+            != sizeof(index_magic);
+    retcode |= fwrite(header, 1, sizeof(header), fout) != sizeof(header);
+
+    for (size_t i = 0; i != index->noentries && !retcode; ++i) {
+        const matfile_index_entry_t *entry = &index->entries[i];
+        size_t length = strlen(entry->name);
+        size_t padding = (MF_ALIGNMENT - length % MF_ALIGNMENT) % MF_ALIGNMENT;
+        uint64_t fields[5] = {entry->offset, entry->size, entry->hash, length,
+                              entry->noblocks};
+        uint64_t zeros = 0;
+
+        retcode |= fwrite(fields, 1, sizeof(fields), fout) != sizeof(fields);
+        retcode |= fwrite(entry->name, 1, length, fout) != length;
+        retcode |= fwrite(&zeros, 1, padding, fout) != padding;
+
+        if (entry->noblocks) {
+            size_t noblocks = entry->noblocks + 1;
+            retcode |= fwrite(entry->blocks, sizeof(matfile_index_block_t),
+                              noblocks, fout) != noblocks;
+        }
+    }
+
+    if (fclose(fout) || retcode) {
+        fprintf(stderr, "could not write sidecar index `%s`\n", sidecar);
+        remove(sidecar);
+        free(sidecar);
+        return 1;
+    }
+
+    free(sidecar);
+    return 0;
+}
+
+matfile_index_t *matfile_index_scan(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "there is not such file `%s`\n", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    matfile_header_t header;
+
+    if (fstat(fd, &st) ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        fprintf(stderr, "could not read header of `%s`\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    if (header.endianness != (('M' << 8) | 'I')) {
+        fprintf(stderr, "mat-file has foreign byte order or wrong header\n");
+        close(fd);
+        return NULL;
+    }
+
+    matfile_index_t *index = matfile_index_create();
+
+    if (!index) {
+        close(fd);
+        return NULL;
+    }
+
+    index->file_size = st.st_size;
+
+    //  Walk over tags of top-level data elements.
+    uint64_t offset = sizeof(matfile_header_t);
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+
+    while (offset + tag_size <= index->file_size) {
+        uint32_t tag[2];
+
+        if (pread(fd, tag, sizeof(tag), offset) != sizeof(tag)) {
+            fprintf(stderr, "could not read tag of data element\n");
+            matfile_index_destroy(index);
+            close(fd);
+            return NULL;
+        }
+
+        uint32_t type, size;
+        size_t length;
+        mf_decode_tag(tag, &type, &size, &length);
+
+        //  All data that is uncompressed must be aligned on 64-bit boundaries
+        //  except for miCOMPRESSED.
+        if (type == MFDT_COMPRESSED) {
+            length = tag_size + size;
+        }
+
+        if (offset + length > index->file_size) {
+            fprintf(stderr, "data element exceeds mat-file `%s`\n", filename);
+            matfile_index_destroy(index);
+            close(fd);
+            return NULL;
+        }
+
+        //  Arrays are indexed by name and other data elements are kept with
+        //  empty name.
+        matfile_array_t array;
+        int named = (type == MFDT_MATRIX || type == MFDT_COMPRESSED)
+                 && !mf_scan_array_header(fd, offset, type, size, &array,
+                                             NULL);
+        int retcode = mf_index_append(index, named ? array.name : "", offset,
+                                      length, 0);
+
+        if (named) {
+            free(array.dims);
+            free(array.name);
+        }
+
+        if (retcode) {
+            matfile_index_destroy(index);
+            close(fd);
+            return NULL;
+        }
+
+        offset += length;
+    }
+
+    close(fd);
+    return index;
+}
@@ -0,0 +1,256 @@
+/**
+ *  \file inflate.c
+ *  \brief The file contains parallel inflate of compressed data elements
+ *  which consist of independently decodable blocks.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/**
+ *  Shared state of workers which inflate blocks of single data element.
+ */
+typedef struct _inflate_job_t {
+    const unsigned char         *input;     ///<Compressed stream.
+    const matfile_index_block_t *blocks;    ///<Block boundaries.
+    size_t                       noblocks;  ///<Number of blocks.
+    size_t                       nothreads; ///<Number of workers.
+    unsigned char               *tag;       ///<Inflated tag of data element.
+    unsigned char               *payload;   ///<Inflated payload.
+    uLong                       *checksums; ///<Adler-32 of every block.
+    int                         *statuses;  ///<Status of every block.
+    matfile_trace_t             *trace;     ///<Trace of blocks or null.
+    const matfile_context_t     *ctx;       ///<Context of reading.
+} inflate_job_t;
+
+/**
+ *  Argument of worker thread.
+ */
+typedef struct _inflate_worker_t {
+    inflate_job_t  *job;    ///<Shared job.
+    size_t          rank;   ///<Index of worker.
+} inflate_worker_t;
+
+/**
+ *  Inflate single block of raw deflate data into its place in output. The
+ *  first bytes of data element are inflated into separate tag buffer.
+ *
+ *  \param[in] job Inflate job.
+ *  \param[in] no  Index of block.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int inflate_block(inflate_job_t *job, size_t no);
+
+/**
+ *  Entry point of worker thread which inflates every nothreads-th block.
+ *
+ *  \param[in] arg Pointer to inflate_worker_t.
+ *  \return Null.
+ */
+void *inflate_worker(void *arg);
+
+int inflate_block(inflate_job_t *job, size_t no) {
+    const matfile_index_block_t *block = &job->blocks[no];
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    size_t begin = block[0].uncompressed, end = block[1].uncompressed;
+    uint64_t clock = mf_trace_clock(job->trace);
+    z_stream stream;
+    int code;
+
+    memset(&stream, 0, sizeof(stream));
+
+    //  Blocks start with raw deflate data since zlib header precedes the
+    //  first one and full flush resets compressor state.
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return 1;
+    }
+
+    stream.next_in = (Bytef *)job->input + block[0].compressed;
+    stream.avail_in = block[1].compressed - block[0].compressed;
+
+    uLong checksum = adler32(0, NULL, 0);
+
+    //  Output is split on tag and payload.
+    while (begin != end) {
+        unsigned char *out = begin < tag_size
+                           ? job->tag + begin
+                           : job->payload + begin - tag_size;
+        size_t length = begin < tag_size && end > tag_size
+                      ? tag_size - begin
+                      : end - begin;
+
+        stream.next_out = out;
+        stream.avail_out = length;
+        code = inflate(&stream, Z_SYNC_FLUSH);
+
+        size_t produced = length - stream.avail_out;
+        checksum = adler32(checksum, out, produced);
+        begin += produced;
+
+        if ((code != Z_OK && code != Z_STREAM_END) || !produced) {
+            break;
+        }
+    }
+
+    int retcode = begin != end || stream.avail_in;
+    job->checksums[no] = checksum;
+    inflateEnd(&stream);
+    mf_trace_span(job->trace, "inflate block", NULL, clock,
+                  mf_trace_clock(job->trace), block[1].uncompressed
+                                      - block[0].uncompressed);
+    return retcode;
+}
+
+void *inflate_worker(void *arg) {
+    inflate_worker_t *worker = arg;
+    inflate_job_t *job = worker->job;
+
+    //  Remaining blocks are skipped as soon as reading is interrupted.
+    for (size_t i = worker->rank; i < job->noblocks; i += job->nothreads) {
+        job->statuses[i] = mf_check_context(job->ctx) || inflate_block(job, i);
+    }
+
+    return NULL;
+}
+
+int mf_decompress_blocks(matfile_data_element_t *element,
+                         const matfile_index_entry_t *entry,
+                         const matfile_context_t *ctx,
+                         matfile_trace_t *trace) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    const matfile_index_block_t *blocks = entry->blocks;
+    size_t noblocks = entry->noblocks;
+    uint64_t total = blocks[noblocks].uncompressed;
+
+    //  Boundaries should cover the whole stream between zlib header and
+    //  checksum.
+    int valid = blocks[0].compressed == 2
+             && blocks[0].uncompressed == 0
+             && blocks[noblocks].compressed + 4 == element->large.size
+             && total >= tag_size;
+
+    for (size_t i = 0; i != noblocks && valid; ++i) {
+        valid = blocks[i].compressed < blocks[i + 1].compressed
+             && blocks[i].uncompressed < blocks[i + 1].uncompressed;
+    }
+
+    if (!valid) {
+        fprintf(stderr, "blocks of compressed data element are wrong\n");
+        return 1;
+    }
+
+    size_t nothreads = ctx ? ctx->nothreads : 0;
+
+    if (!nothreads) {
+        long noprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        nothreads = noprocs > 0 ? noprocs : 1;
+    }
+
+    if (nothreads > noblocks) {
+        nothreads = noblocks;
+    }
+
+    uint32_t tag[2];
+    inflate_job_t job = {
+        element->large.data,
+        blocks,
+        noblocks,
+        nothreads,
+        (unsigned char *)tag,
+        malloc(total - tag_size ? total - tag_size : 1),
+        calloc(noblocks, sizeof(uLong)),
+        calloc(noblocks, sizeof(int)),
+        trace,
+        ctx,
+    };
+    pthread_t *threads = calloc(nothreads, sizeof(pthread_t));
+    inflate_worker_t *workers = calloc(nothreads, sizeof(inflate_worker_t));
+    int retcode = 0;
+
+    if (!job.payload || !job.checksums || !job.statuses || !threads ||
+        !workers) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        retcode = 1;
+    }
+
+    //  The calling thread works as the first worker.
+    size_t nostarted = 1;
+
+    for (size_t i = 0; i != nothreads && !retcode; ++i) {
+        workers[i].job = &job;
+        workers[i].rank = i;
+
+        if (i && !pthread_create(&threads[i], NULL, inflate_worker,
+                                 &workers[i])) {
+            ++nostarted;
+        }
+        else if (i) {
+            //  Blocks of failed worker are inflated serially below.
+            workers[i].job = NULL;
+        }
+    }
+
+    if (!retcode) {
+        inflate_worker(&workers[0]);
+
+        for (size_t i = 1; i != nothreads; ++i) {
+            if (workers[i].job) {
+                pthread_join(threads[i], NULL);
+            }
+            else {
+                for (size_t j = i; j < noblocks; j += nothreads) {
+                    job.statuses[j] = mf_check_context(ctx)
+                                   || inflate_block(&job, j);
+                }
+            }
+        }
+    }
+
+    //  Verify Adler-32 checksum of the whole stream.
+    uLong checksum = adler32(0, NULL, 0);
+
+    for (size_t i = 0; i != noblocks && !retcode; ++i) {
+        uint64_t length = blocks[i + 1].uncompressed - blocks[i].uncompressed;
+        retcode = job.statuses[i];
+        checksum = adler32_combine(checksum, job.checksums[i], length);
+    }
+
+    const unsigned char *trailer = job.input + element->large.size - 4;
+    uLong expected = ((uLong)trailer[0] << 24) | ((uLong)trailer[1] << 16)
+                   | ((uLong)trailer[2] << 8) | (uLong)trailer[3];
+
+    if (!retcode && checksum != expected) {
+        fprintf(stderr, "wrong checksum of compressed data element\n");
+        retcode = 1;
+    }
+
+    if (!retcode && (!(tag[0] >= MFDT_INT8 && tag[0] < MFDT_COUNT) ||
+                     tag[1] > total - tag_size)) {
+        fprintf(stderr, "wrong data type of data subelement: %d\n", tag[0]);
+        retcode = 1;
+    }
+
+    free(workers);
+    free(threads);
+    free(job.statuses);
+    free(job.checksums);
+
+    if (retcode) {
+        free(job.payload);
+        return 1;
+    }
+
+    element->large.type = tag[0];
+    element->large.size = tag[1];
+    element->large.data = job.payload;
+    return 0;
+}
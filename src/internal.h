@@ -0,0 +1,600 @@
+/**
+ *  \file internal.h
+ *  \brief This file declares routines which are shared between translation
+ *  units of the library but are not part of public API.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#pragma once
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+
+#include <stdio.h>
+#include <zlib.h>
+
+#define MF_HEADER_PROBE     4096u   ///<Maximal size of array header.
+#define MF_STREAM_BUFFER    (1u << 20)  ///<Default size of stream buffers.
+
+//! Number of padding bytes after payload of uncompressed data element.
+#define MF_PADDING(size)    ((MF_ALIGNMENT - (size) % MF_ALIGNMENT) % MF_ALIGNMENT)
+
+//! Shortcut for memory freeing.
+#define SAFE_RELEASE(p)     if (p) {free((void *)p); p = NULL;}
+
+/**
+ *  Get current time of monotonic clock.
+ *
+ *  \return Time in nanoseconds or zero if clock is not available.
+ */
+uint64_t mf_monotonic_ns(void);
+
+/**
+ *  Convert numbers between numerical data types with C cast semantics.
+ *
+ *  \param[out] dst      Destination buffer.
+ *  \param[in]  dst_type Data type of destination numbers.
+ *  \param[in]  src      Source buffer.
+ *  \param[in]  src_type Data type of source numbers.
+ *  \param[in]  n        Number of elements to convert.
+ *  \param[in]  swap     Whether byte order of source numbers is switched.
+ *  \return Return zero on success or not zero if data types are not
+ *  numerical.
+ */
+int mf_convert_numbers(void *dst,
+                       matfile_data_type_t dst_type,
+                       const void *src,
+                       matfile_data_type_t src_type,
+                       size_t n,
+                       int swap);
+
+/**
+ *  Decode tag of data element which is either in small or in large format.
+ *
+ *  \param[in]  data   Pointer to tag of data element.
+ *  \param[out] type   Data type of data element.
+ *  \param[out] size   Size of payload in bytes.
+ *  \param[out] length Length of whole data element including tag, payload and
+ *  padding.
+ *  \return Pointer to payload of data element.
+ */
+const void *mf_decode_tag(const void *data,
+                          uint32_t *type,
+                          uint32_t *size,
+                          size_t *length);
+
+/**
+ *  Calculate 64-bit hash of buffer. The hash function is XXH64 so hashes of
+ *  consequent buffers could be chained through seed.
+ *
+ *  \param[in] data Buffer to hash.
+ *  \param[in] size Size of buffer in bytes.
+ *  \param[in] seed Seed of hash function.
+ *  \return Hash value.
+ */
+uint64_t mf_hash_bytes(const void *data, size_t size, uint64_t seed);
+
+/**
+ *  Append entry to index. Name of array is copied.
+ *
+ *  \param[in,out] index  Pointer to index.
+ *  \param[in]     name   Name of array.
+ *  \param[in]     offset Offset of data element.
+ *  \param[in]     size   Size of data element.
+ *  \param[in]     hash   Content hash of array.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_index_append(matfile_index_t *index,
+                    const char *name,
+                    uint64_t offset,
+                    uint64_t size,
+                    uint64_t hash);
+
+/**
+ *  Set boundaries of blocks of compressed array in index entry.
+ *
+ *  \param[in] entry    Index entry.
+ *  \param[in] blocks   Block boundaries. There are noblocks + 1 of them.
+ *  \param[in] noblocks Number of blocks.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_index_set_blocks(matfile_index_entry_t *entry,
+                        const matfile_index_block_t *blocks,
+                        size_t noblocks);
+
+/**
+ *  Get name of sidecar index file for mat-file.
+ *
+ *  \param[in] filename Name of mat-file.
+ *  \return Name of sidecar which should be freed by caller or null.
+ */
+char *mf_index_filename(const char *filename);
+
+/**
+ *  State of single reading which is passed through parsing routines instead
+ *  of file-scope variables so that concurrent readings do not interfere.
+ */
+typedef struct _parse_state_t {
+    const matfile_context_t    *ctx;        ///<Context of reading or null.
+    const matfile_index_t      *sidecar;    ///<Sidecar index or null.
+    size_t                      cursor;     ///<Next entry of sidecar index.
+    int                         swap_bytes; ///<Byte order is switched.
+    matfile_stats_t            *stats;      ///<Statistics or null.
+    matfile_trace_t            *trace;      ///<Trace or null.
+    matfile_latency_t          *latency;    ///<Latency histograms or null.
+    matfile_status_t            status;     ///<Reason of interruption.
+} parse_state_t;
+
+/**
+ *  Decompress compressed data element with zlib. It accepts data element of
+ *  miCOMPRESSED type. After decomporession the routine modifies data element
+ *  in way to store correct inflated content.
+ *
+ *  \note In order to prevent data leak though zlib stream it would be better
+ *  to initialize and destroy stream in this function but decompression logic
+ *  move to subroutine.
+ *
+ *  \param[in,out] element Compressed byte array. It should be of miCOMPRESSED
+ *  type before invocation, and it should contains compressed with correct size
+ *  field.
+ *  \param[in,out] state Reading which could be interrupted or null.
+ *  \return Return zero if data element decompression was successful, otherwise
+ *  result is not zero.
+ */
+int decompress_data_element(matfile_data_element_t *element,
+                            parse_state_t *state);
+
+/**
+ *  Inflate compressed data element which consists of independently decodable
+ *  blocks on many threads. The result is the same as the one of
+ *  decompress_data_element.
+ *
+ *  \param[in,out] element   Compressed data element.
+ *  \param[in]     entry     Index entry with block boundaries.
+ *  \param[in]     ctx       Context of reading which gives number of threads
+ *                           (zero for all processors), cancellation token and
+ *                           deadline.
+ *  \param[in]     trace     Trace of inflate of every block or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_decompress_blocks(matfile_data_element_t *element,
+                         const matfile_index_entry_t *entry,
+                         const matfile_context_t *ctx,
+                         matfile_trace_t *trace);
+
+/**
+ *  Parse array flags, dimensions and name of array which precede content of
+ *  array in miMATRIX data element.
+ *
+ *  \param[out] array       Array which flags, dims and name are filled.
+ *  \param[in]  data        Payload of miMATRIX data element.
+ *  \param[in]  length      Length of payload.
+ *  \param[out] name_offset Offset of array name subelement or null.
+ *  \param[in]  state       State of reading which byte order is applied or
+ *  null.
+ *  \return Pointer to the rest of payload after array name or null if header
+ *  is corrupted.
+ */
+const void *mf_parse_array_header(matfile_array_t *array,
+                                  const void *data,
+                                  size_t length,
+                                  size_t *name_offset,
+                                  const parse_state_t *state);
+
+/**
+ *  Parse real or imaginary part of numerical array since there is not
+ *  difference between them for parsing. Both of part types are represented
+ *  with data element of the same structure. Values which are stored with
+ *  narrower data type are casted back to data type of array class.
+ *
+ *  \param[in,out] array
+ *  \param[out] part
+ *  \param[in]  data
+ *  \param[in,out] length
+ *  \param[in]  state
+ *  \return Return pointer to rest of data if parsing was successful, otherwise
+ *  null.
+ */
+const void *parse_numerical_part(matfile_array_t *array,
+                                 matfile_numerical_part_t *part,
+                                 const void *data,
+                                 size_t *length,
+                                 parse_state_t *state);
+
+/**
+ *  This function swaps 2 bytes i.e. change byte order.
+ *
+ *  \param[in] word Byte word.
+ *  \param[in] swap Whether byte order is switched.
+ *  \return Reversed byte word or the same one if byte order is kept.
+ */
+uint16_t swap2(uint16_t word, int swap);
+
+/**
+ *  This function swaps 4 bytes i.e. change byte order.
+ *
+ *  \param[in] dword Byte double word.
+ *  \param[in] swap  Whether byte order is switched.
+ *  \return Reversed byte double word or the same one if byte order is kept.
+ */
+uint32_t swap4(uint32_t dword, int swap);
+
+/**
+ *  This function swaps 4 bytes i.e. change byte order.
+ *
+ *  \param[in] quad Byte quad word.
+ *  \param[in] swap Whether byte order is switched.
+ *  \return Reversed byte quad word or the same one if byte order is kept.
+ */
+uint64_t swap8(uint64_t quad, int swap);
+
+/**
+ *  Append data element of given type to tape. Payload of data element is
+ *  padded with zeros to 64-bit boundary.
+ *
+ *  \param[in,out] tape Tape to append data element to.
+ *  \param[in]     type Data type of data element.
+ *  \param[in]     data Payload of data element.
+ *  \param[in]     size Size of payload in bytes.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_serialize_data_element(tape_t *tape,
+                              matfile_data_type_t type,
+                              const void *data,
+                              size_t size);
+
+/**
+ *  Deflate buffer into newly allocated zlib stream.
+ *
+ *  \param[in]  data    Buffer to compress.
+ *  \param[in]  size    Size of buffer in bytes.
+ *  \param[in]  level   Level of zlib compression.
+ *  \param[out] out     Compressed stream which should be freed by caller.
+ *  \param[out] outsize Size of compressed stream.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_compress_buffer(const void *data,
+                       size_t size,
+                       int level,
+                       void **out,
+                       size_t *outsize);
+
+/**
+ *  Choose zlib compression level for buffer according to compression policy.
+ *
+ *  \param[in] data Buffer to compress.
+ *  \param[in] size Size of buffer in bytes.
+ *  \param[in] opts Serialization options.
+ *  \return Compression level or zero if buffer should be stored uncompressed.
+ */
+int mf_choose_compression_level(const void *data,
+                                size_t size,
+                                const matfile_write_options_t *opts);
+
+/**
+ *  Compress buffer into zlib stream which consists of independently
+ *  decodable blocks. Every block but the last one is terminated with full
+ *  flush.
+ *
+ *  \param[in]  data       Buffer to compress.
+ *  \param[in]  size       Size of buffer in bytes.
+ *  \param[in]  level      Level of zlib compression.
+ *  \param[in]  block_size Size of uncompressed block or zero for single block.
+ *  \param[out] out        Compressed buffer which should be freed by caller.
+ *  \param[out] outsize    Size of compressed buffer.
+ *  \param[out] blocks     Tape which block boundaries are pushed to or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_compress_blocks(const void *data,
+                       size_t size,
+                       int level,
+                       size_t block_size,
+                       void **out,
+                       size_t *outsize,
+                       tape_t *blocks);
+
+/**
+ *  Fill header of mat-file which is going to be written on this platform.
+ *
+ *  \param[out] header Header to fill.
+ *  \param[in]  origin Header of source mat-file which description is kept
+ *  if it is not empty.
+ */
+void mf_fill_header(matfile_header_t *header, const matfile_header_t *origin);
+
+/**
+ *  Check that header belongs to mat-file which could be extended with data
+ *  elements written on this platform.
+ *
+ *  \param[in] header Header of existing mat-file.
+ *  \return Return zero if mat-file is appendable, otherwise not zero.
+ */
+int mf_validate_header(const matfile_header_t *header);
+
+/**
+ *  Open temporary output file next to target one and write header into it.
+ *
+ *  \param[in]  filename Name of target mat-file.
+ *  \param[out] tmpname  Name of temporary file which should be freed by
+ *  caller.
+ *  \return Opened file or null on failure.
+ */
+FILE *mf_open_output(const char *filename, char **tmpname);
+
+/**
+ *  Close temporary output file and replace target mat-file with it on
+ *  success or remove it on failure.
+ *
+ *  \param[in] fout     Output file.
+ *  \param[in] tmpname  Name of temporary file. It is freed by the routine.
+ *  \param[in] filename Name of target mat-file.
+ *  \param[in] retcode  Status of preceding writes.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_close_output(FILE *fout,
+                    char *tmpname,
+                    const char *filename,
+                    int retcode);
+
+/**
+ *  Open source mat-file and validate that its data elements could be copied
+ *  into mat-file written on this platform.
+ *
+ *  \param[in] filename Name of source mat-file.
+ *  \return Opened file or null on failure.
+ */
+FILE *mf_open_source(const char *filename);
+
+/**
+ *  Copy bytes of data element from one file to another as is. The routine
+ *  uses copy_file_range() where it is available so bytes are not copied
+ *  through user space.
+ *
+ *  \param[in] fin    Source file.
+ *  \param[in] fout   Target file. Bytes are appended to the end of file.
+ *  \param[in] offset Offset of data element in source file.
+ *  \param[in] size   Size of data element in bytes.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_copy_data_element(FILE *fin, FILE *fout, uint64_t offset, uint64_t size);
+
+/**
+ *  Write all data elements of mat-file into opened file and fill index of
+ *  written arrays. Arrays which content hash matches entry of origin index are
+ *  copied from origin mat-file without encoding.
+ *
+ *  \param[in]     fout   Output file.
+ *  \param[in]     mat    Mat-file to write.
+ *  \param[in]     opts   Serialization options.
+ *  \param[in]     fin    Origin mat-file or null.
+ *  \param[in]     origin Index of origin mat-file or null.
+ *  \param[in,out] index  Index of output file or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_write_data_elements(FILE *fout,
+                           const matfile_t *mat,
+                           const matfile_write_options_t *opts,
+                           FILE *fin,
+                           const matfile_index_t *origin,
+                           matfile_index_t *index);
+
+/**
+ *  Parse header of top-level array data element in file without reading of
+ *  its payload. Compressed data element is inflated only until array name.
+ *
+ *  \param[in]  fd      File descriptor of mat-file.
+ *  \param[in]  offset  Offset of data element tag in file.
+ *  \param[in]  type    Data type of data element (miMATRIX or miCOMPRESSED).
+ *  \param[in]  size    Size of data element payload.
+ *  \param[out] array   Array which flags, dims and name are filled.
+ *  \param[out] payload Size of payload of (inflated) miMATRIX or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_scan_array_header(int fd,
+                         uint64_t offset,
+                         uint32_t type,
+                         uint32_t size,
+                         matfile_array_t *array,
+                         uint64_t *payload);
+
+/**
+ *  Locate real part of uncompressed numerical array which is stored in data
+ *  type of its class. Such array could be modified in place.
+ *
+ *  \param[in]  fd          File descriptor of mat-file.
+ *  \param[in]  offset      Offset of data element tag in file.
+ *  \param[in]  size        Size of data element including tag and padding.
+ *  \param[out] array       Array which flags, dims and name are filled.
+ *  \param[out] part_offset Offset of tag of real part in file.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_locate_real_part(int fd,
+                        uint64_t offset,
+                        uint64_t size,
+                        matfile_array_t *array,
+                        uint64_t *part_offset);
+
+/**
+ *  Get monotonic time in nanoseconds if trace is recorded.
+ *
+ *  \param[in] trace Trace or null.
+ *  \return Current time or zero if there is no trace.
+ */
+uint64_t mf_trace_clock(const matfile_trace_t *trace);
+
+/**
+ *  Record complete span on calling thread. Nothing is recorded if there is
+ *  no trace.
+ *
+ *  \param[in] trace Trace or null.
+ *  \param[in] name  Name of span. It should be static string.
+ *  \param[in] array Name of array or null.
+ *  \param[in] begin Start time of span.
+ *  \param[in] end   Finish time of span.
+ *  \param[in] bytes Number of processed bytes.
+ */
+void mf_trace_span(matfile_trace_t *trace,
+                   const char *name,
+                   const char *array,
+                   uint64_t begin,
+                   uint64_t end,
+                   uint64_t bytes);
+
+/**
+ *  Get monotonic time in nanoseconds if latency is recorded.
+ *
+ *  \param[in] latency Histograms or null.
+ *  \return Current time or zero if there are no histograms.
+ */
+uint64_t mf_latency_clock(const matfile_latency_t *latency);
+
+/**
+ *  Record latency of operation. Nothing is recorded if there are no
+ *  histograms.
+ *
+ *  \param[in] latency Histograms or null.
+ *  \param[in] op      Operation.
+ *  \param[in] bytes   Number of bytes which operation produces.
+ *  \param[in] begin   Start time of operation.
+ *  \param[in] end     Finish time of operation.
+ */
+void mf_latency_record(matfile_latency_t *latency,
+                       matfile_operation_t op,
+                       uint64_t bytes,
+                       uint64_t begin,
+                       uint64_t end);
+
+/**
+ *  Check cancellation token and deadline of reading. It is safe to call from
+ *  many threads.
+ *
+ *  \param[in] ctx Context of reading or null.
+ *  \return Status MFSTATUS_OK if reading goes on, otherwise MFSTATUS_CANCELLED
+ *  or MFSTATUS_EXPIRED.
+ */
+matfile_status_t mf_check_context(const matfile_context_t *ctx);
+
+/**
+ *  Sequential reader of payload of miMATRIX data element. Compressed data
+ *  element is inflated on the fly.
+ */
+typedef struct _extract_stream_t {
+    int             fd;         ///<File descriptor of mat-file.
+    uint64_t        offset;     ///<Offset of next bytes to read from file.
+    uint64_t        remaining;  ///<Number of bytes to read from file.
+    int             compressed; ///<Data element is compressed.
+    z_stream        zs;         ///<Inflate state.
+    unsigned char  *input;      ///<Buffer of compressed bytes.
+    unsigned char  *buffer;     ///<Buffer of payload bytes.
+    size_t          capacity;   ///<Capacity of buffers.
+    size_t          begin;      ///<Position of next payload byte in buffer.
+    size_t          end;        ///<End of payload bytes in buffer.
+} extract_stream_t;
+
+/**
+ *  Numerical part of array which is read from stream. Part in small data
+ *  element format carries its payload in tag.
+ */
+typedef struct _extract_part_t {
+    extract_stream_t   *stream;     ///<Underlying stream.
+    matfile_data_type_t type;       ///<Data type of stored values.
+    uint32_t            packed[1];  ///<Payload of small data element.
+    size_t              nopacked;   ///<Number of unread packed bytes.
+    uint64_t            padding;    ///<Padding after payload.
+} extract_part_t;
+
+/**
+ *  Open stream of payload of miMATRIX data element in file.
+ *
+ *  \param[out] stream   Stream to open.
+ *  \param[in]  fd       File descriptor of mat-file.
+ *  \param[in]  offset   Offset of data element tag in file.
+ *  \param[in]  capacity Capacity of buffers. It should not be less than
+ *  MF_HEADER_PROBE.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_stream_open(extract_stream_t *stream,
+                   int fd,
+                   uint64_t offset,
+                   size_t capacity);
+
+/**
+ *  Release buffers and inflate state of stream.
+ *
+ *  \param[in] stream Stream to close.
+ */
+void mf_stream_close(extract_stream_t *stream);
+
+/**
+ *  Move unread payload to the beginning of buffer and fill the rest of
+ *  buffer from file.
+ *
+ *  \param[in,out] stream Stream to fill.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_stream_fill(extract_stream_t *stream);
+
+/**
+ *  Read exact number of payload bytes from stream.
+ *
+ *  \param[in,out] stream Stream to read from.
+ *  \param[out]    dst    Buffer for bytes or null to skip them.
+ *  \param[in]     size   Number of bytes to read.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_stream_read(extract_stream_t *stream, void *dst, uint64_t size);
+
+/**
+ *  Parse array header at the beginning of payload of stream. Flags, dims
+ *  and name of array are filled and stream is positioned at the first
+ *  subelement after array name.
+ *
+ *  \param[in,out] stream      Stream which is just opened.
+ *  \param[out]    array       Array which flags, dims and name are filled.
+ *  \param[out]    header_size Size of array header in bytes or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_stream_read_header(extract_stream_t *stream,
+                          matfile_array_t *array,
+                          size_t *header_size);
+
+/**
+ *  Read tag of numerical part and validate its size against number of
+ *  elements of array.
+ *
+ *  \param[out] part   Numerical part to initialize.
+ *  \param[in]  stream Stream which is positioned at tag of part.
+ *  \param[in]  numel  Number of elements of array.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_part_open(extract_part_t *part,
+                 extract_stream_t *stream,
+                 uint64_t numel);
+
+/**
+ *  Read values of numerical part and convert them to data type of array
+ *  class.
+ *
+ *  \param[in,out] part    Numerical part.
+ *  \param[out]    dst     Buffer for converted values.
+ *  \param[in]     type    Data type of array class.
+ *  \param[in]     scratch Buffer for stored values.
+ *  \param[in]     n       Number of values.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_part_read(extract_part_t *part,
+                 void *dst,
+                 matfile_data_type_t type,
+                 void *scratch,
+                 size_t n);
+
+/**
+ *  Skip the rest of numerical part including padding.
+ *
+ *  \param[in,out] part Numerical part.
+ *  \param[in]     n    Number of unread values.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int mf_part_skip(extract_part_t *part, uint64_t n);
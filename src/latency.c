@@ -0,0 +1,293 @@
+/**
+ *  \file latency.c
+ *  \brief The file contains log-bucketed histograms of latency of operations
+ *  on variables in the spirit of HdrHistogram: every power of two is split
+ *  into linear sub-buckets, so histograms have fixed size and bounded
+ *  relative error.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MF_LATENCY_SUB_BITS 4u          ///<Log2 of sub-buckets per octave.
+#define MF_LATENCY_MAX_EXP  47u         ///<The highest tracked octave.
+#define MF_SIZE_MEDIUM      (64u << 10) ///<Lower bound of medium variables.
+#define MF_SIZE_LARGE       (16u << 20) ///<Lower bound of large variables.
+
+typedef struct _matfile_latency_t {
+    pthread_mutex_t mutex;  ///<Guard of histograms.
+
+    /**
+     *  Histogram of every operation and size class.
+     */
+    matfile_latency_snapshot_t histograms[MFOP_COUNT][MFSIZE_COUNT];
+} matfile_latency_t;
+
+static const char *operation_strings[] = {
+    "lookup",
+    "inflate",
+    "convert",
+};
+
+static const char *size_class_strings[] = {
+    "small",
+    "medium",
+    "large",
+    "any",
+};
+
+/**
+ *  Get index of bucket which value falls into. Values beyond the highest
+ *  octave are saturated.
+ *
+ *  \param[in] value Latency in nanoseconds.
+ *  \return Index of bucket.
+ */
+size_t latency_bucket(uint64_t value);
+
+/**
+ *  Get size class of variable.
+ *
+ *  \param[in] bytes Number of bytes which operation produces.
+ *  \return Size class.
+ */
+matfile_size_class_t latency_size_class(uint64_t bytes);
+
+/**
+ *  Add one histogram to another.
+ *
+ *  \param[in,out] dst Accumulated histogram.
+ *  \param[in]     src Added histogram.
+ */
+void latency_merge(matfile_latency_snapshot_t *dst,
+                   const matfile_latency_snapshot_t *src);
+
+size_t latency_bucket(uint64_t value) {
+    const uint64_t nosubs = 1u << MF_LATENCY_SUB_BITS;
+
+    if (value < nosubs) {
+        return value;
+    }
+
+    size_t exp = 63 - __builtin_clzll(value);
+
+    if (exp > MF_LATENCY_MAX_EXP) {
+        return MF_LATENCY_BUCKETS - 1;
+    }
+
+    size_t shift = exp - MF_LATENCY_SUB_BITS;
+    size_t sub = (value >> shift) & (nosubs - 1);
+    return nosubs * (shift + 1) + sub;
+}
+
+matfile_size_class_t latency_size_class(uint64_t bytes) {
+    if (bytes < MF_SIZE_MEDIUM) {
+        return MFSIZE_SMALL;
+    }
+    else if (bytes < MF_SIZE_LARGE) {
+        return MFSIZE_MEDIUM;
+    }
+    else {
+        return MFSIZE_LARGE;
+    }
+}
+
+void latency_merge(matfile_latency_snapshot_t *dst,
+                   const matfile_latency_snapshot_t *src) {
+    if (!src->count) {
+        return;
+    }
+
+    if (!dst->count || src->min_ns < dst->min_ns) {
+        dst->min_ns = src->min_ns;
+    }
+
+    if (src->max_ns > dst->max_ns) {
+        dst->max_ns = src->max_ns;
+    }
+
+    dst->count += src->count;
+    dst->total_ns += src->total_ns;
+
+    for (size_t i = 0; i != MF_LATENCY_BUCKETS; ++i) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+uint64_t mf_latency_clock(const matfile_latency_t *latency) {
+    return latency ? mf_monotonic_ns() : 0;
+}
+
+void mf_latency_record(matfile_latency_t *latency,
+                       matfile_operation_t op,
+                       uint64_t bytes,
+                       uint64_t begin,
+                       uint64_t end) {
+    if (!latency) {
+        return;
+    }
+
+    uint64_t value = end > begin ? end - begin : 0;
+    size_t bucket = latency_bucket(value);
+
+    pthread_mutex_lock(&latency->mutex);
+    matfile_latency_snapshot_t *histogram =
+        &latency->histograms[op][latency_size_class(bytes)];
+
+    if (!histogram->count || value < histogram->min_ns) {
+        histogram->min_ns = value;
+    }
+
+    if (value > histogram->max_ns) {
+        histogram->max_ns = value;
+    }
+
+    histogram->count += 1;
+    histogram->total_ns += value;
+    histogram->buckets[bucket] += 1;
+    pthread_mutex_unlock(&latency->mutex);
+}
+
+matfile_latency_t *matfile_latency_create(void) {
+    matfile_latency_t *latency = calloc(1, sizeof(matfile_latency_t));
+
+    if (!latency) {
+        fprintf(stderr, "could not allocate memory for histograms\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&latency->mutex, NULL);
+    return latency;
+}
+
+void matfile_latency_destroy(matfile_latency_t *latency) {
+    if (!latency) {
+        return;
+    }
+
+    pthread_mutex_destroy(&latency->mutex);
+    free(latency);
+}
+
+void matfile_latency_reset(matfile_latency_t *latency) {
+    pthread_mutex_lock(&latency->mutex);
+    memset(latency->histograms, 0, sizeof(latency->histograms));
+    pthread_mutex_unlock(&latency->mutex);
+}
+
+int matfile_latency_snapshot(matfile_latency_t *latency,
+                             matfile_operation_t op,
+                             matfile_size_class_t size,
+                             matfile_latency_snapshot_t *snapshot) {
+    if (op >= MFOP_COUNT || size > MFSIZE_ANY) {
+        fprintf(stderr, "there is no histogram of operation %d and size "
+                "class %d\n", op, size);
+        return 1;
+    }
+
+    memset(snapshot, 0, sizeof(matfile_latency_snapshot_t));
+    pthread_mutex_lock(&latency->mutex);
+
+    for (size_t i = 0; i != MFSIZE_COUNT; ++i) {
+        if (size == MFSIZE_ANY || size == i) {
+            latency_merge(snapshot, &latency->histograms[op][i]);
+        }
+    }
+
+    pthread_mutex_unlock(&latency->mutex);
+    return 0;
+}
+
+int matfile_latency_export(matfile_latency_t *latency,
+                           matfile_latency_callback_t callback,
+                           void *opaque) {
+    matfile_latency_snapshot_t *snapshot =
+        malloc(sizeof(matfile_latency_snapshot_t));
+
+    if (!snapshot) {
+        fprintf(stderr, "could not allocate memory for snapshot\n");
+        return 1;
+    }
+
+    int retcode = 0;
+
+    //  Callback is invoked without lock, so it could query histograms too.
+    for (int op = 0; op != MFOP_COUNT && !retcode; ++op) {
+        for (int size = 0; size != MFSIZE_COUNT && !retcode; ++size) {
+            matfile_latency_snapshot(latency, op, size, snapshot);
+
+            if (snapshot->count) {
+                retcode = callback(opaque, op, size, snapshot);
+            }
+        }
+    }
+
+    free(snapshot);
+    return retcode;
+}
+
+uint64_t matfile_latency_quantile(const matfile_latency_snapshot_t *snapshot,
+                                  double q) {
+    if (!snapshot->count) {
+        return 0;
+    }
+
+    //  Nearest rank is one-based so that zero quantile is minimum. Extreme
+    //  ranks are known exactly.
+    double rank = ceil(q * snapshot->count);
+    uint64_t target = rank < 1 ? 1 : (uint64_t)rank;
+    uint64_t seen = 0;
+
+    if (target == 1) {
+        return snapshot->min_ns;
+    }
+    else if (target >= snapshot->count) {
+        return snapshot->max_ns;
+    }
+
+    for (size_t i = 0; i != MF_LATENCY_BUCKETS; ++i) {
+        seen += snapshot->buckets[i];
+
+        if (seen >= target) {
+            //  The highest value of bucket is reported like HdrHistogram
+            //  does but it could not exceed observed maximum.
+            uint64_t value = matfile_latency_bucket_bound(i) - 1;
+            value = value < snapshot->max_ns ? value : snapshot->max_ns;
+            return value > snapshot->min_ns ? value : snapshot->min_ns;
+        }
+    }
+
+    return snapshot->max_ns;
+}
+
+uint64_t matfile_latency_bucket_bound(size_t no) {
+    const uint64_t nosubs = 1u << MF_LATENCY_SUB_BITS;
+
+    if (no < nosubs) {
+        return no + 1;
+    }
+
+    if (no >= MF_LATENCY_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+
+    size_t shift = no / nosubs - 1;
+    uint64_t sub = no % nosubs;
+    return (nosubs + sub + 1) << shift;
+}
+
+const char *matfile_get_operation_string(matfile_operation_t op) {
+    return op < MFOP_COUNT ? operation_strings[op] : "unknown";
+}
+
+const char *matfile_get_size_class_string(matfile_size_class_t size) {
+    return size <= MFSIZE_ANY ? size_class_strings[size] : "unknown";
+}
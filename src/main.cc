@@ -1,7 +1,10 @@
 /**
  *  \file main.cc
  *  \brief Utility to inspect payload of mat-files. It reveals data element
- *  structure and lists symbolyc names of arrays.
+ *  structure and lists symbolyc names of arrays. Also it lists, subsets,
+ *  merges and drops arrays of mat-files without decoding, repacks them,
+ *  extracts single array to .npy or raw binary file and benchmarks loading of
+ *  mat-file.
  *  \author Daniel Bershatsky
  *  \date 2018
  *  \copyright GNU General Public License v3.0
@@ -12,8 +15,25 @@ extern "C" {
 #include <zlib.h>
 }
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using std::unique_ptr;
 
@@ -21,18 +41,864 @@ typedef unique_ptr<matfile_t, decltype(&matfile_destroy)> matfile_ptr;
 typedef unique_ptr<matfile_varname_t,
                    decltype(&matfile_varnames_destroy)> matfile_varname_ptr;
 
+struct command_t {
+    const char *name;
+    const char *usage;
+    int nargs;  ///< Minimal number of positional arguments.
+    int (*main)(int argc, char *argv[]);
+};
+
+int inspect(int argc, char *argv[]);
+int list(int argc, char *argv[]);
+int extract(int argc, char *argv[]);
+int stats(int argc, char *argv[]);
+int bench(int argc, char *argv[]);
+int subset(int argc, char *argv[]);
+int merge(int argc, char *argv[]);
+int drop(int argc, char *argv[]);
+int repack(int argc, char *argv[]);
+
+static const command_t commands[] = {
+    {"inspect", "<matfile>", 1, inspect},
+    {"ls", "<matfile>", 1, list},
+    {"extract", "<matfile> <name> [-o <output>] [--raw] [--row-major]", 2,
+     extract},
+    {"stats", "<matfile> [--json] [--threads <n>]", 1, stats},
+    {"bench", "<matfile> [--repeat <n>] [--modes <list>] [--no-cold]", 1,
+     bench},
+    {"subset", "<input> <output> <name[:newname]>...", 3, subset},
+    {"merge", "<output> <input>...", 2, merge},
+    {"drop", "<input> <output> <name>...", 3, drop},
+    {"repack", "<input> <output> [--level <n>] [--threads <n>] "
+     "[--order keep|size|name|list] [--block-size <bytes>] [--no-index] "
+     "[name...]", 2, repack},
+};
+
+//! Print statistics of reading after inspection.
+static bool print_stats = false;
+
+//! Name of file which trace of reading is written to or null.
+static const char *trace_filename = NULL;
+
+static void usage(const char *prog) {
+    std::cerr
+        << "usage: " << prog << " [--stats] [--trace <json>] [matfile]"
+        << std::endl;
+
+    for (const command_t &cmd : commands) {
+        std::cerr
+            << "       " << prog << ' ' << cmd.name << ' ' << cmd.usage
+            << std::endl;
+    }
+}
+
 int main(int argc, char *argv[]) {
+    //  Options of inspection precede command.
+    while (argc > 1 && !std::strncmp(argv[1], "--", 2)) {
+        int shift = 1;
+
+        if (!std::strcmp(argv[1], "--stats")) {
+            print_stats = true;
+        }
+        else if (!std::strcmp(argv[1], "--trace") && argc > 2) {
+            trace_filename = argv[2];
+            shift = 2;
+        }
+        else {
+            usage(argv[0]);
+            std::cerr << "error: unknown option `" << argv[1] << "`."
+                      << std::endl;
+            return 1;
+        }
+
+        argv[shift] = argv[0];
+        argc -= shift;
+        argv += shift;
+    }
+
+    if (argc < 2) {
+        usage(argv[0]);
+        std::cerr << "error: too few arguments." << std::endl;
+        return 1;
+    }
+
+    for (const command_t &cmd : commands) {
+        if (std::strcmp(argv[1], cmd.name)) {
+            continue;
+        }
+
+        if (argc - 2 < cmd.nargs) {
+            usage(argv[0]);
+            std::cerr << "error: too few arguments." << std::endl;
+            return 1;
+        }
+
+        return cmd.main(argc - 2, argv + 2);
+    }
+
+    //  Inspect mat-file if there is no command.
     if (argc != 2) {
+        usage(argv[0]);
+        std::cerr << "error: unknown command `" << argv[1] << "`." << std::endl;
+        return 1;
+    }
+
+    return inspect(argc - 1, argv + 1);
+}
+
+int list(int argc, char *argv[]) {
+    if (argc != 1) {
         std::cerr
-            << "usage: " << argv[0] << " [matfile]" << std::endl
-            << "error: too few arguments." << std::endl;
+            << "usage: ls <matfile>" << std::endl
+            << "error: unknown option `" << argv[1] << "`." << std::endl;
+        return 1;
+    }
+
+    //  Only tags and array headers are read, so listing does not depend on
+    //  size of payloads.
+    unique_ptr<matfile_estimate_t, decltype(&matfile_estimate_destroy)>
+        estimate(matfile_estimate(argv[0], NULL, 0), matfile_estimate_destroy);
+
+    if (!estimate) {
+        std::cerr << "matfile scanning was failed" << std::endl;
+        return 1;
+    }
+
+    std::cout
+        << std::left << std::setw(24) << "name" << ' '
+        << std::setw(8) << "class" << ' '
+        << std::setw(16) << "dims" << ' '
+        << std::setw(7) << "complex" << ' '
+        << std::right << std::setw(14) << "stored" << ' '
+        << std::setw(14) << "decoded" << ' '
+        << std::setw(7) << "ratio" << std::endl;
+
+    for (size_t i = 0; i != estimate->noentries; ++i) {
+        const matfile_estimate_entry_t &entry = estimate->entries[i];
+        std::string dims;
+
+        for (size_t j = 0; j != entry.nodims; ++j) {
+            dims += (j ? "x" : "") + std::to_string(entry.dims[j]);
+        }
+
+        //  Class is printed in lower case without prefix and suffix, e.g.
+        //  mxDOUBLE_CLASS is double.
+        std::string cls = matfile_get_class_string(entry.type);
+        size_t end = cls.find("_CLASS");
+
+        if (!cls.compare(0, 2, "mx") && end != std::string::npos) {
+            cls = cls.substr(2, end - 2);
+        }
+
+        for (char &ch : cls) {
+            ch = std::tolower(ch);
+        }
+
+        //  Ratio of compression is inflated size over stored one.
+        double ratio = entry.inflated && entry.stored
+                     ? static_cast<double>(entry.inflated) / entry.stored
+                     : 1.0;
+
+        std::cout
+            << std::left << std::setw(24) << entry.name << ' '
+            << std::setw(8) << cls << ' '
+            << std::setw(16) << dims << ' '
+            << std::setw(7) << (entry.complex ? "yes" : "no") << ' '
+            << std::right << std::setw(14) << entry.stored << ' '
+            << std::setw(14) << entry.decoded << ' '
+            << std::setw(7) << std::fixed << std::setprecision(2) << ratio
+            << std::endl;
+    }
+
+    return 0;
+}
+
+int extract(int argc, char *argv[]) {
+    matfile_extract_options_t opts;
+    matfile_extract_options_init(&opts);
+    std::string output;
+
+    for (int i = 2; i != argc; ++i) {
+        if (!std::strcmp(argv[i], "-o") && i + 1 != argc) {
+            output = argv[++i];
+        }
+        else if (!std::strcmp(argv[i], "--raw")) {
+            opts.format = MFEXTRACT_RAW;
+        }
+        else if (!std::strcmp(argv[i], "--row-major")) {
+            opts.row_major = 1;
+        }
+        else {
+            std::cerr << "error: unknown option `" << argv[i] << "`."
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    //  Output file is named after array by default.
+    if (output.empty()) {
+        output = std::string(argv[1]) + (opts.format == MFEXTRACT_NPY ? ".npy"
+                                                                      : ".bin");
+    }
+
+    return matfile_extract(argv[0], argv[1], output.c_str(), &opts);
+}
+
+//! Print number as JSON value where NaN and infinities are null.
+static void print_json_number(double value) {
+    if (!std::isfinite(value)) {
+        std::cout << "null";
+    }
+    else {
+        std::cout << std::setprecision(17) << value;
+    }
+}
+
+//! Print string as JSON value with quotes, backslashes and control
+//! characters escaped.
+static void print_json_string(const char *string) {
+    std::cout << '"';
+
+    for (const unsigned char *ch = (const unsigned char *)string; *ch; ++ch) {
+        if (*ch == '"' || *ch == '\\') {
+            std::cout << '\\' << *ch;
+        }
+        else if (*ch < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", *ch);
+            std::cout << escape;
+        }
+        else {
+            std::cout << *ch;
+        }
+    }
+
+    std::cout << '"';
+}
+
+int stats(int argc, char *argv[]) {
+    bool json = false;
+    size_t nothreads = 0;
+
+    for (int i = 1; i != argc; ++i) {
+        if (!std::strcmp(argv[i], "--json")) {
+            json = true;
+        }
+        else if (!std::strcmp(argv[i], "--threads") && i + 1 != argc) {
+            nothreads = std::strtoul(argv[++i], NULL, 10);
+        }
+        else {
+            std::cerr << "error: unknown option `" << argv[i] << "`."
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    unique_ptr<matfile_summary_t, decltype(&matfile_summary_destroy)>
+        summary(matfile_summarize(argv[0], nothreads),
+                matfile_summary_destroy);
+
+    if (!summary) {
+        std::cerr << "matfile summarizing was failed" << std::endl;
         return 1;
     }
 
+    static const char *part_names[] = {"real", "imag"};
+
+    if (json) {
+        std::cout << '[';
+    }
+    else {
+        std::cout
+            << std::left << std::setw(24) << "name" << ' '
+            << std::setw(4) << "part" << ' '
+            << std::right << std::setw(12) << "numel" << ' '
+            << std::setw(13) << "min" << ' '
+            << std::setw(13) << "max" << ' '
+            << std::setw(13) << "mean" << ' '
+            << std::setw(13) << "std" << ' '
+            << std::setw(10) << "nans" << ' '
+            << std::setw(10) << "zeros" << std::endl;
+    }
+
+    for (size_t i = 0; i != summary->noentries; ++i) {
+        const matfile_summary_entry_t &entry = summary->entries[i];
+
+        if (json) {
+            std::cout << (i ? ",\n" : "\n") << "{\"name\":";
+            print_json_string(entry.name);
+            std::cout
+                << ",\"class\":\"" << matfile_get_class_string(entry.type)
+                << "\",\"numel\":" << entry.numel;
+        }
+
+        for (int j = 0; j <= entry.complex; ++j) {
+            const matfile_summary_part_t &part = entry.parts[j];
+
+            if (json) {
+                std::cout << ",\"" << part_names[j] << "\":{\"min\":";
+                print_json_number(part.min);
+                std::cout << ",\"max\":";
+                print_json_number(part.max);
+                std::cout << ",\"mean\":";
+                print_json_number(part.mean);
+                std::cout << ",\"std\":";
+                print_json_number(part.std);
+                std::cout
+                    << ",\"nans\":" << part.nonans
+                    << ",\"zeros\":" << part.nozeros << '}';
+                continue;
+            }
+
+            std::cout
+                << std::left << std::setw(24) << entry.name << ' '
+                << std::setw(4) << part_names[j] << ' '
+                << std::right << std::setw(12) << entry.numel << ' '
+                << std::setprecision(6) << std::setw(13) << part.min << ' '
+                << std::setw(13) << part.max << ' '
+                << std::setw(13) << part.mean << ' '
+                << std::setw(13) << part.std << ' '
+                << std::setw(10) << part.nonans << ' '
+                << std::setw(10) << part.nozeros << std::endl;
+        }
+
+        if (json) {
+            std::cout << '}';
+        }
+    }
+
+    if (json) {
+        std::cout << "\n]" << std::endl;
+    }
+
+    return 0;
+}
+
+//! Measurement of single load of mat-file which is passed from child process.
+struct bench_sample_t {
+    int ok;
+    uint64_t wall_ns;
+    uint64_t rss;           ///< Growth of peak RSS in KiB.
+    double resident;        ///< Fraction of file in page cache before load.
+    matfile_stats_t stats;
+};
+
+//! Load mode of benchmark which fills statistics of reading.
+struct bench_mode_t {
+    const char *name;
+    int (*load)(const char *filename, const std::vector<std::string> &names,
+                matfile_stats_t *stats);
+};
+
+static uint64_t bench_clock(void) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int bench_read(const char *filename, size_t nothreads,
+                      matfile_stats_t *stats) {
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    ctx.nothreads = nothreads;
+    ctx.stats = stats;
+    matfile_ptr mat(matfile_read_ctx(filename, &ctx), matfile_destroy);
+    return !mat;
+}
+
+static int bench_eager(const char *filename, const std::vector<std::string> &,
+                       matfile_stats_t *stats) {
+    return bench_read(filename, 1, stats);
+}
+
+static int bench_parallel(const char *filename,
+                          const std::vector<std::string> &,
+                          matfile_stats_t *stats) {
+    return bench_read(filename, 0, stats);
+}
+
+static int bench_mmap(const char *filename, const std::vector<std::string> &,
+                      matfile_stats_t *stats) {
+    uint64_t clock = bench_clock();
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        return 1;
+    }
+
+    //  Pages are faulted in during parsing, so there is no read phase.
+    stats->phase_ns[MFPHASE_OPEN] += bench_clock() - clock;
+
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    ctx.nothreads = 1;
+    ctx.stats = stats;
+    matfile_ptr mat(matfile_read_memory(data, st.st_size, &ctx),
+                    matfile_destroy);
+    munmap(data, st.st_size);
+    return !mat;
+}
+
+static int bench_lazy(const char *filename,
+                      const std::vector<std::string> &names,
+                      matfile_stats_t *stats) {
+    uint64_t clock = bench_clock();
+    matfile_view_t *view = matfile_view_open(filename, MF_VIEW_READ);
+
+    if (!view) {
+        return 1;
+    }
+
+    stats->phase_ns[MFPHASE_OPEN] += bench_clock() - clock;
+    clock = bench_clock();
+
+    //  Arrays are bound to mapping on access, so every page of numerical
+    //  parts is touched in order to account page faults as reading.
+    long page = sysconf(_SC_PAGESIZE);
+    volatile unsigned char sink = 0;
+    int retcode = 0;
+
+    for (const std::string &name : names) {
+        matfile_array_t *array = matfile_view_get_array(view, name.c_str());
+
+        if (!array) {
+            retcode = 1;
+            break;
+        }
+
+        matfile_array_type_t type = static_cast<matfile_array_type_t>(
+            array->flags & MF_CLASS_MASK);
+        size_t length = matfile_array_numel(array)
+                      * matfile_get_type_size(matfile_get_storage_type(type));
+
+        for (const void *part : {array->pr.data, array->pi.data}) {
+            const unsigned char *data =
+                static_cast<const unsigned char *>(part);
+
+            for (size_t i = 0; data && i < length; i += page) {
+                sink += data[i];
+            }
+
+            stats->bytes_read += data ? length : 0;
+        }
+    }
+
+    (void)sink;
+    stats->phase_ns[MFPHASE_READ] += bench_clock() - clock;
+    return matfile_view_close(view) || retcode;
+}
+
+static const bench_mode_t bench_modes[] = {
+    {"eager", bench_eager},
+    {"lazy", bench_lazy},
+    {"mmap", bench_mmap},
+    {"parallel", bench_parallel},
+};
+
+//! Get fraction of file which resides in page cache.
+static double bench_resident(int fd, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    void *data = size ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)
+                      : MAP_FAILED;
+
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    std::vector<unsigned char> pages((size + page - 1) / page);
+    size_t noresident = 0;
+
+    if (!mincore(data, size, pages.data())) {
+        for (unsigned char flags : pages) {
+            noresident += flags & 1;
+        }
+    }
+
+    munmap(data, size);
+    return static_cast<double>(noresident) / pages.size();
+}
+
+//! Load mat-file in child process so that peak RSS of every load is isolated.
+static bench_sample_t bench_measure(const char *filename,
+                                    const std::vector<std::string> &names,
+                                    const bench_mode_t &mode) {
+    bench_sample_t sample = {};
+    int fds[2];
+
+    if (pipe(fds)) {
+        return sample;
+    }
+
+    std::fflush(NULL);
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        close(fds[0]);
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        uint64_t rss = usage.ru_maxrss;
+        uint64_t clock = bench_clock();
+
+        matfile_stats_reset(&sample.stats);
+        sample.ok = !mode.load(filename, names, &sample.stats);
+        sample.wall_ns = bench_clock() - clock;
+        getrusage(RUSAGE_SELF, &usage);
+        sample.rss = usage.ru_maxrss - rss;
+
+        ssize_t written = write(fds[1], &sample, sizeof(sample));
+        _exit(written != sizeof(sample));
+    }
+
+    close(fds[1]);
+
+    if (pid > 0 && read(fds[0], &sample, sizeof(sample)) != sizeof(sample)) {
+        sample.ok = 0;
+    }
+
+    close(fds[0]);
+
+    if (pid > 0) {
+        waitpid(pid, NULL, 0);
+    }
+
+    return sample;
+}
+
+//! Print throughput in MB/s or dash if phase took no time.
+static std::string bench_rate(uint64_t bytes, uint64_t ns) {
+    if (!bytes || !ns) {
+        return "-";
+    }
+
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.1f", bytes * 1e3 / ns);
+    return buffer;
+}
+
+int bench(int argc, char *argv[]) {
+    std::vector<const bench_mode_t *> modes;
+    size_t norepeats = 5;
+    bool cold = true;
+
+    for (const bench_mode_t &mode : bench_modes) {
+        modes.push_back(&mode);
+    }
+
+    for (int i = 1; i != argc; ++i) {
+        if (!std::strcmp(argv[i], "--repeat") && i + 1 != argc) {
+            norepeats = std::strtoul(argv[++i], NULL, 10);
+            norepeats = norepeats ? norepeats : 1;
+        }
+        else if (!std::strcmp(argv[i], "--modes") && i + 1 != argc) {
+            std::string list = std::string(argv[++i]) + ',';
+            modes.clear();
+
+            for (size_t pos = 0, end; (end = list.find(',', pos)) !=
+                                      std::string::npos; pos = end + 1) {
+                std::string name = list.substr(pos, end - pos);
+                auto it = std::find_if(
+                    std::begin(bench_modes), std::end(bench_modes),
+                    [&name](const bench_mode_t &mode) {
+                        return name == mode.name;
+                    });
+
+                if (it == std::end(bench_modes)) {
+                    std::cerr << "error: unknown mode `" << name << "`."
+                              << std::endl;
+                    return 1;
+                }
+
+                modes.push_back(it);
+            }
+        }
+        else if (!std::strcmp(argv[i], "--no-cold")) {
+            cold = false;
+        }
+        else {
+            std::cerr << "error: unknown option `" << argv[i] << "`."
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    unique_ptr<matfile_estimate_t, decltype(&matfile_estimate_destroy)>
+        estimate(matfile_estimate(argv[0], NULL, 0), matfile_estimate_destroy);
+
+    if (!estimate) {
+        std::cerr << "matfile scanning was failed" << std::endl;
+        return 1;
+    }
+
+    //  Only uncompressed arrays could be viewed lazily.
+    std::vector<std::string> names;
+    bool compressed = false;
+
+    for (size_t i = 0; i != estimate->noentries; ++i) {
+        names.push_back(estimate->entries[i].name);
+        compressed |= !!estimate->entries[i].inflated;
+    }
+
+    //  Parallel inflate needs blocks listed in sidecar index.
+    unique_ptr<matfile_index_t, decltype(&matfile_index_destroy)>
+        index(matfile_index_read(argv[0]), matfile_index_destroy);
+    bool blocks = false;
+
+    for (size_t i = 0; index && i != index->noentries; ++i) {
+        blocks |= index->entries[i].noblocks > 1;
+    }
+
+    int fd = open(argv[0], O_RDONLY);
+
+    if (fd < 0) {
+        std::cerr << "could not open file `" << argv[0] << "`" << std::endl;
+        return 1;
+    }
+
+    //  Dropping of page cache is advisory, so residency is reported to show
+    //  whether cold runs were cold indeed.
+    if (cold && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) {
+        std::cerr << "warning: page cache could not be dropped, cold runs "
+                  << "are skipped" << std::endl;
+        cold = false;
+    }
+
+    std::cout
+        << "file size " << estimate->file_size << " bytes, "
+        << names.size() << " arrays, " << norepeats << " runs per row, "
+        << "median by wall time" << std::endl;
+
+    if (compressed && std::find(modes.begin(), modes.end(), &bench_modes[1])
+                      != modes.end()) {
+        std::cout << "lazy mode is skipped: compressed arrays could not be "
+                  << "viewed" << std::endl;
+        modes.erase(std::find(modes.begin(), modes.end(), &bench_modes[1]));
+    }
+
+    if (compressed && !blocks &&
+        std::find(modes.begin(), modes.end(), &bench_modes[3])
+        != modes.end()) {
+        std::cout << "parallel mode inflates serially: there is no sidecar "
+                  << "index with blocks" << std::endl;
+    }
+
+    std::cout
+        << std::endl
+        << std::left << std::setw(8) << "mode" << ' '
+        << std::setw(5) << "cache" << ' '
+        << std::right << std::setw(8) << "resident" << ' '
+        << std::setw(10) << "wall ms" << ' '
+        << std::setw(9) << "open ms" << ' '
+        << std::setw(9) << "read ms" << ' '
+        << std::setw(10) << "inflate ms" << ' '
+        << std::setw(9) << "parse ms" << ' '
+        << std::setw(10) << "convert ms" << ' '
+        << std::setw(9) << "read MB/s" << ' '
+        << std::setw(12) << "inflate MB/s" << ' '
+        << std::setw(9) << "allocs" << ' '
+        << std::setw(10) << "alloc MiB" << ' '
+        << std::setw(9) << "RSS MiB" << std::endl;
+
+    struct stat st;
+    size_t size = fstat(fd, &st) ? 0 : st.st_size;
+    int retcode = 0;
+
+    for (const bench_mode_t *mode : modes) {
+        for (int pass = 0; pass != 1 + cold; ++pass) {
+            std::vector<bench_sample_t> samples;
+
+            for (size_t i = 0; i != norepeats; ++i) {
+                if (pass) {
+                    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                }
+                else if (!i) {
+                    //  Warm up page cache with untimed load.
+                    bench_measure(argv[0], names, *mode);
+                }
+
+                double resident = bench_resident(fd, size);
+                samples.push_back(bench_measure(argv[0], names, *mode));
+                samples.back().resident = resident;
+            }
+
+            std::sort(samples.begin(), samples.end(),
+                      [](const bench_sample_t &a, const bench_sample_t &b) {
+                          return a.ok > b.ok || (a.ok == b.ok &&
+                                                 a.wall_ns < b.wall_ns);
+                      });
+
+            const bench_sample_t &median = samples[samples.size() / 2];
+            const matfile_stats_t &stats = median.stats;
+
+            std::cout
+                << std::left << std::setw(8) << mode->name << ' '
+                << std::setw(5) << (pass ? "cold" : "warm") << ' '
+                << std::right << std::fixed << std::setprecision(1);
+
+            if (!median.ok) {
+                std::cout << std::setw(8) << "-" << " failed" << std::endl;
+                retcode = 1;
+                continue;
+            }
+
+            std::cout
+                << std::setw(7) << 100 * median.resident << "% "
+                << std::setw(10) << median.wall_ns / 1e6 << ' '
+                << std::setw(9) << stats.phase_ns[MFPHASE_OPEN] / 1e6 << ' '
+                << std::setw(9) << stats.phase_ns[MFPHASE_READ] / 1e6 << ' '
+                << std::setw(10) << stats.phase_ns[MFPHASE_INFLATE] / 1e6
+                << ' '
+                << std::setw(9) << stats.phase_ns[MFPHASE_PARSE] / 1e6 << ' '
+                << std::setw(10) << stats.phase_ns[MFPHASE_CONVERT] / 1e6
+                << ' '
+                << std::setw(9)
+                    << bench_rate(stats.bytes_read,
+                                  stats.phase_ns[MFPHASE_READ]) << ' '
+                << std::setw(12)
+                    << bench_rate(stats.bytes_inflated,
+                                  stats.phase_ns[MFPHASE_INFLATE]) << ' '
+                << std::setw(9) << stats.noallocs << ' '
+                << std::setw(10) << stats.alloc_bytes / 1048576.0 << ' '
+                << std::setw(9) << median.rss / 1024.0 << std::endl;
+        }
+    }
+
+    close(fd);
+    return retcode;
+}
+
+int subset(int argc, char *argv[]) {
+    std::vector<std::string> names, renames;
+
+    for (int i = 2; i != argc; ++i) {
+        std::string arg(argv[i]);
+        size_t pos = arg.find(':');
+        names.push_back(arg.substr(0, pos));
+        renames.push_back(pos == std::string::npos ? names.back()
+                                                   : arg.substr(pos + 1));
+    }
+
+    std::vector<const char *> cnames, crenames;
+
+    for (size_t i = 0; i != names.size(); ++i) {
+        cnames.push_back(names[i].c_str());
+        crenames.push_back(renames[i].c_str());
+    }
+
+    return matfile_subset(argv[0], argv[1], cnames.data(), crenames.data(),
+                          cnames.size());
+}
+
+int merge(int argc, char *argv[]) {
+    return matfile_merge(argv[0], argv + 1, argc - 1);
+}
+
+int drop(int argc, char *argv[]) {
+    return matfile_drop(argv[0], argv[1], argv + 2, argc - 2);
+}
+
+int repack(int argc, char *argv[]) {
+    matfile_repack_options_t opts;
+    matfile_repack_options_init(&opts);
+    std::vector<const char *> names;
+
+    for (int i = 2; i != argc; ++i) {
+        if (!std::strcmp(argv[i], "--level") && i + 1 != argc) {
+            //  Zero level stores arrays uncompressed.
+            opts.write.level = std::atoi(argv[++i]);
+            opts.write.compression = opts.write.level ? opts.write.compression
+                                                      : MFCOMP_NONE;
+        }
+        else if (!std::strcmp(argv[i], "--threads") && i + 1 != argc) {
+            opts.nothreads = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (!std::strcmp(argv[i], "--order") && i + 1 != argc) {
+            const char *order = argv[++i];
+            int no = 0;
+
+            while (no != MFORDER_COUNT && std::strcmp(order,
+                   matfile_get_repack_order_string(
+                       static_cast<matfile_repack_order_t>(no)))) {
+                ++no;
+            }
+
+            if (no == MFORDER_COUNT) {
+                std::cerr << "error: unknown order `" << order << "`."
+                          << std::endl;
+                return 1;
+            }
+
+            opts.order = static_cast<matfile_repack_order_t>(no);
+        }
+        else if (!std::strcmp(argv[i], "--block-size") && i + 1 != argc) {
+            opts.write.block_size = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (!std::strcmp(argv[i], "--no-index")) {
+            opts.write.index = 0;
+        }
+        else if (!std::strncmp(argv[i], "--", 2)) {
+            std::cerr << "error: unknown option `" << argv[i] << "`."
+                      << std::endl;
+            return 1;
+        }
+        else {
+            names.push_back(argv[i]);
+        }
+    }
+
+    if (opts.write.level > 9) {
+        std::cerr << "error: level should be in range from 0 to 9."
+                  << std::endl;
+        return 1;
+    }
+
+    if (!names.empty() && opts.order != MFORDER_LIST) {
+        std::cerr << "error: names are allowed with list order only."
+                  << std::endl;
+        return 1;
+    }
+
+    opts.names = names.data();
+    opts.nonames = names.size();
+    return matfile_repack(argv[0], argv[1], &opts);
+}
+
+int inspect(int argc, char *argv[]) {
     std::cout << "zlib version is " << zlibVersion() << std::endl;
-    std::cout << "read matfile from `" << argv[1] << "`..." << std::endl;
+    std::cout << "read matfile from `" << argv[0] << "`..." << std::endl;
 
-    matfile_ptr mat(matfile_read(argv[1]), matfile_destroy);
+    matfile_stats_t stats;
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    matfile_stats_reset(&stats);
+    ctx.stats = print_stats ? &stats : NULL;
+    ctx.trace = trace_filename ? matfile_trace_create() : NULL;
+
+    std::unique_ptr<matfile_latency_t, decltype(&matfile_latency_destroy)>
+        latency(print_stats ? matfile_latency_create() : NULL,
+                matfile_latency_destroy);
+    ctx.latency = latency.get();
+
+    matfile_ptr mat(matfile_read_ctx(argv[0], &ctx), matfile_destroy);
+
+    if (ctx.trace) {
+        int retcode = matfile_trace_dump(ctx.trace, trace_filename);
+        matfile_trace_destroy(ctx.trace);
+
+        if (retcode) {
+            return 1;
+        }
+    }
 
     if (!mat) {
         std::cerr << "matfile reading was failed" << std::endl;
@@ -87,5 +953,45 @@ int main(int argc, char *argv[]) {
         std::cout << i << " variable: " << *(varnames.get() + i) << std::endl;
     }
 
+    if (print_stats) {
+        std::cout
+            << "STATISTICS:" << std::endl
+            << "bytes read:            " << stats.bytes_read << std::endl
+            << "bytes inflated:        " << stats.bytes_inflated << std::endl
+            << "allocations:           " << stats.noallocs
+                << " (" << stats.alloc_bytes << " bytes)" << std::endl
+            << "bytes copied:          " << stats.copy_bytes << std::endl;
+
+        for (int i = 0; i != MFPHASE_COUNT; ++i) {
+            matfile_phase_t phase = static_cast<matfile_phase_t>(i);
+            std::string name = matfile_get_phase_string(phase);
+            std::cout
+                << name << " time:" << std::string(17 - name.size(), ' ')
+                << std::fixed << std::setprecision(3)
+                << stats.phase_ns[i] / 1e6 << " ms" << std::endl;
+        }
+
+        matfile_latency_snapshot_t snapshot;
+
+        for (int i = 0; latency && i != MFOP_COUNT; ++i) {
+            matfile_operation_t op = static_cast<matfile_operation_t>(i);
+            std::string name = matfile_get_operation_string(op);
+
+            if (matfile_latency_snapshot(latency.get(), op, MFSIZE_ANY,
+                                         &snapshot) || !snapshot.count) {
+                continue;
+            }
+
+            std::cout
+                << name << " latency:" << std::string(14 - name.size(), ' ')
+                << "p50 " << matfile_latency_quantile(&snapshot, 0.5) / 1e3
+                << " us, p99 "
+                    << matfile_latency_quantile(&snapshot, 0.99) / 1e3
+                << " us, p999 "
+                    << matfile_latency_quantile(&snapshot, 0.999) / 1e3
+                << " us (" << snapshot.count << " ops)" << std::endl;
+        }
+    }
+
     return 0;
 }
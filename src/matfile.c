@@ -8,14 +8,33 @@
 
 #include <matfile/matfile.h>
 #include <matfile/tape.h>
+#include "internal.h"
+#include "probes.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <zlib.h>
 
-//! Shortcut for memory freeing.
-#define SAFE_RELEASE(p)     if (p) {free((void *)p); p = NULL;}
+#define MF_INFLATE_CHUNK    (1u << 20)  ///<Inflated bytes between checks.
+#define MF_READ_CHUNK       (4u << 20)  ///<Bytes read between checks.
+
+//! Increase counter of statistics if they are collected.
+#define STATS_ADD(state, field, n)                                          \
+    do {                                                                    \
+        if ((state) && (state)->stats) {(state)->stats->field += (n);}      \
+    } while (0)
+
+//! Account heap allocation of reader if statistics are collected.
+#define STATS_ALLOC(state, size)                                            \
+    do {                                                                    \
+        MF_PROBE1(alloc, (size));                                           \
+        if ((state) && (state)->stats) {                                    \
+            (state)->stats->noallocs += 1;                                  \
+            (state)->stats->alloc_bytes += (size);                          \
+        }                                                                   \
+    } while (0)
 
 static const char *array_type_string[] = {
     "mxCELL_CLASS",
@@ -77,39 +96,58 @@ static size_t data_type_size[] = {
     0,                  //  not numerical type
 };
 
-static int swap_bytes = 0;
+static matfile_data_type_t array_storage_type[] = {
+    0,              //  mxCELL_CLASS
+    0,              //  mxSTRUCT_CLASS
+    0,              //  mxOBJECT_CLASS
+    0,              //  mxCHAR_CLASS
+    0,              //  mxSPARSE_CLASS
+    MFDT_DOUBLE,
+    MFDT_SINGLE,
+    MFDT_INT8,
+    MFDT_UINT8,
+    MFDT_INT16,
+    MFDT_UINT16,
+    MFDT_INT32,
+    MFDT_UINT32,
+    MFDT_INT64,
+    MFDT_UINT64,
+};
 
-/**
- *  Decompress compressed data element with zlib. It accepts data element of
- *  miCOMPRESSED type. After decomporession the routine modifies data element
- *  in way to store correct inflated content.
- *
- *  \note In order to prevent data leak though zlib stream it would be better
- *  to initialize and destroy stream in this function but decompression logic
- *  move to subroutine.
- *
- *  \param[in,out] element Compressed byte array. It should be of miCOMPRESSED
- *  type before invocation, and it should contains compressed with correct size
- *  field.
- *  \return Return zero if data element decompression was successful, otherwise
- *  result is not zero.
- */
-int decompress_data_element(matfile_data_element_t *element);
+static const char *phase_strings[] = {
+    "open",
+    "read",
+    "inflate",
+    "parse",
+    "convert",
+};
 
 /**
  *  Parse raw data in suggesstion it contains mat-file matrix data type.
  *
- *  \todo Cast (type) compressed data.
- *
- *  \bug There is no type restoration due to values downcasting.
  *  \bug It only supports numerical arrays by now.
  *
  *  \param[in] data   Raw array of bytes.
  *  \param[in] length Length of raw data array.
+ *  \param[in] state  State of reading.
  *  \return If parsing was successful it returns data structures that
  *  represents array in mat-file, otherwise null.
  */
-matfile_array_t *parse_array(const void *data, size_t length);
+matfile_array_t *parse_array(const void *data,
+                             size_t length,
+                             parse_state_t *state);
+
+/**
+ *  Parse mat-file which is entirely in memory.
+ *
+ *  \param[in] data  Bytes of mat-file starting from header.
+ *  \param[in] size  Size of mat-file in bytes.
+ *  \param[in] state State of reading with consistent sidecar index or null.
+ *  \return Parsed mat-file on success, otherwise null.
+ */
+matfile_t *parse_matfile(const void *data,
+                         size_t size,
+                         parse_state_t *state);
 
 /**
  *  Parse arbitrary data that is expected to contain correct data element
@@ -124,12 +162,14 @@ matfile_array_t *parse_array(const void *data, size_t length);
  *  \param[in]  length
  *  \param[in]  endianness The endiannes indicator.
  *  \param[out] noelements
+ *  \param[in]  state      State of reading.
  *  \return If parsing was successful it returns array of data elements.
  */
 matfile_data_element_t *parse_data_elements(const void *data,
                                             size_t length,
                                             matfile_endianness_t endianness,
-                                            size_t *noelements);
+                                            size_t *noelements,
+                                            parse_state_t *state);
 
 /**
  *  Parse data element from raw bytes that is typed as mxMATRIX.
@@ -137,57 +177,118 @@ matfile_data_element_t *parse_data_elements(const void *data,
  *  \param[in,out] array  Data structure that describes numerical array.
  *  \param[in]     data   Pointer to buffer of raw data.
  *  \param[in]     length Length of buffer.
+ *  \param[in]     state  State of reading.
  *  \return Return zero if numerical array parsed successfully, otherwise not
  *  zero value.
  */
 int parse_numerical_array(matfile_array_t *array,
                           const void *data,
-                          size_t length);
+                          size_t length,
+                          parse_state_t *state);
 
 /**
- *  Parse real or imaginary part of numerical array since there is not
- *  difference between them for parsing. Both of part types are represented
- *  with data element of the same structure.
+ *  Get monotonic time in nanoseconds if statistics are collected.
  *
- *  \todo Cast array elements to origin data type.
+ *  \param[in] state State of reading or null.
+ *  \return Current time or zero if there are no statistics.
+ */
+uint64_t stats_clock(const parse_state_t *state);
+
+/**
+ *  Account time elapsed since clock to phase if statistics are collected and
+ *  restart clock.
  *
- *  \param[in,out] array
- *  \param[out] part
- *  \param[in]  data
- *  \param[in,out] length
- *  \return Return pointer to rest of data if parsing was successful, otherwise
- *  null.
+ *  \param[in]     state State of reading or null.
+ *  \param[in]     phase Phase of reading.
+ *  \param[in,out] clock Start time of phase which is set to current time.
  */
-const void *parse_numerical_part(matfile_array_t *array,
-                                 matfile_numerical_part_t *part,
-                                 const void *data,
-                                 size_t *length);
+void stats_phase(const parse_state_t *state,
+                 matfile_phase_t phase,
+                 uint64_t *clock);
 
 /**
- *  This function swaps 2 bytes i.e. change byte order.
+ *  Check whether current reading is cancelled or its deadline has passed.
+ *  Reason of interruption is kept in state until status of reading is
+ *  reported.
  *
- *  \param[in] word Byte word.
- *  \return Reversed byte word.
+ *  \param[in] state State of reading or null.
+ *  \return Return not zero if reading should be abandoned, otherwise zero.
  */
-uint16_t swap2(uint16_t word);
+int interrupted(parse_state_t *state);
 
 /**
- *  This function swaps 4 bytes i.e. change byte order.
+ *  Report status of reading into its context.
  *
- *  \param[in] dword Byte double word.
- *  \return Reversed byte double word.
+ *  \param[in] state State of reading.
+ *  \param[in] mat   Result of reading.
  */
-uint32_t swap4(uint32_t dword);
+void report_status(const parse_state_t *state, const matfile_t *mat);
 
 /**
- *  This function swaps 4 bytes i.e. change byte order.
+ *  Initialize state of reading with given context.
  *
- *  \param[in] quad Byte quad word.
- *  \return Reversed byte quad word.
+ *  \param[out] state State of reading.
+ *  \param[in]  ctx   Reading context or null.
  */
-uint64_t swap8(uint64_t quad);
+void init_parse_state(parse_state_t *state, const matfile_context_t *ctx);
+
+/**
+ *  Read whole mat-file into memory and parse it.
+ *
+ *  \param[in]     filename Name of mat-file.
+ *  \param[in,out] state    State of reading which sidecar index is set.
+ *  \return Parsed mat-file on success, otherwise null.
+ */
+matfile_t *read_matfile(const char *filename, parse_state_t *state);
+
+/**
+ *  Release contents of data elements but not data elements themselves.
+ *
+ *  \param[in] elements   Data elements.
+ *  \param[in] noelements Number of data elements.
+ */
+void release_data_elements(matfile_data_element_t *elements,
+                           size_t noelements);
+
+/**
+ *  Copy tag of data element and switch its byte order if byte order of
+ *  mat-file differs from the one of platform. Payload of small data element
+ *  keeps its byte order.
+ *
+ *  \param[out] tag   Destination of tag.
+ *  \param[in]  data  Tag of data element in mat-file.
+ *  \param[in]  state State of reading or null.
+ */
+static void load_tag(void *tag, const void *data, const parse_state_t *state) {
+    uint32_t words[2];
+    memcpy(words, data, sizeof(words));
+
+    if (state && state->swap_bytes) {
+        words[0] = swap4(words[0], 1);
+        words[1] = words[0] >> 16 ? words[1] : swap4(words[1], 1);
+    }
+
+    memcpy(tag, words, sizeof(words));
+}
+
+/**
+ *  Decode tag of data element in byte order of mat-file being read.
+ *
+ *  \see mf_decode_tag
+ */
+static const void *read_tag(const void *data,
+                            uint32_t *type,
+                            uint32_t *size,
+                            size_t *length,
+                            const parse_state_t *state) {
+    uint32_t tag[2];
+    load_tag(tag, data, state);
+    const char *rest = mf_decode_tag(tag, type, size, length);
+    return (const char *)data + (rest - (const char *)tag);
+}
 
-int decompress_data_element(matfile_data_element_t *element) {
+int decompress_data_element(matfile_data_element_t *element,
+                            parse_state_t *state) {
     //  Initialize tape for inflated data.
     size_t tag_size = sizeof(matfile_data_element_small_t);
     size_t buffer_size = element->large.size | 0x80;    //  128+ bytes
@@ -236,6 +337,7 @@ int decompress_data_element(matfile_data_element_t *element) {
 
     //  Validate (large) data element structure.
     matfile_data_element_t *subel = base;
+    load_tag(subel, subel, state);
 
     if (!(subel->large.type >= MFDT_INT8 && subel->large.type < MFDT_COUNT)) {
         fprintf(stderr, "wrong data type of data subelement: %d\n",
@@ -254,20 +356,36 @@ int decompress_data_element(matfile_data_element_t *element) {
     size_t avail_size = buffer_size - tag_size - stream.avail_out;
     size_t rest_size = element->large.size - avail_size;
     memmove(base, data, avail_size);
+    STATS_ADD(state, copy_bytes, avail_size);
 
     //  Inflate rest of the data.
     tape_pop(tape, buffer_size);
     tape_push(tape, avail_size);
 
     stream.next_out = tape_push(tape, rest_size);
-    stream.avail_out = rest_size;
     stream.total_out = rest_size;
 
-    if ((code = inflate(&stream, Z_SYNC_FLUSH)) < Z_OK) {
-        fprintf(stderr, "inflate failed with error code %d\n", code);
-        tape_destroy(tape);
-        inflateEnd(&stream);
-        return 1;
+    //  Inflate by chunks so that reading could be interrupted midway.
+    while (code != Z_STREAM_END) {
+        size_t chunk_size = rest_size < MF_INFLATE_CHUNK
+                          ? rest_size
+                          : MF_INFLATE_CHUNK;
+        stream.avail_out = chunk_size;
+
+        if ((code = inflate(&stream, Z_SYNC_FLUSH)) < Z_OK) {
+            fprintf(stderr, "inflate failed with error code %d\n", code);
+            tape_destroy(tape);
+            inflateEnd(&stream);
+            return 1;
+        }
+
+        rest_size -= chunk_size - stream.avail_out;
+
+        if (interrupted(state)) {
+            tape_destroy(tape);
+            inflateEnd(&stream);
+            return 1;
+        }
     }
 
     //  There is no input data on correct data element decompression.
@@ -291,11 +409,19 @@ int decompress_data_element(matfile_data_element_t *element) {
     return 0;
 }
 
-matfile_array_t *parse_array(const void *data, size_t length) {
+const void *mf_parse_array_header(matfile_array_t *array,
+                                  const void *data,
+                                  size_t length,
+                                  size_t *name_offset,
+                                  const parse_state_t *state) {
     size_t offset = 0, size = 0, padding;
     const char *bytes = data;
-    matfile_data_element_t *elem = NULL;
-    matfile_array_t array;
+    matfile_data_element_t tag, *elem = NULL;
+
+    array->dims = NULL;
+    array->name = NULL;
+    array->pr.data = NULL;
+    array->pi.data = NULL;
 
     //  Get array flag subelement. See table 1-2.
     size = sizeof(matfile_data_element_small_t);
@@ -305,7 +431,8 @@ matfile_array_t *parse_array(const void *data, size_t length) {
         return NULL;
     }
 
-    elem = (matfile_data_element_t *)(bytes + offset);
+    load_tag(&tag, bytes + offset, state);
+    elem = &tag;
     offset += size;
 
     if (elem->large.type != MFDT_UINT32) {
@@ -320,7 +447,15 @@ matfile_array_t *parse_array(const void *data, size_t length) {
         return NULL;
     }
 
-    array.flags = *((uint64_t *)(bytes + offset));  //  XXX: swap?
+    if (state && state->swap_bytes) {
+        //  Flags and maximal number of non-zero elements are separate words.
+        const uint32_t *words = (const uint32_t *)(bytes + offset);
+        array->flags = swap4(words[0], 1) | (uint64_t)swap4(words[1], 1) << 32;
+    }
+    else {
+        array->flags = *((uint64_t *)(bytes + offset));
+    }
+
     offset += sizeof(uint64_t);
 
     //  Get array dimenstion. See section 1-17.
@@ -331,7 +466,7 @@ matfile_array_t *parse_array(const void *data, size_t length) {
         return NULL;
     }
 
-    elem = (matfile_data_element_t *)(bytes + offset);
+    load_tag(&tag, bytes + offset, state);
     offset += size;
 
     if (elem->large.type != MFDT_INT32) {
@@ -351,58 +486,89 @@ matfile_array_t *parse_array(const void *data, size_t length) {
         return NULL;
     }
 
-    array.nodims = elem->large.size / 4;
-    array.dims = malloc(elem->large.size);
+    array->nodims = elem->large.size / 4;
+    array->dims = malloc(elem->large.size);
+    STATS_ALLOC(state, elem->large.size);
 
-    if (!array.dims) {
+    if (!array->dims) {
         fprintf(stderr, "could not allocate enough memory\n");
         return NULL;
     }
 
-    memcpy(array.dims, bytes + offset, elem->large.size);
+    memcpy(array->dims, bytes + offset, elem->large.size);
+
+    for (size_t i = 0; state && state->swap_bytes && i != array->nodims; ++i) {
+        array->dims[i] = swap4(array->dims[i], 1);
+    }
+
     padding = (MF_ALIGNMENT - elem->large.size % MF_ALIGNMENT) % MF_ALIGNMENT;
     offset += elem->large.size + padding;
 
-    //  Get array name of array variable. See table 1-2.
-    size = sizeof(matfile_data_element_small_t);
+    //  Get array name of array variable. Short names are usually stored in
+    //  small data element format. See table 1-2.
+    uint32_t name_type, name_size;
+    size_t name_length;
 
-    if (length < offset + size) {
+    if (length < offset + sizeof(matfile_data_element_small_t)) {
         fprintf(stderr, "too short subelement for matix: array name\n");
+        SAFE_RELEASE(array->dims)
         return NULL;
     }
 
-    elem = (matfile_data_element_t *)(bytes + offset);
-    offset += size;
+    const char *name = read_tag(bytes + offset, &name_type, &name_size,
+                                &name_length, state);
 
-    if (elem->large.type != MFDT_INT8) {
+    if (name_type != MFDT_INT8) {
         fprintf(stderr, "wrong data type of array name tag: %s(0x%08x)\n",
-            matfile_get_type_string(elem->large.type), elem->large.type);
+            matfile_get_type_string(name_type), name_type);
+        SAFE_RELEASE(array->dims)
         return NULL;
     }
 
-    if (length < offset + elem->large.size) {
+    if (length < offset + name_length) {
         fprintf(stderr, "too short subelement for matix: array name\n");
+        SAFE_RELEASE(array->dims)
         return NULL;
     }
 
-    array.length = elem->large.size;
-    array.name = malloc(elem->large.size + 1);
+    array->length = name_size;
+    array->name = malloc(name_size + 1);
+    STATS_ALLOC(state, name_size + 1);
 
-    if (!array.name) {
+    if (!array->name) {
         fprintf(stderr, "could not allocate enough memory\n");
+        SAFE_RELEASE(array->dims)
         return NULL;
     }
 
-    memcpy(array.name, bytes + offset, elem->large.size);
-    array.name[elem->large.size] = '\0';
-    padding = (MF_ALIGNMENT - elem->large.size % MF_ALIGNMENT) % MF_ALIGNMENT;
-    offset += elem->large.size + padding;
+    memcpy(array->name, name, name_size);
+    array->name[name_size] = '\0';
+
+    if (name_offset) {
+        *name_offset = offset;
+    }
+
+    offset += name_length;
+
+    return bytes + offset;
+}
+
+matfile_array_t *parse_array(const void *data,
+                             size_t length,
+                             parse_state_t *state) {
+    matfile_trace_t *trace = state->trace;
+    uint64_t clock = mf_trace_clock(trace);
+    matfile_array_t array;
+    const char *rest = mf_parse_array_header(&array, data, length, NULL, state);
+
+    if (!rest) {
+        return NULL;
+    }
 
     //  Next array parsing depends on array type.
     int retcode;
-    size_t rest_size = length - offset;
-    const void *rest = (const void *)(bytes + offset);
-    matfile_array_type_t array_type = array.flags & 0xff;
+    size_t rest_size = length - (rest - (const char *)data);
+    matfile_array_type_t array_type = array.flags & MF_CLASS_MASK;
 
     switch (array_type) {
     case MFMX_CELL_CLASS:
@@ -423,19 +589,27 @@ matfile_array_t *parse_array(const void *data, size_t length) {
     case MFMX_UINT64_CLASS:
     case MFMX_SINGLE_CLASS:
     case MFMX_DOUBLE_CLASS:
-        if ((retcode = parse_numerical_array(&array, rest, rest_size)) != 0) {
+        retcode = parse_numerical_array(&array, rest, rest_size, state);
+
+        if (retcode != 0) {
             fprintf(stderr, "error during numerical array parsing\n");
+            SAFE_RELEASE(array.dims)
+            SAFE_RELEASE(array.name)
+            SAFE_RELEASE(array.pr.data)
             return NULL;
         }
         break;
 
     default:
         fprintf(stderr, "unknown array type: %d\n", array_type);
+        SAFE_RELEASE(array.dims)
+        SAFE_RELEASE(array.name)
         return NULL;
     }
 
     //  Allocate memory for array and exit.
     matfile_array_t *array_ptr = malloc(sizeof(matfile_array_t));
+    STATS_ALLOC(state, sizeof(matfile_array_t));
 
     if (!array_ptr) {
         fprintf(stderr, "could not allocate memory for array\n");
@@ -443,6 +617,10 @@ matfile_array_t *parse_array(const void *data, size_t length) {
     }
 
     memcpy(array_ptr, &array, sizeof(matfile_array_t));
+    mf_trace_span(trace, "parse", array.name, clock, mf_trace_clock(trace),
+                  length);
+    MF_PROBE3(array__decoded, array.name, array_type,
+              matfile_array_numel(&array));
 
     return array_ptr;
 }
@@ -450,9 +628,11 @@ matfile_array_t *parse_array(const void *data, size_t length) {
 matfile_data_element_t *parse_data_elements(const void *data,
                                             size_t length,
                                             matfile_endianness_t endianness,
-                                            size_t *noelements) {
+                                            size_t *noelements,
+                                            parse_state_t *state) {
     //  Initialize auxillary structure to accumulate data elements.
     tape_t * tape = tape_create(16 * sizeof(matfile_data_element_t));
+    matfile_trace_t *trace = state->trace;
 
     if (!tape) {
         return NULL;
@@ -466,9 +646,24 @@ matfile_data_element_t *parse_data_elements(const void *data,
     for (size_t offset = 0; offset < length; ++(*noelements)) {
         size_t small_size = sizeof(matfile_data_element_small_t);
         size_t large_size = sizeof(matfile_data_element_large_t);
-        matfile_data_element_t *elem = tape_push(tape, large_size);
 
-        memcpy((void *)elem, (void *)(bytes + offset), small_size);
+        //  Data elements which are parsed so far are released if reading is
+        //  interrupted.
+        if (interrupted(state)) {
+            release_data_elements(tape_deref(tape), *noelements);
+            tape_destroy(tape);
+            return NULL;
+        }
+
+        matfile_data_element_t *elem = tape_push(tape, large_size);
+        uint64_t element_clock = mf_trace_clock(trace);
+        uint64_t lookup_begin = mf_latency_clock(state->latency);
+        uint64_t inflate_begin = 0, inflate_end = 0;
+#ifdef MATFILE_USDT_PROBES
+        size_t element_offset = offset;     //  It is reported by probes only.
+#endif
+
+        load_tag(elem, bytes + offset, state);
         offset += small_size;
 
         elem->large.data = NULL;    //  prevent uninit pointer bugs.
@@ -486,25 +681,75 @@ matfile_data_element_t *parse_data_elements(const void *data,
 
         if (!(data_type >= MFDT_INT8 && data_type < MFDT_COUNT)) {
             fprintf(stderr, "parsing was failed: corrupted mat-file\n");
+            release_data_elements(tape_deref(tape), *noelements);
             tape_destroy(tape);
             return NULL;
         }
 
+        MF_PROBE3(element__start, element_offset, data_type, data_size);
+
         //  Estimate the beginning of compressed data.
         void *buffer = (void *)(bytes + offset);
 
         //  Decompress data element. Only large data element contains
         //  compressed data.
         if (elem->large.type == MFDT_COMPRESSED) {
-            //  Decompress input data element.
+            //  Decompress input data element. Its blocks are inflated in
+            //  parallel if they are known from sidecar index.
+            //  Entries of sidecar index are in file order so lookup resumes
+            //  from the entry which follows the previous one.
+            const matfile_index_entry_t *entry = NULL;
+            const matfile_index_t *sidecar = state->sidecar;
+            uint64_t position = sizeof(matfile_header_t) + offset - small_size;
+
+            while (sidecar && state->cursor != sidecar->noentries &&
+                   sidecar->entries[state->cursor].offset < position) {
+                state->cursor += 1;
+            }
+
+            if (sidecar && state->cursor != sidecar->noentries &&
+                sidecar->entries[state->cursor].offset == position) {
+                entry = &sidecar->entries[state->cursor];
+            }
+
             elem->large.data = buffer;
+            uint64_t clock = stats_clock(state);
+            uint64_t latency_begin = mf_latency_clock(state->latency);
+            inflate_begin = mf_trace_clock(trace);
+            MF_PROBE2(inflate__start, element_offset, data_size);
+
+            //  Stale sidecar index is ignored for the rest of reading once
+            //  its block table fails validation or checksum, and data
+            //  element is inflated serially.
+            int failed = 1;
+
+            if (entry && entry->noblocks > 1 &&
+                (failed = mf_decompress_blocks(elem, entry, state->ctx,
+                                               trace))) {
+                state->sidecar = NULL;
+            }
 
-            if (decompress_data_element(elem)) {
-                fprintf(stderr, "decompression of data element failed\n");
+            if (failed && !interrupted(state)) {
+                failed = decompress_data_element(elem, state);
+            }
+
+            if (failed) {
+                if (!interrupted(state)) {
+                    fprintf(stderr, "decompression of data element failed\n");
+                }
+
+                release_data_elements(tape_deref(tape), *noelements);
                 tape_destroy(tape);
                 return NULL;
             }
 
+            stats_phase(state, MFPHASE_INFLATE, &clock);
+            mf_latency_record(state->latency, MFOP_INFLATE, elem->large.size,
+                              latency_begin, mf_latency_clock(state->latency));
+            inflate_end = mf_trace_clock(trace);
+            MF_PROBE2(inflate__end, element_offset, elem->large.size);
+            STATS_ADD(state, bytes_inflated, small_size + elem->large.size);
+            STATS_ALLOC(state, elem->large.size);
             buffer = elem->large.data;
         }
         else {
@@ -515,21 +760,23 @@ matfile_data_element_t *parse_data_elements(const void *data,
         }
 
         if(elem->large.type == MFDT_MATRIX) {
-            elem->large.array = parse_array(buffer, elem->large.size);
+            elem->large.array = parse_array(buffer, elem->large.size, state);
         }
         else {
             //  Allocate memory in data element.
             elem->large.data = malloc(data_size);
+            STATS_ALLOC(state, data_size);
 
             if (!elem->large.data) {
                 fprintf(stderr, "could not allocate enough memory\n");
-                free(elem->large.data);
+                release_data_elements(tape_deref(tape), *noelements);
                 tape_destroy(tape);
                 return NULL;
             }
 
             //  Just copy bytes from buffer into data element content.
             memcpy(elem->large.data, buffer, data_size);
+            STATS_ADD(state, copy_bytes, data_size);
         }
 
         //  If the data type changes due decompression it means that buffer is
@@ -538,22 +785,49 @@ matfile_data_element_t *parse_data_elements(const void *data,
             free((void *)buffer);
         }
 
+        //  Spans of data element are recorded as soon as array name is
+        //  known.
+        if (trace) {
+            const char *name = elem->large.type == MFDT_MATRIX &&
+                               elem->large.array
+                             ? elem->large.array->name
+                             : NULL;
+
+            if (data_type == MFDT_COMPRESSED) {
+                mf_trace_span(trace, "inflate", name, inflate_begin,
+                              inflate_end, small_size + elem->large.size);
+            }
+
+            mf_trace_span(trace, "element", name, element_clock,
+                          mf_trace_clock(trace), small_size + data_size);
+        }
+
+        if (elem->large.type == MFDT_MATRIX && elem->large.array) {
+            mf_latency_record(state->latency, MFOP_LOOKUP, elem->large.size,
+                              lookup_begin, mf_latency_clock(state->latency));
+        }
+
+        MF_PROBE3(element__end, element_offset, elem->large.type, data_size);
         offset += data_size;
     }
 
+    STATS_ALLOC(state, tape_length(tape));
     return (matfile_data_element_t *)tape_purge(tape);
 }
 
 int parse_numerical_array(matfile_array_t *array,
                           const void *data,
-                          size_t len) {
+                          size_t len,
+                          parse_state_t *state) {
     //  Parse numerical parts.
     const void *end = (const void *)((const char *)data + len);
 
     array->pr.data = NULL;
     array->pi.data = NULL;
 
-    if ((data = parse_numerical_part(array, &array->pr, data, &len)) == NULL) {
+    data = parse_numerical_part(array, &array->pr, data, &len, state);
+
+    if (data == NULL) {
         fprintf(stderr, "could not parse real numerical part\n");
         return 1;
     }
@@ -562,7 +836,9 @@ int parse_numerical_array(matfile_array_t *array,
         return 0;   //  There is only real part.
     }
 
-    if ((data = parse_numerical_part(array, &array->pi, data, &len)) == NULL) {
+    data = parse_numerical_part(array, &array->pi, data, &len, state);
+
+    if (data == NULL) {
         fprintf(stderr, "could not parse imaginary numerical part\n");
         return 1;
     }
@@ -573,59 +849,197 @@ int parse_numerical_array(matfile_array_t *array,
 const void *parse_numerical_part(matfile_array_t *array,
                                  matfile_numerical_part_t *part,
                                  const void *data,
-                                 size_t *len) {
+                                 size_t *len,
+                                 parse_state_t *state) {
     //  Decode tag of numerical part.
     size_t length = *len;
     size_t tag_size = sizeof(matfile_data_element_small_t);
-    const matfile_data_element_t *elem = data;
 
     if (length < tag_size) {
         fprintf(stderr, "numerical part is too small\n");
         return NULL;
     }
 
-    if (length < tag_size + elem->large.size) {
+    uint32_t type, size;
+    size_t elem_length;
+    const void *bytes = read_tag(data, &type, &size, &elem_length, state);
+
+    if (length < (size_t)((const char *)bytes - (const char *)data) + size) {
         fprintf(stderr, "numerical part is too small\n");
         return NULL;
     }
 
-    if (!matfile_is_numerical(elem)) {
+    if (!matfile_get_type_size(type) || type > MFDT_UINT64) {
         fprintf(stderr, "data element as not numerical type\n");
         return NULL;
     }
 
-    //  Calculate total number of elements in array.
-    int noelems = 1;
-
-    for (int i = 0; i != array->nodims; ++i) {
-        noelems *= array->dims[i];
-    }
-
     //  Validate consisntency of numerical array size.
-    size_t type_size = data_type_size[elem->large.type - 1];
-    size_t size = type_size * noelems;
+    size_t noelems = matfile_array_numel(array);
 
-    if (elem->large.size != size) {
+    if (size != matfile_get_type_size(type) * noelems) {
         fprintf(stderr, "mismatch of data element sizes\n");
         return NULL;
     }
 
-    //  Allocate buffer for numerical part.
-    const void *bytes = (const void *)((const char *)data + tag_size);
-    part->data = malloc(size);
+    //  Values could be stored with narrower data type than array class has so
+    //  allocate buffer for numerical part according to array class.
+    matfile_array_type_t array_type = array->flags & MF_CLASS_MASK;
+    matfile_data_type_t part_type = matfile_get_storage_type(array_type);
+    size_t part_size = noelems * matfile_get_type_size(part_type);
+
+    matfile_trace_t *trace = state->trace;
+    uint64_t clock = stats_clock(state);
+    uint64_t trace_begin = mf_trace_clock(trace);
+    uint64_t latency_begin = mf_latency_clock(state->latency);
+    part->data = malloc(part_size ? part_size : 1);
+    STATS_ALLOC(state, part_size ? part_size : 1);
 
     if (!part->data) {
         fprintf(stderr, "could not allocate enough memory\n");
         return NULL;
     }
 
-    memcpy(part->data, bytes, size);
+    if (type == part_type && !state->swap_bytes) {
+        memcpy(part->data, bytes, size);
+        STATS_ADD(state, copy_bytes, size);
+    }
+    else if (mf_convert_numbers(part->data, part_type, bytes, type, noelems,
+                                state->swap_bytes)) {
+        fprintf(stderr, "could not restore data type of numerical part\n");
+        SAFE_RELEASE(part->data)
+        return NULL;
+    }
+
+    stats_phase(state, MFPHASE_CONVERT, &clock);
+    mf_latency_record(state->latency, MFOP_CONVERT, part_size, latency_begin,
+                      mf_latency_clock(state->latency));
+    mf_trace_span(trace, "convert", array->name, trace_begin,
+                  mf_trace_clock(trace), part_size);
+
+    //  Skip padding of numerical part if there is any.
+    if (elem_length > length) {
+        elem_length = length;
+    }
+
+    *len = length - elem_length;
+    return (const void *)((const char *)data + elem_length);
+}
+
+/**
+ *  Reverse order of bytes of value in place.
+ *
+ *  \param[in,out] value Pointer to value.
+ *  \param[in]     size  Size of value in bytes.
+ */
+static inline void reverse_bytes(void *value, size_t size) {
+    uint16_t word;
+    uint32_t dword;
+    uint64_t quad;
+
+    switch (size) {
+    case 2:
+        memcpy(&word, value, size);
+        word = swap2(word, 1);
+        memcpy(value, &word, size);
+        break;
+    case 4:
+        memcpy(&dword, value, size);
+        dword = swap4(dword, 1);
+        memcpy(value, &dword, size);
+        break;
+    case 8:
+        memcpy(&quad, value, size);
+        quad = swap8(quad, 1);
+        memcpy(value, &quad, size);
+        break;
+    }
+}
+
+//! Cast numbers from one type to another element by element. Byte order
+//! of source numbers is switched in separate loop so that the common case
+//! stays vectorizable.
+#define CONVERT_LOOP(dst_t, src_t)                                      \
+    if (swap) {                                                         \
+        for (size_t i = 0; i != n; ++i) {                               \
+            src_t value = ((const src_t *)src)[i];                      \
+            reverse_bytes(&value, sizeof(src_t));                       \
+            ((dst_t *)dst)[i] = (dst_t)value;                           \
+        }                                                               \
+    }                                                                   \
+    else {                                                              \
+        for (size_t i = 0; i != n; ++i) {                               \
+            ((dst_t *)dst)[i] = (dst_t)((const src_t *)src)[i];         \
+        }                                                               \
+    }                                                                   \
+    break;
+
+//! Dispatch conversion on type of source numbers.
+#define CONVERT_FROM(dst_t)                                             \
+    switch (src_type) {                                                 \
+    case MFDT_INT8:     CONVERT_LOOP(dst_t, int8_t)                     \
+    case MFDT_UINT8:    CONVERT_LOOP(dst_t, uint8_t)                    \
+    case MFDT_INT16:    CONVERT_LOOP(dst_t, int16_t)                    \
+    case MFDT_UINT16:   CONVERT_LOOP(dst_t, uint16_t)                   \
+    case MFDT_INT32:    CONVERT_LOOP(dst_t, int32_t)                    \
+    case MFDT_UINT32:   CONVERT_LOOP(dst_t, uint32_t)                   \
+    case MFDT_INT64:    CONVERT_LOOP(dst_t, int64_t)                    \
+    case MFDT_UINT64:   CONVERT_LOOP(dst_t, uint64_t)                   \
+    case MFDT_SINGLE:   CONVERT_LOOP(dst_t, float)                      \
+    case MFDT_DOUBLE:   CONVERT_LOOP(dst_t, double)                     \
+    default:                                                            \
+        return 1;                                                       \
+    }                                                                   \
+    break;
+
+int mf_convert_numbers(void *dst,
+                       matfile_data_type_t dst_type,
+                       const void *src,
+                       matfile_data_type_t src_type,
+                       size_t n,
+                       int swap) {
+    switch (dst_type) {
+    case MFDT_INT8:     CONVERT_FROM(int8_t)
+    case MFDT_UINT8:    CONVERT_FROM(uint8_t)
+    case MFDT_INT16:    CONVERT_FROM(int16_t)
+    case MFDT_UINT16:   CONVERT_FROM(uint16_t)
+    case MFDT_INT32:    CONVERT_FROM(int32_t)
+    case MFDT_UINT32:   CONVERT_FROM(uint32_t)
+    case MFDT_INT64:    CONVERT_FROM(int64_t)
+    case MFDT_UINT64:   CONVERT_FROM(uint64_t)
+    case MFDT_SINGLE:   CONVERT_FROM(float)
+    case MFDT_DOUBLE:   CONVERT_FROM(double)
+    default:
+        return 1;
+    }
 
-    return (const void *)((const char *)bytes + size);
+    return 0;
 }
 
-uint16_t swap2(uint16_t word) {
-    if (swap_bytes) {
+const void *mf_decode_tag(const void *data,
+                          uint32_t *type,
+                          uint32_t *size,
+                          size_t *length) {
+    const uint32_t *tag = data;
+
+    //  If upper 2 bytes of the first word are not zero, the tag uses the
+    //  small data element format and payload is packed into tag itself.
+    if (tag[0] >> 16) {
+        *type = tag[0] & 0xffff;
+        *size = tag[0] >> 16;
+        *length = sizeof(matfile_data_element_small_t);
+        return tag + 1;
+    }
+
+    size_t padding = (MF_ALIGNMENT - tag[1] % MF_ALIGNMENT) % MF_ALIGNMENT;
+    *type = tag[0];
+    *size = tag[1];
+    *length = sizeof(matfile_data_element_small_t) + tag[1] + padding;
+    return tag + 2;
+}
+
+uint16_t swap2(uint16_t word, int swap) {
+    if (swap) {
         uint16_t byte1 = (word & (0xff << 0)) >> 0;
         uint16_t byte2 = (word & (0xff << 8)) >> 8;
         word = (byte1 << 8) + byte2;
@@ -633,8 +1047,8 @@ uint16_t swap2(uint16_t word) {
     return word;
 }
 
-uint32_t swap4(uint32_t dword) {
-    if (swap_bytes) {
+uint32_t swap4(uint32_t dword, int swap) {
+    if (swap) {
         uint32_t byte1 = (dword & (0xff <<  0)) >>  0;
         uint32_t byte2 = (dword & (0xff <<  8)) >>  8;
         uint32_t byte3 = (dword & (0xff << 16)) >> 16;
@@ -644,8 +1058,8 @@ uint32_t swap4(uint32_t dword) {
     return dword;
 }
 
-uint64_t swap8(uint64_t quad) {
-    if (swap_bytes) {
+uint64_t swap8(uint64_t quad, int swap) {
+    if (swap) {
         uint64_t byte1 = (quad & (0xfful <<  0)) >>  0;
         uint64_t byte2 = (quad & (0xfful <<  8)) >>  8;
         uint64_t byte3 = (quad & (0xfful << 16)) >> 16;
@@ -660,6 +1074,101 @@ uint64_t swap8(uint64_t quad) {
     return quad;
 }
 
+matfile_t *matfile_create(void) {
+    matfile_t *mat = calloc(1, sizeof(matfile_t));
+
+    if (!mat) {
+        fprintf(stderr, "could not allocate memory for mat-file\n");
+        return NULL;
+    }
+
+    mat->header.version = 0x0100;
+    mat->header.endianness = ('M' << 8) | 'I';
+
+    return mat;
+}
+
+matfile_array_t *matfile_array_create(const char *name,
+                                      matfile_array_type_t type,
+                                      size_t nodims,
+                                      const int32_t *dims,
+                                      int complex) {
+    matfile_data_type_t data_type = matfile_get_storage_type(type);
+
+    if (!data_type) {
+        fprintf(stderr, "array type is not supported by now\n");
+        return NULL;
+    }
+
+    matfile_array_t *array = calloc(1, sizeof(matfile_array_t));
+
+    if (!array) {
+        fprintf(stderr, "could not allocate memory for array\n");
+        return NULL;
+    }
+
+    array->flags = type | (complex ? MF_FLAG_COMPLEX : 0);
+    array->nodims = nodims;
+    array->length = strlen(name);
+    array->dims = malloc(nodims * sizeof(int32_t));
+    array->name = malloc(array->length + 1);
+
+    if (!array->dims || !array->name) {
+        fprintf(stderr, "could not allocate memory for array\n");
+        matfile_array_destroy(array);
+        return NULL;
+    }
+
+    memcpy(array->dims, dims, nodims * sizeof(int32_t));
+    memcpy(array->name, name, array->length + 1);
+
+    //  Allocate at least one byte in order to distinguish empty part.
+    size_t size = matfile_array_numel(array) * matfile_get_type_size(data_type);
+    array->pr.data = calloc(size ? size : 1, 1);
+
+    if (complex) {
+        array->pi.data = calloc(size ? size : 1, 1);
+    }
+
+    if (!array->pr.data || (complex && !array->pi.data)) {
+        fprintf(stderr, "could not allocate memory for array\n");
+        matfile_array_destroy(array);
+        return NULL;
+    }
+
+    return array;
+}
+
+size_t matfile_array_numel(const matfile_array_t *array) {
+    size_t numel = 1;
+
+    for (size_t i = 0; i != array->nodims; ++i) {
+        numel *= array->dims[i];
+    }
+
+    return numel;
+}
+
+int matfile_add_array(matfile_t *mat, matfile_array_t *array) {
+    size_t size = (mat->noelements + 1) * sizeof(matfile_data_element_t);
+    matfile_data_element_t *elements = realloc(mat->elements, size);
+
+    if (!elements) {
+        fprintf(stderr, "could not reallocate memory for data elements\n");
+        return 1;
+    }
+
+    matfile_data_element_t *elem = &elements[mat->noelements];
+    memset(elem, 0, sizeof(matfile_data_element_t));
+    elem->large.type = MFDT_MATRIX;
+    elem->large.array = array;
+
+    mat->elements = elements;
+    mat->noelements += 1;
+
+    return 0;
+}
+
 void matfile_array_destroy(matfile_array_t *array) {
     //  Nothing to destroy.
     if (!array) {
@@ -685,24 +1194,28 @@ void matfile_destroy(matfile_t *mat) {
         return;
     }
 
-    for (size_t i = 0; i != mat->noelements; ++i) {
-        matfile_data_element_t *el = &mat->elements[i];
+    release_data_elements(mat->elements, mat->noelements);
+    free((void *)mat->elements);
+    free((void *)mat);
+}
+
+void release_data_elements(matfile_data_element_t *elements,
+                           size_t noelements) {
+    for (size_t i = 0; i != noelements; ++i) {
+        matfile_data_element_t *el = &elements[i];
 
         if (matfile_is_small(el) && !el->large.data) {
             continue;
         }
 
         //  Apply different destruct strategies for different types.
-        if (mat->elements[i].large.type == MFDT_MATRIX) {
+        if (el->large.type == MFDT_MATRIX) {
             matfile_array_destroy(el->large.array);
         }
         else {
-            free(mat->elements[i].large.data);
+            free(el->large.data);
         }
     }
-
-    free((void *)mat->elements);
-    free((void *)mat);
 }
 
 const char *matfile_get_type_string(matfile_data_type_t type) {
@@ -714,6 +1227,49 @@ const char *matfile_get_type_string(matfile_data_type_t type) {
     }
 }
 
+size_t matfile_get_type_size(matfile_data_type_t type) {
+    if (type < MFDT_INT8 || type > MFDT_UTF32) {
+        return 0;
+    }
+    else {
+        return data_type_size[type - 1];
+    }
+}
+
+const char *matfile_get_class_string(matfile_array_type_t type) {
+    if (type < MFMX_CELL_CLASS || type >= MFMX_COUNT) {
+        return "unknown";
+    }
+    else {
+        return array_type_string[type - 1];
+    }
+}
+
+matfile_data_type_t matfile_get_storage_type(matfile_array_type_t type) {
+    if (type < MFMX_CELL_CLASS || type >= MFMX_COUNT) {
+        return 0;
+    }
+    else {
+        return array_storage_type[type - 1];
+    }
+}
+
+matfile_array_t *matfile_get_array(const matfile_t *mat, const char *name) {
+    for (size_t i = 0; i != mat->noelements; ++i) {
+        const matfile_data_element_t *el = &mat->elements[i];
+
+        if (matfile_is_small(el) || el->large.type != MFDT_MATRIX) {
+            continue;
+        }
+
+        if (el->large.array && !strcmp(el->large.array->name, name)) {
+            return el->large.array;
+        }
+    }
+
+    return NULL;
+}
+
 //! Suplementary macro for external API.
 #define IS_SMALL(size, type)     (size!= 0 && type != 0)
 
@@ -739,10 +1295,106 @@ matfile_data_element_t *matfile_parse(const void *data,
                                       size_t *noelements) {
     //  Compressed data elements contains only not compressed data and not
     //  matrix.
-    return parse_data_elements(data, length, endianness, noelements);
+    parse_state_t state;
+    init_parse_state(&state, NULL);
+    state.swap_bytes = endianness == MFEND_SWITCH;
+    return parse_data_elements(data, length, endianness, noelements, &state);
+}
+
+void matfile_context_init(matfile_context_t *ctx) {
+    ctx->nothreads = 0;
+    ctx->stats = NULL;
+    ctx->trace = NULL;
+    ctx->latency = NULL;
+    ctx->cancel = NULL;
+    ctx->deadline = 0;
+    ctx->status = NULL;
+}
+
+void matfile_stats_reset(matfile_stats_t *stats) {
+    memset(stats, 0, sizeof(matfile_stats_t));
+}
+
+const char *matfile_get_phase_string(matfile_phase_t phase) {
+    return phase < MFPHASE_COUNT ? phase_strings[phase] : "unknown";
+}
+
+uint64_t mf_monotonic_ns(void) {
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+uint64_t stats_clock(const parse_state_t *state) {
+    return state && state->stats ? mf_monotonic_ns() : 0;
+}
+
+void stats_phase(const parse_state_t *state,
+                 matfile_phase_t phase,
+                 uint64_t *clock) {
+    if (state && state->stats) {
+        uint64_t now = stats_clock(state);
+        state->stats->phase_ns[phase] += now - *clock;
+        *clock = now;
+    }
+}
+
+void init_parse_state(parse_state_t *state, const matfile_context_t *ctx) {
+    state->ctx = ctx;
+    state->sidecar = NULL;
+    state->cursor = 0;
+    state->swap_bytes = 0;
+    state->stats = ctx ? ctx->stats : NULL;
+    state->trace = ctx ? ctx->trace : NULL;
+    state->latency = ctx ? ctx->latency : NULL;
+    state->status = MFSTATUS_OK;
+}
+
+int interrupted(parse_state_t *state) {
+    if (!state) {
+        return 0;
+    }
+
+    if (state->status == MFSTATUS_OK) {
+        state->status = mf_check_context(state->ctx);
+    }
+
+    return state->status != MFSTATUS_OK;
+}
+
+void report_status(const parse_state_t *state, const matfile_t *mat) {
+    const matfile_context_t *ctx = state->ctx;
+
+    if (ctx && ctx->status) {
+        *ctx->status = mat ? MFSTATUS_OK
+                     : state->status ? state->status
+                     : MFSTATUS_ERROR;
+    }
 }
 
 matfile_t *matfile_read(const char *filename) {
+    return matfile_read_ctx(filename, NULL);
+}
+
+matfile_t *matfile_read_ctx(const char *filename, const matfile_context_t *ctx) {
+    parse_state_t state;
+    init_parse_state(&state, ctx);
+
+    matfile_t *mat = read_matfile(filename, &state);
+    report_status(&state, mat);
+    return mat;
+}
+
+matfile_t *read_matfile(const char *filename, parse_state_t *state) {
+    //  Statistics and trace of file access are collected before parsing.
+    matfile_trace_t *trace = state->trace;
+    uint64_t clock = stats_clock(state);
+    uint64_t trace_begin = mf_trace_clock(trace);
+
     //  Open source file.
     FILE *fin = fopen(filename, "r");
 
@@ -751,67 +1403,124 @@ matfile_t *matfile_read(const char *filename) {
         return NULL;
     }
 
-    //  Alloc memory for result struct.
-    matfile_t *mat = malloc(sizeof(matfile_t));
+    //  Get to know size of matfile.
+    fseek(fin, 0, SEEK_END);
+    long end = ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+    stats_phase(state, MFPHASE_OPEN, &clock);
+    mf_trace_span(trace, "open", NULL, trace_begin, mf_trace_clock(trace), 0);
+    trace_begin = mf_trace_clock(trace);
 
-    if (!mat) {
+    //  Allocate enough large buffer for data.
+    size_t size = end > 0 ? end : 0;
+    void *data = malloc(size ? size : 1);
+    STATS_ALLOC(state, size ? size : 1);
+
+    if (!data) {
         fclose(fin);
         return NULL;
     }
 
-    //  And read bytes from file to header struct.
-    size_t header_size = sizeof(matfile_header_t);
+    //  Read whole file here by chunks so that reading could be interrupted.
+    for (size_t offset = 0; offset != size;) {
+        size_t chunk_size = size - offset < MF_READ_CHUNK
+                          ? size - offset
+                          : MF_READ_CHUNK;
 
-    if (fread(mat, 1, header_size, fin) != header_size) {
-        matfile_destroy(mat);
-        fclose(fin);
-        return NULL;
+        if ((state->status = mf_check_context(state->ctx)) ||
+            fread((char *)data + offset, 1, chunk_size, fin) != chunk_size) {
+            free(data);
+            fclose(fin);
+            return NULL;
+        }
+
+        offset += chunk_size;
     }
 
-    swap_bytes = mat->header.endianness == 0x494d; //   IM
-    matfile_endianness_t endianness;
+    fclose(fin);
+    STATS_ADD(state, bytes_read, size);
+    stats_phase(state, MFPHASE_READ, &clock);
+    mf_trace_span(trace, "read", NULL, trace_begin, mf_trace_clock(trace),
+                  size);
+    trace_begin = mf_trace_clock(trace);
+
+    //  Parse header and data elements.
+    matfile_index_t *index = matfile_index_read(filename);
+    stats_phase(state, MFPHASE_OPEN, &clock);
+    mf_trace_span(trace, "read index", NULL, trace_begin, mf_trace_clock(trace),
+                  0);
+    state->sidecar = index;
+    state->cursor = 0;
+    matfile_t *mat = parse_matfile(data, size, state);
+
+    state->sidecar = NULL;
+    matfile_index_destroy(index);
+    free(data); //  Buffer is temporary.
+    return mat;
+}
 
-    if (mat->header.endianness == 0x494d) {
-        endianness = MFEND_SWITCH;
-    }
-    else {
-        endianness = MFEND_SAME;
-    }
+matfile_t *matfile_read_memory(const void *data,
+                               size_t size,
+                               const matfile_context_t *ctx) {
+    parse_state_t state;
+    init_parse_state(&state, ctx);
 
-    //  Get to know size of data part of matfile.
-    long begin = ftell(fin);
-    fseek(fin, 0, SEEK_END);
-    long end = ftell(fin);
-    fseek(fin, begin, SEEK_SET);
+    matfile_t *mat = parse_matfile(data, size, &state);
+    report_status(&state, mat);
+    return mat;
+}
 
-    //  Allocate enough large buffer for data.
-    size_t data_size = end - begin;
-    void *data = malloc(data_size);
+matfile_t *parse_matfile(const void *data,
+                         size_t size,
+                         parse_state_t *state) {
+    size_t header_size = sizeof(matfile_header_t);
 
-    if (!data) {
-        matfile_destroy(mat);
-        fclose(fin);
+    if (size < header_size) {
+        fprintf(stderr, "too short mat-file: %zu bytes\n", size);
         return NULL;
     }
 
-    //  Read whole data from file here.
-    if (fread(data, 1, data_size, fin) != data_size) {
-        free(data);
-        matfile_destroy(mat);
-        fclose(fin);
+    //  Alloc memory for result struct.
+    uint64_t clock = stats_clock(state);
+    matfile_t *mat = calloc(1, sizeof(matfile_t));
+    STATS_ALLOC(state, sizeof(matfile_t));
+
+    if (!mat) {
         return NULL;
     }
 
-    fclose(fin);
+    memcpy(&mat->header, data, header_size);
 
-    //  Parse data elements.
-    mat->header.version = swap2(mat->header.version);
-    mat->elements = matfile_parse(data,
-                                  data_size,
-                                  endianness,
-                                  &mat->noelements);
+    state->swap_bytes = mat->header.endianness == 0x494d; //   IM
+    matfile_endianness_t endianness;
 
-    free(data); //  Buffer is temporary.
+    if (mat->header.endianness == 0x494d) {
+        endianness = MFEND_SWITCH;
+    }
+    else {
+        endianness = MFEND_SAME;
+    }
+
+    //  Parse data elements.
+    mat->header.version = swap2(mat->header.version, state->swap_bytes);
+
+    //  Time of inflate and conversion is excluded from parse time.
+    matfile_stats_t *stats = state->stats;
+    uint64_t nested = stats ? stats->phase_ns[MFPHASE_INFLATE]
+                            + stats->phase_ns[MFPHASE_CONVERT] : 0;
+
+    mat->elements = parse_data_elements((const char *)data + header_size,
+                                        size - header_size,
+                                        endianness,
+                                        &mat->noelements,
+                                        state);
+
+    if (stats) {
+        nested = stats->phase_ns[MFPHASE_INFLATE]
+               + stats->phase_ns[MFPHASE_CONVERT] - nested;
+        stats_phase(state, MFPHASE_PARSE, &clock);
+        stats->phase_ns[MFPHASE_PARSE] -= nested;
+    }
 
     if (!mat->elements) {
         matfile_destroy(mat);
@@ -0,0 +1,426 @@
+/**
+ *  \file passthrough.c
+ *  \brief The file contains routines which subset, merge and reorder
+ *  mat-files by copying of raw data elements without decoding.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include "internal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ *  Copy array data element with other name. Name subelement of uncompressed
+ *  array is rewritten and the rest of payload is copied as is. Compressed
+ *  array has to be inflated and deflated again.
+ *
+ *  \param[in] fin   Source file.
+ *  \param[in] fout  Target file.
+ *  \param[in] entry Index entry of array in source file.
+ *  \param[in] name  New name of array.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int rename_data_element(FILE *fin,
+                        FILE *fout,
+                        const matfile_index_entry_t *entry,
+                        const char *name);
+
+/**
+ *  Check whether index covers every data element of mat-file, i.e. its
+ *  entries follow each other from header to the end of file. Sidecar index
+ *  lists arrays only so it misses other top-level data elements.
+ *
+ *  \param[in] index Index of mat-file.
+ *  \return Return not zero if index is complete, otherwise zero.
+ */
+int index_is_complete(const matfile_index_t *index);
+
+/**
+ *  Copy data elements of source mat-file which are selected by names.
+ *
+ *  \param[in] fout     Target file.
+ *  \param[in] src      Name of source mat-file.
+ *  \param[in] names    Names of arrays.
+ *  \param[in] renames  New names of arrays or null. Null entry keeps name.
+ *  \param[in] nonames  Number of names.
+ *  \param[in] exclude  Copy all data elements except named ones if not zero,
+ *  otherwise copy named arrays in order of names.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int copy_selection(FILE *fout,
+                   const char *src,
+                   const char *const *names,
+                   const char *const *renames,
+                   size_t nonames,
+                   int exclude);
+
+int index_is_complete(const matfile_index_t *index) {
+    uint64_t offset = sizeof(matfile_header_t);
+
+    for (size_t i = 0; i != index->noentries; ++i) {
+        if (index->entries[i].offset != offset) {
+            return 0;
+        }
+
+        offset += index->entries[i].size;
+    }
+
+    return offset == index->file_size;
+}
+
+FILE *mf_open_output(const char *filename, char **tmpname) {
+    *tmpname = malloc(strlen(filename) + sizeof(".tmp"));
+
+    if (!*tmpname) {
+        fprintf(stderr, "could not allocate memory for filename\n");
+        return NULL;
+    }
+
+    sprintf(*tmpname, "%s.tmp", filename);
+
+    FILE *fout = fopen(*tmpname, "wb");
+
+    if (!fout) {
+        fprintf(stderr, "could not open file `%s` for writing\n", *tmpname);
+        free(*tmpname);
+        return NULL;
+    }
+
+    matfile_header_t header;
+    mf_fill_header(&header, NULL);
+
+    if (fwrite(&header, 1, sizeof(header), fout) != sizeof(header)) {
+        fprintf(stderr, "could not write header\n");
+        fclose(fout);
+        remove(*tmpname);
+        free(*tmpname);
+        return NULL;
+    }
+
+    return fout;
+}
+
+int mf_close_output(FILE *fout,
+                    char *tmpname,
+                    const char *filename,
+                    int retcode) {
+    if (fclose(fout)) {
+        fprintf(stderr, "could not close file `%s`\n", tmpname);
+        retcode = 1;
+    }
+
+    if (!retcode && rename(tmpname, filename)) {
+        fprintf(stderr, "could not replace `%s`\n", filename);
+        retcode = 1;
+    }
+
+    if (retcode) {
+        remove(tmpname);
+    }
+    else {
+        //  There is no index of new content.
+        char *sidecar = mf_index_filename(filename);
+
+        if (sidecar) {
+            remove(sidecar);
+            free(sidecar);
+        }
+    }
+
+    free(tmpname);
+    return retcode;
+}
+
+FILE *mf_open_source(const char *filename) {
+    FILE *fin = fopen(filename, "rb");
+    matfile_header_t header;
+
+    if (!fin) {
+        fprintf(stderr, "there is not such file `%s`\n", filename);
+        return NULL;
+    }
+
+    if (fread(&header, 1, sizeof(header), fin) != sizeof(header) ||
+        mf_validate_header(&header)) {
+        fprintf(stderr, "could not copy data elements of `%s`\n", filename);
+        fclose(fin);
+        return NULL;
+    }
+
+    return fin;
+}
+
+int rename_data_element(FILE *fin,
+                        FILE *fout,
+                        const matfile_index_entry_t *entry,
+                        const char *name) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint32_t tag[2];
+
+    if (pread(fileno(fin), tag, tag_size, entry->offset) != tag_size) {
+        fprintf(stderr, "could not read tag of data element\n");
+        return 1;
+    }
+
+    //  Uncompressed array header is small so it is read into memory and
+    //  payload is copied.
+    size_t length = entry->size - tag_size;
+    size_t probe = tag[0] == MFDT_MATRIX && length > MF_HEADER_PROBE
+                 ? MF_HEADER_PROBE
+                 : length;
+    char *payload = malloc(probe);
+
+    if (!payload) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        return 1;
+    }
+
+    if (pread(fileno(fin), payload, probe, entry->offset + tag_size) != probe) {
+        fprintf(stderr, "could not read data element\n");
+        free(payload);
+        return 1;
+    }
+
+    matfile_data_element_t element;
+    memset(&element, 0, sizeof(element));
+    element.large.type = tag[0];
+    element.large.size = tag[1];
+    element.large.data = payload;
+
+    if (tag[0] == MFDT_COMPRESSED) {
+        if (decompress_data_element(&element, NULL)) {
+            free(payload);
+            return 1;
+        }
+
+        free(payload);
+        payload = element.large.data;
+        probe = element.large.size;
+    }
+
+    if (element.large.type != MFDT_MATRIX) {
+        fprintf(stderr, "could not rename data element which is not array\n");
+        free(payload);
+        return 1;
+    }
+
+    //  Locate name subelement.
+    matfile_array_t array;
+    size_t name_offset;
+    const char *rest = mf_parse_array_header(&array, payload, probe,
+                                             &name_offset, NULL);
+
+    if (!rest) {
+        free(payload);
+        return 1;
+    }
+
+    free(array.dims);
+    free(array.name);
+
+    size_t header_size = rest - payload;
+    size_t rest_size = element.large.size - header_size;
+
+    //  Assemble new miMATRIX tag and header.
+    tape_t *tape = tape_create(tag_size + header_size + strlen(name) + 16);
+    int retcode = 0;
+
+    if (!tape || !tape_push(tape, tag_size)) {
+        fprintf(stderr, "could not create tape\n");
+        tape_destroy(tape);
+        free(payload);
+        return 1;
+    }
+
+    memcpy(tape_push(tape, name_offset), payload, name_offset);
+    retcode |= mf_serialize_data_element(tape, MFDT_INT8, name, strlen(name));
+
+    if (tag[0] == MFDT_COMPRESSED) {
+        memcpy(tape_push(tape, rest_size), rest, rest_size);
+    }
+
+    uint32_t *subtag = tape_deref(tape);
+    subtag[0] = MFDT_MATRIX;
+    subtag[1] = tape_length(tape) - tag_size
+              + (tag[0] == MFDT_COMPRESSED ? 0 : rest_size);
+
+    if (retcode) {
+        tape_destroy(tape);
+        free(payload);
+        return 1;
+    }
+
+    if (tag[0] == MFDT_MATRIX) {
+        //  Write new header and copy the rest of payload as is.
+        size_t size = tape_length(tape);
+
+        if (fwrite(tape_deref(tape), 1, size, fout) != size) {
+            fprintf(stderr, "could not write data element\n");
+            retcode = 1;
+        }
+        else {
+            uint64_t offset = entry->offset + tag_size + header_size;
+            retcode = mf_copy_data_element(fin, fout, offset, rest_size);
+        }
+    }
+    else {
+        void *compressed = NULL;
+        size_t compressed_size = 0;
+
+        retcode = mf_compress_buffer(tape_deref(tape), tape_length(tape), 6,
+                                     &compressed, &compressed_size);
+
+        if (!retcode) {
+            uint32_t ctag[2] = {MFDT_COMPRESSED, compressed_size};
+
+            if (fwrite(ctag, 1, tag_size, fout) != tag_size ||
+                fwrite(compressed, 1, compressed_size, fout)
+                    != compressed_size) {
+                fprintf(stderr, "could not write data element\n");
+                retcode = 1;
+            }
+
+            free(compressed);
+        }
+    }
+
+    tape_destroy(tape);
+    free(payload);
+    return retcode;
+}
+
+int copy_selection(FILE *fout,
+                   const char *src,
+                   const char *const *names,
+                   const char *const *renames,
+                   size_t nonames,
+                   int exclude) {
+    FILE *fin = mf_open_source(src);
+
+    if (!fin) {
+        return 1;
+    }
+
+    //  Prefer sidecar index to scan of data elements unless it misses some
+    //  of them.
+    matfile_index_t *index = matfile_index_read(src);
+
+    if (index && !index_is_complete(index)) {
+        matfile_index_destroy(index);
+        index = NULL;
+    }
+
+    if (!index && !(index = matfile_index_scan(src))) {
+        fclose(fin);
+        return 1;
+    }
+
+    int retcode = 0;
+
+    if (exclude) {
+        for (size_t i = 0; i != index->noentries && !retcode; ++i) {
+            const matfile_index_entry_t *entry = &index->entries[i];
+            int excluded = 0;
+
+            for (size_t j = 0; j != nonames && !excluded; ++j) {
+                excluded = !strcmp(entry->name, names[j]);
+            }
+
+            if (!excluded) {
+                retcode = mf_copy_data_element(fin, fout, entry->offset,
+                                               entry->size);
+            }
+        }
+    }
+    else {
+        for (size_t i = 0; i != nonames && !retcode; ++i) {
+            const matfile_index_entry_t *entry;
+            const char *rename = renames ? renames[i] : NULL;
+
+            if (!(entry = matfile_index_find(index, names[i]))) {
+                fprintf(stderr, "there is no array `%s` in `%s`\n",
+                    names[i], src);
+                retcode = 1;
+            }
+            else if (rename && strcmp(rename, names[i])) {
+                retcode = rename_data_element(fin, fout, entry, rename);
+            }
+            else {
+                retcode = mf_copy_data_element(fin, fout, entry->offset,
+                                               entry->size);
+            }
+        }
+    }
+
+    matfile_index_destroy(index);
+    fclose(fin);
+    return retcode;
+}
+
+int matfile_subset(const char *src,
+                   const char *dst,
+                   const char *const *names,
+                   const char *const *renames,
+                   size_t nonames) {
+    char *tmpname;
+    FILE *fout = mf_open_output(dst, &tmpname);
+
+    if (!fout) {
+        return 1;
+    }
+
+    int retcode = copy_selection(fout, src, names, renames, nonames, 0);
+    return mf_close_output(fout, tmpname, dst, retcode);
+}
+
+int matfile_drop(const char *src,
+                 const char *dst,
+                 const char *const *names,
+                 size_t nonames) {
+    char *tmpname;
+    FILE *fout = mf_open_output(dst, &tmpname);
+
+    if (!fout) {
+        return 1;
+    }
+
+    int retcode = copy_selection(fout, src, names, NULL, nonames, 1);
+    return mf_close_output(fout, tmpname, dst, retcode);
+}
+
+int matfile_merge(const char *dst, const char *const *srcs, size_t nosrcs) {
+    char *tmpname;
+    FILE *fout = mf_open_output(dst, &tmpname);
+
+    if (!fout) {
+        return 1;
+    }
+
+    //  Data elements are contiguous so payload of every source is copied at
+    //  once.
+    int retcode = 0;
+
+    for (size_t i = 0; i != nosrcs && !retcode; ++i) {
+        FILE *fin = mf_open_source(srcs[i]);
+
+        if (!fin) {
+            retcode = 1;
+            break;
+        }
+
+        long begin = sizeof(matfile_header_t);
+        fseek(fin, 0, SEEK_END);
+        long end = ftell(fin);
+
+        retcode = mf_copy_data_element(fin, fout, begin, end - begin);
+        fclose(fin);
+    }
+
+    return mf_close_output(fout, tmpname, dst, retcode);
+}
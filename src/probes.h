@@ -0,0 +1,27 @@
+/**
+ *  \file probes.h
+ *  \brief This file defines USDT probes of provider `matfile` which could be
+ *  attached with bpftrace or SystemTap. Probes are built only if library is
+ *  configured with USDT_PROBES, otherwise they expand to nothing.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#pragma once
+
+#ifdef MATFILE_USDT_PROBES
+
+#include <sys/sdt.h>
+
+#define MF_PROBE1(name, a)          DTRACE_PROBE1(matfile, name, a)
+#define MF_PROBE2(name, a, b)       DTRACE_PROBE2(matfile, name, a, b)
+#define MF_PROBE3(name, a, b, c)    DTRACE_PROBE3(matfile, name, a, b, c)
+
+#else
+
+#define MF_PROBE1(name, a)
+#define MF_PROBE2(name, a, b)
+#define MF_PROBE3(name, a, b, c)
+
+#endif
@@ -0,0 +1,598 @@
+/**
+ *  \file repack.c
+ *  \brief The file contains recompression and reordering of data elements of
+ *  mat-file. Data elements are inflated and deflated again on many threads
+ *  and the calling thread writes them in order as soon as they are ready.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+//! Number of data elements which are encoded ahead of writing per thread.
+#define MF_REPACK_WINDOW    2u
+
+static const char *repack_order_strings[] = {
+    "keep",
+    "size",
+    "name",
+    "list",
+};
+
+/**
+ *  Data element of source mat-file and its encoding in output mat-file.
+ */
+typedef struct _repack_item_t {
+    const matfile_index_entry_t *entry;     ///<Source data element.
+    uint32_t                     type;      ///<Data type of source element.
+    uint64_t                     inflated;  ///<Size of inflated element.
+    uint32_t                     tag[2];    ///<Tag of compressed element.
+    void                        *data;      ///<Encoded data element.
+    size_t                       size;      ///<Size of encoded data element.
+    tape_t                      *blocks;    ///<Block boundaries or null.
+    int                          ready;     ///<Data element is encoded.
+} repack_item_t;
+
+/**
+ *  Shared state of workers which encode data elements and of the calling
+ *  thread which writes them.
+ */
+typedef struct _repack_job_t {
+    int                             fd;         ///<Source mat-file.
+    repack_item_t                 **order;      ///<Items in output order.
+    size_t                          noitems;    ///<Number of items.
+    size_t                          next;       ///<Next item to encode.
+    size_t                          nowritten;  ///<Number of written items.
+    size_t                          window;     ///<Items encoded ahead.
+    int                             failed;     ///<Some item failed.
+    const matfile_write_options_t  *opts;       ///<Compression options.
+    pthread_mutex_t                 mutex;      ///<Guard of counters.
+    pthread_cond_t                  cond;       ///<Progress of counters.
+} repack_job_t;
+
+/**
+ *  Read tag of source data element and size of its inflated miMATRIX data
+ *  element. Compressed data element is inflated only until array name.
+ *
+ *  \param[in]     fd   File descriptor of source mat-file.
+ *  \param[in,out] item Item which entry is set.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int repack_plan(int fd, repack_item_t *item);
+
+/**
+ *  Arrange items in output order.
+ *
+ *  \param[out] order   Items in output order.
+ *  \param[in]  items   Items in source order.
+ *  \param[in]  noitems Number of items.
+ *  \param[in]  opts    Repack options.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int repack_order(repack_item_t **order,
+                 repack_item_t *items,
+                 size_t noitems,
+                 const matfile_repack_options_t *opts);
+
+/**
+ *  Compare items by size of inflated data element. Items of equal size keep
+ *  source order.
+ */
+int compare_size(const void *lhs, const void *rhs);
+
+/**
+ *  Compare items by name of array. Items of equal name keep source order.
+ */
+int compare_name(const void *lhs, const void *rhs);
+
+/**
+ *  Inflate data element and deflate it again if compression policy finds it
+ *  profitable. Data elements which are not arrays are read as is.
+ *
+ *  \param[in]     job  Repack job.
+ *  \param[in,out] item Item to encode.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int repack_encode(repack_job_t *job, repack_item_t *item);
+
+/**
+ *  Take the next item and encode it. It is called with mutex held and mutex
+ *  is released while item is encoded.
+ *
+ *  \param[in,out] job Repack job.
+ */
+void repack_take(repack_job_t *job);
+
+/**
+ *  Entry point of worker thread which encodes items until all of them are
+ *  taken or some item fails.
+ *
+ *  \param[in] arg Pointer to repack_job_t.
+ *  \return Null.
+ */
+void *repack_worker(void *arg);
+
+/**
+ *  Write encoded item to output file, add it to index and release it.
+ *
+ *  \param[in]     fout  Output file.
+ *  \param[in,out] item  Encoded item.
+ *  \param[in,out] index Index of output file or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int repack_write_item(FILE *fout, repack_item_t *item, matfile_index_t *index);
+
+/**
+ *  Write items in output order. The calling thread encodes items too while
+ *  the next item to write is not ready.
+ *
+ *  \param[in,out] job   Repack job.
+ *  \param[in]     fout  Output file.
+ *  \param[in,out] index Index of output file or null.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int repack_write(repack_job_t *job, FILE *fout, matfile_index_t *index);
+
+int repack_plan(int fd, repack_item_t *item) {
+    const matfile_index_entry_t *entry = item->entry;
+    uint32_t tag[2], type, size;
+    size_t length;
+
+    if (pread(fd, tag, sizeof(tag), entry->offset) != sizeof(tag)) {
+        fprintf(stderr, "could not read tag of data element\n");
+        return 1;
+    }
+
+    mf_decode_tag(tag, &type, &size, &length);
+    item->type = type;
+    item->inflated = entry->size;
+
+    if (type == MFDT_MATRIX) {
+        item->inflated = sizeof(tag) + size;
+    }
+    else if (type == MFDT_COMPRESSED) {
+        matfile_array_t array;
+        uint64_t payload;
+
+        if (mf_scan_array_header(fd, entry->offset, type, size, &array,
+                                 &payload)) {
+            fprintf(stderr, "could not scan array at offset %llu\n",
+                    (unsigned long long)entry->offset);
+            return 1;
+        }
+
+        free(array.dims);
+        free(array.name);
+        item->inflated = sizeof(tag) + payload;
+    }
+
+    return 0;
+}
+
+int compare_size(const void *lhs, const void *rhs) {
+    const repack_item_t *a = *(repack_item_t *const *)lhs;
+    const repack_item_t *b = *(repack_item_t *const *)rhs;
+
+    if (a->inflated != b->inflated) {
+        return a->inflated < b->inflated ? -1 : 1;
+    }
+
+    return a < b ? -1 : a > b;
+}
+
+int compare_name(const void *lhs, const void *rhs) {
+    const repack_item_t *a = *(repack_item_t *const *)lhs;
+    const repack_item_t *b = *(repack_item_t *const *)rhs;
+    int cmp = strcmp(a->entry->name, b->entry->name);
+
+    if (cmp) {
+        return cmp;
+    }
+
+    return a < b ? -1 : a > b;
+}
+
+int repack_order(repack_item_t **order,
+                 repack_item_t *items,
+                 size_t noitems,
+                 const matfile_repack_options_t *opts) {
+    for (size_t i = 0; i != noitems; ++i) {
+        order[i] = &items[i];
+    }
+
+    switch (opts->order) {
+    case MFORDER_KEEP:
+        return 0;
+    case MFORDER_SIZE:
+        //  Items are in source order, so comparing of their addresses makes
+        //  sorting stable.
+        qsort(order, noitems, sizeof(repack_item_t *), compare_size);
+        return 0;
+    case MFORDER_NAME:
+        qsort(order, noitems, sizeof(repack_item_t *), compare_name);
+        return 0;
+    case MFORDER_LIST:
+        break;
+    default:
+        fprintf(stderr, "unknown repack order: %d\n", opts->order);
+        return 1;
+    }
+
+    //  Listed arrays go first and the rest keeps source order.
+    char *placed = calloc(noitems ? noitems : 1, 1);
+    size_t noplaced = 0;
+
+    if (!placed) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i != opts->nonames; ++i) {
+        size_t j = 0;
+
+        while (j != noitems && strcmp(items[j].entry->name, opts->names[i])) {
+            ++j;
+        }
+
+        if (j == noitems || !items[j].entry->name[0]) {
+            fprintf(stderr, "there is no array `%s`\n", opts->names[i]);
+            free(placed);
+            return 1;
+        }
+
+        if (!placed[j]) {
+            placed[j] = 1;
+            order[noplaced++] = &items[j];
+        }
+    }
+
+    for (size_t i = 0; i != noitems; ++i) {
+        if (!placed[i]) {
+            order[noplaced++] = &items[i];
+        }
+    }
+
+    free(placed);
+    return 0;
+}
+
+int repack_encode(repack_job_t *job, repack_item_t *item) {
+    const matfile_index_entry_t *entry = item->entry;
+    const matfile_write_options_t *opts = job->opts;
+    uint64_t clock = mf_trace_clock(opts->trace);
+
+    //  Data elements which are not arrays are copied as is.
+    if (item->type != MFDT_MATRIX && item->type != MFDT_COMPRESSED) {
+        item->size = entry->size;
+        item->data = malloc(entry->size ? entry->size : 1);
+
+        if (!item->data || pread(job->fd, item->data, entry->size,
+                                 entry->offset) != (ssize_t)entry->size) {
+            fprintf(stderr, "could not read data element at offset %llu\n",
+                    (unsigned long long)entry->offset);
+            return 1;
+        }
+
+        return 0;
+    }
+
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint64_t payload = item->inflated - tag_size;
+    size_t size = tag_size + payload + MF_PADDING(payload);
+    uint32_t *data = malloc(size);
+    extract_stream_t stream;
+
+    if (!data) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        return 1;
+    }
+
+    data[0] = MFDT_MATRIX;
+    data[1] = payload;
+    memset((char *)data + tag_size + payload, 0, MF_PADDING(payload));
+
+    if (mf_stream_open(&stream, job->fd, entry->offset, MF_STREAM_BUFFER)) {
+        free(data);
+        return 1;
+    }
+
+    int retcode = mf_stream_read(&stream, data + 2, payload);
+    mf_stream_close(&stream);
+
+    if (retcode) {
+        fprintf(stderr, "could not inflate array `%s`\n", entry->name);
+        free(data);
+        return 1;
+    }
+
+    mf_trace_span(opts->trace, "inflate", entry->name, clock,
+                  mf_trace_clock(opts->trace), size);
+
+    //  Compressed stream is used only if it pays indeed.
+    clock = mf_trace_clock(opts->trace);
+    int level = mf_choose_compression_level(data, size, opts);
+    void *compressed = NULL;
+    size_t compressed_size = 0;
+
+    if (level > 0 && !mf_compress_blocks(data, size, level, opts->block_size,
+                                         &compressed, &compressed_size,
+                                         item->blocks)) {
+        double ratio = (double)size / compressed_size;
+        double min_ratio = opts->compression == MFCOMP_RATIO
+                         ? 1.0 : opts->min_ratio;
+
+        mf_trace_span(opts->trace, "compress", entry->name, clock,
+                      mf_trace_clock(opts->trace), size);
+
+        if (ratio > 1.0 && ratio >= min_ratio &&
+            compressed_size <= UINT32_MAX) {
+            item->tag[0] = MFDT_COMPRESSED;
+            item->tag[1] = compressed_size;
+            item->data = compressed;
+            item->size = compressed_size;
+            free(data);
+            return 0;
+        }
+
+        free(compressed);
+    }
+
+    if (item->blocks) {
+        tape_pop(item->blocks, tape_length(item->blocks));
+    }
+
+    item->data = data;
+    item->size = size;
+    return 0;
+}
+
+void repack_take(repack_job_t *job) {
+    repack_item_t *item = job->order[job->next++];
+    pthread_mutex_unlock(&job->mutex);
+
+    int retcode = repack_encode(job, item);
+
+    pthread_mutex_lock(&job->mutex);
+    item->ready = 1;
+    job->failed |= retcode;
+    pthread_cond_broadcast(&job->cond);
+}
+
+void *repack_worker(void *arg) {
+    repack_job_t *job = arg;
+    pthread_mutex_lock(&job->mutex);
+
+    //  Encoding is throttled by writing so that only a few encoded data
+    //  elements are kept in memory.
+    while (!job->failed && job->next != job->noitems) {
+        if (job->next < job->nowritten + job->window) {
+            repack_take(job);
+        }
+        else {
+            pthread_cond_wait(&job->cond, &job->mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&job->mutex);
+    return NULL;
+}
+
+int repack_write_item(FILE *fout, repack_item_t *item, matfile_index_t *index) {
+    const matfile_index_entry_t *entry = item->entry;
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    long begin = ftell(fout);
+    int retcode = 0;
+
+    if ((item->tag[0] && fwrite(item->tag, 1, tag_size, fout) != tag_size) ||
+        fwrite(item->data, 1, item->size, fout) != item->size) {
+        fprintf(stderr, "could not write data element\n");
+        retcode = 1;
+    }
+
+    //  Only arrays are indexed like writer does.
+    int array = item->type == MFDT_MATRIX || item->type == MFDT_COMPRESSED;
+
+    if (!retcode && index && array) {
+        retcode = mf_index_append(index, entry->name, begin,
+                                  ftell(fout) - begin, 0);
+    }
+
+    //  Single block gains nothing from parallel inflate.
+    size_t noblocks = item->blocks ? tape_length(item->blocks)
+                                   / sizeof(matfile_index_block_t) : 0;
+
+    if (!retcode && index && array && noblocks > 2) {
+        retcode = mf_index_set_blocks(&index->entries[index->noentries - 1],
+                                      tape_deref(item->blocks), noblocks - 1);
+    }
+
+    free(item->data);
+    tape_destroy(item->blocks);
+    item->data = NULL;
+    item->blocks = NULL;
+    return retcode;
+}
+
+int repack_write(repack_job_t *job, FILE *fout, matfile_index_t *index) {
+    pthread_mutex_lock(&job->mutex);
+
+    while (!job->failed && job->nowritten != job->noitems) {
+        repack_item_t *item = job->order[job->nowritten];
+
+        if (item->ready) {
+            pthread_mutex_unlock(&job->mutex);
+            int retcode = repack_write_item(fout, item, index);
+            pthread_mutex_lock(&job->mutex);
+            job->failed |= retcode;
+            job->nowritten += 1;
+            pthread_cond_broadcast(&job->cond);
+        }
+        else if (job->next != job->noitems &&
+                 job->next < job->nowritten + job->window) {
+            repack_take(job);
+        }
+        else {
+            pthread_cond_wait(&job->cond, &job->mutex);
+        }
+    }
+
+    int retcode = job->failed;
+    pthread_mutex_unlock(&job->mutex);
+    return retcode;
+}
+
+void matfile_repack_options_init(matfile_repack_options_t *opts) {
+    matfile_write_options_init(&opts->write);
+    opts->write.index = 1;
+    opts->nothreads = 0;
+    opts->order = MFORDER_KEEP;
+    opts->names = NULL;
+    opts->nonames = 0;
+}
+
+int matfile_repack(const char *src,
+                   const char *dst,
+                   const matfile_repack_options_t *opts) {
+    matfile_repack_options_t defaults;
+
+    if (!opts) {
+        matfile_repack_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    FILE *fin = mf_open_source(src);
+
+    if (!fin) {
+        return 1;
+    }
+
+    //  Sidecar index lists arrays only, so data elements are scanned.
+    matfile_index_t *index = matfile_index_scan(src);
+
+    if (!index) {
+        fclose(fin);
+        return 1;
+    }
+
+    size_t noitems = index->noentries;
+    size_t nothreads = opts->nothreads;
+
+    if (!nothreads) {
+        long noprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        nothreads = noprocs > 0 ? noprocs : 1;
+    }
+
+    if (nothreads > noitems) {
+        nothreads = noitems ? noitems : 1;
+    }
+
+    repack_item_t *items = calloc(noitems ? noitems : 1,
+                                  sizeof(repack_item_t));
+    repack_item_t **order = calloc(noitems ? noitems : 1,
+                                   sizeof(repack_item_t *));
+    pthread_t *threads = calloc(nothreads, sizeof(pthread_t));
+    int *started = calloc(nothreads, sizeof(int));
+    matfile_index_t *output = NULL;
+    int retcode = 0;
+
+    if (!items || !order || !threads || !started) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        retcode = 1;
+    }
+
+    if (!retcode && opts->write.index && !(output = matfile_index_create())) {
+        retcode = 1;
+    }
+
+    for (size_t i = 0; i != noitems && !retcode; ++i) {
+        items[i].entry = &index->entries[i];
+        retcode = repack_plan(fileno(fin), &items[i]);
+
+        if (!retcode && opts->write.index && !(items[i].blocks =
+                tape_create(16 * sizeof(matfile_index_block_t)))) {
+            fprintf(stderr, "could not create tape\n");
+            retcode = 1;
+        }
+    }
+
+    if (!retcode) {
+        retcode = repack_order(order, items, noitems, opts);
+    }
+
+    char *tmpname = NULL;
+    FILE *fout = retcode ? NULL : mf_open_output(dst, &tmpname);
+
+    if (!retcode && fout) {
+        repack_job_t job = {
+            .fd = fileno(fin),
+            .order = order,
+            .noitems = noitems,
+            .next = 0,
+            .nowritten = 0,
+            .window = MF_REPACK_WINDOW * nothreads,
+            .failed = 0,
+            .opts = &opts->write,
+        };
+
+        pthread_mutex_init(&job.mutex, NULL);
+        pthread_cond_init(&job.cond, NULL);
+
+        //  The calling thread writes data elements and works as the first
+        //  worker. Items of workers which are not started are taken by
+        //  others.
+        for (size_t i = 1; i < nothreads; ++i) {
+            started[i] = !pthread_create(&threads[i], NULL, repack_worker,
+                                         &job);
+        }
+
+        retcode = repack_write(&job, fout, output);
+
+        for (size_t i = 1; i < nothreads; ++i) {
+            if (started[i]) {
+                pthread_join(threads[i], NULL);
+            }
+        }
+
+        pthread_cond_destroy(&job.cond);
+        pthread_mutex_destroy(&job.mutex);
+
+        if (output) {
+            output->file_size = ftell(fout);
+        }
+
+        retcode = mf_close_output(fout, tmpname, dst, retcode);
+    }
+    else if (!retcode) {
+        retcode = 1;
+    }
+
+    if (!retcode && output) {
+        retcode = matfile_index_write(dst, output);
+    }
+
+    for (size_t i = 0; items && i != noitems; ++i) {
+        free(items[i].data);
+        tape_destroy(items[i].blocks);
+    }
+
+    matfile_index_destroy(output);
+    matfile_index_destroy(index);
+    free(started);
+    free(threads);
+    free(order);
+    free(items);
+    fclose(fin);
+    return retcode;
+}
+
+const char *matfile_get_repack_order_string(matfile_repack_order_t order) {
+    return order < MFORDER_COUNT ? repack_order_strings[order] : "unknown";
+}
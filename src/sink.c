@@ -0,0 +1,176 @@
+/**
+ *  \file sink.c
+ *  \brief The file contains routines which serialize mat-file into memory or
+ *  user callback without touching filesystem.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include "internal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+/**
+ *  State of stream which passes written bytes to user callback.
+ */
+typedef struct _sink_t {
+    matfile_write_callback_t    callback;   ///<User callback.
+    void                       *opaque;     ///<User data of callback.
+    uint64_t                    position;   ///<Number of bytes passed.
+} sink_t;
+
+/**
+ *  Write function of custom stream.
+ *
+ *  \param[in] cookie Sink.
+ *  \param[in] data   Bytes to write.
+ *  \param[in] size   Number of bytes.
+ *  \return Number of written bytes or zero on failure.
+ */
+ssize_t sink_write(void *cookie, const char *data, size_t size);
+
+/**
+ *  Seek function of custom stream. Sink could not seek so it only reports
+ *  current position.
+ *
+ *  \param[in]     cookie Sink.
+ *  \param[in,out] offset Offset to seek.
+ *  \param[in]     whence Origin of offset.
+ *  \return Zero on success, otherwise -1.
+ */
+int sink_seek(void *cookie, off64_t *offset, int whence);
+#endif
+
+/**
+ *  Callback which appends bytes to tape.
+ *
+ *  \param[in] opaque Tape.
+ *  \param[in] data   Bytes to append.
+ *  \param[in] size   Number of bytes.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int push_to_tape(void *opaque, const void *data, size_t size);
+
+#ifdef __linux__
+ssize_t sink_write(void *cookie, const char *data, size_t size) {
+    sink_t *sink = cookie;
+
+    if (sink->callback(sink->opaque, data, size)) {
+        errno = EIO;
+        return 0;
+    }
+
+    sink->position += size;
+    return size;
+}
+
+int sink_seek(void *cookie, off64_t *offset, int whence) {
+    sink_t *sink = cookie;
+
+    if (whence != SEEK_CUR || *offset != 0) {
+        errno = ESPIPE;
+        return -1;
+    }
+
+    *offset = sink->position;
+    return 0;
+}
+#endif
+
+int push_to_tape(void *opaque, const void *data, size_t size) {
+    void *dst = tape_push(opaque, size);
+
+    if (!dst) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        return 1;
+    }
+
+    memcpy(dst, data, size);
+    return 0;
+}
+
+int matfile_write_callback(const matfile_t *mat,
+                           matfile_write_callback_t callback,
+                           void *opaque,
+                           const matfile_write_options_t *opts) {
+    matfile_write_options_t defaults;
+
+    if (!opts) {
+        matfile_write_options_init(&defaults);
+        opts = &defaults;
+    }
+
+#ifdef __linux__
+    sink_t sink = {callback, opaque, 0};
+    cookie_io_functions_t functions = {NULL, sink_write, sink_seek, NULL};
+    FILE *fout = fopencookie(&sink, "w", functions);
+#else
+    //  Custom streams are glibc extension so elsewhere mat-file is written
+    //  into memory first and then it is passed to callback at once.
+    char *buffer = NULL;
+    size_t size = 0;
+    FILE *fout = open_memstream(&buffer, &size);
+#endif
+
+    if (!fout) {
+        fprintf(stderr, "could not open stream for callback\n");
+        return 1;
+    }
+
+#ifdef __linux__
+    //  Data elements are passed to callback as soon as they are serialized.
+    setvbuf(fout, NULL, _IONBF, 0);
+#endif
+
+    matfile_header_t header;
+    int retcode = 0;
+
+    mf_fill_header(&header, &mat->header);
+
+    if (fwrite(&header, 1, sizeof(header), fout) != sizeof(header)) {
+        fprintf(stderr, "could not write header\n");
+        retcode = 1;
+    }
+    else {
+        retcode = mf_write_data_elements(fout, mat, opts, NULL, NULL, NULL);
+    }
+
+    if (fclose(fout)) {
+        retcode = 1;
+    }
+
+#ifndef __linux__
+    if (!retcode && callback(opaque, buffer, size)) {
+        retcode = 1;
+    }
+
+    free(buffer);
+#endif
+
+    return retcode;
+}
+
+int matfile_write_memory(const matfile_t *mat,
+                         tape_t *tape,
+                         const matfile_write_options_t *opts) {
+    size_t length = tape_length(tape);
+    int retcode = matfile_write_callback(mat, push_to_tape, tape, opts);
+
+    //  Do not leave partially serialized mat-file on tape.
+    if (retcode) {
+        tape_pop(tape, tape_length(tape) - length);
+    }
+
+    return retcode;
+}
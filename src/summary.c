@@ -0,0 +1,446 @@
+/**
+ *  \file summary.c
+ *  \brief The file contains streaming summary statistics of numerical arrays
+ *  of mat-file. Arrays are decoded chunk by chunk and statistics of chunks
+ *  are merged, so arrays are never materialized.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MF_SUMMARY_LANES    8u      ///<Number of values per iteration.
+#define MF_SUMMARY_CHUNK    8192u   ///<Number of values in chunk.
+
+/**
+ *  Vector of doubles of native SIMD width of baseline SSE2 and NEON. Vector
+ *  extension of GCC and Clang lowers operations on it to packed
+ *  instructions without intrinsics.
+ */
+typedef double summary_vector_t __attribute__((vector_size(16)));
+
+/**
+ *  Mask which is result of comparison of vectors of doubles.
+ */
+typedef int64_t summary_mask_t __attribute__((vector_size(16)));
+
+//! Number of doubles in vector.
+#define MF_SUMMARY_WIDTH    (sizeof(summary_vector_t) / sizeof(double))
+
+//! Number of independent vector accumulators.
+#define MF_SUMMARY_VECTORS  (MF_SUMMARY_LANES / MF_SUMMARY_WIDTH)
+
+//! Select elements of a where mask is set and elements of b otherwise.
+#define SUMMARY_SELECT(mask, a, b)                                      \
+    ((summary_vector_t)(((mask) & (summary_mask_t)(a)) |                \
+                        (~(mask) & (summary_mask_t)(b))))
+
+/**
+ *  Running moments of part of array which are merged chunk by chunk.
+ */
+typedef struct _summary_moments_t {
+    uint64_t count;     ///<Number of values which are not NaN.
+    uint64_t nonans;    ///<Number of NaN values.
+    uint64_t nozeros;   ///<Number of zero values.
+    double   min;       ///<Minimal value.
+    double   max;       ///<Maximal value.
+    double   mean;      ///<Mean value.
+    double   m2;        ///<Sum of squared deviations from mean.
+} summary_moments_t;
+
+/**
+ *  Shared state of workers which summarize arrays of single mat-file.
+ */
+typedef struct _summary_job_t {
+    int                         fd;         ///<File descriptor of mat-file.
+    const matfile_index_t      *index;      ///<Data elements of mat-file.
+    matfile_summary_entry_t    *entries;    ///<Entry of every data element.
+    int                        *statuses;   ///<Status of every data element.
+    atomic_size_t               next;       ///<Next data element to take.
+} summary_job_t;
+
+/**
+ *  Accumulate chunk of values into running moments. Values are split over
+ *  independent vector accumulators, so there are no data dependencies
+ *  between packed operations. Moments of chunk are merged with Chan's
+ *  formula.
+ *
+ *  \param[in,out] moments Running moments.
+ *  \param[in]     values  Chunk of values.
+ *  \param[in]     n       Number of values.
+ */
+void summarize_chunk(summary_moments_t *moments,
+                     const double *values,
+                     size_t n);
+
+/**
+ *  Stream numerical part of array through chunk buffers and accumulate its
+ *  moments.
+ *
+ *  \param[in,out] part    Numerical part which tag is read.
+ *  \param[in]     numel   Number of elements of array.
+ *  \param[out]    summary Statistics of part.
+ *  \param[in]     values  Buffer for chunk of values.
+ *  \param[in]     scratch Buffer for chunk of stored values.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int summarize_part(extract_part_t *part,
+                   uint64_t numel,
+                   matfile_summary_part_t *summary,
+                   double *values,
+                   void *scratch);
+
+/**
+ *  Summarize single data element. Data elements which are not numerical
+ *  arrays are left without name.
+ *
+ *  \param[in] job     Summary job.
+ *  \param[in] no      Index of data element.
+ *  \param[in] values  Buffer for chunk of values.
+ *  \param[in] scratch Buffer for chunk of stored values.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int summarize_entry(summary_job_t *job,
+                    size_t no,
+                    double *values,
+                    void *scratch);
+
+/**
+ *  Entry point of worker thread which takes data elements one by one.
+ *
+ *  \param[in] arg Pointer to summary_job_t.
+ *  \return Null.
+ */
+void *summarize_worker(void *arg);
+
+void summarize_chunk(summary_moments_t *moments,
+                     const double *values,
+                     size_t n) {
+    summary_vector_t lo[MF_SUMMARY_VECTORS], hi[MF_SUMMARY_VECTORS];
+    summary_vector_t sum[MF_SUMMARY_VECTORS], m2[MF_SUMMARY_VECTORS];
+    summary_mask_t nans[MF_SUMMARY_VECTORS], zeros[MF_SUMMARY_VECTORS];
+    size_t body = n - n % MF_SUMMARY_LANES;
+
+    for (size_t v = 0; v != MF_SUMMARY_VECTORS; ++v) {
+        lo[v] = (summary_vector_t){0} + INFINITY;
+        hi[v] = (summary_vector_t){0} - INFINITY;
+        sum[v] = m2[v] = (summary_vector_t){0};
+        nans[v] = zeros[v] = (summary_mask_t){0};
+    }
+
+    //  Comparisons give -1 where they hold, so masks are subtracted to count
+    //  values. Comparisons with NaN are false, so NaN never gets into min or
+    //  max.
+    for (size_t i = 0; i != body; i += MF_SUMMARY_LANES) {
+        for (size_t v = 0; v != MF_SUMMARY_VECTORS; ++v) {
+            summary_vector_t x;
+            memcpy(&x, values + i + v * MF_SUMMARY_WIDTH, sizeof(x));
+            summary_mask_t valid = x == x;
+            nans[v] -= x != x;
+            zeros[v] -= x == 0.0;
+            lo[v] = SUMMARY_SELECT(x < lo[v], x, lo[v]);
+            hi[v] = SUMMARY_SELECT(x > hi[v], x, hi[v]);
+            sum[v] += SUMMARY_SELECT(valid, x, (summary_vector_t){0});
+        }
+    }
+
+    summary_moments_t chunk = {0, 0, 0, INFINITY, -INFINITY, 0.0, 0.0};
+    double total = 0.0;
+
+    for (size_t v = 0; v != MF_SUMMARY_VECTORS; ++v) {
+        for (size_t w = 0; w != MF_SUMMARY_WIDTH; ++w) {
+            chunk.nonans += nans[v][w];
+            chunk.nozeros += zeros[v][w];
+            chunk.min = lo[v][w] < chunk.min ? lo[v][w] : chunk.min;
+            chunk.max = hi[v][w] > chunk.max ? hi[v][w] : chunk.max;
+            total += sum[v][w];
+        }
+    }
+
+    for (size_t i = body; i != n; ++i) {
+        double x = values[i];
+        chunk.nonans += x != x;
+        chunk.nozeros += x == 0.0;
+        chunk.min = x < chunk.min ? x : chunk.min;
+        chunk.max = x > chunk.max ? x : chunk.max;
+        total += x == x ? x : 0.0;
+    }
+
+    chunk.count = n - chunk.nonans;
+    moments->nonans += chunk.nonans;
+    moments->nozeros += chunk.nozeros;
+
+    if (!chunk.count) {
+        return;
+    }
+
+    //  Deviations are taken from mean of chunk which is exact enough since
+    //  chunk is small, and the second pass hits cache.
+    chunk.mean = total / chunk.count;
+
+    for (size_t i = 0; i != body; i += MF_SUMMARY_LANES) {
+        for (size_t v = 0; v != MF_SUMMARY_VECTORS; ++v) {
+            summary_vector_t x;
+            memcpy(&x, values + i + v * MF_SUMMARY_WIDTH, sizeof(x));
+            summary_vector_t d = SUMMARY_SELECT(x == x, x - chunk.mean,
+                                                (summary_vector_t){0});
+            m2[v] += d * d;
+        }
+    }
+
+    for (size_t v = 0; v != MF_SUMMARY_VECTORS; ++v) {
+        for (size_t w = 0; w != MF_SUMMARY_WIDTH; ++w) {
+            chunk.m2 += m2[v][w];
+        }
+    }
+
+    for (size_t i = body; i != n; ++i) {
+        double d = values[i] - chunk.mean;
+        chunk.m2 += d == d ? d * d : 0.0;
+    }
+
+    if (!moments->count) {
+        chunk.nonans = moments->nonans;
+        chunk.nozeros = moments->nozeros;
+        *moments = chunk;
+        return;
+    }
+
+    uint64_t count = moments->count + chunk.count;
+    double delta = chunk.mean - moments->mean;
+    moments->m2 += chunk.m2 + delta * delta * ((double)moments->count
+                                               * chunk.count / count);
+    moments->mean += delta * chunk.count / count;
+    moments->count = count;
+    moments->min = chunk.min < moments->min ? chunk.min : moments->min;
+    moments->max = chunk.max > moments->max ? chunk.max : moments->max;
+}
+
+int summarize_part(extract_part_t *part,
+                   uint64_t numel,
+                   matfile_summary_part_t *summary,
+                   double *values,
+                   void *scratch) {
+    summary_moments_t moments;
+    memset(&moments, 0, sizeof(moments));
+
+    for (uint64_t i = 0; i < numel; i += MF_SUMMARY_CHUNK) {
+        size_t n = numel - i < MF_SUMMARY_CHUNK ? numel - i : MF_SUMMARY_CHUNK;
+
+        if (mf_part_read(part, values, MFDT_DOUBLE, scratch, n)) {
+            return 1;
+        }
+
+        summarize_chunk(&moments, values, n);
+    }
+
+    summary->count = moments.count;
+    summary->nonans = moments.nonans;
+    summary->nozeros = moments.nozeros;
+    summary->min = moments.count ? moments.min : NAN;
+    summary->max = moments.count ? moments.max : NAN;
+    summary->mean = moments.count ? moments.mean : NAN;
+    summary->std = moments.count ? sqrt(moments.m2 / moments.count) : NAN;
+    return 0;
+}
+
+int summarize_entry(summary_job_t *job,
+                    size_t no,
+                    double *values,
+                    void *scratch) {
+    const matfile_index_entry_t *entry = &job->index->entries[no];
+    matfile_summary_entry_t *summary = &job->entries[no];
+    uint32_t tag[2];
+
+    if (pread(job->fd, tag, sizeof(tag), entry->offset) != sizeof(tag)) {
+        fprintf(stderr, "could not read tag of data element\n");
+        return 1;
+    }
+
+    if (tag[0] != MFDT_MATRIX && tag[0] != MFDT_COMPRESSED) {
+        return 0;
+    }
+
+    extract_stream_t stream;
+    extract_part_t part;
+    matfile_array_t array;
+    memset(&array, 0, sizeof(array));
+
+    if (mf_stream_open(&stream, job->fd, entry->offset, MF_STREAM_BUFFER)) {
+        return 1;
+    }
+
+    int retcode = mf_stream_read_header(&stream, &array, NULL);
+    matfile_array_type_t type = array.flags & MF_CLASS_MASK;
+
+    if (!retcode && type >= MFMX_DOUBLE_CLASS && type < MFMX_COUNT) {
+        summary->type = type;
+        summary->complex = !!(array.flags & MF_FLAG_COMPLEX);
+        summary->numel = matfile_array_numel(&array);
+
+        for (int i = 0; i <= summary->complex && !retcode; ++i) {
+            retcode = (i && mf_part_skip(&part, 0))
+                   || mf_part_open(&part, &stream, summary->numel)
+                   || summarize_part(&part, summary->numel,
+                                     &summary->parts[i], values, scratch);
+        }
+
+        if (!retcode) {
+            summary->name = array.name;
+            array.name = NULL;
+        }
+    }
+
+    if (retcode) {
+        fprintf(stderr, "could not summarize data element at offset %llu\n",
+                (unsigned long long)entry->offset);
+    }
+
+    mf_stream_close(&stream);
+    free(array.dims);
+    free(array.name);
+    return retcode;
+}
+
+void *summarize_worker(void *arg) {
+    summary_job_t *job = arg;
+    double *values = malloc(MF_SUMMARY_CHUNK * sizeof(double));
+    void *scratch = malloc(MF_SUMMARY_CHUNK * sizeof(uint64_t));
+    size_t no;
+
+    while ((no = atomic_fetch_add(&job->next, 1)) < job->index->noentries) {
+        job->statuses[no] = !values || !scratch
+                         || summarize_entry(job, no, values, scratch);
+    }
+
+    free(scratch);
+    free(values);
+    return NULL;
+}
+
+matfile_summary_t *matfile_summarize(const char *filename, size_t nothreads) {
+    int fd = open(filename, O_RDONLY);
+    matfile_header_t header;
+
+    if (fd < 0) {
+        fprintf(stderr, "there is not such file `%s`\n", filename);
+        return NULL;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        mf_validate_header(&header)) {
+        fprintf(stderr, "could not summarize arrays of `%s`\n", filename);
+        close(fd);
+        return NULL;
+    }
+
+    //  Prefer sidecar index to scan of data elements.
+    matfile_index_t *index = matfile_index_read(filename);
+
+    if (!index && !(index = matfile_index_scan(filename))) {
+        close(fd);
+        return NULL;
+    }
+
+    if (!nothreads) {
+        long noprocs = sysconf(_SC_NPROCESSORS_ONLN);
+        nothreads = noprocs > 0 ? noprocs : 1;
+    }
+
+    if (nothreads > index->noentries) {
+        nothreads = index->noentries ? index->noentries : 1;
+    }
+
+    size_t noentries = index->noentries ? index->noentries : 1;
+    summary_job_t job;
+    job.fd = fd;
+    job.index = index;
+    job.entries = calloc(noentries, sizeof(matfile_summary_entry_t));
+    job.statuses = calloc(noentries, sizeof(int));
+    atomic_init(&job.next, 0);
+
+    matfile_summary_t *summary = calloc(1, sizeof(matfile_summary_t));
+    pthread_t *threads = calloc(nothreads, sizeof(pthread_t));
+    int *started = calloc(nothreads, sizeof(int));
+    int retcode = 0;
+
+    if (!job.entries || !job.statuses || !summary || !threads || !started) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        retcode = 1;
+    }
+
+    //  The calling thread works as the first worker. Data elements of
+    //  workers which are not started are taken by others.
+    for (size_t i = 1; i < nothreads && !retcode; ++i) {
+        started[i] = !pthread_create(&threads[i], NULL, summarize_worker,
+                                     &job);
+    }
+
+    if (!retcode) {
+        summarize_worker(&job);
+    }
+
+    for (size_t i = 1; i < nothreads && !retcode; ++i) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    for (size_t i = 0; i != index->noentries && !retcode; ++i) {
+        retcode = job.statuses[i];
+    }
+
+    //  Keep numerical arrays only in order of mat-file.
+    if (!retcode) {
+        summary->entries = job.entries;
+
+        for (size_t i = 0; i != index->noentries; ++i) {
+            if (job.entries[i].name) {
+                job.entries[summary->noentries++] = job.entries[i];
+            }
+        }
+
+        job.entries = NULL;
+    }
+
+    for (size_t i = 0; job.entries && i != index->noentries; ++i) {
+        free(job.entries[i].name);
+    }
+
+    free(started);
+    free(threads);
+    free(job.statuses);
+    free(job.entries);
+    matfile_index_destroy(index);
+    close(fd);
+
+    if (retcode) {
+        matfile_summary_destroy(summary);
+        return NULL;
+    }
+
+    return summary;
+}
+
+void matfile_summary_destroy(matfile_summary_t *summary) {
+    if (!summary) {
+        return;
+    }
+
+    for (size_t i = 0; i != summary->noentries; ++i) {
+        free(summary->entries[i].name);
+    }
+
+    free(summary->entries);
+    free(summary);
+}
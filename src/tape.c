@@ -6,6 +6,7 @@
  */
 
 #include "matfile/tape.h"
+#include "probes.h"
 #include <memory.h>
 #include <stdlib.h>
 
@@ -38,6 +39,7 @@ tape_t *tape_create(size_t length) {
 
     tape->elems = malloc(length);
     tape->cur_length = 0;
+    MF_PROBE1(tape__create, length);
     tape->max_length = length;
 
     if (!tape->elems) {
@@ -64,6 +66,10 @@ void *tape_deref(tape_t *tape) {
     return tape->elems;
 }
 
+size_t tape_length(const tape_t *tape) {
+    return tape->cur_length;
+}
+
 void tape_pop(tape_t *tape, size_t size) {
     if (tape->cur_length > size) {
         tape->cur_length -= size;
@@ -75,12 +81,21 @@ void tape_pop(tape_t *tape, size_t size) {
 
 void * tape_push(tape_t *tape, size_t size) {
     if (tape->cur_length + size > tape->max_length) {
-        tape->max_length *= 2;
-        tape->elems = realloc((void *)tape->elems, tape->max_length);
+        size_t max_length = tape->max_length ? tape->max_length : 1;
+
+        while (tape->cur_length + size > max_length) {
+            max_length *= 2;
+        }
+
+        void *elems = realloc((void *)tape->elems, max_length);
+        MF_PROBE2(tape__grow, tape->max_length, max_length);
 
-        if (!tape->elems) {
+        if (!elems) {
             return NULL;
         }
+
+        tape->elems = elems;
+        tape->max_length = max_length;
     }
 
     void *current = (char *)tape->elems + tape->cur_length;
@@ -0,0 +1,174 @@
+/**
+ *  \file trace.c
+ *  \brief The file contains recording of spans of reading and writing and
+ *  their serialization into Chrome trace event format which is understood
+ *  by chrome://tracing and Perfetto.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ *  Complete event of Chrome trace which covers time span on single thread.
+ */
+typedef struct _trace_event_t {
+    const char *name;       ///<Name of span. It is static string.
+    char        array[64];  ///<Name of array or empty string.
+    uint64_t    begin;      ///<Start time in nanoseconds.
+    uint64_t    end;        ///<Finish time in nanoseconds.
+    uint64_t    bytes;      ///<Number of processed bytes.
+    long        tid;        ///<Identifier of thread.
+} trace_event_t;
+
+typedef struct _matfile_trace_t {
+    pthread_mutex_t mutex;  ///<Guard of events.
+    tape_t         *events; ///<Recorded events.
+    uint64_t        origin; ///<Time of trace creation.
+} matfile_trace_t;
+
+/**
+ *  Write string as JSON string literal.
+ *
+ *  \param[in] fout   Output file.
+ *  \param[in] string String to escape.
+ */
+void write_json_string(FILE *fout, const char *string);
+
+uint64_t mf_trace_clock(const matfile_trace_t *trace) {
+    return trace ? mf_monotonic_ns() : 0;
+}
+
+void mf_trace_span(matfile_trace_t *trace,
+                   const char *name,
+                   const char *array,
+                   uint64_t begin,
+                   uint64_t end,
+                   uint64_t bytes) {
+    if (!trace) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace->mutex);
+    trace_event_t *event = tape_push(trace->events, sizeof(trace_event_t));
+
+    //  Event is lost if there is no memory but reading goes on.
+    if (event) {
+        event->name = name;
+        event->begin = begin;
+        event->end = end;
+        event->bytes = bytes;
+        event->tid = syscall(SYS_gettid);
+        snprintf(event->array, sizeof(event->array), "%s",
+                 array ? array : "");
+    }
+
+    pthread_mutex_unlock(&trace->mutex);
+}
+
+void write_json_string(FILE *fout, const char *string) {
+    fputc('"', fout);
+
+    for (const unsigned char *ch = (const unsigned char *)string; *ch; ++ch) {
+        if (*ch == '"' || *ch == '\\') {
+            fprintf(fout, "\\%c", *ch);
+        }
+        else if (*ch < 0x20) {
+            fprintf(fout, "\\u%04x", *ch);
+        }
+        else {
+            fputc(*ch, fout);
+        }
+    }
+
+    fputc('"', fout);
+}
+
+matfile_trace_t *matfile_trace_create(void) {
+    matfile_trace_t *trace = calloc(1, sizeof(matfile_trace_t));
+
+    if (!trace) {
+        fprintf(stderr, "could not allocate memory for trace\n");
+        return NULL;
+    }
+
+    if (!(trace->events = tape_create(256 * sizeof(trace_event_t)))) {
+        fprintf(stderr, "could not create tape\n");
+        free(trace);
+        return NULL;
+    }
+
+    pthread_mutex_init(&trace->mutex, NULL);
+    trace->origin = mf_trace_clock(trace);
+    return trace;
+}
+
+void matfile_trace_destroy(matfile_trace_t *trace) {
+    if (!trace) {
+        return;
+    }
+
+    pthread_mutex_destroy(&trace->mutex);
+    tape_destroy(trace->events);
+    free(trace);
+}
+
+size_t matfile_trace_length(matfile_trace_t *trace) {
+    pthread_mutex_lock(&trace->mutex);
+    size_t length = tape_length(trace->events) / sizeof(trace_event_t);
+    pthread_mutex_unlock(&trace->mutex);
+    return length;
+}
+
+int matfile_trace_dump(matfile_trace_t *trace, const char *filename) {
+    FILE *fout = fopen(filename, "w");
+
+    if (!fout) {
+        fprintf(stderr, "could not open file `%s` for writing\n", filename);
+        return 1;
+    }
+
+    pthread_mutex_lock(&trace->mutex);
+
+    const trace_event_t *events = tape_deref(trace->events);
+    size_t noevents = tape_length(trace->events) / sizeof(trace_event_t);
+    long pid = getpid();
+
+    //  Timestamps and durations of complete events are in microseconds.
+    fprintf(fout, "{\"traceEvents\":[");
+
+    for (size_t i = 0; i != noevents; ++i) {
+        const trace_event_t *event = &events[i];
+        fprintf(fout, "%s\n{\"name\":\"%s\",\"cat\":\"matfile\",\"ph\":\"X\","
+                "\"pid\":%ld,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"array\":", i ? "," : "", event->name, pid,
+                event->tid, (event->begin - trace->origin) / 1e3,
+                (event->end - event->begin) / 1e3);
+        write_json_string(fout, event->array);
+        fprintf(fout, ",\"bytes\":%llu}}",
+                (unsigned long long)event->bytes);
+    }
+
+    fprintf(fout, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    pthread_mutex_unlock(&trace->mutex);
+
+    if (fclose(fout)) {
+        fprintf(stderr, "could not write trace to `%s`\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,454 @@
+/**
+ *  \file view.c
+ *  \brief The file contains routines which map uncompressed mat-file into
+ *  memory and expose numerical parts of arrays without copying.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <matfile/matfile.h>
+#include "internal.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct _matfile_view_t {
+    int                 fd;         ///<File descriptor of mat-file.
+    int                 flags;      ///<Flags of view.
+    char               *base;       ///<Mapping of whole mat-file.
+    size_t              length;     ///<Size of mapping.
+    matfile_index_t    *index;      ///<Locations of data elements.
+    matfile_array_t   **arrays;     ///<Arrays which are already located.
+} matfile_view_t;
+
+/**
+ *  Make numerical part of array point to mapped memory. Data element should
+ *  be in data type of array class and it should be aligned on its type.
+ *
+ *  \param[in]  view   Mapped mat-file.
+ *  \param[in]  offset Offset of tag of numerical part in file.
+ *  \param[in]  array  Array which is the owner of numerical part.
+ *  \param[out] part   Numerical part to bind.
+ *  \return Offset of the next data element in file or zero on failure.
+ */
+uint64_t bind_numerical_part(const matfile_view_t *view,
+                             uint64_t offset,
+                             const matfile_array_t *array,
+                             matfile_numerical_part_t *part);
+
+/**
+ *  Map the whole opened file of view.
+ *
+ *  \param[in] view View with opened file descriptor.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int map_view(matfile_view_t *view);
+
+/**
+ *  Compute size of miMATRIX data element of numerical array including tag
+ *  and padding.
+ *
+ *  \param[in] array Array which flags, dims and name define layout.
+ *  \return Size of data element or zero if array could not be stored.
+ */
+uint64_t layout_array(const matfile_array_t *array);
+
+/**
+ *  Write header of miMATRIX data element and tags of numerical parts into
+ *  mapped memory. Payload of numerical parts is left as is.
+ *
+ *  \param[in] dst   Pointer to location of data element.
+ *  \param[in] size  Size of data element including tag and padding.
+ *  \param[in] array Array which flags, dims and name define layout.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int layout_array_header(char *dst, uint64_t size, const matfile_array_t *array);
+
+uint64_t bind_numerical_part(const matfile_view_t *view,
+                             uint64_t offset,
+                             const matfile_array_t *array,
+                             matfile_numerical_part_t *part) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    matfile_array_type_t type = array->flags & MF_CLASS_MASK;
+    matfile_data_type_t storage_type = matfile_get_storage_type(type);
+    size_t type_size = matfile_get_type_size(storage_type);
+    uint32_t part_type, part_size;
+    size_t length;
+
+    if (offset + tag_size > view->length) {
+        fprintf(stderr, "numerical part of `%s` exceeds mat-file\n",
+            array->name);
+        return 0;
+    }
+
+    const char *data = mf_decode_tag(view->base + offset, &part_type,
+                                     &part_size, &length);
+
+    if (data != view->base + offset + tag_size ||
+        part_type != storage_type ||
+        part_size != matfile_array_numel(array) * type_size ||
+        offset + length > view->length) {
+        fprintf(stderr, "numerical part of `%s` is not stored as %s\n",
+            array->name, matfile_get_type_string(storage_type));
+        return 0;
+    }
+
+    //  Uncompressed data element which follows compressed one could be
+    //  misaligned since compressed data elements are not padded.
+    if ((uintptr_t)data % type_size) {
+        fprintf(stderr, "numerical part of `%s` is misaligned\n",
+            array->name);
+        return 0;
+    }
+
+    part->data = (void *)data;
+    return offset + length;
+}
+
+int map_view(matfile_view_t *view) {
+    struct stat st;
+
+    if (fstat(view->fd, &st) || st.st_size < sizeof(matfile_header_t)) {
+        return 1;
+    }
+
+    int prot = view->flags & MF_VIEW_WRITE ? PROT_READ | PROT_WRITE
+                                           : PROT_READ;
+    view->length = st.st_size;
+    view->base = mmap(NULL, view->length, prot, MAP_SHARED, view->fd, 0);
+    return view->base == MAP_FAILED;
+}
+
+uint64_t layout_array(const matfile_array_t *array) {
+    matfile_array_type_t type = array->flags & MF_CLASS_MASK;
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+
+    if (type < MFMX_DOUBLE_CLASS || type >= MFMX_COUNT) {
+        fprintf(stderr, "array `%s` is not numerical\n", array->name);
+        return 0;
+    }
+
+    uint64_t part_size = matfile_array_numel(array)
+                       * matfile_get_type_size(matfile_get_storage_type(type));
+    uint64_t dims_size = array->nodims * sizeof(int32_t);
+    uint64_t name_size = strlen(array->name);
+    uint64_t size = 2 * tag_size + 8
+                  + tag_size + dims_size + MF_PADDING(dims_size)
+                  + tag_size + name_size + MF_PADDING(name_size)
+                  + tag_size + part_size + MF_PADDING(part_size);
+
+    if (array->flags & MF_FLAG_COMPLEX) {
+        size += tag_size + part_size + MF_PADDING(part_size);
+    }
+
+    if (size - tag_size > UINT32_MAX) {
+        fprintf(stderr, "array `%s` exceeds size limit of data element\n",
+            array->name);
+        return 0;
+    }
+
+    return size;
+}
+
+int layout_array_header(char *dst, uint64_t size, const matfile_array_t *array) {
+    matfile_array_type_t type = array->flags & MF_CLASS_MASK;
+    matfile_data_type_t data_type = matfile_get_storage_type(type);
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    uint32_t part_size = matfile_array_numel(array)
+                       * matfile_get_type_size(data_type);
+    tape_t *tape = tape_create(MF_HEADER_PROBE);
+
+    if (!tape || !tape_push(tape, tag_size)) {
+        fprintf(stderr, "could not create tape\n");
+        tape_destroy(tape);
+        return 1;
+    }
+
+    uint32_t flags[2] = {array->flags & 0xffffffffu, 0};
+    int retcode = 0;
+
+    retcode |= mf_serialize_data_element(tape, MFDT_UINT32, flags,
+                                         sizeof(flags));
+    retcode |= mf_serialize_data_element(tape, MFDT_INT32, array->dims,
+                                         array->nodims * sizeof(int32_t));
+    retcode |= mf_serialize_data_element(tape, MFDT_INT8, array->name,
+                                         strlen(array->name));
+
+    if (retcode) {
+        tape_destroy(tape);
+        return 1;
+    }
+
+    //  Tags of numerical parts follow the header. Padding is zero since
+    //  space is allocated with fallocate.
+    uint32_t *tag = tape_deref(tape);
+    size_t header_size = tape_length(tape);
+    uint32_t part_tag[2] = {data_type, part_size};
+
+    tag[0] = MFDT_MATRIX;
+    tag[1] = size - tag_size;
+    memcpy(dst, tag, header_size);
+    memcpy(dst + header_size, part_tag, tag_size);
+
+    if (array->flags & MF_FLAG_COMPLEX) {
+        size_t offset = header_size + tag_size + part_size
+                      + MF_PADDING(part_size);
+        memcpy(dst + offset, part_tag, tag_size);
+    }
+
+    tape_destroy(tape);
+    return 0;
+}
+
+matfile_view_t *matfile_view_open(const char *filename, int flags) {
+    int writable = flags & MF_VIEW_WRITE;
+    matfile_view_t *view = calloc(1, sizeof(matfile_view_t));
+
+    if (!view) {
+        fprintf(stderr, "could not allocate memory for view\n");
+        return NULL;
+    }
+
+    view->flags = flags;
+    view->base = MAP_FAILED;
+
+    if ((view->fd = open(filename, writable ? O_RDWR : O_RDONLY)) < 0) {
+        fprintf(stderr, "could not open file `%s`\n", filename);
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    if (map_view(view)) {
+        fprintf(stderr, "could not map mat-file `%s`\n", filename);
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    //  Byte swapping in place would break the file for other readers.
+    const matfile_header_t *header = (const matfile_header_t *)view->base;
+
+    if (header->endianness != (('M' << 8) | 'I')) {
+        fprintf(stderr, "mat-file has foreign byte order or wrong header\n");
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    //  Prefer sidecar index to scan of data elements.
+    if (!(view->index = matfile_index_read(filename)) &&
+        !(view->index = matfile_index_scan(filename))) {
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    //  Content hashes of sidecar index go stale as soon as arrays are updated
+    //  in place.
+    if (writable) {
+        char *sidecar = mf_index_filename(filename);
+
+        if (sidecar) {
+            remove(sidecar);
+            free(sidecar);
+        }
+    }
+
+    view->arrays = calloc(view->index->noentries + 1,
+                          sizeof(matfile_array_t *));
+
+    if (!view->arrays) {
+        fprintf(stderr, "could not allocate memory for view\n");
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    return view;
+}
+
+matfile_view_t *matfile_view_create(const char *filename,
+                                    const matfile_array_t *const *arrays,
+                                    size_t noarrays) {
+    matfile_view_t *view = calloc(1, sizeof(matfile_view_t));
+
+    if (!view) {
+        fprintf(stderr, "could not allocate memory for view\n");
+        return NULL;
+    }
+
+    view->flags = MF_VIEW_WRITE;
+    view->base = MAP_FAILED;
+    view->fd = -1;
+
+    //  Compute layout of the whole mat-file up front.
+    if (!(view->index = matfile_index_create())) {
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    uint64_t offset = sizeof(matfile_header_t);
+
+    for (size_t i = 0; i != noarrays; ++i) {
+        uint64_t size = layout_array(arrays[i]);
+
+        if (!size ||
+            mf_index_append(view->index, arrays[i]->name, offset, size, 0)) {
+            matfile_view_close(view);
+            return NULL;
+        }
+
+        offset += size;
+    }
+
+    //  Allocate blocks of file at once. This avoids fragmentation and
+    //  page faults on holes while mapping is filled.
+    view->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (view->fd < 0) {
+        fprintf(stderr, "could not open file `%s` for writing\n", filename);
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    if (posix_fallocate(view->fd, 0, offset) || map_view(view)) {
+        fprintf(stderr, "could not allocate and map mat-file `%s`\n",
+            filename);
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    view->index->file_size = offset;
+    mf_fill_header((matfile_header_t *)view->base, NULL);
+
+    for (size_t i = 0; i != noarrays; ++i) {
+        const matfile_index_entry_t *entry = &view->index->entries[i];
+
+        if (layout_array_header(view->base + entry->offset, entry->size,
+                                arrays[i])) {
+            matfile_view_close(view);
+            return NULL;
+        }
+    }
+
+    //  Bind all arrays in advance so that producers could get them from many
+    //  threads concurrently.
+    view->arrays = calloc(noarrays + 1, sizeof(matfile_array_t *));
+
+    if (!view->arrays) {
+        fprintf(stderr, "could not allocate memory for view\n");
+        matfile_view_close(view);
+        return NULL;
+    }
+
+    for (size_t i = 0; i != noarrays; ++i) {
+        if (!matfile_view_get_array(view, arrays[i]->name)) {
+            matfile_view_close(view);
+            return NULL;
+        }
+    }
+
+    return view;
+}
+
+matfile_view_t *matfile_open_rw(const char *filename) {
+    return matfile_view_open(filename, MF_VIEW_WRITE);
+}
+
+matfile_array_t *matfile_view_get_array(matfile_view_t *view,
+                                        const char *name) {
+    const matfile_index_entry_t *entry = matfile_index_find(view->index, name);
+
+    if (!entry) {
+        fprintf(stderr, "there is no array `%s`\n", name);
+        return NULL;
+    }
+
+    size_t no = entry - view->index->entries;
+
+    if (view->arrays[no]) {
+        return view->arrays[no];
+    }
+
+    matfile_array_t *array = calloc(1, sizeof(matfile_array_t));
+    uint64_t offset;
+
+    if (!array) {
+        fprintf(stderr, "could not allocate memory for array\n");
+        return NULL;
+    }
+
+    if (mf_locate_real_part(view->fd, entry->offset, entry->size, array,
+                            &offset)) {
+        free(array);
+        return NULL;
+    }
+
+    array->length = strlen(array->name);
+
+    if (!(offset = bind_numerical_part(view, offset, array, &array->pr)) ||
+        ((array->flags & MF_FLAG_COMPLEX) &&
+         !bind_numerical_part(view, offset, array, &array->pi))) {
+        free(array->dims);
+        free(array->name);
+        free(array);
+        return NULL;
+    }
+
+    return view->arrays[no] = array;
+}
+
+int matfile_view_flush(matfile_view_t *view) {
+    if (!(view->flags & MF_VIEW_WRITE)) {
+        return 0;
+    }
+
+    if (msync(view->base, view->length, MS_SYNC)) {
+        fprintf(stderr, "could not flush mapped mat-file\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int matfile_view_close(matfile_view_t *view) {
+    int retcode = 0;
+
+    if (!view) {
+        return 0;
+    }
+
+    if (view->base != MAP_FAILED) {
+        retcode = matfile_view_flush(view);
+        munmap(view->base, view->length);
+    }
+
+    if (view->arrays) {
+        for (size_t i = 0; i != view->index->noentries; ++i) {
+            if (view->arrays[i]) {
+                free(view->arrays[i]->dims);
+                free(view->arrays[i]->name);
+                free(view->arrays[i]);
+            }
+        }
+
+        free(view->arrays);
+    }
+
+    if (view->index) {
+        matfile_index_destroy(view->index);
+    }
+
+    if (view->fd >= 0) {
+        close(view->fd);
+    }
+
+    free(view);
+    return retcode;
+}
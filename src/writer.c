@@ -0,0 +1,1149 @@
+/**
+ *  \file writer.c
+ *  \brief The file contains serialization routines and write API
+ *  implementation.
+ *  \author Daniel Bershatsky
+ *  \date 2018
+ *  \copyright GNU General Public License v3.0
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <matfile/matfile.h>
+#include <matfile/tape.h>
+#include "internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define MF_SAMPLE_SIZE      65536u  ///<Default size of compressibility sample.
+#define MF_SAMPLE_CHUNK     4096u   ///<Size of contiguous chunk of sample.
+#define MF_MAX_ENTROPY      7.95    ///<Entropy of incompressible data (bits).
+#define MF_SCAN_BLOCK       1024u   ///<Number of values scanned between checks.
+
+/**
+ *  Append numerical part of array to tape. If narrowing is requested values
+ *  are stored with the smallest lossless data type.
+ *
+ *  \param[in,out] tape   Tape to append data element to.
+ *  \param[in]     type   Data type of numbers in memory.
+ *  \param[in]     data   Numbers to serialize.
+ *  \param[in]     n      Number of values.
+ *  \param[in]     narrow Narrow data type if not zero.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int serialize_numerical_part(tape_t *tape,
+                             matfile_data_type_t type,
+                             const void *data,
+                             size_t n,
+                             int narrow);
+
+/**
+ *  Serialize numerical array into complete miMATRIX data element (tag
+ *  included) and append it to tape.
+ *
+ *  \param[in,out] tape  Tape to append data element to.
+ *  \param[in]     array Array to serialize.
+ *  \param[in]     opts  Serialization options.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int serialize_array(tape_t *tape,
+                    const matfile_array_t *array,
+                    const matfile_write_options_t *opts);
+
+/**
+ *  Find the smallest data type which represents all values exactly. The
+ *  routine scans minimum, maximum and integrality of values block by block
+ *  and stops as soon as narrowing becomes impossible.
+ *
+ *  \param[in] type Data type of values.
+ *  \param[in] data Values to scan.
+ *  \param[in] n    Number of values.
+ *  \return The smallest lossless data type. It is the same as type if
+ *  narrowing does not reduce size.
+ */
+matfile_data_type_t narrow_data_type(matfile_data_type_t type,
+                                     const void *data,
+                                     size_t n);
+
+/**
+ *  Estimate compression ratio of buffer. The routine samples evenly spaced
+ *  chunks of buffer, builds byte histogram of the sample and, if order-0
+ *  entropy and quick deflate of single chunk do not show that the sample is
+ *  random, deflates the sample.
+ *
+ *  \param[in] data        Buffer to estimate.
+ *  \param[in] size        Size of buffer in bytes.
+ *  \param[in] level       Level of zlib compression to try.
+ *  \param[in] sample_size Maximal size of sample in bytes.
+ *  \return Estimated ratio of uncompressed size to compressed size.
+ */
+double estimate_compression_ratio(const void *data,
+                                  size_t size,
+                                  int level,
+                                  size_t sample_size);
+
+/**
+ *  Write data element into file. Arrays are serialized and compressed if
+ *  compression policy finds it profitable.
+ *
+ *  \param[in]  fout    Output file.
+ *  \param[in]  element Data element to write.
+ *  \param[in]  opts    Serialization options.
+ *  \param[out] blocks  Tape which boundaries of blocks of compressed stream
+ *  are pushed to or null. It is left empty if array is not compressed.
+ *  \return Return zero on success, otherwise not zero.
+ */
+int write_data_element(FILE *fout,
+                       const matfile_data_element_t *element,
+                       const matfile_write_options_t *opts,
+                       tape_t *blocks);
+
+/**
+ *  Check that data element which index entry points to is array of the same
+ *  name and size, so that it could be copied as is.
+ *
+ *  \param[in] fin   Source file.
+ *  \param[in] entry Index entry of array in source file.
+ *  \return Return zero if data element matches entry, otherwise not zero.
+ */
+int mf_check_data_element(FILE *fin, const matfile_index_entry_t *entry);
+
+int mf_serialize_data_element(tape_t *tape,
+                              matfile_data_type_t type,
+                              const void *data,
+                              size_t size) {
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "payload of %zu bytes is too large for data element\n",
+            size);
+        return 1;
+    }
+
+    size_t padding = (MF_ALIGNMENT - size % MF_ALIGNMENT) % MF_ALIGNMENT;
+    uint32_t *tag = tape_push(tape, sizeof(matfile_data_element_small_t));
+
+    if (!tag) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        return 1;
+    }
+
+    tag[0] = type;
+    tag[1] = size;
+
+    char *payload = tape_push(tape, size + padding);
+
+    if (!payload) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        return 1;
+    }
+
+    memcpy(payload, data, size);
+    memset(payload + size, 0, padding);
+
+    return 0;
+}
+
+int serialize_numerical_part(tape_t *tape,
+                             matfile_data_type_t type,
+                             const void *data,
+                             size_t n,
+                             int narrow) {
+    matfile_data_type_t storage_type = narrow
+                                     ? narrow_data_type(type, data, n)
+                                     : type;
+
+    if (storage_type == type) {
+        return mf_serialize_data_element(tape, type, data,
+                                         n * matfile_get_type_size(type));
+    }
+
+    size_t size = n * matfile_get_type_size(storage_type);
+
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "payload of %zu bytes is too large for data element\n",
+            size);
+        return 1;
+    }
+
+    size_t padding = (MF_ALIGNMENT - size % MF_ALIGNMENT) % MF_ALIGNMENT;
+    uint32_t *tag = tape_push(tape, sizeof(matfile_data_element_small_t));
+
+    if (!tag) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        return 1;
+    }
+
+    tag[0] = storage_type;
+    tag[1] = size;
+
+    char *payload = tape_push(tape, size + padding);
+
+    if (!payload) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        return 1;
+    }
+
+    mf_convert_numbers(payload, storage_type, data, type, n, 0);
+    memset(payload + size, 0, padding);
+
+    return 0;
+}
+
+//! Scan range of integers.
+#define SCAN_INTEGERS(src_t)                                            \
+    do {                                                                \
+        const src_t *values = data;                                     \
+        src_t lo = values[0], hi = values[0];                           \
+        for (size_t i = 0; i != n; ++i) {                               \
+            lo = values[i] < lo ? values[i] : lo;                       \
+            hi = values[i] > hi ? values[i] : hi;                       \
+        }                                                               \
+        min = lo;                                                       \
+        max = hi;                                                       \
+    } while (0)
+
+//! Scan range and integrality of real values. Negative zero and NaN are not
+//! integers in sense of lossless storage.
+#define SCAN_REALS(src_t)                                               \
+    do {                                                                \
+        const src_t *values = data;                                     \
+        src_t lo = values[0], hi = values[0];                           \
+        for (size_t begin = 0; begin < n; begin += MF_SCAN_BLOCK) {     \
+            size_t end = begin + MF_SCAN_BLOCK < n                      \
+                       ? begin + MF_SCAN_BLOCK : n;                     \
+            int fractional = 0;                                         \
+            for (size_t i = begin; i != end; ++i) {                     \
+                src_t value = values[i];                                \
+                lo = value < lo ? value : lo;                           \
+                hi = value > hi ? value : hi;                           \
+                fractional |= (value != trunc(value))                   \
+                            | ((value == 0) & (signbit(value) != 0));   \
+            }                                                           \
+            if (fractional) {                                           \
+                return type;                                            \
+            }                                                           \
+        }                                                               \
+        min = lo;                                                       \
+        max = hi;                                                       \
+    } while (0)
+
+matfile_data_type_t narrow_data_type(matfile_data_type_t type,
+                                     const void *data,
+                                     size_t n) {
+    double min = 0, max = 0;
+
+    if (!n) {
+        return type;
+    }
+
+    switch (type) {
+    case MFDT_INT8:     SCAN_INTEGERS(int8_t);      break;
+    case MFDT_UINT8:    SCAN_INTEGERS(uint8_t);     break;
+    case MFDT_INT16:    SCAN_INTEGERS(int16_t);     break;
+    case MFDT_UINT16:   SCAN_INTEGERS(uint16_t);    break;
+    case MFDT_INT32:    SCAN_INTEGERS(int32_t);     break;
+    case MFDT_UINT32:   SCAN_INTEGERS(uint32_t);    break;
+    case MFDT_INT64:    SCAN_INTEGERS(int64_t);     break;
+    case MFDT_UINT64:   SCAN_INTEGERS(uint64_t);    break;
+    case MFDT_SINGLE:   SCAN_REALS(float);          break;
+    case MFDT_DOUBLE:   SCAN_REALS(double);         break;
+    default:
+        return type;
+    }
+
+    //  Choose the smallest integer type which contains range of values.
+    matfile_data_type_t narrow_type = type;
+
+    if (min >= 0) {
+        if (max <= UINT8_MAX) {
+            narrow_type = MFDT_UINT8;
+        }
+        else if (max <= UINT16_MAX) {
+            narrow_type = MFDT_UINT16;
+        }
+        else if (max <= UINT32_MAX) {
+            narrow_type = MFDT_UINT32;
+        }
+    }
+    else {
+        if (min >= INT8_MIN && max <= INT8_MAX) {
+            narrow_type = MFDT_INT8;
+        }
+        else if (min >= INT16_MIN && max <= INT16_MAX) {
+            narrow_type = MFDT_INT16;
+        }
+        else if (min >= INT32_MIN && max <= INT32_MAX) {
+            narrow_type = MFDT_INT32;
+        }
+    }
+
+    if (matfile_get_type_size(narrow_type) < matfile_get_type_size(type)) {
+        return narrow_type;
+    }
+    else {
+        return type;
+    }
+}
+
+int serialize_array(tape_t *tape,
+                    const matfile_array_t *array,
+                    const matfile_write_options_t *opts) {
+    matfile_array_type_t array_type = array->flags & MF_CLASS_MASK;
+    matfile_data_type_t data_type = matfile_get_storage_type(array_type);
+
+    if (!data_type) {
+        fprintf(stderr, "array type is not supported by now\n");
+        return 1;
+    }
+
+    //  Reserve tag of miMATRIX data element. Its size is known at the end.
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+    size_t begin = tape_length(tape);
+
+    if (!tape_push(tape, tag_size)) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        return 1;
+    }
+
+    //  Array flags subelement contains class, flags and nzmax. See table 1-3.
+    uint32_t flags[2] = {array->flags & 0xffffffffu, 0};
+
+    if (array->pi.data) {
+        flags[0] |= MF_FLAG_COMPLEX;
+    }
+    else {
+        flags[0] &= ~MF_FLAG_COMPLEX;
+    }
+
+    size_t numel = matfile_array_numel(array);
+    int retcode = 0;
+
+    retcode |= mf_serialize_data_element(tape, MFDT_UINT32, flags,
+                                         sizeof(flags));
+    retcode |= mf_serialize_data_element(tape, MFDT_INT32, array->dims,
+                                         array->nodims * sizeof(int32_t));
+    retcode |= mf_serialize_data_element(tape, MFDT_INT8, array->name,
+                                         strlen(array->name));
+    retcode |= serialize_numerical_part(tape, data_type, array->pr.data,
+                                        numel, opts->narrow);
+
+    if (array->pi.data) {
+        retcode |= serialize_numerical_part(tape, data_type, array->pi.data,
+                                            numel, opts->narrow);
+    }
+
+    if (retcode) {
+        return retcode;
+    }
+
+    //  Patch tag of miMATRIX data element.
+    size_t size = tape_length(tape) - begin - tag_size;
+    uint32_t *tag = (uint32_t *)((char *)tape_deref(tape) + begin);
+
+    if (size > UINT32_MAX) {
+        fprintf(stderr, "array `%s` exceeds size limit of data element\n",
+            array->name);
+        return 1;
+    }
+
+    tag[0] = MFDT_MATRIX;
+    tag[1] = size;
+
+    return 0;
+}
+
+double estimate_compression_ratio(const void *data,
+                                  size_t size,
+                                  int level,
+                                  size_t sample_size) {
+    const unsigned char *bytes = data;
+    unsigned char *sample = NULL;
+
+    //  Sample whole buffer if it is small, otherwise gather evenly spaced
+    //  chunks in order to catch changes of data along the buffer.
+    if (sample_size < MF_SAMPLE_CHUNK) {
+        sample_size = MF_SAMPLE_CHUNK;
+    }
+
+    if (size <= sample_size) {
+        sample_size = size;
+    }
+    else {
+        size_t nochunks = sample_size / MF_SAMPLE_CHUNK;
+        size_t stride = size / nochunks;
+
+        sample_size = nochunks * MF_SAMPLE_CHUNK;
+        sample = malloc(sample_size);
+
+        if (!sample) {
+            return 1.0;
+        }
+
+        for (size_t i = 0; i != nochunks; ++i) {
+            memcpy(sample + i * MF_SAMPLE_CHUNK,
+                   bytes + i * stride,
+                   MF_SAMPLE_CHUNK);
+        }
+
+        bytes = sample;
+    }
+
+    if (!sample_size) {
+        return 1.0;
+    }
+
+    //  Byte histogram is much cheaper than deflate and it is enough to reject
+    //  noise, encrypted or already compressed data.
+    size_t histogram[256] = {0};
+    double entropy = 0.0;
+
+    for (size_t i = 0; i != sample_size; ++i) {
+        ++histogram[bytes[i]];
+    }
+
+    for (size_t i = 0; i != 256; ++i) {
+        if (histogram[i]) {
+            double p = (double)histogram[i] / sample_size;
+            entropy -= p * log2(p);
+        }
+    }
+
+    //  Periodic data could have flat histogram as well so the verdict is
+    //  confirmed with the fastest deflate of a single chunk.
+    void *out = NULL;
+    size_t outsize = 0;
+    double ratio = 1.0;
+
+    if (entropy > MF_MAX_ENTROPY) {
+        size_t chunk_size = sample_size < MF_SAMPLE_CHUNK
+                          ? sample_size : MF_SAMPLE_CHUNK;
+
+        if (!mf_compress_buffer(bytes, chunk_size, Z_BEST_SPEED, &out,
+                                &outsize)) {
+            ratio = (double)chunk_size / outsize;
+            free(out);
+        }
+
+        if (ratio < 1.0 + (8.0 - entropy)) {
+            SAFE_RELEASE(sample)
+            return ratio;
+        }
+    }
+
+    //  Trial deflate of the sample.
+    if (!mf_compress_buffer(bytes, sample_size, level, &out, &outsize)) {
+        ratio = (double)sample_size / outsize;
+        free(out);
+    }
+
+    SAFE_RELEASE(sample)
+    return ratio;
+}
+
+int mf_choose_compression_level(const void *data,
+                                size_t size,
+                                const matfile_write_options_t *opts) {
+    int level = opts->level;
+    double min_ratio = opts->min_ratio;
+
+    switch (opts->compression) {
+    case MFCOMP_NONE:
+        return 0;
+    case MFCOMP_SPEED:
+        level = level > 0 ? level : Z_BEST_SPEED;
+        break;
+    case MFCOMP_RATIO:
+        level = level > 0 ? level : Z_BEST_COMPRESSION;
+        min_ratio = 1.0;
+        break;
+    case MFCOMP_THRESHOLD:
+        level = level > 0 ? level : 6;
+        break;
+    default:
+        fprintf(stderr, "unknown compression policy: %d\n", opts->compression);
+        return 0;
+    }
+
+    //  Small buffers are compressed as is and checked after compression.
+    if (size <= opts->sample_size) {
+        return level;
+    }
+
+    double ratio = estimate_compression_ratio(data, size, level,
+                                              opts->sample_size);
+    return ratio >= min_ratio ? level : 0;
+}
+
+int mf_compress_buffer(const void *data,
+                       size_t size,
+                       int level,
+                       void **out,
+                       size_t *outsize) {
+    return mf_compress_blocks(data, size, level, 0, out, outsize, NULL);
+}
+
+int mf_compress_blocks(const void *data,
+                       size_t size,
+                       int level,
+                       size_t block_size,
+                       void **out,
+                       size_t *outsize,
+                       tape_t *blocks) {
+    z_stream stream;
+    int code;
+
+    memset(&stream, 0, sizeof(z_stream));
+
+    if ((code = deflateInit(&stream, level)) != Z_OK) {
+        fprintf(stderr, "deflate init failed with error code %d\n", code);
+        return 1;
+    }
+
+    if (!block_size || block_size > size) {
+        block_size = size;
+    }
+
+    //  Every full flush emits empty stored block so bound is extended a bit.
+    size_t noblocks = block_size ? (size + block_size - 1) / block_size : 1;
+    size_t bound = deflateBound(&stream, size) + 8 * noblocks;
+    unsigned char *buffer = malloc(bound);
+
+    if (!buffer) {
+        fprintf(stderr, "could not allocate enough memory\n");
+        deflateEnd(&stream);
+        return 1;
+    }
+
+    stream.next_out = buffer;
+    stream.avail_out = bound;
+
+    for (size_t begin = 0, i = 0; i != noblocks; ++i, begin += block_size) {
+        size_t length = size - begin < block_size ? size - begin : block_size;
+        int flush = i + 1 == noblocks ? Z_FINISH : Z_FULL_FLUSH;
+
+        //  Full flush resets state of compressor so that raw deflate data
+        //  after it could be inflated without preceding data. Zlib header
+        //  takes two bytes without preset dictionary.
+        matfile_index_block_t *block = blocks
+            ? tape_push(blocks, sizeof(matfile_index_block_t))
+            : NULL;
+
+        if (block) {
+            block->compressed = i ? stream.total_out : 2;
+            block->uncompressed = begin;
+        }
+
+        stream.next_in = (Bytef *)data + begin;
+        stream.avail_in = length;
+
+        do {
+            if (!stream.avail_out) {
+                unsigned char *extended = realloc(buffer, 2 * bound);
+
+                if (!extended) {
+                    fprintf(stderr, "could not allocate enough memory\n");
+                    deflateEnd(&stream);
+                    free(buffer);
+                    return 1;
+                }
+
+                buffer = extended;
+                stream.next_out = buffer + stream.total_out;
+                stream.avail_out = 2 * bound - stream.total_out;
+                bound *= 2;
+            }
+
+            code = deflate(&stream, flush);
+        } while (code == Z_OK && (stream.avail_in || !stream.avail_out));
+
+        if (code != (flush == Z_FINISH ? Z_STREAM_END : Z_OK) ||
+            (blocks && !block)) {
+            fprintf(stderr, "deflate failed with error code %d\n", code);
+            deflateEnd(&stream);
+            free(buffer);
+            return 1;
+        }
+    }
+
+    //  The last boundary marks the end of deflate data which is followed by
+    //  Adler-32 checksum.
+    matfile_index_block_t *block = blocks
+        ? tape_push(blocks, sizeof(matfile_index_block_t))
+        : NULL;
+
+    if (blocks && !block) {
+        fprintf(stderr, "could not reallocate memory for tape\n");
+        deflateEnd(&stream);
+        free(buffer);
+        return 1;
+    }
+
+    if (block) {
+        block->compressed = stream.total_out - 4;
+        block->uncompressed = size;
+    }
+
+    *out = buffer;
+    *outsize = stream.total_out;
+
+    deflateEnd(&stream);
+    return 0;
+}
+
+int write_data_element(FILE *fout,
+                       const matfile_data_element_t *element,
+                       const matfile_write_options_t *opts,
+                       tape_t *blocks) {
+    size_t tag_size = sizeof(matfile_data_element_small_t);
+
+    //  Small data element is written as is.
+    if (matfile_is_small(element)) {
+        if (fwrite(element, 1, tag_size, fout) != tag_size) {
+            fprintf(stderr, "could not write small data element\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    //  Other data elements are written with payload and padding.
+    if (element->large.type != MFDT_MATRIX) {
+        uint32_t tag[2] = {element->large.type, element->large.size};
+        size_t size = element->large.size;
+        size_t padding = (MF_ALIGNMENT - size % MF_ALIGNMENT) % MF_ALIGNMENT;
+        uint64_t zeros = 0;
+
+        if (fwrite(tag, 1, tag_size, fout) != tag_size ||
+            fwrite(element->large.data, 1, size, fout) != size ||
+            fwrite(&zeros, 1, padding, fout) != padding) {
+            fprintf(stderr, "could not write data element\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!element->large.array) {
+        fprintf(stderr, "there is no array in miMATRIX data element\n");
+        return 1;
+    }
+
+    //  Serialize array and choose compression level for it.
+    const matfile_array_t *array = element->large.array;
+    uint64_t clock = mf_trace_clock(opts->trace);
+    tape_t *tape = tape_create(128 + 2 * matfile_array_numel(array));
+
+    if (!tape) {
+        fprintf(stderr, "could not create tape\n");
+        return 1;
+    }
+
+    if (serialize_array(tape, array, opts)) {
+        fprintf(stderr, "could not serialize array `%s`\n", array->name);
+        tape_destroy(tape);
+        return 1;
+    }
+
+    const void *data = tape_deref(tape);
+    size_t size = tape_length(tape);
+    mf_trace_span(opts->trace, "serialize", array->name, clock,
+                  mf_trace_clock(opts->trace), size);
+
+    clock = mf_trace_clock(opts->trace);
+    int level = mf_choose_compression_level(data, size, opts);
+    int retcode = 0;
+
+    //  Compressed stream is used only if it pays indeed.
+    void *compressed = NULL;
+    size_t compressed_size = 0;
+
+    if (level > 0 && !mf_compress_blocks(data, size, level, opts->block_size,
+                                         &compressed, &compressed_size,
+                                         blocks)) {
+        double ratio = (double)size / compressed_size;
+        double min_ratio = opts->compression == MFCOMP_RATIO
+                         ? 1.0 : opts->min_ratio;
+
+        mf_trace_span(opts->trace, "compress", array->name, clock,
+                      mf_trace_clock(opts->trace), size);
+
+        if (ratio > 1.0 && ratio >= min_ratio) {
+            uint32_t tag[2] = {MFDT_COMPRESSED, compressed_size};
+
+            clock = mf_trace_clock(opts->trace);
+
+            if (fwrite(tag, 1, tag_size, fout) != tag_size ||
+                fwrite(compressed, 1, compressed_size, fout)
+                    != compressed_size) {
+                fprintf(stderr, "could not write data element\n");
+                retcode = 1;
+            }
+
+            mf_trace_span(opts->trace, "write", array->name, clock,
+                          mf_trace_clock(opts->trace),
+                          tag_size + compressed_size);
+            free(compressed);
+            tape_destroy(tape);
+            return retcode;
+        }
+
+        free(compressed);
+    }
+
+    if (blocks) {
+        tape_pop(blocks, tape_length(blocks));
+    }
+
+    clock = mf_trace_clock(opts->trace);
+
+    if (fwrite(data, 1, size, fout) != size) {
+        fprintf(stderr, "could not write data element\n");
+        retcode = 1;
+    }
+
+    mf_trace_span(opts->trace, "write", array->name, clock,
+                  mf_trace_clock(opts->trace), size);
+    tape_destroy(tape);
+    return retcode;
+}
+
+int mf_copy_data_element(FILE *fin,
+                         FILE *fout,
+                         uint64_t offset,
+                         uint64_t size) {
+    if (fflush(fout)) {
+        fprintf(stderr, "could not flush output file\n");
+        return 1;
+    }
+
+    int fdin = fileno(fin), fdout = fileno(fout);
+    off_t pos = offset;
+    uint64_t rest = size;
+
+#ifdef __linux__
+    while (rest) {
+        ssize_t copied = copy_file_range(fdin, &pos, fdout, NULL, rest, 0);
+
+        if (copied <= 0) {
+            break;
+        }
+
+        rest -= copied;
+    }
+#endif
+
+    //  Fall back to copying through buffer if kernel could not copy data.
+    char buffer[65536];
+
+    while (rest) {
+        size_t length = rest < sizeof(buffer) ? rest : sizeof(buffer);
+        ssize_t nread = pread(fdin, buffer, length, pos);
+
+        if (nread <= 0 || write(fdout, buffer, nread) != nread) {
+            fprintf(stderr, "could not copy data element\n");
+            return 1;
+        }
+
+        pos += nread;
+        rest -= nread;
+    }
+
+    //  Synchronize position of output stream with file descriptor.
+    return fseek(fout, 0, SEEK_END);
+}
+
+int mf_check_data_element(FILE *fin, const matfile_index_entry_t *entry) {
+    int fd = fileno(fin);
+    uint32_t tag[2];
+
+    if (pread(fd, tag, sizeof(tag), entry->offset) != sizeof(tag)) {
+        return 1;
+    }
+
+    uint32_t type, size;
+    size_t length;
+    mf_decode_tag(tag, &type, &size, &length);
+
+    if (type == MFDT_COMPRESSED) {
+        length = sizeof(tag) + size;
+    }
+
+    matfile_array_t array;
+
+    if ((type != MFDT_MATRIX && type != MFDT_COMPRESSED) ||
+        length != entry->size ||
+        mf_scan_array_header(fd, entry->offset, type, size, &array,
+                             NULL)) {
+        return 1;
+    }
+
+    int retcode = strcmp(array.name, entry->name) != 0;
+    free(array.dims);
+    free(array.name);
+    return retcode;
+}
+
+int mf_write_data_elements(FILE *fout,
+                           const matfile_t *mat,
+                           const matfile_write_options_t *opts,
+                           FILE *fin,
+                           const matfile_index_t *origin,
+                           matfile_index_t *index) {
+    tape_t *blocks = index ? tape_create(16 * sizeof(matfile_index_block_t))
+                           : NULL;
+
+    if (index && !blocks) {
+        fprintf(stderr, "could not create tape\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i != mat->noelements; ++i) {
+        const matfile_data_element_t *element = &mat->elements[i];
+        const matfile_array_t *array = NULL;
+        const matfile_index_entry_t *entry = NULL;
+        uint64_t hash = 0;
+        uint64_t clock = mf_trace_clock(opts->trace);
+        long begin = ftell(fout);
+        int retcode;
+
+        if (matfile_is_large(element) && element->large.type == MFDT_MATRIX) {
+            array = element->large.array;
+        }
+
+        if (array && index) {
+            hash = matfile_array_hash(array);
+        }
+
+        if (array && origin) {
+            entry = matfile_index_find(origin, array->name);
+        }
+
+        if (blocks) {
+            tape_pop(blocks, tape_length(blocks));
+        }
+
+        //  Data element is copied as is only if it is unchanged and index
+        //  entry still points to it.
+        if (entry && (entry->hash != hash ||
+                      mf_check_data_element(fin, entry))) {
+            entry = NULL;
+        }
+
+        if (entry) {
+            retcode = mf_copy_data_element(fin, fout, entry->offset,
+                                           entry->size);
+
+            //  Block boundaries are relative to data element so they are
+            //  still valid.
+            if (!retcode && blocks && entry->noblocks) {
+                size_t size = (entry->noblocks + 1)
+                            * sizeof(matfile_index_block_t);
+                void *copy = tape_push(blocks, size);
+
+                if (copy) {
+                    memcpy(copy, entry->blocks, size);
+                }
+            }
+        }
+        else {
+            retcode = write_data_element(fout, element, opts, blocks);
+        }
+
+        if (!retcode && array && index) {
+            retcode = mf_index_append(index, array->name, begin,
+                                      ftell(fout) - begin, hash);
+        }
+
+        //  Single block gains nothing from parallel inflate.
+        size_t noblocks = blocks ? tape_length(blocks)
+                                 / sizeof(matfile_index_block_t) : 0;
+
+        if (!retcode && array && noblocks > 2) {
+            retcode = mf_index_set_blocks(&index->entries[index->noentries - 1],
+                                          tape_deref(blocks), noblocks - 1);
+        }
+
+        if (retcode) {
+            tape_destroy(blocks);
+            return retcode;
+        }
+
+        mf_trace_span(opts->trace, entry && entry->hash == hash ? "copy"
+                                                             : "element",
+                      array ? array->name : NULL, clock,
+                      mf_trace_clock(opts->trace), ftell(fout) - begin);
+    }
+
+    tape_destroy(blocks);
+    return 0;
+}
+
+void mf_fill_header(matfile_header_t *header, const matfile_header_t *origin) {
+    memset(header, ' ', sizeof(header->description));
+
+    if (origin && origin->description[0]) {
+        memcpy(header->description, origin->description,
+               sizeof(header->description));
+    }
+    else {
+        char created[64];
+        time_t now = time(NULL);
+        strftime(created, sizeof(created), "%a %b %d %H:%M:%S %Y",
+                 localtime(&now));
+
+        int length = snprintf(header->description,
+                              sizeof(header->description),
+                              "MATLAB 5.0 MAT-file, Platform: libmatfile %s, "
+                              "Created on: %s", MATFILE_VERSION, created);
+
+        if (length >= 0 && length < sizeof(header->description)) {
+            header->description[length] = ' ';
+        }
+    }
+
+    header->subsys_data_offset = 0;
+    header->version = 0x0100;
+    header->endianness = ('M' << 8) | 'I';
+}
+
+int mf_validate_header(const matfile_header_t *header) {
+    if (header->endianness != (('M' << 8) | 'I')) {
+        fprintf(stderr, "mat-file has foreign byte order or wrong header\n");
+        return 1;
+    }
+
+    if (header->version != 0x0100) {
+        fprintf(stderr, "unsupported version of mat-file: 0x%04x\n",
+            header->version);
+        return 1;
+    }
+
+    //  All zeros or all spaces indicate that there is no subsystem data.
+    uint64_t offset = header->subsys_data_offset;
+
+    if (offset != 0 && offset != 0x2020202020202020ul) {
+        fprintf(stderr, "mat-file contains subsystem-specific data\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+void matfile_write_options_init(matfile_write_options_t *opts) {
+    opts->compression = MFCOMP_THRESHOLD;
+    opts->level = -1;
+    opts->min_ratio = 1.1;
+    opts->sample_size = MF_SAMPLE_SIZE;
+    opts->narrow = 1;
+    opts->index = 0;
+    opts->incremental = 0;
+    opts->block_size = 0;
+    opts->trace = NULL;
+}
+
+int matfile_write(const char *filename,
+                  const matfile_t *mat,
+                  const matfile_write_options_t *opts) {
+    matfile_write_options_t defaults;
+
+    if (!opts) {
+        matfile_write_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    //  Incremental save reads unchanged data elements from origin mat-file so
+    //  new content is written to temporary file which replaces origin one.
+    matfile_index_t *origin = NULL, *index = NULL;
+    FILE *fin = NULL;
+    char *tmpname = NULL;
+    const char *target = filename;
+
+    if (opts->index || opts->incremental) {
+        if (!(index = matfile_index_create())) {
+            return 1;
+        }
+    }
+
+    if (opts->incremental && (origin = matfile_index_read(filename))) {
+        fin = fopen(filename, "rb");
+        tmpname = malloc(strlen(filename) + sizeof(".tmp"));
+
+        if (!fin || !tmpname) {
+            fprintf(stderr, "could not prepare incremental save\n");
+            SAFE_RELEASE(tmpname)
+            matfile_index_destroy(origin);
+            matfile_index_destroy(index);
+
+            if (fin) {
+                fclose(fin);
+            }
+
+            return 1;
+        }
+
+        sprintf(tmpname, "%s.tmp", filename);
+        target = tmpname;
+    }
+
+    FILE *fout = fopen(target, "wb");
+    int retcode = 0;
+
+    if (!fout) {
+        fprintf(stderr, "could not open file `%s` for writing\n", target);
+        retcode = 1;
+    }
+    else {
+        matfile_header_t header;
+        mf_fill_header(&header, &mat->header);
+
+        if (fwrite(&header, 1, sizeof(header), fout) != sizeof(header)) {
+            fprintf(stderr, "could not write header\n");
+            retcode = 1;
+        }
+        else {
+            retcode = mf_write_data_elements(fout, mat, opts, fin, origin,
+                                             index);
+        }
+
+        if (index) {
+            index->file_size = ftell(fout);
+        }
+
+        if (fclose(fout)) {
+            fprintf(stderr, "could not close file `%s`\n", target);
+            retcode = 1;
+        }
+    }
+
+    if (fin) {
+        fclose(fin);
+    }
+
+    if (tmpname && !retcode && rename(tmpname, filename)) {
+        fprintf(stderr, "could not replace `%s`\n", filename);
+        retcode = 1;
+    }
+
+    if (tmpname && retcode) {
+        remove(tmpname);
+    }
+
+    //  Sidecar index without new content would be stale.
+    char *sidecar = mf_index_filename(filename);
+
+    if (!retcode && index) {
+        retcode = matfile_index_write(filename, index);
+    }
+    else if (!retcode && sidecar) {
+        remove(sidecar);
+    }
+
+    SAFE_RELEASE(sidecar)
+    SAFE_RELEASE(tmpname)
+    matfile_index_destroy(origin);
+    matfile_index_destroy(index);
+    return retcode;
+}
+
+int matfile_append(const char *filename,
+                   const matfile_array_t *array,
+                   const matfile_write_options_t *opts) {
+    matfile_write_options_t defaults;
+
+    if (!opts) {
+        matfile_write_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    //  Open existing mat-file or create new one with header.
+    matfile_header_t header;
+    FILE *fout = fopen(filename, "r+b");
+
+    if (!fout && errno == ENOENT) {
+        if (!(fout = fopen(filename, "w+b"))) {
+            fprintf(stderr, "could not create file `%s`\n", filename);
+            return 1;
+        }
+
+        mf_fill_header(&header, NULL);
+
+        if (fwrite(&header, 1, sizeof(header), fout) != sizeof(header)) {
+            fprintf(stderr, "could not write header\n");
+            fclose(fout);
+            return 1;
+        }
+    }
+    else if (!fout) {
+        fprintf(stderr, "could not open file `%s` for update\n", filename);
+        return 1;
+    }
+    else if (fread(&header, 1, sizeof(header), fout) != sizeof(header) ||
+             mf_validate_header(&header)) {
+        fprintf(stderr, "could not append to mat-file `%s`\n", filename);
+        fclose(fout);
+        return 1;
+    }
+
+    //  Write new data element at the end of file.
+    if (fseek(fout, 0, SEEK_END)) {
+        fprintf(stderr, "could not seek to the end of `%s`\n", filename);
+        fclose(fout);
+        return 1;
+    }
+
+    long end = ftell(fout);
+    matfile_index_t *index = matfile_index_read(filename);
+    matfile_data_element_t element;
+
+    memset(&element, 0, sizeof(element));
+    element.large.type = MFDT_MATRIX;
+    element.large.array = (matfile_array_t *)array;
+
+    tape_t *blocks = index ? tape_create(16 * sizeof(matfile_index_block_t))
+                           : NULL;
+    int retcode = (index && !blocks)
+               || write_data_element(fout, &element, opts, blocks);
+    long size = ftell(fout);
+
+    //  Stream is closed before truncation so that rest of its buffer could
+    //  not be flushed beyond original size.
+    if (fclose(fout)) {
+        fprintf(stderr, "could not close file `%s`\n", filename);
+        retcode = 1;
+    }
+
+    //  Do not leave partially written data element in mat-file.
+    if (retcode && truncate(filename, end)) {
+        fprintf(stderr, "could not truncate `%s` to original size\n",
+            filename);
+    }
+
+    //  Keep sidecar index consistent with extended mat-file. If it could not
+    //  be updated then it becomes stale and it is ignored by readers.
+    if (!retcode && index) {
+        uint64_t hash = matfile_array_hash(array);
+
+        size_t noblocks = tape_length(blocks) / sizeof(matfile_index_block_t);
+        int stale = mf_index_append(index, array->name, end, size - end, hash);
+
+        if (!stale && noblocks > 2) {
+            stale = mf_index_set_blocks(&index->entries[index->noentries - 1],
+                                        tape_deref(blocks), noblocks - 1);
+        }
+
+        if (!stale) {
+            index->file_size = size;
+            matfile_index_write(filename, index);
+        }
+    }
+
+    tape_destroy(blocks);
+    matfile_index_destroy(index);
+    return retcode;
+}
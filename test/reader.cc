@@ -5,3 +5,663 @@ extern "C" {
 }
 
 #include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+typedef std::unique_ptr<matfile_t, decltype(&matfile_destroy)> matfile_ptr;
+
+//  Append word to buffer in big-endian byte order.
+static void PushBigEndian(std::vector<unsigned char> &bytes,
+                          uint32_t word,
+                          size_t size = 4) {
+    for (size_t i = size; i != 0; --i) {
+        bytes.push_back(word >> (8 * (i - 1)));
+    }
+}
+
+TEST(Reader, SwitchedByteOrder) {
+    //  Real array x = [1; -2] of class double is stored as miINT16.
+    std::vector<unsigned char> array;
+    PushBigEndian(array, MFDT_MATRIX);
+    PushBigEndian(array, 56);
+    PushBigEndian(array, MFDT_UINT32);
+    PushBigEndian(array, 8);
+    PushBigEndian(array, MFMX_DOUBLE_CLASS);
+    PushBigEndian(array, 0);
+    PushBigEndian(array, MFDT_INT32);
+    PushBigEndian(array, 8);
+    PushBigEndian(array, 2);
+    PushBigEndian(array, 1);
+    PushBigEndian(array, 1 << 16 | MFDT_INT8);
+    array.insert(array.end(), {'x', 0, 0, 0});
+    PushBigEndian(array, MFDT_INT16);
+    PushBigEndian(array, 4);
+    PushBigEndian(array, 1, 2);
+    PushBigEndian(array, -2, 2);
+    PushBigEndian(array, 0);
+
+    //  The same array is stored compressed as well.
+    uLongf length = compressBound(array.size());
+    std::vector<unsigned char> compressed(length);
+    ASSERT_EQ(Z_OK, compress(compressed.data(), &length, array.data(),
+                             array.size()));
+    compressed.resize(length);
+
+    std::vector<unsigned char> bytes(sizeof(matfile_header_t), ' ');
+    std::fill(bytes.end() - 12, bytes.end(), 0);
+    bytes[124] = 0x01;
+    bytes[126] = 'M';
+    bytes[127] = 'I';
+    bytes.insert(bytes.end(), array.begin(), array.end());
+    PushBigEndian(bytes, MFDT_COMPRESSED);
+    PushBigEndian(bytes, compressed.size());
+    bytes.insert(bytes.end(), compressed.begin(), compressed.end());
+
+    matfile_ptr mat(matfile_read_memory(bytes.data(), bytes.size(), NULL),
+                    matfile_destroy);
+    ASSERT_TRUE(mat);
+    EXPECT_EQ(0x0100, mat->header.version);
+    ASSERT_EQ(2u, mat->noelements);
+
+    for (size_t i = 0; i != mat->noelements; ++i) {
+        const matfile_array_t *x = mat->elements[i].large.array;
+        ASSERT_EQ(MFDT_MATRIX, mat->elements[i].large.type);
+        EXPECT_STREQ("x", x->name);
+        EXPECT_EQ(MFMX_DOUBLE_CLASS, x->flags & MF_CLASS_MASK);
+        ASSERT_EQ(2u, x->nodims);
+        EXPECT_EQ(2, x->dims[0]);
+        EXPECT_EQ(1, x->dims[1]);
+        EXPECT_EQ(1.0, x->pr.mx_double[0]);
+        EXPECT_EQ(-2.0, x->pr.mx_double[1]);
+    }
+}
+
+TEST(Reader, Statistics) {
+    std::string filename = ::testing::TempDir() + "stats.mat";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {100, 20};
+    matfile_array_t *array = matfile_array_create("ramp", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 0);
+
+    for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+        array->pr.mx_double[i] = i % 100;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    opts.narrow = 0;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    matfile_stats_t stats;
+    matfile_context_t ctx;
+    matfile_stats_reset(&stats);
+    matfile_context_init(&ctx);
+
+    //  Nothing is measured without statistics.
+    matfile_ptr plain(matfile_read_ctx(filename.c_str(), &ctx),
+                      matfile_destroy);
+    ASSERT_TRUE(plain);
+
+    ctx.stats = &stats;
+    matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                       matfile_destroy);
+    ASSERT_TRUE(loaded);
+
+    FILE *file = fopen(filename.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    EXPECT_EQ(static_cast<uint64_t>(ftell(file)), stats.bytes_read);
+    fclose(file);
+
+    EXPECT_LT(2000u * sizeof(double), stats.bytes_inflated);
+    EXPECT_LT(2000u * sizeof(double), stats.alloc_bytes);
+    EXPECT_LT(4u, stats.noallocs);
+    EXPECT_LT(0u, stats.phase_ns[MFPHASE_INFLATE]
+                + stats.phase_ns[MFPHASE_PARSE]);
+    EXPECT_STREQ("inflate", matfile_get_phase_string(MFPHASE_INFLATE));
+
+    //  Counters accumulate until reset.
+    uint64_t bytes_read = stats.bytes_read;
+    matfile_ptr again(matfile_read_ctx(filename.c_str(), &ctx),
+                      matfile_destroy);
+    EXPECT_EQ(2 * bytes_read, stats.bytes_read);
+
+    matfile_stats_reset(&stats);
+    EXPECT_EQ(0u, stats.bytes_read);
+    remove(filename.c_str());
+}
+
+TEST(Reader, TraceSpans) {
+    std::string filename = ::testing::TempDir() + "trace.mat";
+    std::string tracename = ::testing::TempDir() + "trace.json";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {1000, 100};
+    matfile_array_t *array = matfile_array_create("ramp", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 0);
+
+    for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+        array->pr.mx_double[i] = i % 1000 + 0.5;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    matfile_trace_t *trace = matfile_trace_create();
+    ASSERT_NE(nullptr, trace);
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    opts.index = 1;
+    opts.block_size = 64 * 1024;
+    opts.trace = trace;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    size_t nowrites = matfile_trace_length(trace);
+    EXPECT_LE(3u, nowrites);
+
+    //  Blocks of compressed array are inflated and traced on many threads.
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    ctx.nothreads = 2;
+    ctx.trace = trace;
+
+    matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                       matfile_destroy);
+    ASSERT_TRUE(loaded);
+    EXPECT_LT(nowrites + 8, matfile_trace_length(trace));
+    ASSERT_EQ(0, matfile_trace_dump(trace, tracename.c_str()));
+    matfile_trace_destroy(trace);
+
+    FILE *file = fopen(tracename.c_str(), "r");
+    ASSERT_NE(nullptr, file);
+    std::string json;
+    char buffer[4096];
+
+    for (size_t size; (size = fread(buffer, 1, sizeof(buffer), file));) {
+        json.append(buffer, size);
+    }
+
+    fclose(file);
+    EXPECT_EQ(0u, json.find("{\"traceEvents\":["));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"inflate block\""));
+    EXPECT_NE(std::string::npos, json.find("\"name\":\"compress\""));
+    EXPECT_NE(std::string::npos, json.find("\"array\":\"ramp\""));
+
+    remove((filename + MF_INDEX_SUFFIX).c_str());
+    remove(filename.c_str());
+    remove(tracename.c_str());
+}
+
+static int CountHistograms(void *opaque,
+                           matfile_operation_t op,
+                           matfile_size_class_t size,
+                           const matfile_latency_snapshot_t *snapshot) {
+    EXPECT_LT(0u, snapshot->count);
+    EXPECT_LE(snapshot->min_ns, snapshot->max_ns);
+    *static_cast<int *>(opaque) += 1;
+    return 0;
+}
+
+TEST(Reader, LatencyHistograms) {
+    std::string filename = ::testing::TempDir() + "latency.mat";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t small_dims[] = {10, 10}, large_dims[] = {100, 1000};
+    matfile_array_t *small = matfile_array_create("small", MFMX_DOUBLE_CLASS,
+                                                  2, small_dims, 0);
+    matfile_array_t *large = matfile_array_create("large", MFMX_DOUBLE_CLASS,
+                                                  2, large_dims, 0);
+
+    for (size_t i = 0; i != matfile_array_numel(small); ++i) {
+        small->pr.mx_double[i] = i;
+    }
+
+    for (size_t i = 0; i != matfile_array_numel(large); ++i) {
+        large->pr.mx_double[i] = i % 100;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), small));
+    ASSERT_EQ(0, matfile_add_array(mat.get(), large));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    matfile_latency_t *latency = matfile_latency_create();
+    ASSERT_NE(nullptr, latency);
+
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    ctx.latency = latency;
+
+    for (int i = 0; i != 3; ++i) {
+        matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                           matfile_destroy);
+        ASSERT_TRUE(loaded);
+    }
+
+    //  Every variable is looked up and converted once per reading.
+    matfile_latency_snapshot_t snapshot;
+    ASSERT_EQ(0, matfile_latency_snapshot(latency, MFOP_LOOKUP, MFSIZE_ANY,
+                                          &snapshot));
+    EXPECT_EQ(6u, snapshot.count);
+    EXPECT_LE(snapshot.min_ns, matfile_latency_quantile(&snapshot, 0.5));
+    EXPECT_LE(matfile_latency_quantile(&snapshot, 0.5),
+              matfile_latency_quantile(&snapshot, 0.999));
+    EXPECT_EQ(snapshot.max_ns, matfile_latency_quantile(&snapshot, 1.0));
+
+    ASSERT_EQ(0, matfile_latency_snapshot(latency, MFOP_CONVERT, MFSIZE_SMALL,
+                                          &snapshot));
+    EXPECT_EQ(3u, snapshot.count);
+    ASSERT_EQ(0, matfile_latency_snapshot(latency, MFOP_CONVERT, MFSIZE_MEDIUM,
+                                          &snapshot));
+    EXPECT_EQ(3u, snapshot.count);
+    EXPECT_STREQ("convert", matfile_get_operation_string(MFOP_CONVERT));
+    EXPECT_STREQ("medium", matfile_get_size_class_string(MFSIZE_MEDIUM));
+
+    int nohistograms = 0;
+    EXPECT_EQ(0, matfile_latency_export(latency, CountHistograms,
+                                        &nohistograms));
+    EXPECT_LE(4, nohistograms);
+
+    //  Buckets are contiguous and their bounds grow.
+    for (size_t i = 1; i != MF_LATENCY_BUCKETS; ++i) {
+        ASSERT_LT(matfile_latency_bucket_bound(i - 1),
+                  matfile_latency_bucket_bound(i));
+    }
+
+    matfile_latency_reset(latency);
+    ASSERT_EQ(0, matfile_latency_snapshot(latency, MFOP_LOOKUP, MFSIZE_ANY,
+                                          &snapshot));
+    EXPECT_EQ(0u, snapshot.count);
+    EXPECT_EQ(0u, matfile_latency_quantile(&snapshot, 0.99));
+
+    //  Quantiles of known sample follow nearest rank. Value 1000 falls into
+    //  bucket [992, 1024) so its upper bound is reported.
+    uint64_t sample[] = {100, 1000, 10000};
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.count = 3;
+    snapshot.min_ns = 100;
+    snapshot.max_ns = 10000;
+
+    for (uint64_t value : sample) {
+        size_t i = 0;
+
+        while (matfile_latency_bucket_bound(i) <= value) {
+            ++i;
+        }
+
+        snapshot.total_ns += value;
+        snapshot.buckets[i] += 1;
+    }
+
+    EXPECT_EQ(100u, matfile_latency_quantile(&snapshot, 0.0));
+    EXPECT_EQ(100u, matfile_latency_quantile(&snapshot, 0.3));
+    EXPECT_EQ(1023u, matfile_latency_quantile(&snapshot, 0.5));
+    EXPECT_EQ(1023u, matfile_latency_quantile(&snapshot, 0.6));
+    EXPECT_EQ(10000u, matfile_latency_quantile(&snapshot, 0.9));
+    EXPECT_EQ(10000u, matfile_latency_quantile(&snapshot, 0.99));
+    EXPECT_EQ(10000u, matfile_latency_quantile(&snapshot, 1.0));
+
+    matfile_latency_destroy(latency);
+    remove(filename.c_str());
+}
+
+TEST(Reader, EstimateFootprint) {
+    std::string filename = ::testing::TempDir() + "estimate.mat";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {300, 200};
+    matfile_array_t *real = matfile_array_create("real", MFMX_DOUBLE_CLASS,
+                                                 2, dims, 0);
+    matfile_array_t *cplx = matfile_array_create("cplx", MFMX_SINGLE_CLASS,
+                                                 2, dims, 1);
+
+    for (size_t i = 0; i != matfile_array_numel(real); ++i) {
+        real->pr.mx_double[i] = i % 300;
+        cplx->pr.mx_single[i] = i % 7;
+        cplx->pi.mx_single[i] = -1.0f * (i % 5);
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), real));
+    ASSERT_EQ(0, matfile_add_array(mat.get(), cplx));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    matfile_estimate_t *estimate = matfile_estimate(filename.c_str(), NULL, 0);
+    ASSERT_NE(nullptr, estimate);
+    ASSERT_EQ(2u, estimate->noentries);
+    EXPECT_STREQ("real", estimate->entries[0].name);
+    EXPECT_EQ(60000u, estimate->entries[0].numel);
+    ASSERT_EQ(2u, estimate->entries[0].nodims);
+    EXPECT_EQ(dims[0], estimate->entries[0].dims[0]);
+    EXPECT_EQ(dims[1], estimate->entries[0].dims[1]);
+    EXPECT_EQ(60000u * sizeof(double), estimate->entries[0].decoded);
+    EXPECT_EQ(1, estimate->entries[1].complex);
+    EXPECT_EQ(2 * 60000u * sizeof(float), estimate->entries[1].decoded);
+    EXPECT_LT(estimate->entries[0].stored, estimate->entries[0].inflated);
+    EXPECT_EQ(estimate->entries[0].decoded + estimate->entries[1].decoded,
+              estimate->decoded);
+
+    //  Peak covers decoded arrays and inflate buffer, and reading of file
+    //  holds its bytes in addition.
+    EXPECT_LT(estimate->decoded, estimate->peak[MFLOAD_MEMORY]);
+    EXPECT_EQ(estimate->peak[MFLOAD_MEMORY] + estimate->file_size,
+              estimate->peak[MFLOAD_FILE]);
+    EXPECT_STREQ("memory", matfile_get_load_mode_string(MFLOAD_MEMORY));
+
+    matfile_stats_t stats;
+    matfile_context_t ctx;
+    matfile_stats_reset(&stats);
+    matfile_context_init(&ctx);
+    ctx.stats = &stats;
+    matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                       matfile_destroy);
+    ASSERT_TRUE(loaded);
+    EXPECT_LE(estimate->peak[MFLOAD_FILE], stats.alloc_bytes);
+    matfile_estimate_destroy(estimate);
+
+    const char *names[] = {"cplx"};
+    estimate = matfile_estimate(filename.c_str(), names, 1);
+    ASSERT_NE(nullptr, estimate);
+    ASSERT_EQ(1u, estimate->noentries);
+    EXPECT_EQ(MFMX_SINGLE_CLASS, estimate->entries[0].type);
+    EXPECT_STREQ("mxSINGLE_CLASS",
+                 matfile_get_class_string(estimate->entries[0].type));
+    EXPECT_EQ(estimate->entries[0].decoded, estimate->decoded);
+    matfile_estimate_destroy(estimate);
+
+    const char *missing[] = {"cplx", "nothing"};
+    EXPECT_EQ(nullptr, matfile_estimate(filename.c_str(), missing, 2));
+    remove(filename.c_str());
+}
+
+TEST(Reader, CancelAndDeadline) {
+    std::string filename = ::testing::TempDir() + "cancel.mat";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {500, 40};
+    matfile_array_t *array = matfile_array_create("ramp", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 0);
+
+    for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+        array->pr.mx_double[i] = i % 500;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    matfile_cancel_t *cancel = matfile_cancel_create();
+    matfile_status_t status = MFSTATUS_COUNT;
+    matfile_context_t ctx;
+    ASSERT_NE(nullptr, cancel);
+    matfile_context_init(&ctx);
+    ctx.cancel = cancel;
+    ctx.status = &status;
+
+    //  Reading succeeds until cancellation is requested.
+    matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                       matfile_destroy);
+    EXPECT_TRUE(loaded);
+    EXPECT_EQ(MFSTATUS_OK, status);
+
+    matfile_cancel(cancel);
+    EXPECT_TRUE(matfile_is_cancelled(cancel));
+    EXPECT_EQ(nullptr, matfile_read_ctx(filename.c_str(), &ctx));
+    EXPECT_EQ(MFSTATUS_CANCELLED, status);
+    EXPECT_STREQ("cancelled", matfile_get_status_string(status));
+
+    //  Partially parsed content is released if reading from memory is
+    //  cancelled.
+    std::string bytes;
+    FILE *fin = fopen(filename.c_str(), "rb");
+    ASSERT_NE(nullptr, fin);
+    char chunk[4096];
+    size_t length;
+
+    while ((length = fread(chunk, 1, sizeof(chunk), fin)) != 0) {
+        bytes.append(chunk, length);
+    }
+
+    fclose(fin);
+    EXPECT_EQ(nullptr, matfile_read_memory(bytes.data(), bytes.size(), &ctx));
+    EXPECT_EQ(MFSTATUS_CANCELLED, status);
+
+    //  Expired deadline is distinguished from cancellation.
+    matfile_cancel_reset(cancel);
+    ctx.deadline = matfile_deadline(0);
+    EXPECT_EQ(nullptr, matfile_read_ctx(filename.c_str(), &ctx));
+    EXPECT_EQ(MFSTATUS_EXPIRED, status);
+
+    ctx.deadline = matfile_deadline(60000000000u);
+    loaded.reset(matfile_read_ctx(filename.c_str(), &ctx));
+    EXPECT_TRUE(loaded);
+    EXPECT_EQ(MFSTATUS_OK, status);
+
+    ctx.deadline = 0;
+    EXPECT_EQ(nullptr, matfile_read_ctx("nothing.mat", &ctx));
+    EXPECT_EQ(MFSTATUS_ERROR, status);
+
+    //  Interruption of one reading does not leak into concurrent one.
+    matfile_cancel(cancel);
+    matfile_status_t statuses[2] = {MFSTATUS_COUNT, MFSTATUS_COUNT};
+    matfile_context_t contexts[2];
+
+    for (int i = 0; i != 2; ++i) {
+        matfile_context_init(&contexts[i]);
+        contexts[i].cancel = i ? cancel : nullptr;
+        contexts[i].status = &statuses[i];
+    }
+
+    auto read = [&](int i) {
+        for (int j = 0; j != 16; ++j) {
+            matfile_destroy(matfile_read_ctx(filename.c_str(), &contexts[i]));
+            EXPECT_EQ(i ? MFSTATUS_CANCELLED : MFSTATUS_OK, statuses[i]);
+        }
+    };
+
+    std::thread reader(read, 0);
+    read(1);
+    reader.join();
+
+    matfile_cancel_destroy(cancel);
+    remove(filename.c_str());
+}
+
+TEST(Reader, ExtractNpy) {
+    std::string filename = ::testing::TempDir() + "extract.mat";
+    std::string output = ::testing::TempDir() + "extract.npy";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {300, 7};
+    matfile_array_t *array = matfile_array_create("cplx", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 1);
+
+    for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+        array->pr.mx_double[i] = i % 200;
+        array->pi.mx_double[i] = -1.0 * (i % 3);
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    //  Narrowed and compressed values are restored chunk by chunk.
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    matfile_extract_options_t extract_opts;
+    matfile_extract_options_init(&extract_opts);
+    extract_opts.buffer_size = 4096;
+
+    for (int row_major = 0; row_major != 2; ++row_major) {
+        extract_opts.row_major = row_major;
+        ASSERT_EQ(0, matfile_extract(filename.c_str(), "cplx", output.c_str(),
+                                     &extract_opts));
+
+        std::string bytes;
+        FILE *fin = fopen(output.c_str(), "rb");
+        ASSERT_NE(nullptr, fin);
+        char chunk[4096];
+        size_t length;
+
+        while ((length = fread(chunk, 1, sizeof(chunk), fin)) != 0) {
+            bytes.append(chunk, length);
+        }
+
+        fclose(fin);
+
+        //  Header is padded so that payload is aligned to 64 bytes.
+        size_t header = 10 + (uint8_t)bytes[8] + ((uint8_t)bytes[9] << 8);
+        ASSERT_EQ(0u, header % 64);
+        ASSERT_EQ(header + 2 * 2100 * sizeof(double), bytes.size());
+        EXPECT_EQ(0, bytes.compare(0, 6, "\x93NUMPY"));
+        EXPECT_NE(std::string::npos, bytes.find("'shape': (300, 7)"));
+        EXPECT_NE(std::string::npos, bytes.find(row_major ? "False" : "True"));
+        EXPECT_NE(std::string::npos, bytes.find("c16"));
+
+        const double *values = (const double *)(bytes.data() + header);
+
+        for (size_t i = 0; i != 300; ++i) {
+            for (size_t j = 0; j != 7; ++j) {
+                size_t src = j * 300 + i;
+                size_t dst = row_major ? i * 7 + j : src;
+                ASSERT_EQ(src % 200, values[2 * dst]);
+                ASSERT_EQ(-1.0 * (src % 3), values[2 * dst + 1]);
+            }
+        }
+    }
+
+    EXPECT_NE(0, matfile_extract(filename.c_str(), "nothing", output.c_str(),
+                                 NULL));
+
+    //  Shape which does not fit into .npy header is rejected while raw
+    //  values are still extracted.
+    std::vector<int32_t> wide(350, INT32_MAX);
+    wide[0] = 0;
+    mat.reset(matfile_create());
+    array = matfile_array_create("tall", MFMX_DOUBLE_CLASS, wide.size(),
+                                 wide.data(), 0);
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    EXPECT_NE(0, matfile_extract(filename.c_str(), "tall", output.c_str(),
+                                 NULL));
+    extract_opts.format = MFEXTRACT_RAW;
+    EXPECT_EQ(0, matfile_extract(filename.c_str(), "tall", output.c_str(),
+                                 &extract_opts));
+
+    //  Array header whose product of dims wraps around to zero.
+    std::vector<uint32_t> words;
+    uint32_t nodims = 400;
+    words.insert(words.end(), {MFDT_MATRIX, 0, MFDT_UINT32, 8,
+                               MFMX_DOUBLE_CLASS, 0, MFDT_INT32, 4 * nodims});
+    words.insert(words.end(), nodims, 65536);
+    words.insert(words.end(), {(4u << 16) | MFDT_INT8, 0, MFDT_DOUBLE, 0});
+    std::memcpy(&words[words.size() - 3], "huge", 4);
+    words[1] = (words.size() - 2) * sizeof(uint32_t);
+
+    matfile_header_t header;
+    std::memset(&header, ' ', sizeof(header));
+    header.subsys_data_offset = 0;
+    header.version = 0x0100;
+    header.endianness = ('M' << 8) | 'I';
+
+    FILE *fout = fopen(filename.c_str(), "wb");
+    ASSERT_NE(nullptr, fout);
+    fwrite(&header, 1, sizeof(header), fout);
+    fwrite(words.data(), sizeof(uint32_t), words.size(), fout);
+    fclose(fout);
+    remove((filename + MF_INDEX_SUFFIX).c_str());
+
+    extract_opts.format = MFEXTRACT_NPY;
+    EXPECT_NE(0, matfile_extract(filename.c_str(), "huge", output.c_str(),
+                                 &extract_opts));
+
+    remove(output.c_str());
+    remove(filename.c_str());
+}
+
+TEST(Reader, SummaryStatistics) {
+    std::string filename = ::testing::TempDir() + "summary.mat";
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {1000, 11};
+    matfile_array_t *real = matfile_array_create("real", MFMX_DOUBLE_CLASS,
+                                                 2, dims, 0);
+    matfile_array_t *cplx = matfile_array_create("cplx", MFMX_INT16_CLASS,
+                                                 2, dims, 1);
+    size_t numel = matfile_array_numel(real);
+
+    //  Values of real part are 0..10 with NaN instead of every 100th value.
+    for (size_t i = 0; i != numel; ++i) {
+        real->pr.mx_double[i] = i % 100 ? i % 11 : NAN;
+        cplx->pr.mx_int16[i] = i % 2 ? 3 : -3;
+        cplx->pi.mx_int16[i] = 7;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), real));
+    ASSERT_EQ(0, matfile_add_array(mat.get(), cplx));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_RATIO;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    double sum = 0, sum2 = 0;
+    size_t count = 0, nozeros = 0;
+
+    for (size_t i = 0; i != numel; ++i) {
+        if (i % 100) {
+            sum += i % 11;
+            sum2 += (i % 11) * (i % 11);
+            count += 1;
+            nozeros += i % 11 == 0;
+        }
+    }
+
+    matfile_summary_t *summary = matfile_summarize(filename.c_str(), 2);
+    ASSERT_NE(nullptr, summary);
+    ASSERT_EQ(2u, summary->noentries);
+
+    const matfile_summary_entry_t &first = summary->entries[0];
+    EXPECT_STREQ("real", first.name);
+    EXPECT_EQ(numel, first.numel);
+    EXPECT_EQ(0, first.complex);
+    EXPECT_EQ(count, first.parts[0].count);
+    EXPECT_EQ(numel - count, first.parts[0].nonans);
+    EXPECT_EQ(nozeros, first.parts[0].nozeros);
+    EXPECT_EQ(0.0, first.parts[0].min);
+    EXPECT_EQ(10.0, first.parts[0].max);
+    EXPECT_NEAR(sum / count, first.parts[0].mean, 1e-12);
+    EXPECT_NEAR(std::sqrt(sum2 / count - sum * sum / count / count),
+                first.parts[0].std, 1e-9);
+
+    const matfile_summary_entry_t &second = summary->entries[1];
+    EXPECT_STREQ("cplx", second.name);
+    EXPECT_EQ(MFMX_INT16_CLASS, second.type);
+    EXPECT_EQ(1, second.complex);
+    EXPECT_EQ(-3.0, second.parts[0].min);
+    EXPECT_EQ(3.0, second.parts[0].max);
+    EXPECT_EQ(0.0, second.parts[0].mean);
+    EXPECT_EQ(3.0, second.parts[0].std);
+    EXPECT_EQ(7.0, second.parts[1].mean);
+    EXPECT_EQ(0.0, second.parts[1].std);
+
+    matfile_summary_destroy(summary);
+    EXPECT_EQ(nullptr, matfile_summarize("nothing.mat", 0));
+    remove(filename.c_str());
+}
@@ -5,3 +5,879 @@ extern "C" {
 }
 
 #include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::unique_ptr<matfile_t, decltype(&matfile_destroy)> matfile_ptr;
+
+static std::string TempPath(const char *name) {
+    return ::testing::TempDir() + name;
+}
+
+static long FileSize(const std::string &filename) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static uint32_t FirstElementType(const std::string &filename) {
+    uint32_t tag[2] = {0, 0};
+    FILE *file = fopen(filename.c_str(), "rb");
+    fseek(file, sizeof(matfile_header_t), SEEK_SET);
+    EXPECT_EQ(sizeof(tag), fread(tag, 1, sizeof(tag), file));
+    fclose(file);
+    return tag[0];
+}
+
+TEST(Writer, RoundTripUncompressed) {
+    int32_t dims[] = {3, 4}, vdims[] = {3, 1};
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    matfile_array_t *hilbert = matfile_array_create("hilbert",
+                                                    MFMX_DOUBLE_CLASS,
+                                                    2, dims, 0);
+    matfile_array_t *vec = matfile_array_create("vec", MFMX_INT8_CLASS,
+                                                2, vdims, 1);
+
+    for (int j = 0; j != 4; ++j) {
+        for (int i = 0; i != 3; ++i) {
+            hilbert->pr.mx_double[i + 3 * j] = 1.0 / (i + j + 1);
+        }
+    }
+
+    for (int i = 0; i != 3; ++i) {
+        vec->pr.mx_int8[i] = i - 1;
+        vec->pi.mx_int8[i] = 2 * i;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), hilbert));
+    ASSERT_EQ(0, matfile_add_array(mat.get(), vec));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+
+    std::string filename = TempPath("writer-uncompressed.mat");
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    EXPECT_EQ(MFDT_MATRIX, FirstElementType(filename));
+
+    matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(2u, loaded->noelements);
+
+    matfile_array_t *array = matfile_get_array(loaded.get(), "hilbert");
+    ASSERT_NE(nullptr, array);
+    EXPECT_EQ(MFMX_DOUBLE_CLASS, array->flags & MF_CLASS_MASK);
+    EXPECT_EQ(12u, matfile_array_numel(array));
+    EXPECT_EQ(nullptr, array->pi.data);
+
+    for (int i = 0; i != 12; ++i) {
+        EXPECT_EQ(hilbert->pr.mx_double[i], array->pr.mx_double[i]);
+    }
+
+    array = matfile_get_array(loaded.get(), "vec");
+    ASSERT_NE(nullptr, array);
+    EXPECT_TRUE(array->flags & MF_FLAG_COMPLEX);
+    ASSERT_NE(nullptr, array->pi.data);
+
+    for (int i = 0; i != 3; ++i) {
+        EXPECT_EQ(i - 1, array->pr.mx_int8[i]);
+        EXPECT_EQ(2 * i, array->pi.mx_int8[i]);
+    }
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, CompressRedundantData) {
+    int32_t dims[] = {256, 256};
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    matfile_array_t *array = matfile_array_create("ramp", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 0);
+
+    for (int i = 0; i != 256 * 256; ++i) {
+        array->pr.mx_double[i] = i % 256;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    std::string filename = TempPath("writer-compressed.mat");
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), nullptr));
+    EXPECT_EQ(MFDT_COMPRESSED, FirstElementType(filename));
+    EXPECT_LT(FileSize(filename), 256 * 256 * 8 / 10);
+
+    matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+
+    matfile_array_t *ramp = matfile_get_array(loaded.get(), "ramp");
+    ASSERT_NE(nullptr, ramp);
+
+    for (int i = 0; i != 256 * 256; ++i) {
+        ASSERT_EQ(i % 256, ramp->pr.mx_double[i]);
+    }
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, SkipCompressionOfNoise) {
+    int32_t dims[] = {512, 512};
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    matfile_array_t *array = matfile_array_create("noise", MFMX_UINT64_CLASS,
+                                                  2, dims, 0);
+    std::mt19937_64 rng(42);
+
+    for (int i = 0; i != 512 * 512; ++i) {
+        array->pr.mx_uint64[i] = rng();
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+
+    for (int policy = MFCOMP_NONE; policy != MFCOMP_COUNT; ++policy) {
+        opts.compression = static_cast<matfile_compression_t>(policy);
+        std::string filename = TempPath("writer-noise.mat");
+        ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+        EXPECT_EQ(MFDT_MATRIX, FirstElementType(filename));
+        remove(filename.c_str());
+    }
+}
+
+TEST(Writer, RejectOversizedDataElement) {
+    //  Payload of real part does not fit into 32-bit size of tag. It is
+    //  rejected before it is read so array holds single element actually.
+    int32_t dims[] = {1, 1};
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    matfile_array_t *array = matfile_array_create("huge", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 0);
+    array->dims[0] = 23171;
+    array->dims[1] = 23171;
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+    opts.narrow = 0;
+
+    std::string filename = TempPath("writer-huge.mat");
+    EXPECT_NE(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    remove(filename.c_str());
+}
+
+static uint32_t RealPartType(const std::string &filename) {
+    //  Header, miMATRIX tag, array flags, 2-D dimensions and short name
+    //  precede real part.
+    uint32_t tag[2] = {0, 0};
+    FILE *file = fopen(filename.c_str(), "rb");
+    fseek(file, sizeof(matfile_header_t) + 8 + 16 + 16 + 16, SEEK_SET);
+    EXPECT_EQ(sizeof(tag), fread(tag, 1, sizeof(tag), file));
+    fclose(file);
+    return tag[0];
+}
+
+TEST(Writer, NarrowStorageType) {
+    struct {
+        double values[4];
+        uint32_t type;
+    } cases[] = {
+        {{0.0, 1.0, 200.0, 255.0}, MFDT_UINT8},
+        {{-1.0, 1.0, 100.0, 127.0}, MFDT_INT8},
+        {{-300.0, 1.0, 2.0, 3.0}, MFDT_INT16},
+        {{0.0, 70000.0, 2.0, 3.0}, MFDT_UINT32},
+        {{0.5, 1.0, 2.0, 3.0}, MFDT_DOUBLE},
+        {{-0.0, 1.0, 2.0, 3.0}, MFDT_DOUBLE},
+        {{1e10, 1.0, 2.0, 3.0}, MFDT_DOUBLE},
+    };
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+
+    std::string filename = TempPath("writer-narrow.mat");
+
+    for (const auto &test : cases) {
+        int32_t dims[] = {2, 2};
+        matfile_ptr mat(matfile_create(), matfile_destroy);
+        matfile_array_t *array = matfile_array_create("labels",
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims, 0);
+        std::copy(test.values, test.values + 4, array->pr.mx_double);
+        ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+        ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+        EXPECT_EQ(test.type, RealPartType(filename));
+
+        matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+        ASSERT_TRUE(loaded);
+
+        matfile_array_t *labels = matfile_get_array(loaded.get(), "labels");
+        ASSERT_NE(nullptr, labels);
+        EXPECT_EQ(MFMX_DOUBLE_CLASS, labels->flags & MF_CLASS_MASK);
+
+        for (int i = 0; i != 4; ++i) {
+            EXPECT_EQ(test.values[i], labels->pr.mx_double[i]);
+            EXPECT_EQ(std::signbit(test.values[i]),
+                      std::signbit(labels->pr.mx_double[i]));
+        }
+    }
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, AppendArrays) {
+    std::string filename = TempPath("writer-append.mat");
+    remove(filename.c_str());
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+
+    for (int epoch = 0; epoch != 3; ++epoch) {
+        int32_t dims[] = {64, 64};
+        std::string name = "epoch" + std::to_string(epoch);
+        matfile_array_t *array = matfile_array_create(name.c_str(),
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims, 0);
+
+        for (int i = 0; i != 64 * 64; ++i) {
+            array->pr.mx_double[i] = epoch + 0.5 * (i % 7);
+        }
+
+        opts.compression = epoch == 1 ? MFCOMP_NONE : MFCOMP_THRESHOLD;
+        EXPECT_EQ(0, matfile_append(filename.c_str(), array, &opts));
+        matfile_array_destroy(array);
+    }
+
+    matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(3u, loaded->noelements);
+
+    for (int epoch = 0; epoch != 3; ++epoch) {
+        std::string name = "epoch" + std::to_string(epoch);
+        matfile_array_t *array = matfile_get_array(loaded.get(), name.c_str());
+        ASSERT_NE(nullptr, array);
+
+        for (int i = 0; i != 64 * 64; ++i) {
+            ASSERT_EQ(epoch + 0.5 * (i % 7), array->pr.mx_double[i]);
+        }
+    }
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, IncrementalSave) {
+    std::string filename = TempPath("writer-incremental.mat");
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+
+    for (int k = 0; k != 3; ++k) {
+        int32_t dims[] = {128, 128};
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *array = matfile_array_create(name.c_str(),
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims, 0);
+        for (int i = 0; i != 128 * 128; ++i) {
+            array->pr.mx_double[i] = k * 1000 + i % 100;
+        }
+        ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+    }
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.index = 1;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    //  Change the only array and save workspace without compression. Arrays
+    //  which are not changed should be copied in compressed form.
+    matfile_get_array(mat.get(), "var1")->pr.mx_double[7] = -1.0;
+    opts.compression = MFCOMP_NONE;
+    opts.incremental = 1;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    matfile_index_t *index = matfile_index_read(filename.c_str());
+    ASSERT_NE(nullptr, index);
+    ASSERT_EQ(3u, index->noentries);
+    EXPECT_EQ(FileSize(filename), static_cast<long>(index->file_size));
+
+    FILE *file = fopen(filename.c_str(), "rb");
+    uint32_t types[3];
+
+    for (int k = 0; k != 3; ++k) {
+        uint32_t tag[2];
+        fseek(file, index->entries[k].offset, SEEK_SET);
+        ASSERT_EQ(sizeof(tag), fread(tag, 1, sizeof(tag), file));
+        types[k] = tag[0];
+    }
+
+    fclose(file);
+    EXPECT_EQ(MFDT_COMPRESSED, types[0]);
+    EXPECT_EQ(MFDT_MATRIX, types[1]);
+    EXPECT_EQ(MFDT_COMPRESSED, types[2]);
+    matfile_index_destroy(index);
+
+    matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+
+    for (int k = 0; k != 3; ++k) {
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *lhs = matfile_get_array(mat.get(), name.c_str());
+        matfile_array_t *rhs = matfile_get_array(loaded.get(), name.c_str());
+        ASSERT_NE(nullptr, rhs);
+        EXPECT_EQ(matfile_array_hash(lhs), matfile_array_hash(rhs));
+    }
+
+    //  Appending keeps sidecar index consistent.
+    int32_t dims[] = {1, 1};
+    matfile_array_t *scalar = matfile_array_create("epoch", MFMX_INT32_CLASS,
+                                                   2, dims, 0);
+    ASSERT_EQ(0, matfile_append(filename.c_str(), scalar, &opts));
+    matfile_array_destroy(scalar);
+
+    index = matfile_index_read(filename.c_str());
+    ASSERT_NE(nullptr, index);
+    EXPECT_EQ(4u, index->noentries);
+    EXPECT_NE(nullptr, matfile_index_find(index, "epoch"));
+
+    //  Entry which does not point to data element of the same array is not
+    //  copied as is.
+    index->entries[0].offset = index->entries[2].offset;
+    index->entries[0].size = index->entries[2].size;
+    ASSERT_EQ(0, matfile_index_write(filename.c_str(), index));
+    matfile_index_destroy(index);
+
+    matfile_get_array(mat.get(), "var1")->pr.mx_double[7] = -2.0;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    loaded.reset(matfile_read(filename.c_str()));
+    ASSERT_TRUE(loaded);
+
+    for (int k = 0; k != 3; ++k) {
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *lhs = matfile_get_array(mat.get(), name.c_str());
+        matfile_array_t *rhs = matfile_get_array(loaded.get(), name.c_str());
+        ASSERT_NE(nullptr, rhs);
+        EXPECT_EQ(matfile_array_hash(lhs), matfile_array_hash(rhs));
+    }
+
+    //  Sidecar is stale once mat-file is replaced even with the same bytes.
+    std::string copy = TempPath("writer-incremental-copy.mat");
+    FILE *fin = fopen(filename.c_str(), "rb");
+    FILE *fout = fopen(copy.c_str(), "wb");
+    ASSERT_NE(nullptr, fin);
+    ASSERT_NE(nullptr, fout);
+    char chunk[4096];
+    size_t length;
+
+    while ((length = fread(chunk, 1, sizeof(chunk), fin)) != 0) {
+        ASSERT_EQ(length, fwrite(chunk, 1, length, fout));
+    }
+
+    fclose(fin);
+    fclose(fout);
+    ASSERT_EQ(0, rename(copy.c_str(), filename.c_str()));
+    EXPECT_EQ(nullptr, matfile_index_read(filename.c_str()));
+
+    std::string sidecar = filename + MF_INDEX_SUFFIX;
+    remove(sidecar.c_str());
+    remove(filename.c_str());
+}
+
+TEST(Writer, SubsetMergeDrop) {
+    std::string filename = TempPath("writer-passthrough.mat");
+    std::string subset = TempPath("writer-passthrough-subset.mat");
+    std::string merged = TempPath("writer-passthrough-merged.mat");
+    std::string dropped = TempPath("writer-passthrough-dropped.mat");
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+
+    for (int k = 0; k != 3; ++k) {
+        int32_t dims[] = {32, 32};
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *array = matfile_array_create(name.c_str(),
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims, 0);
+        for (int i = 0; i != 32 * 32; ++i) {
+            array->pr.mx_double[i] = k + 0.25 * (i % 5);
+        }
+        ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+    }
+
+    const char *names[] = {"var0", "var2", "var1"};
+    const char *renames[] = {"first", "second", NULL};
+
+    //  The first array is stored uncompressed, the others are compressed.
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    ASSERT_EQ(0, matfile_subset(filename.c_str(), filename.c_str(),
+                                names, NULL, 1));
+    opts.compression = MFCOMP_SPEED;
+
+    for (int k = 1; k != 3; ++k) {
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *array = matfile_get_array(mat.get(), name.c_str());
+        ASSERT_EQ(0, matfile_append(filename.c_str(), array, &opts));
+    }
+
+    ASSERT_EQ(0, matfile_subset(filename.c_str(), subset.c_str(),
+                                names, renames, 3));
+
+    const char *srcs[] = {subset.c_str(), filename.c_str()};
+    ASSERT_EQ(0, matfile_merge(merged.c_str(), srcs, 2));
+
+    const char *drops[] = {"var1", "second"};
+    ASSERT_EQ(0, matfile_drop(merged.c_str(), dropped.c_str(), drops, 2));
+
+    matfile_ptr loaded(matfile_read(dropped.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(3u, loaded->noelements);
+
+    const char *loaded_names[] = {"first", "var0", "var2"};
+    const char *origin_names[] = {"var0", "var0", "var2"};
+
+    for (int k = 0; k != 3; ++k) {
+        matfile_array_t *lhs = matfile_get_array(mat.get(), origin_names[k]);
+        matfile_array_t *rhs = loaded->elements[k].large.array;
+        ASSERT_NE(nullptr, rhs);
+        EXPECT_STREQ(loaded_names[k], rhs->name);
+        ASSERT_EQ(matfile_array_numel(lhs), matfile_array_numel(rhs));
+
+        for (size_t i = 0; i != matfile_array_numel(lhs); ++i) {
+            ASSERT_EQ(lhs->pr.mx_double[i], rhs->pr.mx_double[i]);
+        }
+    }
+
+    //  Data elements which are not arrays are kept on drop even if they are
+    //  not listed in sidecar index.
+    opts.index = 1;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    matfile_index_t *index = matfile_index_read(filename.c_str());
+    ASSERT_NE(nullptr, index);
+
+    uint32_t raw[4] = {MFDT_UINT8, 8, 0x01020304, 0x05060708};
+    FILE *fout = fopen(filename.c_str(), "ab");
+    ASSERT_NE(nullptr, fout);
+    ASSERT_EQ(sizeof(raw), fwrite(raw, 1, sizeof(raw), fout));
+    fclose(fout);
+
+    index->file_size += sizeof(raw);
+    ASSERT_EQ(0, matfile_index_write(filename.c_str(), index));
+    matfile_index_destroy(index);
+
+    ASSERT_EQ(0, matfile_drop(filename.c_str(), dropped.c_str(), drops, 1));
+    loaded.reset(matfile_read(dropped.c_str()));
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(3u, loaded->noelements);
+    EXPECT_EQ(MFDT_UINT8, loaded->elements[2].large.type);
+    remove((filename + MF_INDEX_SUFFIX).c_str());
+
+    const char *missing[] = {"missing"};
+    EXPECT_NE(0, matfile_subset(filename.c_str(), subset.c_str(),
+                                missing, NULL, 1));
+
+    remove(filename.c_str());
+    remove(subset.c_str());
+    remove(merged.c_str());
+    remove(dropped.c_str());
+}
+
+TEST(Writer, GrowableArray) {
+    std::string filename = TempPath("writer-growable.mat");
+    remove(filename.c_str());
+
+    int32_t dims[] = {3, 1};
+    matfile_array_t *scalar = matfile_array_create("meta", MFMX_INT16_CLASS,
+                                                   2, dims, 0);
+    matfile_array_t *series = matfile_array_create("series",
+                                                   MFMX_SINGLE_CLASS,
+                                                   2, dims, 0);
+
+    for (int i = 0; i != 3; ++i) {
+        scalar->pr.mx_int16[i] = i;
+        series->pr.mx_single[i] = i;
+    }
+
+    ASSERT_EQ(0, matfile_append(filename.c_str(), scalar, nullptr));
+    matfile_growable_t *growable = matfile_growable_create(filename.c_str(),
+                                                           series);
+    ASSERT_NE(nullptr, growable);
+    matfile_array_destroy(scalar);
+    matfile_array_destroy(series);
+
+    //  Mat-file should be loadable after every append. Odd number of single
+    //  precision numbers requires padding.
+    for (int step = 1; step != 4; ++step) {
+        std::vector<float> columns(3 * step);
+
+        for (size_t i = 0; i != columns.size(); ++i) {
+            columns[i] = 3 * step * (step - 1) / 2 + 3 + i;
+        }
+
+        ASSERT_EQ(0, matfile_growable_append(growable, columns.data(), step));
+        ASSERT_EQ(0, matfile_growable_flush(growable));
+
+        matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+        ASSERT_TRUE(loaded);
+        matfile_array_t *array = matfile_get_array(loaded.get(), "series");
+        ASSERT_NE(nullptr, array);
+        ASSERT_EQ(3, array->dims[0]);
+        ASSERT_EQ(1 + step * (step + 1) / 2, array->dims[1]);
+
+        for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+            ASSERT_EQ(static_cast<float>(i), array->pr.mx_single[i]);
+        }
+    }
+
+    ASSERT_EQ(0, matfile_growable_close(growable));
+
+    //  Growing could be resumed but only for the last array.
+    EXPECT_EQ(nullptr, matfile_growable_open(filename.c_str(), "meta"));
+    growable = matfile_growable_open(filename.c_str(), "series");
+    ASSERT_NE(nullptr, growable);
+    ASSERT_EQ(0, matfile_growable_close(growable));
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, UpdateInPlace) {
+    std::string filename = TempPath("writer-view.mat");
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {16, 16};
+    const char *names[] = {"plain", "packed", "narrow"};
+
+    for (int k = 0; k != 3; ++k) {
+        matfile_array_t *array = matfile_array_create(names[k],
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims, k == 0);
+        for (int i = 0; i != 16 * 16; ++i) {
+            array->pr.mx_double[i] = i % 3;
+        }
+        ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+    }
+
+    //  Only the first array could be viewed: the second one is compressed
+    //  and the third one is stored in shorter data type.
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+    opts.narrow = 0;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    opts.compression = MFCOMP_SPEED;
+    ASSERT_EQ(0, matfile_subset(filename.c_str(), filename.c_str(),
+                                names, nullptr, 1));
+    ASSERT_EQ(0, matfile_append(filename.c_str(),
+                                matfile_get_array(mat.get(), "packed"),
+                                &opts));
+    opts.compression = MFCOMP_NONE;
+    opts.narrow = 1;
+    ASSERT_EQ(0, matfile_append(filename.c_str(),
+                                matfile_get_array(mat.get(), "narrow"),
+                                &opts));
+
+    long size = FileSize(filename);
+    matfile_view_t *view = matfile_open_rw(filename.c_str());
+    ASSERT_NE(nullptr, view);
+    EXPECT_EQ(nullptr, matfile_view_get_array(view, "packed"));
+    EXPECT_EQ(nullptr, matfile_view_get_array(view, "narrow"));
+
+    matfile_array_t *array = matfile_view_get_array(view, "plain");
+    ASSERT_NE(nullptr, array);
+    ASSERT_EQ(16 * 16u, matfile_array_numel(array));
+
+    for (int i = 0; i != 16 * 16; ++i) {
+        array->pr.mx_double[i] *= -2;
+        array->pi.mx_double[i] = i;
+    }
+
+    ASSERT_EQ(0, matfile_view_flush(view));
+    ASSERT_EQ(0, matfile_view_close(view));
+    EXPECT_EQ(size, FileSize(filename));
+
+    matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+    array = matfile_get_array(loaded.get(), "plain");
+    ASSERT_NE(nullptr, array);
+
+    for (int i = 0; i != 16 * 16; ++i) {
+        ASSERT_EQ(-2.0 * (i % 3), array->pr.mx_double[i]);
+        ASSERT_EQ(i, array->pi.mx_double[i]);
+    }
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, FillPreallocated) {
+    std::string filename = TempPath("writer-prealloc.mat");
+    int32_t dims[] = {7, 33}, vdims[] = {5, 1};
+    matfile_array_t *layout[] = {
+        matfile_array_create("odd", MFMX_INT16_CLASS, 2, dims, 1),
+        matfile_array_create("weights", MFMX_DOUBLE_CLASS, 2, dims, 0),
+        matfile_array_create("v", MFMX_SINGLE_CLASS, 2, vdims, 0),
+    };
+
+    matfile_view_t *view = matfile_view_create(filename.c_str(), layout, 3);
+    ASSERT_NE(nullptr, view);
+
+    //  Producers fill different arrays concurrently.
+    std::vector<std::thread> producers;
+
+    for (int k = 0; k != 3; ++k) {
+        producers.emplace_back([view, &layout, k]() {
+            matfile_array_t *array = matfile_view_get_array(view,
+                                                            layout[k]->name);
+            ASSERT_NE(nullptr, array);
+
+            for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+                switch (k) {
+                case 0:
+                    array->pr.mx_int16[i] = i;
+                    array->pi.mx_int16[i] = -i;
+                    break;
+                case 1:
+                    array->pr.mx_double[i] = 0.5 * i;
+                    break;
+                default:
+                    array->pr.mx_single[i] = i + 1;
+                }
+            }
+        });
+    }
+
+    for (auto &producer : producers) {
+        producer.join();
+    }
+
+    ASSERT_EQ(0, matfile_view_close(view));
+
+    matfile_ptr loaded(matfile_read(filename.c_str()), matfile_destroy);
+    ASSERT_TRUE(loaded);
+    ASSERT_EQ(3u, loaded->noelements);
+
+    for (int k = 0; k != 3; ++k) {
+        matfile_array_t *array = matfile_get_array(loaded.get(),
+                                                   layout[k]->name);
+        ASSERT_NE(nullptr, array);
+        ASSERT_EQ(matfile_array_numel(layout[k]), matfile_array_numel(array));
+
+        for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+            switch (k) {
+            case 0:
+                ASSERT_EQ(static_cast<int16_t>(i), array->pr.mx_int16[i]);
+                ASSERT_EQ(static_cast<int16_t>(-i), array->pi.mx_int16[i]);
+                break;
+            case 1:
+                ASSERT_EQ(0.5 * i, array->pr.mx_double[i]);
+                break;
+            default:
+                ASSERT_EQ(i + 1, array->pr.mx_single[i]);
+            }
+        }
+
+        matfile_array_destroy(layout[k]);
+    }
+
+    remove(filename.c_str());
+}
+
+TEST(Writer, ParallelDecodableBlocks) {
+    std::string filename = TempPath("writer-blocks.mat");
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {512, 300};
+    matfile_array_t *array = matfile_array_create("big", MFMX_DOUBLE_CLASS,
+                                                  2, dims, 0);
+
+    for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+        array->pr.mx_double[i] = (i * 7919) % 1013 + 0.5;
+    }
+
+    ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_SPEED;
+    opts.narrow = 0;
+    opts.index = 1;
+    opts.block_size = 65536;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+    ASSERT_EQ(MFDT_COMPRESSED, FirstElementType(filename));
+
+    matfile_index_t *index = matfile_index_read(filename.c_str());
+    ASSERT_NE(nullptr, index);
+    ASSERT_EQ(1u, index->noentries);
+    EXPECT_LT(15u, index->entries[0].noblocks);
+
+    //  Blocks are inflated in parallel with sidecar and serially without it.
+    matfile_context_t ctx;
+    matfile_context_init(&ctx);
+    ctx.nothreads = 4;
+
+    for (int pass = 0; pass != 2; ++pass) {
+        matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                           matfile_destroy);
+        ASSERT_TRUE(loaded);
+        matfile_array_t *lhs = matfile_get_array(loaded.get(), "big");
+        ASSERT_NE(nullptr, lhs);
+        ASSERT_EQ(matfile_array_numel(array), matfile_array_numel(lhs));
+        EXPECT_EQ(matfile_array_hash(array), matfile_array_hash(lhs));
+        remove((filename + MF_INDEX_SUFFIX).c_str());
+    }
+
+    //  Stale block table is ignored and data element is inflated serially.
+    index->entries[0].blocks[1].compressed += 1;
+    ASSERT_EQ(0, matfile_index_write(filename.c_str(), index));
+    matfile_index_destroy(index);
+
+    matfile_ptr loaded(matfile_read_ctx(filename.c_str(), &ctx),
+                       matfile_destroy);
+    ASSERT_TRUE(loaded);
+    matfile_array_t *lhs = matfile_get_array(loaded.get(), "big");
+    ASSERT_NE(nullptr, lhs);
+    EXPECT_EQ(matfile_array_hash(array), matfile_array_hash(lhs));
+
+    remove((filename + MF_INDEX_SUFFIX).c_str());
+    remove(filename.c_str());
+}
+
+static int CollectChunks(void *opaque, const void *data, size_t size) {
+    auto *chunks = static_cast<std::vector<std::string> *>(opaque);
+    chunks->emplace_back(static_cast<const char *>(data), size);
+    return 0;
+}
+
+TEST(Writer, MemoryAndCallbackSinks) {
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    int32_t dims[] = {40, 25};
+
+    for (int k = 0; k != 2; ++k) {
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *array = matfile_array_create(name.c_str(),
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims, 0);
+        for (int i = 0; i != 40 * 25; ++i) {
+            array->pr.mx_double[i] = k * (i % 11);
+        }
+        ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+    }
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_SPEED;
+
+    tape_t *tape = tape_create(16);
+    ASSERT_NE(nullptr, tape);
+    ASSERT_EQ(0, matfile_write_memory(mat.get(), tape, &opts));
+
+    std::vector<std::string> chunks;
+    ASSERT_EQ(0, matfile_write_callback(mat.get(), CollectChunks, &chunks,
+                                        &opts));
+#ifdef __linux__
+    EXPECT_LT(2u, chunks.size());
+#endif
+
+    //  Both sinks produce the same bytes except for creation time in header.
+    std::string joined;
+
+    for (const auto &chunk : chunks) {
+        joined += chunk;
+    }
+
+    size_t offset = sizeof(matfile_header_t);
+    ASSERT_EQ(tape_length(tape), joined.size());
+    EXPECT_EQ(0, memcmp(static_cast<char *>(tape_deref(tape)) + offset,
+                        joined.data() + offset, joined.size() - offset));
+
+    matfile_ptr loaded(matfile_read_memory(tape_deref(tape),
+                                           tape_length(tape), nullptr),
+                       matfile_destroy);
+    tape_destroy(tape);
+    ASSERT_TRUE(loaded);
+
+    for (int k = 0; k != 2; ++k) {
+        std::string name = "var" + std::to_string(k);
+        matfile_array_t *lhs = matfile_get_array(mat.get(), name.c_str());
+        matfile_array_t *rhs = matfile_get_array(loaded.get(), name.c_str());
+        ASSERT_NE(nullptr, rhs);
+        EXPECT_EQ(matfile_array_hash(lhs), matfile_array_hash(rhs));
+    }
+}
+
+TEST(Writer, RepackAndReorder) {
+    std::string filename = TempPath("writer-repack.mat");
+    std::string repacked = TempPath("writer-repack-out.mat");
+    matfile_ptr mat(matfile_create(), matfile_destroy);
+    std::mt19937_64 rng(42);
+    int32_t dims[][2] = {{512, 64}, {2, 2}, {64, 64}};
+    const char *names[] = {"big", "small", "noise"};
+
+    for (int k = 0; k != 3; ++k) {
+        matfile_array_t *array = matfile_array_create(names[k],
+                                                      MFMX_DOUBLE_CLASS,
+                                                      2, dims[k], 0);
+        for (size_t i = 0; i != matfile_array_numel(array); ++i) {
+            array->pr.mx_double[i] = k == 2 ? std::ldexp(rng(), -64)
+                                            : (i * 7919) % 1013 + 0.5;
+        }
+        ASSERT_EQ(0, matfile_add_array(mat.get(), array));
+    }
+
+    matfile_write_options_t opts;
+    matfile_write_options_init(&opts);
+    opts.compression = MFCOMP_NONE;
+    ASSERT_EQ(0, matfile_write(filename.c_str(), mat.get(), &opts));
+
+    //  Small arrays go first and only compressible ones are compressed.
+    matfile_repack_options_t repack;
+    matfile_repack_options_init(&repack);
+    repack.nothreads = 3;
+    repack.order = MFORDER_SIZE;
+    repack.write.block_size = 65536;
+    ASSERT_EQ(0, matfile_repack(filename.c_str(), repacked.c_str(), &repack));
+    EXPECT_GT(FileSize(filename) / 2, FileSize(repacked));
+
+    matfile_index_t *index = matfile_index_read(repacked.c_str());
+    ASSERT_NE(nullptr, index);
+    ASSERT_EQ(3u, index->noentries);
+    EXPECT_STREQ("small", index->entries[0].name);
+    EXPECT_STREQ("noise", index->entries[1].name);
+    EXPECT_STREQ("big", index->entries[2].name);
+    EXPECT_LT(1u, index->entries[2].noblocks);
+    matfile_index_destroy(index);
+
+    for (int pass = 0; pass != 2; ++pass) {
+        matfile_ptr loaded(matfile_read(repacked.c_str()), matfile_destroy);
+        ASSERT_TRUE(loaded);
+        ASSERT_EQ(3u, loaded->noelements);
+
+        for (const char *name : names) {
+            matfile_array_t *lhs = matfile_get_array(mat.get(), name);
+            matfile_array_t *rhs = matfile_get_array(loaded.get(), name);
+            ASSERT_NE(nullptr, rhs);
+            EXPECT_EQ(matfile_array_hash(lhs), matfile_array_hash(rhs));
+        }
+
+        //  Listed arrays go first and the rest keeps order.
+        const char *first[] = {"big"};
+        repack.order = MFORDER_LIST;
+        repack.names = first;
+        repack.nonames = 1;
+        repack.write.compression = MFCOMP_NONE;
+        repack.write.index = 0;
+        ASSERT_EQ(0, matfile_repack(repacked.c_str(), repacked.c_str(),
+                                    &repack));
+        EXPECT_EQ(FileSize(filename), FileSize(repacked));
+        EXPECT_EQ(MFDT_MATRIX, FirstElementType(repacked));
+        EXPECT_EQ(nullptr, matfile_index_read(repacked.c_str()));
+    }
+
+    const char *missing[] = {"missing"};
+    repack.names = missing;
+    EXPECT_NE(0, matfile_repack(filename.c_str(), repacked.c_str(), &repack));
+
+    remove(filename.c_str());
+    remove(repacked.c_str());
+}